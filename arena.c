@@ -0,0 +1,138 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+// Allocations are aligned to cache lines, which also suits every vector unit
+// the kernels use.
+#define ARENA_ALIGN 64
+
+// The huge page size explicit huge pages are requested in.
+#define HUGE_PAGE_SIZE ((size_t) 2 << 20)
+
+struct _Arena {
+	unsigned char *base;
+	size_t size;     // Bytes mapped.
+	size_t used;     // Bytes handed out so far.
+};
+
+/**
+ * Rounds a size up to a multiple of a power of two.
+ *
+ * @param size The size.
+ * @param align The power of two.
+ * @return The rounded size.
+ */
+static size_t roundUp(size_t size, size_t align) {
+	return (size + align - 1) & ~(align - 1);
+}
+
+/**
+ * Returns how much of an arena's room an allocation of "size" bytes takes up,
+ * padding included, so an arena can be sized for the allocations it will
+ * hand out.
+ *
+ * @param size The size of the allocation.
+ * @return The room it needs.
+ */
+size_t arenaSpace(size_t size) {
+	return roundUp(size > 0 ? size : 1, ARENA_ALIGN);
+}
+
+/**
+ * Creates an arena with room for "size" bytes of allocations, as measured by
+ * arenaSpace.  Explicit huge pages are tried first for arenas of at least one
+ * huge page; when none are reserved, the mapping falls back to normal pages
+ * and asks for transparent huge pages instead.
+ *
+ * @param size The bytes of room to reserve.
+ * @return The arena, or NULL if memory runs out.
+ */
+Arena *createArena(size_t size) {
+	Arena *arena = malloc(sizeof(Arena));
+	if (arena == NULL)
+		return NULL;
+
+	arena->size = roundUp(size > 0 ? size : 1, ARENA_ALIGN);
+	arena->used = 0;
+	arena->base = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	if (arena->size >= HUGE_PAGE_SIZE) {
+		size_t huge = roundUp(arena->size, HUGE_PAGE_SIZE);
+		arena->base = mmap(NULL, huge, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (arena->base != MAP_FAILED)
+			arena->size = huge;
+	}
+#endif
+
+	if (arena->base == MAP_FAILED) {
+		arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (arena->base == MAP_FAILED) {
+			free(arena);
+			return NULL;
+		}
+
+#ifdef MADV_HUGEPAGE
+		madvise(arena->base, arena->size, MADV_HUGEPAGE);
+#endif
+	}
+
+	return arena;
+}
+
+/**
+ * Hands out the next "size" bytes of an arena.  They are zeroed the first
+ * time they are handed out, and stay valid until the arena is reset or
+ * destroyed.
+ *
+ * @param arena The arena.
+ * @param size The number of bytes.
+ * @return The memory, or NULL if the arena has no room left.
+ */
+void *arenaAlloc(Arena *arena, size_t size) {
+	size = arenaSpace(size);
+	if (arena->size - arena->used < size)
+		return NULL;
+
+	void *memory = arena->base + arena->used;
+	arena->used += size;
+	return memory;
+}
+
+/**
+ * Returns how much room an arena has in all, as measured by arenaSpace.
+ *
+ * @param arena The arena.
+ * @return The bytes of room.
+ */
+size_t arenaRoom(const Arena *arena) {
+	return arena->size;
+}
+
+/**
+ * Takes back everything allocated from an arena so its memory can be handed
+ * out again.  The memory keeps whatever was last written to it.
+ *
+ * @param arena The arena.
+ */
+void resetArena(Arena *arena) {
+	arena->used = 0;
+}
+
+/**
+ * Unmaps an arena, and everything allocated from it.
+ *
+ * @param arena The arena to destroy, or NULL.
+ */
+void destroyArena(Arena *arena) {
+	if (arena == NULL)
+		return;
+
+	munmap(arena->base, arena->size);
+	free(arena);
+}
@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A bump allocator over one anonymous mapping, for the large sample buffers
+ * of a job.  The buffers are carved out once, as soon as the longest stage
+ * of the chain is known, and all of them go when the arena is destroyed, so
+ * the actions reuse the same memory instead of allocating and freeing whole
+ * channels.  Pages are only faulted in when first touched, so a buffer that
+ * is never used costs nothing.  The mapping is backed by huge pages when the
+ * system has them: reserved ones if any are free, or else transparent ones.
+ * An arena can also be reset and handed to the next job, which then starts
+ * with its pages already faulted in.
+ */
+
+typedef struct _Arena Arena;
+
+size_t arenaSpace(size_t size);
+Arena *createArena(size_t size);
+void *arenaAlloc(Arena *arena, size_t size);
+size_t arenaRoom(const Arena *arena);
+void resetArena(Arena *arena);
+void destroyArena(Arena *arena);
+
+#endif
@@ -0,0 +1,436 @@
+/*
+ * Benchmark harness.  Generates a synthetic 16-bit stereo wave file, then
+ * times each action and a few typical chains in-process through libwave, on
+ * one thread and on all of them, and the program's I/O paths end to end.
+ * Every case runs in its own child process so its peak RSS can be measured
+ * on its own, and the best of several runs is reported, one JSON object per
+ * line on stdout.
+ *
+ * Usage: bench [-seconds length] [-rate samples] [-repeat runs] [-j threads] [-wave program]
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "libwave.h"
+
+// The most words a benchmarked chain has.
+#define BENCH_MAX_WORDS 32
+
+/**
+ * The chains timed in-process, each on its own and as part of a typical
+ * chain.  "copy" is the empty chain, which only copies the samples, so the
+ * cost of the copy can be taken off the others.
+ */
+static const char *const actionCases[][2] = {
+	{ "copy",        "" },
+	{ "reverse",     "-r" },
+	{ "speed",       "-s 1.5" },
+	{ "speed-sinc",  "-s 1.5 sinc" },
+	{ "flip",        "-f" },
+	{ "fade-out",    "-o 2" },
+	{ "fade-in",     "-i 2" },
+	{ "volume",      "-v 0.8" },
+	{ "echo",        "-e 0.25 0.5" },
+	{ "echo-taps",   "-e 0.25 0.5 0.4 0.3 0.6 0.2" },
+	{ "echo-feedback", "-e 0.25 0.5 feedback" },
+	{ "float-volume", "-float -v 0.8" },
+	{ "chain-fused", "-v 0.8 -i 2 -o 2 -f" },
+	{ "chain-mixed", "-r -s 0.75 -e 0.1 0.3 -v 0.9 -i 1" },
+};
+
+/**
+ * The I/O paths timed end to end by running the program.  "<" and ">" stand
+ * for the input and output files opened as stdin and stdout.
+ */
+static const char *const ioCases[][2] = {
+	{ "stream",      "-v 0.8 < >" },
+	{ "whole-file",  "-r < >" },
+	{ "mapped-in",   "-in -r >" },
+	{ "mapped-out",  "-out -r <" },
+	{ "mapped",      "-in -out -v 0.8" },
+};
+
+/**
+ * What one run of a case measured.
+ */
+typedef struct _Result {
+	double seconds;
+	long peakKilobytes;
+} Result;
+
+/**
+ * The settings shared by every case.
+ */
+typedef struct _Bench {
+	int seconds;
+	int rate;
+	int repeat;
+	int threads;
+	const char *program;
+	unsigned char *input;
+	size_t inputSize;
+	int frames;
+	char inPath[64];
+	char outPath[64];
+} Bench;
+
+/**
+ * Returns the time on a monotonic clock.
+ *
+ * @return The time in seconds.
+ */
+double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Prints an error-message to stderr and exits.
+ *
+ * @param message The error-message to print.
+ */
+void benchFailure(const char *message) {
+	fprintf(stderr, "bench: %s\n", message);
+	exit(1);
+}
+
+/**
+ * Splits a chain in to words, in place, after a program name.
+ *
+ * @param chain The chain, which is overwritten.
+ * @param words Where to store the words, with room for BENCH_MAX_WORDS.
+ * @return The number of words, counting the program name.
+ */
+int splitChain(char *chain, char **words) {
+	int count = 0;
+	words[count++] = "wave";
+
+	char *state;
+	for (char *word = strtok_r(chain, " ", &state); word != NULL && count < BENCH_MAX_WORDS - 1;
+			word = strtok_r(NULL, " ", &state))
+		words[count++] = word;
+
+	words[count] = NULL;
+	return count;
+}
+
+/**
+ * Generates the synthetic wave file: a stereo sine sweep with a little noise
+ * on top, at about half of full scale, so no action starts out clipping.
+ *
+ * @param bench The settings, whose input is filled in.
+ */
+void generateInput(Bench *bench) {
+	WaveHeader header;
+	memcpy(header.ID, "RIFF", 4);
+	memcpy(header.format, "WAVE", 4);
+	memcpy(header.formatChunk.ID, "fmt ", 4);
+	header.formatChunk.size = 16;
+	header.formatChunk.compression = 1;
+	header.formatChunk.channels = 2;
+	header.formatChunk.sampleRate = bench->rate;
+	header.formatChunk.byteRate = bench->rate * 4;
+	header.formatChunk.blockAlign = 4;
+	header.formatChunk.bitsPerSample = 16;
+	memcpy(header.dataChunk.ID, "data", 4);
+
+	bench->frames = bench->seconds * bench->rate;
+	header.dataChunk.size = (unsigned long long) bench->frames * 4;
+	header.size = WAVE_HEADER_SIZE - 8 + header.dataChunk.size;
+
+	size_t offset = waveHeaderSize(&header);
+	bench->inputSize = offset + (size_t) bench->frames * 4;
+	bench->input = malloc(bench->inputSize);
+	if (bench->input == NULL)
+		benchFailure("out of memory");
+	waveWriteHeader(&header, bench->input, bench->inputSize);
+
+	unsigned char *samples = bench->input + offset;
+	unsigned int noise = 1;
+	double phase = 0;
+	for (int i = 0; i < bench->frames; i++) {
+		// The sweep rises from 50Hz to 5kHz over every second.
+		phase += 2 * M_PI * (50 + 4950.0 * (i % bench->rate) / bench->rate) / bench->rate;
+		for (int c = 0; c < 2; c++) {
+			noise = noise * 1664525 + 1013904223;
+			int sample = (int) (16000 * sin(phase + c) + (int) (noise >> 22) - 512);
+
+			samples[4 * i + 2 * c] = sample & 0xFF;
+			samples[4 * i + 2 * c + 1] = (sample >> 8) & 0xFF;
+		}
+	}
+
+	int fd = open(bench->inPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || write(fd, bench->input, bench->inputSize) != (ssize_t) bench->inputSize)
+		benchFailure("could not write the input file");
+	close(fd);
+}
+
+/**
+ * Runs a chain over the input in-process, "repeat" times, and returns the
+ * best time.  Runs in the case's child process.
+ *
+ * @param bench The settings.
+ * @param chain The chain.
+ * @param threads The number of threads to use.
+ * @return The best time in seconds.
+ */
+double timeChain(const Bench *bench, const char *chain, int threads) {
+	char words[256];
+	char *argv[BENCH_MAX_WORDS];
+	strncpy(words, chain, sizeof(words) - 1);
+	words[sizeof(words) - 1] = '\0';
+	int argc = splitChain(words, argv);
+
+	WaveContext *context = waveCreateContext(threads);
+	if (context == NULL)
+		benchFailure("out of memory");
+
+	size_t size, written;
+	int code = waveParseChain(context, argc, argv);
+	if (code == WAVE_OK)
+		code = waveOutputSize(context, bench->input, bench->inputSize, &size);
+	if (code != WAVE_OK)
+		benchFailure(waveErrorMessage(code));
+
+	unsigned char *output = malloc(size);
+	if (output == NULL)
+		benchFailure("out of memory");
+
+	double best = HUGE_VAL;
+	for (int run = 0; run < bench->repeat; run++) {
+		double start = now();
+		code = waveProcess(context, bench->input, bench->inputSize, output, size, &written);
+		double seconds = now() - start;
+
+		if (code != WAVE_OK)
+			benchFailure(waveErrorMessage(code));
+		if (seconds < best)
+			best = seconds;
+	}
+
+	free(output);
+	waveDestroyContext(context);
+	return best;
+}
+
+/**
+ * Runs the program over the input files once, with the words of an I/O case.
+ * Runs in a child process, which becomes the program.
+ *
+ * @param bench The settings.
+ * @param chain The words of the I/O case.
+ * @param threads The number of threads to use.
+ */
+void execProgram(const Bench *bench, const char *chain, int threads) {
+	char words[256], jobs[16];
+	char *argv[BENCH_MAX_WORDS];
+	int argc = 0;
+
+	strncpy(words, chain, sizeof(words) - 1);
+	words[sizeof(words) - 1] = '\0';
+	snprintf(jobs, sizeof(jobs), "%d", threads);
+
+	argv[argc++] = (char *) bench->program;
+	argv[argc++] = "-j";
+	argv[argc++] = jobs;
+
+	char *state;
+	for (char *word = strtok_r(words, " ", &state); word != NULL && argc < BENCH_MAX_WORDS - 3;
+			word = strtok_r(NULL, " ", &state)) {
+		if (strcmp(word, "<") == 0) {
+			int fd = open(bench->inPath, O_RDONLY);
+			dup2(fd, 0);
+		} else if (strcmp(word, ">") == 0) {
+			int fd = open(bench->outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			dup2(fd, 1);
+		} else {
+			argv[argc++] = word;
+			if (strcmp(word, "-in") == 0)
+				argv[argc++] = (char *) bench->inPath;
+			else if (strcmp(word, "-out") == 0)
+				argv[argc++] = (char *) bench->outPath;
+		}
+	}
+	argv[argc] = NULL;
+
+	// The header dumps are not part of the measurement.
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, 2);
+
+	execv(bench->program, argv);
+	_exit(127);
+}
+
+/**
+ * Runs one case in a child process.  An in-process case times itself and
+ * sends back its time; an I/O case is timed from the outside, run by run.
+ *
+ * @param bench The settings.
+ * @param chain The chain or the words of the I/O case.
+ * @param threads The number of threads to use.
+ * @param program 1 to run the program, 0 to run the chain in-process.
+ * @return The best time and the peak RSS of the case.
+ */
+Result runCase(const Bench *bench, const char *chain, int threads, int program) {
+	Result result = { HUGE_VAL, 0 };
+	int runs = program ? bench->repeat : 1;
+
+	for (int run = 0; run < runs; run++) {
+		int pipes[2];
+		if (pipe(pipes) != 0)
+			benchFailure("could not create a pipe");
+
+		double start = now();
+		pid_t child = fork();
+		if (child < 0)
+			benchFailure("could not fork");
+
+		if (child == 0) {
+			close(pipes[0]);
+			if (program)
+				execProgram(bench, chain, threads);
+
+			// exit rather than _exit, so that a build instrumented by
+			// "make pgo-gen" writes the profile of the chain.  stdout is
+			// flushed after every result, so nothing is printed twice.
+			double seconds = timeChain(bench, chain, threads);
+			exit(write(pipes[1], &seconds, sizeof(seconds)) != sizeof(seconds));
+		}
+
+		close(pipes[1]);
+		double seconds;
+		int status;
+		struct rusage usage;
+		ssize_t got = read(pipes[0], &seconds, sizeof(seconds));
+		close(pipes[0]);
+		if (wait4(child, &status, 0, &usage) < 0 || !WIFEXITED(status)
+			|| WEXITSTATUS(status) != 0 || (!program && got != sizeof(seconds)))
+			benchFailure(chain);
+
+		if (program)
+			seconds = now() - start;
+		if (seconds < result.seconds)
+			result.seconds = seconds;
+		if (usage.ru_maxrss > result.peakKilobytes)
+			result.peakKilobytes = usage.ru_maxrss;
+	}
+
+	return result;
+}
+
+/**
+ * Prints the result of a case as one line of JSON.
+ *
+ * @param bench The settings.
+ * @param kind "action" or "io".
+ * @param name The name of the case.
+ * @param chain The chain of the case.
+ * @param threads The number of threads it used.
+ * @param result What it measured.
+ */
+void printResult(const Bench *bench, const char *kind, const char *name, const char *chain,
+		int threads, Result result) {
+	double samples = 2.0 * bench->frames;
+	double megabytes = bench->frames * 4.0 / 1e6;
+
+	printf("{\"kind\":\"%s\",\"name\":\"%s\",\"chain\":\"%s\",\"kernels\":\"%s\","
+		"\"threads\":%d,\"frames\":%d,\"seconds\":%.6f,\"ns_per_sample\":%.3f,"
+		"\"mb_per_s\":%.1f,\"peak_rss_kb\":%ld}\n",
+		kind, name, chain, waveKernelsName(), threads, bench->frames, result.seconds,
+		result.seconds * 1e9 / samples, megabytes / result.seconds, result.peakKilobytes);
+	fflush(stdout);
+}
+
+/**
+ * Parses a positive whole number argument of the bench.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param i The index of the option, moved on to its value.
+ * @return The number.
+ */
+int parseCount(int argc, char **argv, int *i) {
+	char *end;
+	if (*i + 1 >= argc)
+		benchFailure("missing value");
+
+	long value = strtol(argv[++*i], &end, 10);
+	if (*end != '\0' || value < 1 || value > 1000000)
+		benchFailure("values must be positive whole numbers");
+
+	return (int) value;
+}
+
+int main(int argc, char **argv) {
+	Bench bench = { 60, 44100, 5, 0, "./wave" };
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-seconds") == 0)
+			bench.seconds = parseCount(argc, argv, &i);
+		else if (strcmp(argv[i], "-rate") == 0)
+			bench.rate = parseCount(argc, argv, &i);
+		else if (strcmp(argv[i], "-repeat") == 0)
+			bench.repeat = parseCount(argc, argv, &i);
+		else if (strcmp(argv[i], "-j") == 0)
+			bench.threads = parseCount(argc, argv, &i);
+		else if (strcmp(argv[i], "-wave") == 0 && i + 1 < argc)
+			bench.program = argv[++i];
+		else
+			benchFailure("usage: bench [-seconds length] [-rate samples] [-repeat runs] [-j threads] [-wave program]");
+	}
+
+	if ((double) bench.seconds * bench.rate > 500000000)
+		benchFailure("the input is too long");
+	if (bench.threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		bench.threads = online > 0 ? (int) online : 1;
+	}
+
+	// A kernel set the host does not support is skipped rather than being
+	// reported under the name of the one picked in its place.
+	const char *requested = getenv("WAVE_KERNELS");
+	if (requested != NULL && strcmp(requested, waveKernelsName()) != 0) {
+		fprintf(stderr, "bench: %s kernels are not supported here, skipping\n", requested);
+		return 0;
+	}
+
+	const char *directory = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+	snprintf(bench.inPath, sizeof(bench.inPath), "%s/wave-bench-%d-in.wav", directory, (int) getpid());
+	snprintf(bench.outPath, sizeof(bench.outPath), "%s/wave-bench-%d-out.wav", directory, (int) getpid());
+	generateInput(&bench);
+
+	int threads[2] = { 1, bench.threads };
+	int variants = bench.threads > 1 ? 2 : 1;
+
+	for (size_t i = 0; i < sizeof(actionCases) / sizeof(actionCases[0]); i++) {
+		for (int t = 0; t < variants; t++) {
+			Result result = runCase(&bench, actionCases[i][1], threads[t], 0);
+			printResult(&bench, "action", actionCases[i][0], actionCases[i][1], threads[t], result);
+		}
+	}
+
+	for (size_t i = 0; i < sizeof(ioCases) / sizeof(ioCases[0]); i++) {
+		for (int t = 0; t < variants; t++) {
+			Result result = runCase(&bench, ioCases[i][1], threads[t], 1);
+			printResult(&bench, "io", ioCases[i][0], ioCases[i][1], threads[t], result);
+		}
+	}
+
+	unlink(bench.inPath);
+	unlink(bench.outPath);
+	free(bench.input);
+	return 0;
+}
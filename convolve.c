@@ -0,0 +1,338 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "kernels.h"
+#include "convolve.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// The smallest block a convolver works in.
+#define CONVOLVE_MIN_BLOCK 64
+
+/*
+ * The spectrum of a real signal is symmetric, so only its first "bins" =
+ * size / 2 + 1 bins are kept, for each channel on its own.  The two channels
+ * are still transformed together, and their spectra separated after the
+ * forward transform and joined again before the inverse one.
+ */
+struct _Convolver {
+	int block;          // Frames per block and per partition.
+	int size;           // Points per transform, two blocks.
+	int bins;           // Bins kept of each spectrum.
+	int partitions;     // Partitions of the impulse response.
+	int newest;         // Slot of the newest spectra in the delay line.
+	int *reversal;      // Bit-reversed index of each point.
+	double *twiddleRe;  // The twiddles of each stage of a transform, those
+	double *twiddleIm;  // of the stage with butterflies "half" points long
+	                    // at [half, 2 * half).
+	double *filterRe[2]; // The spectra of each channel's partitions, the
+	double *filterIm[2]; // same ones for both when the channels share them.
+	double *lineRe[2];  // The delay line of each channel's input spectra,
+	double *lineIm[2];  // one slot per partition.
+	double *sumRe[2];   // The sum of the products of each channel.
+	double *sumIm[2];
+	double *historyRe;  // The previous block of input.
+	double *historyIm;
+	double *workRe;     // The transform being worked on.
+	double *workIm;
+};
+
+/**
+ * Transforms "size" points in place with an iterative radix-2 FFT.
+ *
+ * @param convolver The convolver, for its tables.
+ * @param re The real parts.
+ * @param im The imaginary parts.
+ */
+static void transform(const Convolver *convolver, double *re, double *im) {
+	int n = convolver->size;
+
+	for (int i = 0; i < n; i++) {
+		int j = convolver->reversal[i];
+		if (i < j) {
+			double t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	for (int half = 1; half < n; half *= 2)
+		butterflyStage(re, im, convolver->twiddleRe + half, convolver->twiddleIm + half, half, n);
+}
+
+/**
+ * Transforms "size" points back in place, without dividing by "size", by
+ * transforming their conjugates.
+ *
+ * @param convolver The convolver, for its tables.
+ * @param re The real parts.
+ * @param im The imaginary parts.
+ */
+static void inverseTransform(const Convolver *convolver, double *re, double *im) {
+	for (int i = 0; i < convolver->size; i++)
+		im[i] = -im[i];
+
+	transform(convolver, re, im);
+
+	for (int i = 0; i < convolver->size; i++)
+		im[i] = -im[i];
+}
+
+/**
+ * Picks the block of a convolver: the shortest power of two that holds the
+ * whole impulse response, up to CONVOLVE_MAX_BLOCK.  A file is convolved
+ * offline, so the latency of a long block costs nothing, while each doubling
+ * halves the partitions, and with them the spectra read per frame.
+ *
+ * @param length The length of the impulse response.
+ * @return The block in frames.
+ */
+static int pickBlock(int64_t length) {
+	int block = CONVOLVE_MIN_BLOCK;
+	while (block < CONVOLVE_MAX_BLOCK && block < length)
+		block *= 2;
+
+	return block;
+}
+
+/**
+ * Separates the spectra of the two channels transformed together as the real
+ * and imaginary parts of "work", keeping the first "bins" bins of each.
+ *
+ * @param convolver The convolver.
+ * @param re The spectra of each channel's real parts.
+ * @param im The spectra of each channel's imaginary parts.
+ */
+static void splitSpectra(const Convolver *convolver, double *re[2], double *im[2]) {
+	const double *workRe = convolver->workRe;
+	const double *workIm = convolver->workIm;
+	int n = convolver->size;
+
+	for (int k = 0; k < convolver->bins; k++) {
+		int j = k == 0 ? 0 : n - k;
+		re[0][k] = (workRe[k] + workRe[j]) / 2;
+		im[0][k] = (workIm[k] - workIm[j]) / 2;
+		re[1][k] = (workIm[k] + workIm[j]) / 2;
+		im[1][k] = (workRe[j] - workRe[k]) / 2;
+	}
+}
+
+/**
+ * Works out the spectra of every partition of an impulse response pair, each
+ * divided by "size" so the inverse transform needs no scaling.
+ *
+ * @param convolver The convolver.
+ * @param first The impulse response of the first channel.
+ * @param second The impulse response of the second channel, or NULL.
+ * @param length The length of the impulse responses.
+ */
+static void fillSpectra(Convolver *convolver, const double *first, const double *second,
+		int64_t length) {
+	int n = convolver->size;
+	double *scratchRe = convolver->sumRe[1];
+	double *scratchIm = convolver->sumIm[1];
+
+	for (int p = 0; p < convolver->partitions; p++) {
+		int64_t start = (int64_t) p * convolver->block;
+		int count = length - start < convolver->block ? (int) (length - start) : convolver->block;
+		size_t offset = (size_t) p * convolver->bins;
+
+		memset(convolver->workRe, 0, sizeof(double) * n);
+		memset(convolver->workIm, 0, sizeof(double) * n);
+		for (int i = 0; i < count; i++) {
+			convolver->workRe[i] = first[start + i] / n;
+			convolver->workIm[i] = second != NULL ? second[start + i] / n : 0;
+		}
+		transform(convolver, convolver->workRe, convolver->workIm);
+
+		double *re[2] = { convolver->filterRe[0] + offset, scratchRe };
+		double *im[2] = { convolver->filterIm[0] + offset, scratchIm };
+		if (second != NULL) {
+			re[1] = convolver->filterRe[1] + offset;
+			im[1] = convolver->filterIm[1] + offset;
+		}
+		splitSpectra(convolver, re, im);
+	}
+}
+
+/**
+ * Creates a convolver for a pair of channels.  Both channels start out
+ * silent.
+ *
+ * @param first The impulse response of the first channel.
+ * @param second The impulse response of the second channel, or NULL to share
+ *        the first's.
+ * @param length The length of the impulse responses, at least 1.
+ * @return The convolver, or NULL if memory runs out.
+ */
+Convolver *createConvolver(const double *first, const double *second, int64_t length) {
+	Convolver *convolver = calloc(1, sizeof(Convolver));
+	if (convolver == NULL)
+		return NULL;
+
+	convolver->block = pickBlock(length);
+	convolver->size = 2 * convolver->block;
+	convolver->bins = convolver->block + 1;
+	convolver->partitions = (int) ((length + convolver->block - 1) / convolver->block);
+
+	int n = convolver->size;
+	size_t spectra = sizeof(double) * convolver->bins * convolver->partitions;
+	convolver->reversal = malloc(sizeof(int) * n);
+	convolver->twiddleRe = malloc(sizeof(double) * n);
+	convolver->twiddleIm = malloc(sizeof(double) * n);
+	convolver->historyRe = calloc(convolver->block, sizeof(double));
+	convolver->historyIm = calloc(convolver->block, sizeof(double));
+	convolver->workRe = malloc(sizeof(double) * n);
+	convolver->workIm = malloc(sizeof(double) * n);
+	int failed = convolver->reversal == NULL || convolver->twiddleRe == NULL
+		|| convolver->twiddleIm == NULL || convolver->historyRe == NULL
+		|| convolver->historyIm == NULL || convolver->workRe == NULL
+		|| convolver->workIm == NULL;
+
+	for (int c = 0; c < 2; c++) {
+		if (c == 0 || second != NULL) {
+			convolver->filterRe[c] = malloc(spectra);
+			convolver->filterIm[c] = malloc(spectra);
+			failed = failed || convolver->filterRe[c] == NULL || convolver->filterIm[c] == NULL;
+		}
+		convolver->lineRe[c] = calloc(1, spectra);
+		convolver->lineIm[c] = calloc(1, spectra);
+		convolver->sumRe[c] = malloc(sizeof(double) * convolver->bins);
+		convolver->sumIm[c] = malloc(sizeof(double) * convolver->bins);
+		failed = failed || convolver->lineRe[c] == NULL || convolver->lineIm[c] == NULL
+			|| convolver->sumRe[c] == NULL || convolver->sumIm[c] == NULL;
+	}
+
+	if (failed) {
+		destroyConvolver(convolver);
+		return NULL;
+	}
+
+	int bits = 0;
+	while ((1 << bits) < n)
+		bits++;
+	for (int i = 0; i < n; i++) {
+		int j = 0;
+		for (int b = 0; b < bits; b++)
+			j |= ((i >> b) & 1) << (bits - 1 - b);
+		convolver->reversal[i] = j;
+	}
+	for (int half = 1; half < n; half *= 2) {
+		for (int k = 0; k < half; k++) {
+			convolver->twiddleRe[half + k] = cos(M_PI * k / half);
+			convolver->twiddleIm[half + k] = -sin(M_PI * k / half);
+		}
+	}
+
+	fillSpectra(convolver, first, second, length);
+	return convolver;
+}
+
+/**
+ * Returns the block a convolver works in.
+ *
+ * @param convolver The convolver.
+ * @return The block in frames.
+ */
+int convolverBlockFrames(const Convolver *convolver) {
+	return convolver->block;
+}
+
+/**
+ * Convolves the next block of a pair of channels in place.  The block starts
+ * where the last one ended.
+ *
+ * @param convolver The convolver.
+ * @param re The block of the first channel, replaced by its output.
+ * @param im The block of the second channel, replaced by its output.
+ */
+void runConvolver(Convolver *convolver, double *re, double *im) {
+	int b = convolver->block;
+	int n = convolver->size;
+	int bins = convolver->bins;
+	int partitions = convolver->partitions;
+	double *workRe = convolver->workRe;
+	double *workIm = convolver->workIm;
+
+	// The input spectra are of this block and the one before it.
+	int slot = convolver->newest = (convolver->newest + 1) % partitions;
+	memcpy(workRe, convolver->historyRe, sizeof(double) * b);
+	memcpy(workIm, convolver->historyIm, sizeof(double) * b);
+	memcpy(workRe + b, re, sizeof(double) * b);
+	memcpy(workIm + b, im, sizeof(double) * b);
+	memcpy(convolver->historyRe, re, sizeof(double) * b);
+	memcpy(convolver->historyIm, im, sizeof(double) * b);
+	transform(convolver, workRe, workIm);
+
+	double *lineRe[2], *lineIm[2];
+	for (int c = 0; c < 2; c++) {
+		lineRe[c] = convolver->lineRe[c] + (size_t) slot * bins;
+		lineIm[c] = convolver->lineIm[c] + (size_t) slot * bins;
+	}
+	splitSpectra(convolver, lineRe, lineIm);
+
+	for (int c = 0; c < 2; c++) {
+		const double *filterRe = convolver->filterRe[convolver->filterRe[1] != NULL ? c : 0];
+		const double *filterIm = convolver->filterIm[convolver->filterIm[1] != NULL ? c : 0];
+
+		memset(convolver->sumRe[c], 0, sizeof(double) * bins);
+		memset(convolver->sumIm[c], 0, sizeof(double) * bins);
+		for (int p = 0; p < partitions; p++) {
+			size_t input = (size_t) ((slot - p + partitions) % partitions) * bins;
+			size_t filter = (size_t) p * bins;
+
+			multiplySpectra(convolver->sumRe[c], convolver->sumIm[c],
+				convolver->lineRe[c] + input, convolver->lineIm[c] + input,
+				filterRe + filter, filterIm + filter, bins);
+		}
+	}
+
+	// The channels are joined again as the real and imaginary parts of one
+	// spectrum, whose upper half mirrors the lower half of each.
+	const double *sumRe[2] = { convolver->sumRe[0], convolver->sumRe[1] };
+	const double *sumIm[2] = { convolver->sumIm[0], convolver->sumIm[1] };
+	for (int k = 0; k < bins; k++) {
+		workRe[k] = sumRe[0][k] - sumIm[1][k];
+		workIm[k] = sumIm[0][k] + sumRe[1][k];
+	}
+	for (int k = bins; k < n; k++) {
+		int j = n - k;
+		workRe[k] = sumRe[0][j] + sumIm[1][j];
+		workIm[k] = sumRe[1][j] - sumIm[0][j];
+	}
+
+	// The first half of the circular convolution wraps around; the second
+	// is this block's output.
+	inverseTransform(convolver, workRe, workIm);
+	memcpy(re, workRe + b, sizeof(double) * b);
+	memcpy(im, workIm + b, sizeof(double) * b);
+}
+
+/**
+ * Frees a convolver.
+ *
+ * @param convolver The convolver, or NULL.
+ */
+void destroyConvolver(Convolver *convolver) {
+	if (convolver == NULL)
+		return;
+
+	free(convolver->reversal);
+	free(convolver->twiddleRe);
+	free(convolver->twiddleIm);
+	for (int c = 0; c < 2; c++) {
+		free(convolver->filterRe[c]);
+		free(convolver->filterIm[c]);
+		free(convolver->lineRe[c]);
+		free(convolver->lineIm[c]);
+		free(convolver->sumRe[c]);
+		free(convolver->sumIm[c]);
+	}
+	free(convolver->historyRe);
+	free(convolver->historyIm);
+	free(convolver->workRe);
+	free(convolver->workIm);
+	free(convolver);
+}
@@ -0,0 +1,37 @@
+#ifndef CONVOLVE_H
+#define CONVOLVE_H
+
+#include <stdint.h>
+
+/*
+ * Convolution with long impulse responses, by uniformly partitioned
+ * overlap-save FFT convolution.  The impulse response is cut in to
+ * partitions of one block each, and each partition's spectrum is worked out
+ * once, when the convolver is created.  Every block of input is transformed
+ * once and kept in a delay line of spectra as long as the impulse response,
+ * and a block of output is the inverse transform of the sum of each kept
+ * spectrum times the spectrum of its partition, so the work per frame grows
+ * with the number of partitions rather than with the length of the impulse
+ * response.
+ *
+ * A convolver runs two channels at once, as the real and imaginary parts of
+ * one complex signal, so a block of a stereo pair costs one transform each
+ * way, and keeps only the half of each channel's spectra that a real signal
+ * does not mirror.  Each channel has its own impulse response, or both share
+ * one, which halves the memory of the spectra.  The output has the length of the input
+ * plus the length of the impulse response less one, and the input has to be
+ * followed by that much silence to get all of it.
+ */
+
+// The largest block a convolver works in.  The block of a convolver is a
+// power of two, so it always divides a multiple of this.
+#define CONVOLVE_MAX_BLOCK 16384
+
+typedef struct _Convolver Convolver;
+
+Convolver *createConvolver(const double *first, const double *second, int64_t length);
+int convolverBlockFrames(const Convolver *convolver);
+void runConvolver(Convolver *convolver, double *re, double *im);
+void destroyConvolver(Convolver *convolver);
+
+#endif
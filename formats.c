@@ -0,0 +1,447 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "formats.h"
+
+/*
+ * Little-endian sample codecs.  The reads leave integer samples on their own
+ * scale, with 8-bit ones re-centred on zero, and the writes undo that.
+ */
+
+static inline uint32_t readWord(const unsigned char *p) {
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline void writeWord(unsigned char *p, uint32_t word) {
+	p[0] = (unsigned char) word;
+	p[1] = (unsigned char) (word >> 8);
+	p[2] = (unsigned char) (word >> 16);
+	p[3] = (unsigned char) (word >> 24);
+}
+
+static inline int32_t readU8(const unsigned char *p) {
+	return (int32_t) p[0] - 128;
+}
+
+static inline void writeU8(unsigned char *p, int32_t sample) {
+	p[0] = (unsigned char) (sample + 128);
+}
+
+static inline int32_t readS16(const unsigned char *p) {
+	return (int16_t) (p[0] | p[1] << 8);
+}
+
+static inline void writeS16(unsigned char *p, int32_t sample) {
+	p[0] = (unsigned char) sample;
+	p[1] = (unsigned char) ((uint32_t) sample >> 8);
+}
+
+static inline int32_t readS24(const unsigned char *p) {
+	uint32_t word = (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16;
+
+	// Sign-extend from bit 23.
+	return (int32_t) (word ^ 0x800000) - 0x800000;
+}
+
+static inline void writeS24(unsigned char *p, int32_t sample) {
+	p[0] = (unsigned char) sample;
+	p[1] = (unsigned char) ((uint32_t) sample >> 8);
+	p[2] = (unsigned char) ((uint32_t) sample >> 16);
+}
+
+static inline int32_t readS32(const unsigned char *p) {
+	return (int32_t) readWord(p);
+}
+
+static inline void writeS32(unsigned char *p, int32_t sample) {
+	writeWord(p, (uint32_t) sample);
+}
+
+static inline float readF32(const unsigned char *p) {
+	uint32_t word = readWord(p);
+	float sample;
+	memcpy(&sample, &word, sizeof(sample));
+	return sample;
+}
+
+static inline void writeF32(unsigned char *p, float sample) {
+	uint32_t word;
+	memcpy(&word, &sample, sizeof(word));
+	writeWord(p, word);
+}
+
+/*
+ * Conversions of a computed value back to a sample.  "saturate" truncates and
+ * clamps to the format's range, like scaleSample does for 16-bit samples, and
+ * "quantize" rounds a filtered value to nearest first, like the resampler
+ * does.  Float samples are neither clamped nor rounded.
+ */
+
+static inline int32_t saturateU8(double x) {
+	return x < -128 ? -128 : (x > 127 ? 127 : (int32_t) x);
+}
+
+static inline int32_t saturateS16(double x) {
+	return x < INT16_MIN ? INT16_MIN : (x > INT16_MAX ? INT16_MAX : (int32_t) x);
+}
+
+static inline int32_t saturateS24(double x) {
+	return x < -0x800000 ? -0x800000 : (x > 0x7FFFFF ? 0x7FFFFF : (int32_t) x);
+}
+
+static inline int32_t saturateS32(double x) {
+	return x < INT32_MIN ? INT32_MIN : (x > INT32_MAX ? INT32_MAX : (int32_t) x);
+}
+
+static inline float saturateF32(double x) {
+	return (float) x;
+}
+
+static inline double quantizeInt(double x) {
+	return floor(x + 0.5);
+}
+
+static inline double quantizeFloat(double x) {
+	return x;
+}
+
+/*
+ * Generates the decoder and encoder of a format for one channel count.  A
+ * "fixed" count of 0 takes the count from the caller; any other count is a
+ * constant the compiler unrolls the channel loop over.
+ */
+#define DEFINE_CODEC(name, type, size, read, write, suffix, fixed)                  \
+static void decode##name##suffix(const unsigned char *bytes, void **channels,      \
+		int numChannels, size_t first, size_t count) {                               \
+	const int n = fixed ? fixed : numChannels;                                       \
+	for (size_t i = 0; i < count; i++) {                                             \
+		for (int c = 0; c < n; c++, bytes += size)                                   \
+			((type *) channels[c])[first + i] = read(bytes);                         \
+	}                                                                                \
+}                                                                                    \
+                                                                                     \
+static void encode##name##suffix(unsigned char *bytes, void *const *channels,      \
+		int numChannels, size_t first, size_t count) {                               \
+	const int n = fixed ? fixed : numChannels;                                       \
+	for (size_t i = 0; i < count; i++) {                                             \
+		for (int c = 0; c < n; c++, bytes += size)                                   \
+			write(bytes, ((const type *) channels[c])[first + i]);                   \
+	}                                                                                \
+}
+
+#define DEFINE_CODECS(name, type, size, read, write)                                \
+	DEFINE_CODEC(name, type, size, read, write, Mono, 1)                             \
+	DEFINE_CODEC(name, type, size, read, write, Stereo, 2)                           \
+	DEFINE_CODEC(name, type, size, read, write, Any, 0)
+
+DEFINE_CODECS(U8,  int32_t, 1, readU8,  writeU8)
+DEFINE_CODECS(S16, int32_t, 2, readS16, writeS16)
+DEFINE_CODECS(S24, int32_t, 3, readS24, writeS24)
+DEFINE_CODECS(S32, int32_t, 4, readS32, writeS32)
+DEFINE_CODECS(F32, float,   4, readF32, writeF32)
+
+/*
+ * Generates the kernels that only move samples, which depend on nothing but
+ * the sample type.
+ */
+#define DEFINE_MOVES(name, type)                                                    \
+static void reverse##name(void *samples, size_t count) {                            \
+	type *s = samples;                                                               \
+	for (size_t lo = 0, hi = count; lo + 1 < hi; lo++) {                             \
+		hi--;                                                                        \
+		type temp = s[lo];                                                           \
+		s[lo] = s[hi];                                                               \
+		s[hi] = temp;                                                                \
+	}                                                                                \
+}                                                                                    \
+                                                                                     \
+static void pick##name(void *out, size_t outLength, const void *in, double factor) { \
+	type *o = out;                                                                   \
+	const type *s = in;                                                              \
+	for (size_t i = 0; i < outLength; i++)                                           \
+		o[i] = s[(size_t) (i * factor)];                                             \
+}
+
+DEFINE_MOVES(Int, int32_t)
+DEFINE_MOVES(Float, float)
+
+/*
+ * Generates the arithmetic kernels of an integer format, which compute in
+ * double precision and saturate each result.
+ */
+#define DEFINE_ARITHMETIC(name, type, saturate)                                     \
+static void scale##name(void *samples, int count, double scale) {                   \
+	type *s = samples;                                                               \
+	for (int i = 0; i < count; i++)                                                  \
+		s[i] = saturate(s[i] * scale);                                               \
+}                                                                                    \
+                                                                                     \
+static void gain##name(void *samples, const double *gains, int count) {             \
+	type *s = samples;                                                               \
+	for (int i = 0; i < count; i++)                                                  \
+		s[i] = saturate(s[i] * gains[i]);                                            \
+}                                                                                    \
+                                                                                     \
+static void mix##name(void *out, const void *delayed, size_t count, double scale) { \
+	type *o = out;                                                                   \
+	const type *d = delayed;                                                         \
+	for (size_t i = 0; i < count; i++)                                               \
+		o[i] = saturate(o[i] + (double) saturate(d[i] * scale));                     \
+}
+
+DEFINE_ARITHMETIC(U8,  int32_t, saturateU8)
+DEFINE_ARITHMETIC(S16, int32_t, saturateS16)
+DEFINE_ARITHMETIC(S24, int32_t, saturateS24)
+DEFINE_ARITHMETIC(S32, int32_t, saturateS32)
+
+/*
+ * The float arithmetic kernels.  Nothing is clamped, so each is a plain
+ * single-precision multiply or multiply-add the compiler can vectorize.
+ */
+
+static void scaleF32(void *samples, int count, double scale) {
+	float *s = samples;
+	const float g = (float) scale;
+	for (int i = 0; i < count; i++)
+		s[i] *= g;
+}
+
+static void gainF32(void *samples, const double *gains, int count) {
+	float *s = samples;
+	for (int i = 0; i < count; i++)
+		s[i] *= (float) gains[i];
+}
+
+static void mixF32(void *out, const void *delayed, size_t count, double scale) {
+	float *o = out;
+	const float *d = delayed;
+	const float g = (float) scale;
+	for (size_t i = 0; i < count; i++)
+		o[i] += d[i] * g;
+}
+
+/*
+ * Generates the filtered speed change of a format.
+ */
+#define DEFINE_RESAMPLE(name, type, saturate, quantize)                             \
+static void resample##name(void *out, size_t outLength, const void *in,             \
+		size_t length, const Resampler *resampler) {                                 \
+	type *o = out;                                                                   \
+	const type *s = in;                                                              \
+	const int64_t last = (int64_t) length - 1;                                       \
+	int taps = resamplerTaps(resampler);                                             \
+	for (size_t i = 0; i < outLength; i++) {                                         \
+		int64_t first;                                                               \
+		double fraction;                                                             \
+		const int32_t *filter = resamplerFilter(resampler, (int64_t) i, &first,      \
+			&fraction);                                                              \
+		const int32_t *next = filter + taps;                                         \
+		double lower = 0, upper = 0;                                                 \
+		for (int k = 0; k < taps; k++) {                                             \
+			int64_t j = first + k;                                                   \
+			j = j < 0 ? 0 : (j > last ? last : j);                                   \
+			lower += filter[k] * (double) s[j];                                      \
+			upper += next[k] * (double) s[j];                                        \
+		}                                                                            \
+		double sum = lower + fraction * (upper - lower);                             \
+		o[i] = saturate(quantize(sum / (1 << RESAMPLE_FILTER_BITS)));                \
+	}                                                                                \
+}
+
+DEFINE_RESAMPLE(U8,  int32_t, saturateU8,  quantizeInt)
+DEFINE_RESAMPLE(S16, int32_t, saturateS16, quantizeInt)
+DEFINE_RESAMPLE(S24, int32_t, saturateS24, quantizeInt)
+DEFINE_RESAMPLE(S32, int32_t, saturateS32, quantizeInt)
+DEFINE_RESAMPLE(F32, float,   saturateF32, quantizeFloat)
+
+/*
+ * State of the dither noise, a xorshift generator.  Only the thread writing
+ * an output encodes its samples, so each thread has its own state, and it is
+ * reseeded whenever dithering kernels are picked, so dithered output is
+ * reproducible.
+ */
+#define DITHER_SEED 0x9E3779B9
+
+static __thread uint32_t ditherState = DITHER_SEED;
+
+static inline uint32_t nextDither(void) {
+	ditherState ^= ditherState << 13;
+	ditherState ^= ditherState >> 17;
+	ditherState ^= ditherState << 5;
+	return ditherState;
+}
+
+/**
+ * Returns triangular (TPDF) dither noise of up to one step either way, the
+ * difference of two uniform values.
+ *
+ * @return The noise, on (-1, 1).
+ */
+static inline double ditherNoise(void) {
+	double a = nextDither() / 4294967296.0;
+	double b = nextDither() / 4294967296.0;
+	return a - b;
+}
+
+/*
+ * Generates the codecs of an integer format for the float working mode,
+ * which holds its samples as float on their own scale.  The encoders round
+ * to nearest and saturate, the dithering one after adding dither noise, so
+ * the chain is quantized exactly once.
+ */
+#define DEFINE_FLOAT_CODEC(name, size, read, write, saturate, suffix, fixed)        \
+static void decodeFloat##name##suffix(const unsigned char *bytes, void **channels, \
+		int numChannels, size_t first, size_t count) {                               \
+	const int n = fixed ? fixed : numChannels;                                       \
+	for (size_t i = 0; i < count; i++) {                                             \
+		for (int c = 0; c < n; c++, bytes += size)                                   \
+			((float *) channels[c])[first + i] = (float) read(bytes);                \
+	}                                                                                \
+}                                                                                    \
+                                                                                     \
+static void encodeFloat##name##suffix(unsigned char *bytes, void *const *channels, \
+		int numChannels, size_t first, size_t count) {                               \
+	const int n = fixed ? fixed : numChannels;                                       \
+	for (size_t i = 0; i < count; i++) {                                             \
+		for (int c = 0; c < n; c++, bytes += size)                                   \
+			write(bytes, saturate(floor(((const float *) channels[c])[first + i] + 0.5))); \
+	}                                                                                \
+}                                                                                    \
+                                                                                     \
+static void encodeDither##name##suffix(unsigned char *bytes, void *const *channels, \
+		int numChannels, size_t first, size_t count) {                               \
+	const int n = fixed ? fixed : numChannels;                                       \
+	for (size_t i = 0; i < count; i++) {                                             \
+		for (int c = 0; c < n; c++, bytes += size) {                                 \
+			double x = ((const float *) channels[c])[first + i] + ditherNoise();     \
+			write(bytes, saturate(floor(x + 0.5)));                                  \
+		}                                                                            \
+	}                                                                                \
+}
+
+#define DEFINE_FLOAT_CODECS(name, size, read, write, saturate)                      \
+	DEFINE_FLOAT_CODEC(name, size, read, write, saturate, Mono, 1)                   \
+	DEFINE_FLOAT_CODEC(name, size, read, write, saturate, Stereo, 2)                 \
+	DEFINE_FLOAT_CODEC(name, size, read, write, saturate, Any, 0)
+
+DEFINE_FLOAT_CODECS(U8,  1, readU8,  writeU8,  saturateU8)
+DEFINE_FLOAT_CODECS(S16, 2, readS16, writeS16, saturateS16)
+DEFINE_FLOAT_CODECS(S24, 3, readS24, writeS24, saturateS24)
+DEFINE_FLOAT_CODECS(S32, 4, readS32, writeS32, saturateS32)
+
+#define KERNELS(name, moves, suffix) {                                              \
+	decode##name##suffix, encode##name##suffix, scale##name, gain##name, mix##name, \
+	reverse##moves, pick##moves, resample##name                                      \
+}
+
+#define FORMAT_KERNELS(name, moves) {                                               \
+	KERNELS(name, moves, Mono), KERNELS(name, moves, Stereo), KERNELS(name, moves, Any) \
+}
+
+// Indexed by FORMAT_* code, then by mono, stereo or any channel count.
+static const SampleKernels formatKernels[5][3] = {
+	FORMAT_KERNELS(U8,  Int),
+	FORMAT_KERNELS(S16, Int),
+	FORMAT_KERNELS(S24, Int),
+	FORMAT_KERNELS(S32, Int),
+	FORMAT_KERNELS(F32, Float)
+};
+
+/**
+ * The float working mode codecs of one integer format and channel count.
+ */
+typedef struct _FloatCodecs {
+	void (*decode)(const unsigned char *bytes, void **channels, int numChannels,
+		size_t first, size_t count);
+	void (*encode)(unsigned char *bytes, void *const *channels, int numChannels,
+		size_t first, size_t count);
+	void (*dither)(unsigned char *bytes, void *const *channels, int numChannels,
+		size_t first, size_t count);
+} FloatCodecs;
+
+#define FLOAT_CODECS(name, suffix) {                                                \
+	decodeFloat##name##suffix, encodeFloat##name##suffix, encodeDither##name##suffix \
+}
+
+#define FORMAT_FLOAT_CODECS(name) {                                                 \
+	FLOAT_CODECS(name, Mono), FLOAT_CODECS(name, Stereo), FLOAT_CODECS(name, Any)    \
+}
+
+// Indexed like formatKernels, for the integer formats.
+static const FloatCodecs floatCodecs[4][3] = {
+	FORMAT_FLOAT_CODECS(U8),
+	FORMAT_FLOAT_CODECS(S16),
+	FORMAT_FLOAT_CODECS(S24),
+	FORMAT_FLOAT_CODECS(S32)
+};
+
+/**
+ * Picks which of a format's kernel tables serves a channel count.
+ *
+ * @param numChannels The number of channels in a frame.
+ * @return 0 for mono, 1 for stereo, or 2 for any other count.
+ */
+static int channelVariant(int numChannels) {
+	return numChannels == 1 ? 0 : (numChannels == 2 ? 1 : 2);
+}
+
+/**
+ * Finds the FORMAT_* code of a wave file's samples.
+ *
+ * @param compression The format chunk's compression code: 1 for integer PCM
+ *        or 3 for IEEE float.
+ * @param bitsPerSample The format chunk's sample size.
+ * @return The FORMAT_* code, or -1 if the format is not supported.
+ */
+int sampleFormat(int compression, int bitsPerSample) {
+	if (compression == 1) {
+		switch (bitsPerSample) {
+		case 8:  return FORMAT_U8;
+		case 16: return FORMAT_S16;
+		case 24: return FORMAT_S24;
+		case 32: return FORMAT_S32;
+		}
+	} else if (compression == 3 && bitsPerSample == 32) {
+		return FORMAT_F32;
+	}
+
+	return -1;
+}
+
+/**
+ * Returns the kernels for a format and channel count.
+ *
+ * @param format The FORMAT_* code.
+ * @param numChannels The number of channels in a frame.
+ * @return The kernels.
+ */
+SampleKernels sampleKernels(int format, int numChannels) {
+	return formatKernels[format][channelVariant(numChannels)];
+}
+
+/**
+ * Returns the kernels for the float working mode: a format's samples are
+ * decoded to float, processed by the float kernels, and quantized back to
+ * the format only when they are encoded.  Asking for dither restarts the
+ * calling thread's dither noise, which the kernels must then be encoded on.
+ *
+ * @param format The FORMAT_* code of the file.
+ * @param numChannels The number of channels in a frame.
+ * @param dither 1 to add dither noise as integer samples are quantized.
+ * @return The kernels.
+ */
+SampleKernels floatKernels(int format, int numChannels, int dither) {
+	SampleKernels kernels = sampleKernels(FORMAT_F32, numChannels);
+
+	if (format != FORMAT_F32) {
+		const FloatCodecs *codecs = &floatCodecs[format][channelVariant(numChannels)];
+		kernels.decode = codecs->decode;
+		kernels.encode = dither ? codecs->dither : codecs->encode;
+	}
+
+	if (dither)
+		ditherState = DITHER_SEED;
+
+	return kernels;
+}
@@ -0,0 +1,60 @@
+#ifndef FORMATS_H
+#define FORMATS_H
+
+#include <stddef.h>
+
+#include "resample.h"
+
+/*
+ * Kernels for the sample formats other than the 16-bit stereo the rest of the
+ * program is specialized for.  Sound data in these formats is held one array
+ * per channel, at the file's own precision: integer samples as int32_t on
+ * their own scale (8-bit samples re-centred on zero) and float samples as
+ * float, so both take SAMPLE_SIZE bytes.  The kernels are generated by macros
+ * once per format, and the codecs once more per channel count (mono, stereo
+ * or any), so each runs with its sample width, range and frame size fixed at
+ * compile time.  Integer results saturate to the format's range; float ones
+ * are left as they are.
+ *
+ * In the float working mode every format is held as float instead, integer
+ * samples still on their own scale, so a whole chain runs unclamped and is
+ * rounded, saturated and optionally dithered only once, on the way out.
+ */
+
+#define FORMAT_U8  0
+#define FORMAT_S16 1
+#define FORMAT_S24 2
+#define FORMAT_S32 3
+#define FORMAT_F32 4
+
+#define SAMPLE_SIZE 4
+
+/**
+ * The kernels for one format.  "decode" splits "count" frames of the file's
+ * bytes in to the channels from frame "first" on, and "encode" does the
+ * reverse.  The rest work on a single channel: "scale" and "gain" multiply by
+ * one scale or a scale per sample, "mix" adds "delayed" times "scale" in to
+ * "out", "reverse" reverses in place, "pick" copies every factor'th sample of
+ * "in" for a nearest-sample speed change, and "resample" filters "in" through
+ * a resampler's filter bank instead.  "scale" and "gain" work on blocks; the
+ * rest take the whole of a channel, so their counts are 64-bit.
+ */
+typedef struct _SampleKernels {
+	void (*decode)(const unsigned char *bytes, void **channels, int numChannels,
+		size_t first, size_t count);
+	void (*encode)(unsigned char *bytes, void *const *channels, int numChannels,
+		size_t first, size_t count);
+	void (*scale)(void *samples, int count, double scale);
+	void (*gain)(void *samples, const double *gains, int count);
+	void (*mix)(void *out, const void *delayed, size_t count, double scale);
+	void (*reverse)(void *samples, size_t count);
+	void (*pick)(void *out, size_t outLength, const void *in, double factor);
+	void (*resample)(void *out, size_t outLength, const void *in, size_t length,
+		const Resampler *resampler);
+} SampleKernels;
+
+int sampleFormat(int compression, int bitsPerSample);
+SampleKernels sampleKernels(int format, int numChannels);
+SampleKernels floatKernels(int format, int numChannels, int dither);
+
+#endif
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "kernels.h"
+#include "formats.h"
+#include "index.h"
+
+// The start of every index, with its version.
+#define INDEX_MAGIC "WAVEIDX1"
+
+/**
+ * Names a file next to a wave file, at its path with a suffix added.
+ *
+ * @param path The path of the wave file.
+ * @param suffix The suffix.
+ * @return The allocated name, or NULL if memory runs out.
+ */
+static char *sidecarName(const char *path, const char *suffix) {
+	char *name = malloc(strlen(path) + strlen(suffix) + 1);
+	if (name != NULL) {
+		strcpy(name, path);
+		strcat(name, suffix);
+	}
+
+	return name;
+}
+
+/**
+ * Rounds a sample on the 16-bit scale down to a short, saturating.
+ *
+ * @param sample The sample.
+ * @return The short.
+ */
+static int16_t shortLevel(double sample) {
+	if (!(sample > -32768))
+		return -32768;
+	if (sample >= 32767)
+		return 32767;
+
+	return (int16_t) floor(sample);
+}
+
+/**
+ * Measures one of the finest blocks of each channel.
+ *
+ * @param blocks Where to store the levels of the channels.
+ * @param channels The decoded channels, int32_t or float.
+ * @param numChannels The number of channels.
+ * @param count The number of frames in the block.
+ * @param isFloat 1 for float samples, 0 for int32_t.
+ * @param fullScale The magnitude of a full-scale sample.
+ */
+static void measureBlock(IndexBlock *blocks, void *const *channels, int numChannels, int count,
+		int isFloat, double fullScale) {
+	for (int c = 0; c < numChannels; c++) {
+		const int32_t *ints = channels[c];
+		const float *floats = channels[c];
+		double min = 0, max = 0, squares = 0;
+
+		for (int i = 0; i < count; i++) {
+			double sample = isFloat ? floats[i] : ints[i];
+			min = i == 0 || sample < min ? sample : min;
+			max = i == 0 || sample > max ? sample : max;
+			squares += sample * sample;
+		}
+
+		blocks[c].min = shortLevel(min * 32768 / fullScale);
+		blocks[c].max = shortLevel(max * 32768 / fullScale);
+		blocks[c].rms = (float) (sqrt(squares / count) / fullScale);
+	}
+}
+
+/**
+ * Works out the blocks of one level from those of the level below it.
+ *
+ * @param out Where to store the blocks.
+ * @param numOut The number of blocks to work out.
+ * @param in The blocks of the level below.
+ * @param inFrames The frames in each of them but the last.
+ * @param numChannels The number of channels.
+ * @param numFrames The number of frames in the file.
+ */
+static void mergeBlocks(IndexBlock *out, uint64_t numOut, const IndexBlock *in, int64_t inFrames,
+		int numChannels, int64_t numFrames) {
+	for (uint64_t b = 0; b < numOut; b++) {
+		uint64_t first = b * INDEX_LEVEL_FACTOR;
+		uint64_t end = first + INDEX_LEVEL_FACTOR;
+		uint64_t numIn = (numFrames + inFrames - 1) / inFrames;
+		end = end < numIn ? end : numIn;
+
+		for (int c = 0; c < numChannels; c++) {
+			IndexBlock *block = &out[b * numChannels + c];
+			double squares = 0;
+			int64_t frames = 0;
+
+			*block = in[first * numChannels + c];
+			for (uint64_t j = first; j < end; j++) {
+				const IndexBlock *part = &in[j * numChannels + c];
+				int64_t length = numFrames - (int64_t) j * inFrames;
+				length = length < inFrames ? length : inFrames;
+
+				block->min = part->min < block->min ? part->min : block->min;
+				block->max = part->max > block->max ? part->max : block->max;
+				squares += (double) part->rms * part->rms * length;
+				frames += length;
+			}
+
+			block->rms = (float) sqrt(squares / frames);
+		}
+	}
+}
+
+/**
+ * Writes the file of an index, under a temporary name that is then renamed
+ * over the index, so no run ever reads a partly written one.
+ *
+ * @param path The path of the wave file.
+ * @param index The fixed part of the index.
+ * @param blocks The blocks of every level.
+ * @param numBlocks The number of them.
+ * @param checksums The checksums of the finest blocks.
+ * @return INDEX_OK or INDEX_ERROR_FILE.
+ */
+static int writeIndexFile(const char *path, const WaveIndex *index, const IndexBlock *blocks,
+		size_t numBlocks, const uint32_t *checksums) {
+	char *name = sidecarName(path, ".idx");
+	char *temporary = sidecarName(path, ".idx.tmp");
+	FILE *out = name != NULL && temporary != NULL ? fopen(temporary, "wb") : NULL;
+
+	int written = out != NULL
+		&& fwrite(index, sizeof(WaveIndex), 1, out) == 1
+		&& fwrite(blocks, sizeof(IndexBlock), numBlocks, out) == numBlocks
+		&& fwrite(checksums, sizeof(uint32_t), index->numBlocks[0], out) == index->numBlocks[0];
+	if (out != NULL && fclose(out) != 0)
+		written = 0;
+	if (written && rename(temporary, name) != 0)
+		written = 0;
+	if (!written && out != NULL)
+		remove(temporary);
+
+	free(name);
+	free(temporary);
+	return written ? INDEX_OK : INDEX_ERROR_FILE;
+}
+
+/**
+ * Makes the index of a wave file and writes it next to the file.  The
+ * sound data is decoded, measured and checksummed one of the finest blocks at
+ * a time, and the coarser levels are worked out from the finer ones.  The
+ * levels a '-n' normalizes to are measured just as the read would measure
+ * them, so a '-n' that uses them gives exactly the same gain.
+ *
+ * @param path The path of the wave file.
+ * @param stamp The identity of the wave file.
+ * @param header The validated header of the wave file.
+ * @param file The whole wave file, in memory or mapped.
+ * @param dataOffset Where its sound data starts.
+ * @return INDEX_OK, INDEX_ERROR_MEMORY or INDEX_ERROR_FILE.
+ */
+int writeIndex(const char *path, const IndexStamp *stamp, const WaveHeader *header,
+		const unsigned char *file, uint64_t dataOffset) {
+	const FormatChunk *format = &header->formatChunk;
+	int numChannels = format->channels;
+	int code = sampleFormat(format->compression, format->bitsPerSample);
+	int64_t numFrames = header->dataChunk.size / format->blockAlign;
+	const unsigned char *data = file + dataOffset;
+
+	WaveIndex index;
+	memset(&index, 0, sizeof(index));
+	memcpy(index.magic, INDEX_MAGIC, sizeof(index.magic));
+	index.stamp = *stamp;
+	index.header = *header;
+	index.dataOffset = dataOffset;
+
+	size_t numBlocks = 0;
+	int64_t frames = INDEX_BLOCK_FRAMES;
+	for (int l = 0; l < INDEX_LEVELS; l++) {
+		index.numBlocks[l] = (numFrames + frames - 1) / frames;
+		numBlocks += index.numBlocks[l] * numChannels;
+		frames *= INDEX_LEVEL_FACTOR;
+	}
+
+	IndexBlock *blocks = malloc(sizeof(IndexBlock) * (numBlocks > 0 ? numBlocks : 1));
+	uint32_t *checksums = malloc(sizeof(uint32_t) * (index.numBlocks[0] > 0 ? index.numBlocks[0] : 1));
+	void **channels = malloc(sizeof(void *) * numChannels);
+	unsigned char *samples = malloc((size_t) SAMPLE_SIZE * INDEX_BLOCK_FRAMES * numChannels);
+	if (blocks == NULL || checksums == NULL || channels == NULL || samples == NULL) {
+		free(blocks);
+		free(checksums);
+		free(channels);
+		free(samples);
+		return INDEX_ERROR_MEMORY;
+	}
+
+	for (int c = 0; c < numChannels; c++)
+		channels[c] = samples + (size_t) SAMPLE_SIZE * INDEX_BLOCK_FRAMES * c;
+
+	SampleKernels kernels = sampleKernels(code, numChannels);
+	int isFloat = code == FORMAT_F32;
+	double fullScale = isFloat ? 1 : ldexp(1, format->bitsPerSample - 1);
+	int isShort = code == FORMAT_S16 && numChannels == 2;
+
+	Loudness loudness;
+	index.measured = initLoudness(&loudness, numChannels, format->sampleRate, fullScale);
+
+	for (uint64_t b = 0; b < index.numBlocks[0]; b++) {
+		int64_t first = (int64_t) b * INDEX_BLOCK_FRAMES;
+		int count = numFrames - first < INDEX_BLOCK_FRAMES
+			? (int) (numFrames - first) : INDEX_BLOCK_FRAMES;
+		const unsigned char *bytes = data + (size_t) first * format->blockAlign;
+
+		kernels.decode(bytes, channels, numChannels, 0, count);
+		measureBlock(blocks + b * numChannels, channels, numChannels, count, isFloat, fullScale);
+		checksums[b] = checksumBytes(0, bytes, (size_t) count * format->blockAlign);
+
+		// 16-bit stereo is measured from the frames themselves, as it is read.
+		if (index.measured && isShort)
+			measureShorts(&loudness, (const short *) bytes, (const short *) bytes + 1, 2, count);
+		else if (index.measured)
+			measureChannels(&loudness, channels, isFloat, 0, count);
+	}
+
+	if (index.measured)
+		loudnessLevels(&loudness, &index.levels);
+
+	IndexBlock *level = blocks;
+	frames = INDEX_BLOCK_FRAMES;
+	for (int l = 1; l < INDEX_LEVELS; l++) {
+		IndexBlock *next = level + index.numBlocks[l - 1] * numChannels;
+		mergeBlocks(next, index.numBlocks[l], level, frames, numChannels, numFrames);
+		level = next;
+		frames *= INDEX_LEVEL_FACTOR;
+	}
+
+	int result = writeIndexFile(path, &index, blocks, numBlocks, checksums);
+
+	free(blocks);
+	free(checksums);
+	free(channels);
+	free(samples);
+	return result;
+}
+
+/**
+ * Checks whether two files are the same file, unchanged.
+ *
+ * @param a The identity of one.
+ * @param b The identity of the other.
+ * @return 1 if they are, 0 if not.
+ */
+static int sameStamp(const IndexStamp *a, const IndexStamp *b) {
+	return a->device == b->device && a->inode == b->inode && a->size == b->size
+		&& a->seconds == b->seconds && a->nanoseconds == b->nanoseconds;
+}
+
+/**
+ * Reads the fixed part of the index of a wave file, if it has one that still
+ * matches it.
+ *
+ * @param path The path of the wave file.
+ * @param stamp The identity of the wave file as it is now.
+ * @param index Where to store the fixed part of the index.
+ * @return 1 if the file has an index to use, 0 if it has none, or only a
+ *         stale or unreadable one.
+ */
+int readIndex(const char *path, const IndexStamp *stamp, WaveIndex *index) {
+	char *name = sidecarName(path, ".idx");
+	FILE *in = name != NULL ? fopen(name, "rb") : NULL;
+	free(name);
+	if (in == NULL)
+		return 0;
+
+	int read = fread(index, sizeof(WaveIndex), 1, in) == 1;
+	fclose(in);
+
+	return read && memcmp(index->magic, INDEX_MAGIC, sizeof(index->magic)) == 0
+		&& sameStamp(&index->stamp, stamp);
+}
@@ -0,0 +1,80 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdint.h>
+
+#include "wave.h"
+#include "loudness.h"
+
+/*
+ * Sidecar indexes.  An index is kept next to a wave file, at the file's path
+ * with ".idx" added, and holds what a run would otherwise have to work out
+ * from the whole file again: the parsed header and where the sound data
+ * starts, the levels a '-n' normalizes to, the smallest, largest and RMS
+ * level of each channel over blocks of frames at INDEX_LEVELS resolutions,
+ * for drawing waveforms, and the CRC-32C of the bytes of each of the finest
+ * blocks.
+ *
+ * An index records the device, inode, size and modification time of the
+ * file it was made from, and is only used while the file still has them, so
+ * rewriting the file, in place or not, leaves its index stale rather than
+ * wrong.  Using an index only ever reads its fixed part, however long the
+ * file is.  It is a cache rather than an interchange format, so it is laid
+ * out in the host's own byte order; an index from another kind of host does
+ * not match and is ignored.
+ */
+
+#define INDEX_OK           0
+#define INDEX_ERROR_MEMORY 1
+#define INDEX_ERROR_FILE   2
+
+// The frames in each of the finest blocks, and how many blocks of one level
+// make up a block of the next one.
+#define INDEX_LEVELS       3
+#define INDEX_BLOCK_FRAMES 4096
+#define INDEX_LEVEL_FACTOR 16
+
+/**
+ * The identity of a file, as stat gives it.
+ */
+typedef struct _IndexStamp {
+	uint64_t device;
+	uint64_t inode;
+	uint64_t size;
+	int64_t seconds;
+	int64_t nanoseconds;
+} IndexStamp;
+
+/**
+ * The level of one channel over one block: its smallest and largest samples,
+ * on the 16-bit scale whatever the format, and its RMS level on full scale 1.
+ */
+typedef struct _IndexBlock {
+	int16_t min;
+	int16_t max;
+	float rms;
+} IndexBlock;
+
+/**
+ * The fixed part of an index, at the start of its file.  It is followed by
+ * the blocks of each level in turn, numBlocks[l] of them from the start of
+ * the sound data on, with the channels of each block together, and then by
+ * the uint32_t checksums of the numBlocks[0] finest blocks.  "measured" is
+ * 0 when the file has too many channels for "levels" to be measured, and
+ * "dataOffset" is where the sound data starts in the file.
+ */
+typedef struct _WaveIndex {
+	char magic[8];
+	IndexStamp stamp;
+	WaveHeader header;
+	uint64_t dataOffset;
+	uint64_t numBlocks[INDEX_LEVELS];
+	int measured;
+	Levels levels;
+} WaveIndex;
+
+int writeIndex(const char *path, const IndexStamp *stamp, const WaveHeader *header,
+	const unsigned char *file, uint64_t dataOffset);
+int readIndex(const char *path, const IndexStamp *stamp, WaveIndex *index);
+
+#endif
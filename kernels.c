@@ -0,0 +1,1976 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define KERNELS_NEON
+#include <arm_neon.h>
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#endif
+
+#include "kernels.h"
+
+#ifndef M_PI_2
+#define M_PI_2 1.57079632679489661923
+#endif
+
+/**
+ * Scales a short value by some double quantity.
+ * Ensures the result will be on [SHRT_MIN, SHRT_MAX].
+ *
+ * This is the reference every vector kernel must match sample for sample.
+ *
+ * @param sample The data to scale.
+ * @param scale How much to scale the sample.
+ * @return The scaled short.
+ */
+short scaleSample(short sample, double scale) {
+	int temp = (int) (sample * scale);
+	if (temp < SHRT_MIN)
+		temp = SHRT_MIN;
+	if (temp > SHRT_MAX)
+		temp = SHRT_MAX;
+	return (short) temp;
+}
+
+/**
+ * The scalar volume kernel.
+ *
+ * @param samples The samples to scale in place.
+ * @param count The number of samples.
+ * @param scale How much to scale the samples.
+ */
+static void scaleSamplesScalar(short *samples, int count, double scale) {
+	for (int i = 0; i < count; i++)
+		samples[i] = scaleSample(samples[i], scale);
+}
+
+/**
+ * The scalar envelope kernel.  Envelope gains never exceed 1, so clamping
+ * with scaleSample gives the same result as a plain truncating multiply.
+ *
+ * @param samples The samples to scale in place.
+ * @param gains The gain of each sample.
+ * @param count The number of samples.
+ */
+static void applyGainsScalar(short *samples, const double *gains, int count) {
+	for (int i = 0; i < count; i++)
+		samples[i] = scaleSample(samples[i], gains[i]);
+}
+
+/**
+ * The scalar interleaved envelope kernel.
+ *
+ * @param frames The interleaved frames to scale in place.
+ * @param gains The gain of each frame.
+ * @param count The number of frames.
+ */
+static void applyFrameGainsScalar(short *frames, const double *gains, int count) {
+	for (int i = 0; i < count; i++) {
+		frames[2 * i]     = scaleSample(frames[2 * i], gains[i]);
+		frames[2 * i + 1] = scaleSample(frames[2 * i + 1], gains[i]);
+	}
+}
+
+/**
+ * The scalar reversing copy kernel.
+ *
+ * @param out Where to store the frames.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ * @param swap 1 to swap the two samples of each frame as well.
+ */
+static void reverseFramesScalar(short *out, const short *in, int count, int swap) {
+	int s = swap ? 1 : 0;
+
+	for (int i = 0; i < count; i++) {
+		const short *frame = in + 2 * (count - 1 - i);
+		out[2 * i]     = frame[s];
+		out[2 * i + 1] = frame[1 - s];
+	}
+}
+
+/**
+ * The scalar channel swapping copy kernel.
+ *
+ * @param out Where to store the frames, which may be "in" itself.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ */
+static void swapFramesScalar(short *out, const short *in, int count) {
+	for (int i = 0; i < count; i++) {
+		short left = in[2 * i];
+		out[2 * i]     = in[2 * i + 1];
+		out[2 * i + 1] = left;
+	}
+}
+
+/**
+ * The scalar filter kernel.
+ *
+ * @param frames The interleaved frames under the filter.
+ * @param taps The filter's fixed-point taps, one per frame.
+ * @param count The number of taps.
+ * @param sums Where to store the left and right sums.
+ */
+static void convolveFramesScalar(const short *frames, const int32_t *taps, int count,
+		long long *sums) {
+	long long left = 0;
+	long long right = 0;
+
+	for (int i = 0; i < count; i++) {
+		left  += frames[2 * i] * (long long) taps[i];
+		right += frames[2 * i + 1] * (long long) taps[i];
+	}
+
+	sums[0] = left;
+	sums[1] = right;
+}
+
+/**
+ * The scalar level kernel.
+ *
+ * @param frames The interleaved frames to measure.
+ * @param count The number of frames.
+ * @param peaks The largest magnitude of each channel so far, updated.
+ * @param squares The sum of the squares of each channel so far, updated.
+ */
+static void measureFramesScalar(const short *frames, int count, int *peaks, long long *squares) {
+	for (int c = 0; c < 2; c++) {
+		int peak = peaks[c];
+		long long sum = 0;
+
+		for (int i = 0; i < count; i++) {
+			int sample = frames[2 * i + c];
+			int magnitude = sample < 0 ? -sample : sample;
+			if (magnitude > peak)
+				peak = magnitude;
+			sum += sample * sample;
+		}
+
+		peaks[c] = peak;
+		squares[c] += sum;
+	}
+}
+
+/**
+ * The scalar spectrum kernel.  Each product is worked out in full before it
+ * is added, with no fused multiply-add, and the vector versions do the same,
+ * so every version gives the same sums to the bit.
+ *
+ * @param re The real parts of the sums, updated.
+ * @param im The imaginary parts of the sums, updated.
+ * @param xRe The real parts of one spectrum.
+ * @param xIm The imaginary parts of one spectrum.
+ * @param hRe The real parts of the other spectrum.
+ * @param hIm The imaginary parts of the other spectrum.
+ * @param count The number of bins.
+ */
+static void multiplySpectraScalar(double *re, double *im, const double *xRe, const double *xIm,
+		const double *hRe, const double *hIm, int count) {
+	for (int k = 0; k < count; k++) {
+		double r = xRe[k] * hRe[k] - xIm[k] * hIm[k];
+		double i = xRe[k] * hIm[k] + xIm[k] * hRe[k];
+		re[k] += r;
+		im[k] += i;
+	}
+}
+
+/**
+ * The scalar butterfly kernel: one radix-2 stage of an FFT, over every group
+ * of 2 * half points.  As with the spectra the products are not fused, so
+ * every version transforms to the bit alike.
+ *
+ * @param re The real parts of the points, updated.
+ * @param im The imaginary parts of the points, updated.
+ * @param wRe The real parts of the stage's twiddles, one per butterfly of a
+ *        group.
+ * @param wIm The imaginary parts of the stage's twiddles.
+ * @param half The span of each butterfly, half the size of a group.
+ * @param size The number of points.
+ */
+static void butterflyStageScalar(double *re, double *im, const double *wRe, const double *wIm,
+		int half, int size) {
+	for (int start = 0; start < size; start += 2 * half) {
+		for (int k = 0; k < half; k++) {
+			int a = start + k, b = a + half;
+			double tr = re[b] * wRe[k] - im[b] * wIm[k];
+			double ti = re[b] * wIm[k] + im[b] * wRe[k];
+			re[b] = re[a] - tr;
+			im[b] = im[a] - ti;
+			re[a] += tr;
+			im[a] += ti;
+		}
+	}
+}
+
+/**
+ * The scalar mixing kernel: adds samples to running sums, which are clamped
+ * only once every input has been added, so the order of the inputs does not
+ * change the mix.
+ *
+ * @param sums The running sums, updated.
+ * @param samples The samples to add.
+ * @param count The number of samples.
+ */
+static void mixSamplesScalar(int *sums, const short *samples, int count) {
+	for (int i = 0; i < count; i++)
+		sums[i] += samples[i];
+}
+
+/**
+ * The scalar clamping kernel: stores sums as samples, clamped to
+ * [SHRT_MIN, SHRT_MAX] just as scaleSample clamps.
+ *
+ * @param samples Where to store the clamped samples.
+ * @param sums The sums.
+ * @param count The number of samples.
+ */
+static void clampSumsScalar(short *samples, const int *sums, int count) {
+	for (int i = 0; i < count; i++) {
+		int sum = sums[i];
+		if (sum < SHRT_MIN)
+			sum = SHRT_MIN;
+		if (sum > SHRT_MAX)
+			sum = SHRT_MAX;
+		samples[i] = (short) sum;
+	}
+}
+
+// CRC-32C, the Castagnoli polynomial in its reflected form, a byte at a time.
+static const uint32_t crcTable[256] = {
+	0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+	0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+	0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+	0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+	0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+	0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+	0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+	0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+	0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+	0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+	0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+	0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+	0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+	0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+	0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+	0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+	0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+	0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+	0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+	0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+	0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+	0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+	0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+	0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+	0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+	0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+	0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+	0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+	0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+	0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+	0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+	0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+	0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+	0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+	0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+	0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+	0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+	0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+	0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+	0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+	0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+	0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+	0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+};
+
+/**
+ * The scalar checksum kernel.
+ *
+ * @param crc 0 to start, or the checksum of the bytes before these.
+ * @param bytes The bytes.
+ * @param size The number of bytes.
+ * @return The checksum of everything so far.
+ */
+static uint32_t checksumBytesScalar(uint32_t crc, const void *bytes, size_t size) {
+	const unsigned char *p = bytes;
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = crcTable[(crc ^ p[i]) & 0xff] ^ crc >> 8;
+
+	return ~crc;
+}
+
+#ifdef KERNELS_X86
+
+/*
+ * The x86 kernels multiply in double precision, exactly like scaleSample, and
+ * truncate with cvttpd.  The saturating pack then does the clamping.  An
+ * out-of-range product truncates to INT_MIN in both the scalar and the vector
+ * conversion, so even those match.
+ */
+
+/**
+ * Scales 8 samples by 8 gains, two per vector, in place.
+ *
+ * @param samples The samples to scale.
+ * @param f0 The gains of samples 0 and 1.
+ * @param f1 The gains of samples 2 and 3.
+ * @param f2 The gains of samples 4 and 5.
+ * @param f3 The gains of samples 6 and 7.
+ */
+__attribute__((target("sse2")))
+static inline void scale8Sse2(short *samples, __m128d f0, __m128d f1, __m128d f2, __m128d f3) {
+	__m128i in = _mm_loadu_si128((const __m128i *) samples);
+
+	// Sign-extend to 32 bits: samples 0-3 and 4-7.
+	__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16);
+	__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16);
+
+	__m128i a = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtepi32_pd(lo), f0));
+	__m128i b = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtepi32_pd(
+		_mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2))), f1));
+	__m128i c = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtepi32_pd(hi), f2));
+	__m128i d = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtepi32_pd(
+		_mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2))), f3));
+
+	__m128i out = _mm_packs_epi32(_mm_unpacklo_epi64(a, b), _mm_unpacklo_epi64(c, d));
+	_mm_storeu_si128((__m128i *) samples, out);
+}
+
+/**
+ * Scales 16 samples by 16 gains, four per vector, in place.
+ *
+ * @param samples The samples to scale.
+ * @param f0 The gains of samples 0-3.
+ * @param f1 The gains of samples 4-7.
+ * @param f2 The gains of samples 8-11.
+ * @param f3 The gains of samples 12-15.
+ */
+__attribute__((target("avx2")))
+static inline void scale16Avx2(short *samples, __m256d f0, __m256d f1, __m256d f2, __m256d f3) {
+	__m256i in = _mm256_loadu_si256((const __m256i *) samples);
+
+	// Sign-extend to 32 bits: samples 0-7 and 8-15.
+	__m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(in));
+	__m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(in, 1));
+
+	__m128i a = _mm256_cvttpd_epi32(_mm256_mul_pd(
+		_mm256_cvtepi32_pd(_mm256_castsi256_si128(lo)), f0));
+	__m128i b = _mm256_cvttpd_epi32(_mm256_mul_pd(
+		_mm256_cvtepi32_pd(_mm256_extracti128_si256(lo, 1)), f1));
+	__m128i c = _mm256_cvttpd_epi32(_mm256_mul_pd(
+		_mm256_cvtepi32_pd(_mm256_castsi256_si128(hi)), f2));
+	__m128i d = _mm256_cvttpd_epi32(_mm256_mul_pd(
+		_mm256_cvtepi32_pd(_mm256_extracti128_si256(hi, 1)), f3));
+
+	// packs works within 128-bit lanes, leaving the quarters as a, c, b, d.
+	__m256i out = _mm256_packs_epi32(
+		_mm256_inserti128_si256(_mm256_castsi128_si256(a), b, 1),
+		_mm256_inserti128_si256(_mm256_castsi128_si256(c), d, 1));
+	out = _mm256_permute4x64_epi64(out, _MM_SHUFFLE(3, 1, 2, 0));
+	_mm256_storeu_si256((__m256i *) samples, out);
+}
+
+/**
+ * The SSE2 volume kernel.
+ *
+ * @param samples The samples to scale in place.
+ * @param count The number of samples.
+ * @param scale How much to scale the samples.
+ */
+__attribute__((target("sse2")))
+static void scaleSamplesSse2(short *samples, int count, double scale) {
+	__m128d factor = _mm_set1_pd(scale);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+		scale8Sse2(samples + i, factor, factor, factor, factor);
+
+	scaleSamplesScalar(samples + i, count - i, scale);
+}
+
+/**
+ * The SSE2 envelope kernel.
+ *
+ * @param samples The samples to scale in place.
+ * @param gains The gain of each sample.
+ * @param count The number of samples.
+ */
+__attribute__((target("sse2")))
+static void applyGainsSse2(short *samples, const double *gains, int count) {
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		scale8Sse2(samples + i, _mm_loadu_pd(gains + i), _mm_loadu_pd(gains + i + 2),
+			_mm_loadu_pd(gains + i + 4), _mm_loadu_pd(gains + i + 6));
+	}
+
+	applyGainsScalar(samples + i, gains + i, count - i);
+}
+
+/**
+ * The SSE2 interleaved envelope kernel.
+ *
+ * @param frames The interleaved frames to scale in place.
+ * @param gains The gain of each frame.
+ * @param count The number of frames.
+ */
+__attribute__((target("sse2")))
+static void applyFrameGainsSse2(short *frames, const double *gains, int count) {
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m128d g01 = _mm_loadu_pd(gains + i);
+		__m128d g23 = _mm_loadu_pd(gains + i + 2);
+
+		scale8Sse2(frames + 2 * i, _mm_unpacklo_pd(g01, g01), _mm_unpackhi_pd(g01, g01),
+			_mm_unpacklo_pd(g23, g23), _mm_unpackhi_pd(g23, g23));
+	}
+
+	applyFrameGainsScalar(frames + 2 * i, gains + i, count - i);
+}
+
+/**
+ * The SSE2 reversing copy kernel.  A frame is one 32-bit lane, so reversing
+ * the lanes reverses four frames, and rotating each lane by 16 bits swaps
+ * its samples.
+ *
+ * @param out Where to store the frames.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ * @param swap 1 to swap the two samples of each frame as well.
+ */
+__attribute__((target("sse2")))
+static void reverseFramesSse2(short *out, const short *in, int count, int swap) {
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (in + 2 * (count - i - 4)));
+		v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+		if (swap)
+			v = _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+
+		_mm_storeu_si128((__m128i *) (out + 2 * i), v);
+	}
+
+	// What is left are the first frames of the input.
+	reverseFramesScalar(out + 2 * i, in, count - i, swap);
+}
+
+/**
+ * The SSE2 channel swapping copy kernel, rotating each 32-bit frame by 16
+ * bits as the reversing copy does.
+ *
+ * @param out Where to store the frames, which may be "in" itself.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ */
+__attribute__((target("sse2")))
+static void swapFramesSse2(short *out, const short *in, int count) {
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (in + 2 * i));
+		v = _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+		_mm_storeu_si128((__m128i *) (out + 2 * i), v);
+	}
+
+	swapFramesScalar(out + 2 * i, in + 2 * i, count - i);
+}
+
+/**
+ * The SSE2 filter kernel, four frames at a time.  SSE2 has no 64-bit integer
+ * multiply, so the samples and taps are converted to doubles, each frame to
+ * a left and right pair multiplied by its tap twice over.  Every product and
+ * partial sum is an integer below 2^53, so the sums are exact and the order
+ * they are added in does not matter.
+ *
+ * @param frames The interleaved frames under the filter.
+ * @param taps The filter's fixed-point taps, one per frame.
+ * @param count The number of taps.
+ * @param sums Where to store the left and right sums.
+ */
+__attribute__((target("sse2")))
+static void convolveFramesSse2(const short *frames, const int32_t *taps, int count,
+		long long *sums) {
+	__m128d acc[4] = { _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd() };
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (frames + 2 * i));
+		__m128i t = _mm_loadu_si128((const __m128i *) (taps + i));
+		__m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		__m128i lowTaps = _mm_unpacklo_epi32(t, t);
+		__m128i highTaps = _mm_unpackhi_epi32(t, t);
+
+		acc[0] = _mm_add_pd(acc[0], _mm_mul_pd(_mm_cvtepi32_pd(low), _mm_cvtepi32_pd(lowTaps)));
+		acc[1] = _mm_add_pd(acc[1], _mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(low, low)),
+			_mm_cvtepi32_pd(_mm_unpackhi_epi64(lowTaps, lowTaps))));
+		acc[2] = _mm_add_pd(acc[2], _mm_mul_pd(_mm_cvtepi32_pd(high), _mm_cvtepi32_pd(highTaps)));
+		acc[3] = _mm_add_pd(acc[3], _mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(high, high)),
+			_mm_cvtepi32_pd(_mm_unpackhi_epi64(highTaps, highTaps))));
+	}
+
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(_mm_add_pd(acc[0], acc[1]), _mm_add_pd(acc[2], acc[3])));
+
+	convolveFramesScalar(frames + 2 * i, taps + i, count - i, sums);
+	sums[0] += (long long) lanes[0];
+	sums[1] += (long long) lanes[1];
+}
+
+/**
+ * Folds the per-lane extremes of a vector level kernel in to the peaks of
+ * the two channels, which take the even and the odd lanes.
+ *
+ * @param highs The largest sample of each lane.
+ * @param lows The smallest sample of each lane.
+ * @param lanes The number of lanes.
+ * @param peaks The largest magnitude of each channel so far, updated.
+ */
+static void foldPeaks(const short *highs, const short *lows, int lanes, int *peaks) {
+	for (int k = 0; k < lanes; k++) {
+		int peak = highs[k] > -lows[k] ? highs[k] : -lows[k];
+		if (peak > peaks[k & 1])
+			peaks[k & 1] = peak;
+	}
+}
+
+/**
+ * The SSE2 level kernel.  The extremes are tracked per lane with pmaxsw and
+ * pminsw, and each square is built from the low and high halves of its
+ * product.  A square is at most 2^30, so it widens to 64 bits with zeros,
+ * and the order of the unpacks leaves the left channel in the low lane of
+ * the accumulator and the right in the high one.
+ *
+ * @param frames The interleaved frames to measure.
+ * @param count The number of frames.
+ * @param peaks The largest magnitude of each channel so far, updated.
+ * @param squares The sum of the squares of each channel so far, updated.
+ */
+__attribute__((target("sse2")))
+static void measureFramesSse2(const short *frames, int count, int *peaks, long long *squares) {
+	__m128i high = _mm_set1_epi16(SHRT_MIN);
+	__m128i low = _mm_set1_epi16(SHRT_MAX);
+	__m128i sums = _mm_setzero_si128();
+	__m128i zero = _mm_setzero_si128();
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (frames + 2 * i));
+		high = _mm_max_epi16(high, v);
+		low = _mm_min_epi16(low, v);
+
+		__m128i lo = _mm_mullo_epi16(v, v);
+		__m128i hi = _mm_mulhi_epi16(v, v);
+		__m128i p0 = _mm_unpacklo_epi16(lo, hi);
+		__m128i p1 = _mm_unpackhi_epi16(lo, hi);
+		sums = _mm_add_epi64(sums, _mm_add_epi64(_mm_unpacklo_epi32(p0, zero),
+			_mm_unpackhi_epi32(p0, zero)));
+		sums = _mm_add_epi64(sums, _mm_add_epi64(_mm_unpacklo_epi32(p1, zero),
+			_mm_unpackhi_epi32(p1, zero)));
+	}
+
+	short highs[8];
+	short lows[8];
+	long long lanes[2];
+	_mm_storeu_si128((__m128i *) highs, high);
+	_mm_storeu_si128((__m128i *) lows, low);
+	_mm_storeu_si128((__m128i *) lanes, sums);
+
+	measureFramesScalar(frames + 2 * i, count - i, peaks, squares);
+	foldPeaks(highs, lows, 8, peaks);
+	squares[0] += lanes[0];
+	squares[1] += lanes[1];
+}
+
+/**
+ * The SSE2 spectrum kernel, two bins at a time.
+ *
+ * @param re The real parts of the sums, updated.
+ * @param im The imaginary parts of the sums, updated.
+ * @param xRe The real parts of one spectrum.
+ * @param xIm The imaginary parts of one spectrum.
+ * @param hRe The real parts of the other spectrum.
+ * @param hIm The imaginary parts of the other spectrum.
+ * @param count The number of bins.
+ */
+__attribute__((target("sse2")))
+static void multiplySpectraSse2(double *re, double *im, const double *xRe, const double *xIm,
+		const double *hRe, const double *hIm, int count) {
+	int k = 0;
+	for (; k + 2 <= count; k += 2) {
+		__m128d a = _mm_loadu_pd(xRe + k), b = _mm_loadu_pd(xIm + k);
+		__m128d c = _mm_loadu_pd(hRe + k), d = _mm_loadu_pd(hIm + k);
+		__m128d r = _mm_sub_pd(_mm_mul_pd(a, c), _mm_mul_pd(b, d));
+		__m128d i = _mm_add_pd(_mm_mul_pd(a, d), _mm_mul_pd(b, c));
+		_mm_storeu_pd(re + k, _mm_add_pd(_mm_loadu_pd(re + k), r));
+		_mm_storeu_pd(im + k, _mm_add_pd(_mm_loadu_pd(im + k), i));
+	}
+
+	multiplySpectraScalar(re + k, im + k, xRe + k, xIm + k, hRe + k, hIm + k, count - k);
+}
+
+/**
+ * The SSE2 butterfly kernel, two butterflies at a time.  The first stage,
+ * of single butterflies, goes to the scalar kernel.
+ *
+ * @param re The real parts of the points, updated.
+ * @param im The imaginary parts of the points, updated.
+ * @param wRe The real parts of the stage's twiddles, one per butterfly of a
+ *        group.
+ * @param wIm The imaginary parts of the stage's twiddles.
+ * @param half The span of each butterfly, half the size of a group.
+ * @param size The number of points.
+ */
+__attribute__((target("sse2")))
+static void butterflyStageSse2(double *re, double *im, const double *wRe, const double *wIm,
+		int half, int size) {
+	if (half < 2) {
+		butterflyStageScalar(re, im, wRe, wIm, half, size);
+		return;
+	}
+
+	for (int start = 0; start < size; start += 2 * half) {
+		double *aRe = re + start, *aIm = im + start;
+		double *bRe = aRe + half, *bIm = aIm + half;
+
+		for (int k = 0; k < half; k += 2) {
+			__m128d xr = _mm_loadu_pd(bRe + k), xi = _mm_loadu_pd(bIm + k);
+			__m128d wr = _mm_loadu_pd(wRe + k), wi = _mm_loadu_pd(wIm + k);
+			__m128d tr = _mm_sub_pd(_mm_mul_pd(xr, wr), _mm_mul_pd(xi, wi));
+			__m128d ti = _mm_add_pd(_mm_mul_pd(xr, wi), _mm_mul_pd(xi, wr));
+			__m128d ar = _mm_loadu_pd(aRe + k), ai = _mm_loadu_pd(aIm + k);
+			_mm_storeu_pd(bRe + k, _mm_sub_pd(ar, tr));
+			_mm_storeu_pd(bIm + k, _mm_sub_pd(ai, ti));
+			_mm_storeu_pd(aRe + k, _mm_add_pd(ar, tr));
+			_mm_storeu_pd(aIm + k, _mm_add_pd(ai, ti));
+		}
+	}
+}
+
+/**
+ * The SSE2 mixing kernel, eight samples at a time, each widened by
+ * interleaving it with itself and shifting its sign back down.
+ *
+ * @param sums The running sums, updated.
+ * @param samples The samples to add.
+ * @param count The number of samples.
+ */
+__attribute__((target("sse2")))
+static void mixSamplesSse2(int *sums, const short *samples, int count) {
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (samples + i));
+		__m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		__m128i *out = (__m128i *) (sums + i);
+
+		_mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), low));
+		_mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), high));
+	}
+
+	mixSamplesScalar(sums + i, samples + i, count - i);
+}
+
+/**
+ * The SSE2 clamping kernel, eight samples at a time.  packssdw saturates to
+ * the same bounds the scalar kernel clamps to.
+ *
+ * @param samples Where to store the clamped samples.
+ * @param sums The sums.
+ * @param count The number of samples.
+ */
+__attribute__((target("sse2")))
+static void clampSumsSse2(short *samples, const int *sums, int count) {
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i low = _mm_loadu_si128((const __m128i *) (sums + i));
+		__m128i high = _mm_loadu_si128((const __m128i *) (sums + i + 4));
+		_mm_storeu_si128((__m128i *) (samples + i), _mm_packs_epi32(low, high));
+	}
+
+	clampSumsScalar(samples + i, sums + i, count - i);
+}
+
+/**
+ * The AVX2 volume kernel.
+ *
+ * @param samples The samples to scale in place.
+ * @param count The number of samples.
+ * @param scale How much to scale the samples.
+ */
+__attribute__((target("avx2")))
+static void scaleSamplesAvx2(short *samples, int count, double scale) {
+	__m256d factor = _mm256_set1_pd(scale);
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+		scale16Avx2(samples + i, factor, factor, factor, factor);
+
+	scaleSamplesScalar(samples + i, count - i, scale);
+}
+
+/**
+ * The AVX2 envelope kernel.
+ *
+ * @param samples The samples to scale in place.
+ * @param gains The gain of each sample.
+ * @param count The number of samples.
+ */
+__attribute__((target("avx2")))
+static void applyGainsAvx2(short *samples, const double *gains, int count) {
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		scale16Avx2(samples + i, _mm256_loadu_pd(gains + i), _mm256_loadu_pd(gains + i + 4),
+			_mm256_loadu_pd(gains + i + 8), _mm256_loadu_pd(gains + i + 12));
+	}
+
+	applyGainsScalar(samples + i, gains + i, count - i);
+}
+
+/**
+ * The AVX2 interleaved envelope kernel.
+ *
+ * @param frames The interleaved frames to scale in place.
+ * @param gains The gain of each frame.
+ * @param count The number of frames.
+ */
+__attribute__((target("avx2")))
+static void applyFrameGainsAvx2(short *frames, const double *gains, int count) {
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256d g0 = _mm256_loadu_pd(gains + i);
+		__m256d g1 = _mm256_loadu_pd(gains + i + 4);
+
+		// Each gain covers both samples of its frame.
+		scale16Avx2(frames + 2 * i,
+			_mm256_permute4x64_pd(g0, _MM_SHUFFLE(1, 1, 0, 0)),
+			_mm256_permute4x64_pd(g0, _MM_SHUFFLE(3, 3, 2, 2)),
+			_mm256_permute4x64_pd(g1, _MM_SHUFFLE(1, 1, 0, 0)),
+			_mm256_permute4x64_pd(g1, _MM_SHUFFLE(3, 3, 2, 2)));
+	}
+
+	applyFrameGainsScalar(frames + 2 * i, gains + i, count - i);
+}
+
+/**
+ * The AVX2 reversing copy kernel, eight frames at a time.
+ *
+ * @param out Where to store the frames.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ * @param swap 1 to swap the two samples of each frame as well.
+ */
+__attribute__((target("avx2")))
+static void reverseFramesAvx2(short *out, const short *in, int count, int swap) {
+	__m256i order = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (in + 2 * (count - i - 8)));
+		v = _mm256_permutevar8x32_epi32(v, order);
+		if (swap)
+			v = _mm256_or_si256(_mm256_slli_epi32(v, 16), _mm256_srli_epi32(v, 16));
+
+		_mm256_storeu_si256((__m256i *) (out + 2 * i), v);
+	}
+
+	reverseFramesScalar(out + 2 * i, in, count - i, swap);
+}
+
+/**
+ * The AVX2 channel swapping copy kernel, eight frames at a time.
+ *
+ * @param out Where to store the frames, which may be "in" itself.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ */
+__attribute__((target("avx2")))
+static void swapFramesAvx2(short *out, const short *in, int count) {
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (in + 2 * i));
+		v = _mm256_or_si256(_mm256_slli_epi32(v, 16), _mm256_srli_epi32(v, 16));
+		_mm256_storeu_si256((__m256i *) (out + 2 * i), v);
+	}
+
+	swapFramesScalar(out + 2 * i, in + 2 * i, count - i);
+}
+
+/**
+ * The AVX2 filter kernel, eight frames at a time.  The samples are widened
+ * to 32 bits, and vpmuldq multiplies the left ones, then the right ones
+ * shifted down in to their place, by the taps widened to 64 bits, giving
+ * exact 64-bit products.
+ *
+ * @param frames The interleaved frames under the filter.
+ * @param taps The filter's fixed-point taps, one per frame.
+ * @param count The number of taps.
+ * @param sums Where to store the left and right sums.
+ */
+__attribute__((target("avx2")))
+static void convolveFramesAvx2(const short *frames, const int32_t *taps, int count,
+		long long *sums) {
+	__m256i left = _mm256_setzero_si256();
+	__m256i right = _mm256_setzero_si256();
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		for (int half = 0; half < 2; half++) {
+			int j = i + 4 * half;
+			__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (frames + 2 * j)));
+			__m256i t = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *) (taps + j)));
+
+			left = _mm256_add_epi64(left, _mm256_mul_epi32(v, t));
+			right = _mm256_add_epi64(right, _mm256_mul_epi32(_mm256_srli_epi64(v, 32), t));
+		}
+	}
+
+	long long lanes[8];
+	_mm256_storeu_si256((__m256i *) lanes, left);
+	_mm256_storeu_si256((__m256i *) (lanes + 4), right);
+
+	convolveFramesScalar(frames + 2 * i, taps + i, count - i, sums);
+	sums[0] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	sums[1] += lanes[4] + lanes[5] + lanes[6] + lanes[7];
+}
+
+/**
+ * The AVX2 level kernel, eight frames at a time.  The unpacks work within
+ * each 128-bit lane as in the SSE2 version, so the even 64-bit lanes of the
+ * accumulator hold the left channel and the odd ones the right.
+ *
+ * @param frames The interleaved frames to measure.
+ * @param count The number of frames.
+ * @param peaks The largest magnitude of each channel so far, updated.
+ * @param squares The sum of the squares of each channel so far, updated.
+ */
+__attribute__((target("avx2")))
+static void measureFramesAvx2(const short *frames, int count, int *peaks, long long *squares) {
+	__m256i high = _mm256_set1_epi16(SHRT_MIN);
+	__m256i low = _mm256_set1_epi16(SHRT_MAX);
+	__m256i sums = _mm256_setzero_si256();
+	__m256i zero = _mm256_setzero_si256();
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (frames + 2 * i));
+		high = _mm256_max_epi16(high, v);
+		low = _mm256_min_epi16(low, v);
+
+		__m256i lo = _mm256_mullo_epi16(v, v);
+		__m256i hi = _mm256_mulhi_epi16(v, v);
+		__m256i p0 = _mm256_unpacklo_epi16(lo, hi);
+		__m256i p1 = _mm256_unpackhi_epi16(lo, hi);
+		sums = _mm256_add_epi64(sums, _mm256_add_epi64(_mm256_unpacklo_epi32(p0, zero),
+			_mm256_unpackhi_epi32(p0, zero)));
+		sums = _mm256_add_epi64(sums, _mm256_add_epi64(_mm256_unpacklo_epi32(p1, zero),
+			_mm256_unpackhi_epi32(p1, zero)));
+	}
+
+	short highs[16];
+	short lows[16];
+	long long lanes[4];
+	_mm256_storeu_si256((__m256i *) highs, high);
+	_mm256_storeu_si256((__m256i *) lows, low);
+	_mm256_storeu_si256((__m256i *) lanes, sums);
+
+	measureFramesScalar(frames + 2 * i, count - i, peaks, squares);
+	foldPeaks(highs, lows, 16, peaks);
+	squares[0] += lanes[0] + lanes[2];
+	squares[1] += lanes[1] + lanes[3];
+}
+
+/**
+ * The AVX2 spectrum kernel, four bins at a time.  Only the AVX instructions
+ * are used, and none of the FMA ones, so it matches the scalar kernel.
+ *
+ * @param re The real parts of the sums, updated.
+ * @param im The imaginary parts of the sums, updated.
+ * @param xRe The real parts of one spectrum.
+ * @param xIm The imaginary parts of one spectrum.
+ * @param hRe The real parts of the other spectrum.
+ * @param hIm The imaginary parts of the other spectrum.
+ * @param count The number of bins.
+ */
+__attribute__((target("avx2")))
+static void multiplySpectraAvx2(double *re, double *im, const double *xRe, const double *xIm,
+		const double *hRe, const double *hIm, int count) {
+	int k = 0;
+	for (; k + 4 <= count; k += 4) {
+		__m256d a = _mm256_loadu_pd(xRe + k), b = _mm256_loadu_pd(xIm + k);
+		__m256d c = _mm256_loadu_pd(hRe + k), d = _mm256_loadu_pd(hIm + k);
+		__m256d r = _mm256_sub_pd(_mm256_mul_pd(a, c), _mm256_mul_pd(b, d));
+		__m256d i = _mm256_add_pd(_mm256_mul_pd(a, d), _mm256_mul_pd(b, c));
+		_mm256_storeu_pd(re + k, _mm256_add_pd(_mm256_loadu_pd(re + k), r));
+		_mm256_storeu_pd(im + k, _mm256_add_pd(_mm256_loadu_pd(im + k), i));
+	}
+
+	multiplySpectraScalar(re + k, im + k, xRe + k, xIm + k, hRe + k, hIm + k, count - k);
+}
+
+/**
+ * The AVX2 butterfly kernel, four butterflies at a time, without FMA.  The
+ * first two stages go to the scalar kernel.
+ *
+ * @param re The real parts of the points, updated.
+ * @param im The imaginary parts of the points, updated.
+ * @param wRe The real parts of the stage's twiddles, one per butterfly of a
+ *        group.
+ * @param wIm The imaginary parts of the stage's twiddles.
+ * @param half The span of each butterfly, half the size of a group.
+ * @param size The number of points.
+ */
+__attribute__((target("avx2")))
+static void butterflyStageAvx2(double *re, double *im, const double *wRe, const double *wIm,
+		int half, int size) {
+	if (half < 4) {
+		butterflyStageScalar(re, im, wRe, wIm, half, size);
+		return;
+	}
+
+	for (int start = 0; start < size; start += 2 * half) {
+		double *aRe = re + start, *aIm = im + start;
+		double *bRe = aRe + half, *bIm = aIm + half;
+
+		for (int k = 0; k < half; k += 4) {
+			__m256d xr = _mm256_loadu_pd(bRe + k), xi = _mm256_loadu_pd(bIm + k);
+			__m256d wr = _mm256_loadu_pd(wRe + k), wi = _mm256_loadu_pd(wIm + k);
+			__m256d tr = _mm256_sub_pd(_mm256_mul_pd(xr, wr), _mm256_mul_pd(xi, wi));
+			__m256d ti = _mm256_add_pd(_mm256_mul_pd(xr, wi), _mm256_mul_pd(xi, wr));
+			__m256d ar = _mm256_loadu_pd(aRe + k), ai = _mm256_loadu_pd(aIm + k);
+			_mm256_storeu_pd(bRe + k, _mm256_sub_pd(ar, tr));
+			_mm256_storeu_pd(bIm + k, _mm256_sub_pd(ai, ti));
+			_mm256_storeu_pd(aRe + k, _mm256_add_pd(ar, tr));
+			_mm256_storeu_pd(aIm + k, _mm256_add_pd(ai, ti));
+		}
+	}
+}
+
+/**
+ * The AVX2 mixing kernel, sixteen samples at a time.
+ *
+ * @param sums The running sums, updated.
+ * @param samples The samples to add.
+ * @param count The number of samples.
+ */
+__attribute__((target("avx2")))
+static void mixSamplesAvx2(int *sums, const short *samples, int count) {
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i low = _mm_loadu_si128((const __m128i *) (samples + i));
+		__m128i high = _mm_loadu_si128((const __m128i *) (samples + i + 8));
+		__m256i *out = (__m256i *) (sums + i);
+
+		_mm256_storeu_si256(out, _mm256_add_epi32(_mm256_loadu_si256(out),
+			_mm256_cvtepi16_epi32(low)));
+		_mm256_storeu_si256(out + 1, _mm256_add_epi32(_mm256_loadu_si256(out + 1),
+			_mm256_cvtepi16_epi32(high)));
+	}
+
+	mixSamplesScalar(sums + i, samples + i, count - i);
+}
+
+/**
+ * The AVX2 clamping kernel, sixteen samples at a time.  vpackssdw packs
+ * within each 128-bit lane, so the middle quarters are swapped back after.
+ *
+ * @param samples Where to store the clamped samples.
+ * @param sums The sums.
+ * @param count The number of samples.
+ */
+__attribute__((target("avx2")))
+static void clampSumsAvx2(short *samples, const int *sums, int count) {
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256i low = _mm256_loadu_si256((const __m256i *) (sums + i));
+		__m256i high = _mm256_loadu_si256((const __m256i *) (sums + i + 8));
+		__m256i packed = _mm256_packs_epi32(low, high);
+		_mm256_storeu_si256((__m256i *) (samples + i),
+			_mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	clampSumsScalar(samples + i, sums + i, count - i);
+}
+
+/*
+ * The AVX-512 kernels take twice the AVX2 width.  vpmovsdw narrows with
+ * signed saturation and keeps the samples in order, so unlike vpackssdw it
+ * needs no shuffle after.  The filter, level and checksum kernels are the
+ * AVX2 set's.
+ */
+
+/**
+ * Scales 16 samples by 16 gains, eight per vector, in place.
+ *
+ * @param samples The samples to scale.
+ * @param f0 The gains of samples 0-7.
+ * @param f1 The gains of samples 8-15.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static inline void scale16Avx512(short *samples, __m512d f0, __m512d f1) {
+	__m512i in = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *) samples));
+
+	__m256i a = _mm512_cvttpd_epi32(_mm512_mul_pd(
+		_mm512_cvtepi32_pd(_mm512_castsi512_si256(in)), f0));
+	__m256i b = _mm512_cvttpd_epi32(_mm512_mul_pd(
+		_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(in, 1)), f1));
+
+	__m512i out = _mm512_inserti64x4(_mm512_castsi256_si512(a), b, 1);
+	_mm256_storeu_si256((__m256i *) samples, _mm512_cvtsepi32_epi16(out));
+}
+
+/**
+ * The AVX-512 volume kernel.
+ *
+ * @param samples The samples to scale in place.
+ * @param count The number of samples.
+ * @param scale How much to scale the samples.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void scaleSamplesAvx512(short *samples, int count, double scale) {
+	__m512d factor = _mm512_set1_pd(scale);
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+		scale16Avx512(samples + i, factor, factor);
+
+	scaleSamplesScalar(samples + i, count - i, scale);
+}
+
+/**
+ * The AVX-512 envelope kernel.
+ *
+ * @param samples The samples to scale in place.
+ * @param gains The gain of each sample.
+ * @param count The number of samples.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void applyGainsAvx512(short *samples, const double *gains, int count) {
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+		scale16Avx512(samples + i, _mm512_loadu_pd(gains + i), _mm512_loadu_pd(gains + i + 8));
+
+	applyGainsScalar(samples + i, gains + i, count - i);
+}
+
+/**
+ * The AVX-512 interleaved envelope kernel.
+ *
+ * @param frames The interleaved frames to scale in place.
+ * @param gains The gain of each frame.
+ * @param count The number of frames.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void applyFrameGainsAvx512(short *frames, const double *gains, int count) {
+	__m512i first = _mm512_set_epi64(3, 3, 2, 2, 1, 1, 0, 0);
+	__m512i second = _mm512_set_epi64(7, 7, 6, 6, 5, 5, 4, 4);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m512d g = _mm512_loadu_pd(gains + i);
+
+		// Each gain covers both samples of its frame.
+		scale16Avx512(frames + 2 * i, _mm512_permutexvar_pd(first, g),
+			_mm512_permutexvar_pd(second, g));
+	}
+
+	applyFrameGainsScalar(frames + 2 * i, gains + i, count - i);
+}
+
+/**
+ * The AVX-512 reversing copy kernel, sixteen frames at a time.
+ *
+ * @param out Where to store the frames.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ * @param swap 1 to swap the two samples of each frame as well.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void reverseFramesAvx512(short *out, const short *in, int count, int swap) {
+	__m512i order = _mm512_set_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m512i v = _mm512_loadu_si512((const void *) (in + 2 * (count - i - 16)));
+		v = _mm512_permutexvar_epi32(order, v);
+		if (swap)
+			v = _mm512_rol_epi32(v, 16);
+
+		_mm512_storeu_si512((void *) (out + 2 * i), v);
+	}
+
+	reverseFramesScalar(out + 2 * i, in, count - i, swap);
+}
+
+/**
+ * The AVX-512 channel swapping copy kernel, sixteen frames at a time.
+ *
+ * @param out Where to store the frames, which may be "in" itself.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void swapFramesAvx512(short *out, const short *in, int count) {
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m512i v = _mm512_loadu_si512((const void *) (in + 2 * i));
+		_mm512_storeu_si512((void *) (out + 2 * i), _mm512_rol_epi32(v, 16));
+	}
+
+	swapFramesScalar(out + 2 * i, in + 2 * i, count - i);
+}
+
+/**
+ * The AVX-512 spectrum kernel, eight bins at a time, without FMA.
+ *
+ * @param re The real parts of the sums, updated.
+ * @param im The imaginary parts of the sums, updated.
+ * @param xRe The real parts of one spectrum.
+ * @param xIm The imaginary parts of one spectrum.
+ * @param hRe The real parts of the other spectrum.
+ * @param hIm The imaginary parts of the other spectrum.
+ * @param count The number of bins.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void multiplySpectraAvx512(double *re, double *im, const double *xRe, const double *xIm,
+		const double *hRe, const double *hIm, int count) {
+	int k = 0;
+	for (; k + 8 <= count; k += 8) {
+		__m512d a = _mm512_loadu_pd(xRe + k), b = _mm512_loadu_pd(xIm + k);
+		__m512d c = _mm512_loadu_pd(hRe + k), d = _mm512_loadu_pd(hIm + k);
+		__m512d r = _mm512_sub_pd(_mm512_mul_pd(a, c), _mm512_mul_pd(b, d));
+		__m512d i = _mm512_add_pd(_mm512_mul_pd(a, d), _mm512_mul_pd(b, c));
+		_mm512_storeu_pd(re + k, _mm512_add_pd(_mm512_loadu_pd(re + k), r));
+		_mm512_storeu_pd(im + k, _mm512_add_pd(_mm512_loadu_pd(im + k), i));
+	}
+
+	multiplySpectraScalar(re + k, im + k, xRe + k, xIm + k, hRe + k, hIm + k, count - k);
+}
+
+/**
+ * The AVX-512 butterfly kernel, eight butterflies at a time, without FMA.
+ * The first three stages go to the AVX2 kernel.
+ *
+ * @param re The real parts of the points, updated.
+ * @param im The imaginary parts of the points, updated.
+ * @param wRe The real parts of the stage's twiddles, one per butterfly of a
+ *        group.
+ * @param wIm The imaginary parts of the stage's twiddles.
+ * @param half The span of each butterfly, half the size of a group.
+ * @param size The number of points.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void butterflyStageAvx512(double *re, double *im, const double *wRe, const double *wIm,
+		int half, int size) {
+	if (half < 8) {
+		butterflyStageAvx2(re, im, wRe, wIm, half, size);
+		return;
+	}
+
+	for (int start = 0; start < size; start += 2 * half) {
+		double *aRe = re + start, *aIm = im + start;
+		double *bRe = aRe + half, *bIm = aIm + half;
+
+		for (int k = 0; k < half; k += 8) {
+			__m512d xr = _mm512_loadu_pd(bRe + k), xi = _mm512_loadu_pd(bIm + k);
+			__m512d wr = _mm512_loadu_pd(wRe + k), wi = _mm512_loadu_pd(wIm + k);
+			__m512d tr = _mm512_sub_pd(_mm512_mul_pd(xr, wr), _mm512_mul_pd(xi, wi));
+			__m512d ti = _mm512_add_pd(_mm512_mul_pd(xr, wi), _mm512_mul_pd(xi, wr));
+			__m512d ar = _mm512_loadu_pd(aRe + k), ai = _mm512_loadu_pd(aIm + k);
+			_mm512_storeu_pd(bRe + k, _mm512_sub_pd(ar, tr));
+			_mm512_storeu_pd(bIm + k, _mm512_sub_pd(ai, ti));
+			_mm512_storeu_pd(aRe + k, _mm512_add_pd(ar, tr));
+			_mm512_storeu_pd(aIm + k, _mm512_add_pd(ai, ti));
+		}
+	}
+}
+
+/**
+ * The AVX-512 mixing kernel, thirty-two samples at a time.
+ *
+ * @param sums The running sums, updated.
+ * @param samples The samples to add.
+ * @param count The number of samples.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void mixSamplesAvx512(int *sums, const short *samples, int count) {
+	int i = 0;
+
+	for (; i + 32 <= count; i += 32) {
+		__m256i low = _mm256_loadu_si256((const __m256i *) (samples + i));
+		__m256i high = _mm256_loadu_si256((const __m256i *) (samples + i + 16));
+		int *out = sums + i;
+
+		_mm512_storeu_si512((void *) out, _mm512_add_epi32(_mm512_loadu_si512((const void *) out),
+			_mm512_cvtepi16_epi32(low)));
+		_mm512_storeu_si512((void *) (out + 16), _mm512_add_epi32(
+			_mm512_loadu_si512((const void *) (out + 16)), _mm512_cvtepi16_epi32(high)));
+	}
+
+	mixSamplesScalar(sums + i, samples + i, count - i);
+}
+
+/**
+ * The AVX-512 clamping kernel, sixteen samples at a time.
+ *
+ * @param samples Where to store the clamped samples.
+ * @param sums The sums.
+ * @param count The number of samples.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void clampSumsAvx512(short *samples, const int *sums, int count) {
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m512i v = _mm512_loadu_si512((const void *) (sums + i));
+		_mm256_storeu_si256((__m256i *) (samples + i), _mm512_cvtsepi32_epi16(v));
+	}
+
+	clampSumsScalar(samples + i, sums + i, count - i);
+}
+
+/**
+ * The checksum kernel on the SSE4.2 CRC-32C instruction, eight bytes at a
+ * time.  Every AVX2 host has it, so it goes with the AVX2 kernels.
+ *
+ * @param crc 0 to start, or the checksum of the bytes before these.
+ * @param bytes The bytes.
+ * @param size The number of bytes.
+ * @return The checksum of everything so far.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t checksumBytesSse42(uint32_t crc, const void *bytes, size_t size) {
+	const unsigned char *p = bytes;
+	uint32_t c = ~crc;
+
+#if defined(__x86_64__)
+	uint64_t wide = c;
+	for (; size >= 8; p += 8, size -= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		wide = _mm_crc32_u64(wide, word);
+	}
+	c = (uint32_t) wide;
+#endif
+	for (; size >= 4; p += 4, size -= 4) {
+		uint32_t word;
+		memcpy(&word, p, 4);
+		c = _mm_crc32_u32(c, word);
+	}
+	for (; size > 0; p++, size--)
+		c = _mm_crc32_u8(c, *p);
+
+	return ~c;
+}
+
+#endif
+
+#ifdef KERNELS_NEON
+
+/*
+ * On AArch64 the scalar double-to-int conversion saturates, and so do the
+ * vector conversion and the narrowing moves, so the NEON kernel matches
+ * scaleSample there.
+ */
+
+/**
+ * Scales two sign-extended samples in double precision.
+ *
+ * @param samples The two samples.
+ * @param factor The gains of the two samples.
+ * @return The two truncated products, saturated to 32 bits.
+ */
+static inline int32x2_t scalePairNeon(int32x2_t samples, float64x2_t factor) {
+	float64x2_t product = vmulq_f64(vcvtq_f64_s64(vmovl_s32(samples)), factor);
+	return vqmovn_s64(vcvtq_s64_f64(product));
+}
+
+/**
+ * Scales 8 samples by 8 gains, two per vector, in place.
+ *
+ * @param samples The samples to scale.
+ * @param f0 The gains of samples 0 and 1.
+ * @param f1 The gains of samples 2 and 3.
+ * @param f2 The gains of samples 4 and 5.
+ * @param f3 The gains of samples 6 and 7.
+ */
+static inline void scale8Neon(short *samples, float64x2_t f0, float64x2_t f1,
+		float64x2_t f2, float64x2_t f3) {
+	int16x8_t in = vld1q_s16(samples);
+	int32x4_t lo = vmovl_s16(vget_low_s16(in));
+	int32x4_t hi = vmovl_s16(vget_high_s16(in));
+
+	int32x4_t a = vcombine_s32(scalePairNeon(vget_low_s32(lo), f0),
+		scalePairNeon(vget_high_s32(lo), f1));
+	int32x4_t b = vcombine_s32(scalePairNeon(vget_low_s32(hi), f2),
+		scalePairNeon(vget_high_s32(hi), f3));
+
+	vst1q_s16(samples, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+}
+
+/**
+ * The NEON volume kernel.
+ *
+ * @param samples The samples to scale in place.
+ * @param count The number of samples.
+ * @param scale How much to scale the samples.
+ */
+static void scaleSamplesNeon(short *samples, int count, double scale) {
+	float64x2_t factor = vdupq_n_f64(scale);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+		scale8Neon(samples + i, factor, factor, factor, factor);
+
+	scaleSamplesScalar(samples + i, count - i, scale);
+}
+
+/**
+ * The NEON envelope kernel.
+ *
+ * @param samples The samples to scale in place.
+ * @param gains The gain of each sample.
+ * @param count The number of samples.
+ */
+static void applyGainsNeon(short *samples, const double *gains, int count) {
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		scale8Neon(samples + i, vld1q_f64(gains + i), vld1q_f64(gains + i + 2),
+			vld1q_f64(gains + i + 4), vld1q_f64(gains + i + 6));
+	}
+
+	applyGainsScalar(samples + i, gains + i, count - i);
+}
+
+/**
+ * The NEON interleaved envelope kernel.
+ *
+ * @param frames The interleaved frames to scale in place.
+ * @param gains The gain of each frame.
+ * @param count The number of frames.
+ */
+static void applyFrameGainsNeon(short *frames, const double *gains, int count) {
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		scale8Neon(frames + 2 * i, vld1q_dup_f64(gains + i), vld1q_dup_f64(gains + i + 1),
+			vld1q_dup_f64(gains + i + 2), vld1q_dup_f64(gains + i + 3));
+	}
+
+	applyFrameGainsScalar(frames + 2 * i, gains + i, count - i);
+}
+
+/**
+ * The NEON reversing copy kernel, four frames at a time.
+ *
+ * @param out Where to store the frames.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ * @param swap 1 to swap the two samples of each frame as well.
+ */
+static void reverseFramesNeon(short *out, const short *in, int count, int swap) {
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		int16x8_t v = vld1q_s16(in + 2 * (count - i - 4));
+		int32x4_t frames = vrev64q_s32(vreinterpretq_s32_s16(v));
+		frames = vcombine_s32(vget_high_s32(frames), vget_low_s32(frames));
+
+		v = vreinterpretq_s16_s32(frames);
+		if (swap)
+			v = vrev32q_s16(v);
+
+		vst1q_s16(out + 2 * i, v);
+	}
+
+	reverseFramesScalar(out + 2 * i, in, count - i, swap);
+}
+
+/**
+ * The NEON channel swapping copy kernel, four frames at a time.
+ *
+ * @param out Where to store the frames, which may be "in" itself.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ */
+static void swapFramesNeon(short *out, const short *in, int count) {
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+		vst1q_s16(out + 2 * i, vrev32q_s16(vld1q_s16(in + 2 * i)));
+
+	swapFramesScalar(out + 2 * i, in + 2 * i, count - i);
+}
+
+/**
+ * The NEON filter kernel.  vld2 splits the channels, and each is widened,
+ * multiplied by the taps and widened again in to its own 64-bit
+ * accumulators.
+ *
+ * @param frames The interleaved frames under the filter.
+ * @param taps The filter's fixed-point taps, one per frame.
+ * @param count The number of taps.
+ * @param sums Where to store the left and right sums.
+ */
+static void convolveFramesNeon(const short *frames, const int32_t *taps, int count,
+		long long *sums) {
+	int64x2_t left = vdupq_n_s64(0);
+	int64x2_t right = vdupq_n_s64(0);
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		int16x4x2_t v = vld2_s16(frames + 2 * i);
+		int32x4_t t = vld1q_s32(taps + i);
+		int32x4_t l = vmovl_s16(v.val[0]);
+		int32x4_t r = vmovl_s16(v.val[1]);
+
+		left = vmlal_s32(left, vget_low_s32(l), vget_low_s32(t));
+		left = vmlal_s32(left, vget_high_s32(l), vget_high_s32(t));
+		right = vmlal_s32(right, vget_low_s32(r), vget_low_s32(t));
+		right = vmlal_s32(right, vget_high_s32(r), vget_high_s32(t));
+	}
+
+	convolveFramesScalar(frames + 2 * i, taps + i, count - i, sums);
+	sums[0] += vaddvq_s64(left);
+	sums[1] += vaddvq_s64(right);
+}
+
+/**
+ * The NEON level kernel.  vld2 splits the channels, so each has its own
+ * extremes, and the squares are widened twice, to 32 and then 64 bits.
+ *
+ * @param frames The interleaved frames to measure.
+ * @param count The number of frames.
+ * @param peaks The largest magnitude of each channel so far, updated.
+ * @param squares The sum of the squares of each channel so far, updated.
+ */
+static void measureFramesNeon(const short *frames, int count, int *peaks, long long *squares) {
+	int16x4_t high[2] = { vdup_n_s16(SHRT_MIN), vdup_n_s16(SHRT_MIN) };
+	int16x4_t low[2] = { vdup_n_s16(SHRT_MAX), vdup_n_s16(SHRT_MAX) };
+	int64x2_t sums[2] = { vdupq_n_s64(0), vdupq_n_s64(0) };
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		int16x4x2_t v = vld2_s16(frames + 2 * i);
+
+		for (int c = 0; c < 2; c++) {
+			high[c] = vmax_s16(high[c], v.val[c]);
+			low[c] = vmin_s16(low[c], v.val[c]);
+			sums[c] = vpadalq_s32(sums[c], vmull_s16(v.val[c], v.val[c]));
+		}
+	}
+
+	measureFramesScalar(frames + 2 * i, count - i, peaks, squares);
+	for (int c = 0; c < 2; c++) {
+		int peak = vmaxv_s16(high[c]) > -vminv_s16(low[c])
+			? vmaxv_s16(high[c]) : -vminv_s16(low[c]);
+		if (peak > peaks[c])
+			peaks[c] = peak;
+		squares[c] += vaddvq_s64(sums[c]);
+	}
+}
+
+/**
+ * The NEON spectrum kernel, two bins at a time, with separate multiplies and
+ * adds rather than vfmaq_f64, so it matches the scalar kernel.
+ *
+ * @param re The real parts of the sums, updated.
+ * @param im The imaginary parts of the sums, updated.
+ * @param xRe The real parts of one spectrum.
+ * @param xIm The imaginary parts of one spectrum.
+ * @param hRe The real parts of the other spectrum.
+ * @param hIm The imaginary parts of the other spectrum.
+ * @param count The number of bins.
+ */
+static void multiplySpectraNeon(double *re, double *im, const double *xRe, const double *xIm,
+		const double *hRe, const double *hIm, int count) {
+	int k = 0;
+	for (; k + 2 <= count; k += 2) {
+		float64x2_t a = vld1q_f64(xRe + k), b = vld1q_f64(xIm + k);
+		float64x2_t c = vld1q_f64(hRe + k), d = vld1q_f64(hIm + k);
+		float64x2_t r = vsubq_f64(vmulq_f64(a, c), vmulq_f64(b, d));
+		float64x2_t i = vaddq_f64(vmulq_f64(a, d), vmulq_f64(b, c));
+		vst1q_f64(re + k, vaddq_f64(vld1q_f64(re + k), r));
+		vst1q_f64(im + k, vaddq_f64(vld1q_f64(im + k), i));
+	}
+
+	multiplySpectraScalar(re + k, im + k, xRe + k, xIm + k, hRe + k, hIm + k, count - k);
+}
+
+/**
+ * The NEON butterfly kernel, two butterflies at a time, without vfmaq_f64.
+ * The first stage, of single butterflies, goes to the scalar kernel.
+ *
+ * @param re The real parts of the points, updated.
+ * @param im The imaginary parts of the points, updated.
+ * @param wRe The real parts of the stage's twiddles, one per butterfly of a
+ *        group.
+ * @param wIm The imaginary parts of the stage's twiddles.
+ * @param half The span of each butterfly, half the size of a group.
+ * @param size The number of points.
+ */
+static void butterflyStageNeon(double *re, double *im, const double *wRe, const double *wIm,
+		int half, int size) {
+	if (half < 2) {
+		butterflyStageScalar(re, im, wRe, wIm, half, size);
+		return;
+	}
+
+	for (int start = 0; start < size; start += 2 * half) {
+		double *aRe = re + start, *aIm = im + start;
+		double *bRe = aRe + half, *bIm = aIm + half;
+
+		for (int k = 0; k < half; k += 2) {
+			float64x2_t xr = vld1q_f64(bRe + k), xi = vld1q_f64(bIm + k);
+			float64x2_t wr = vld1q_f64(wRe + k), wi = vld1q_f64(wIm + k);
+			float64x2_t tr = vsubq_f64(vmulq_f64(xr, wr), vmulq_f64(xi, wi));
+			float64x2_t ti = vaddq_f64(vmulq_f64(xr, wi), vmulq_f64(xi, wr));
+			float64x2_t ar = vld1q_f64(aRe + k), ai = vld1q_f64(aIm + k);
+			vst1q_f64(bRe + k, vsubq_f64(ar, tr));
+			vst1q_f64(bIm + k, vsubq_f64(ai, ti));
+			vst1q_f64(aRe + k, vaddq_f64(ar, tr));
+			vst1q_f64(aIm + k, vaddq_f64(ai, ti));
+		}
+	}
+}
+
+/**
+ * The NEON mixing kernel, eight samples at a time with widening adds.
+ *
+ * @param sums The running sums, updated.
+ * @param samples The samples to add.
+ * @param count The number of samples.
+ */
+static void mixSamplesNeon(int *sums, const short *samples, int count) {
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t v = vld1q_s16(samples + i);
+		vst1q_s32(sums + i, vaddw_s16(vld1q_s32(sums + i), vget_low_s16(v)));
+		vst1q_s32(sums + i + 4, vaddw_s16(vld1q_s32(sums + i + 4), vget_high_s16(v)));
+	}
+
+	mixSamplesScalar(sums + i, samples + i, count - i);
+}
+
+/**
+ * The NEON clamping kernel, eight samples at a time.  vqmovn saturates to
+ * the same bounds the scalar kernel clamps to.
+ *
+ * @param samples Where to store the clamped samples.
+ * @param sums The sums.
+ * @param count The number of samples.
+ */
+static void clampSumsNeon(short *samples, const int *sums, int count) {
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+		vst1q_s16(samples + i, vcombine_s16(vqmovn_s32(vld1q_s32(sums + i)),
+			vqmovn_s32(vld1q_s32(sums + i + 4))));
+
+	clampSumsScalar(samples + i, sums + i, count - i);
+}
+
+
+/**
+ * The checksum kernel on the ARMv8 CRC-32C instructions, eight bytes at a
+ * time, where the compiler targets them; the scalar one otherwise.
+ *
+ * @param crc 0 to start, or the checksum of the bytes before these.
+ * @param bytes The bytes.
+ * @param size The number of bytes.
+ * @return The checksum of everything so far.
+ */
+static uint32_t checksumBytesArm(uint32_t crc, const void *bytes, size_t size) {
+#if defined(__ARM_FEATURE_CRC32)
+	const unsigned char *p = bytes;
+	uint32_t c = ~crc;
+
+	for (; size >= 8; p += 8, size -= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		c = __crc32cd(c, word);
+	}
+	for (; size > 0; p++, size--)
+		c = __crc32cb(c, *p);
+
+	return ~c;
+#else
+	return checksumBytesScalar(crc, bytes, size);
+#endif
+}
+
+#endif
+
+/**
+ * One set of kernels.  The table is filled in once, the first time a kernel
+ * is needed.
+ */
+typedef struct _Kernels {
+	const char *name;
+	void (*scaleSamples)(short *samples, int count, double scale);
+	void (*applyGains)(short *samples, const double *gains, int count);
+	void (*applyFrameGains)(short *frames, const double *gains, int count);
+	void (*reverseFrames)(short *out, const short *in, int count, int swap);
+	void (*swapFrames)(short *out, const short *in, int count);
+	void (*convolveFrames)(const short *frames, const int32_t *taps, int count, long long *sums);
+	void (*measureFrames)(const short *frames, int count, int *peaks, long long *squares);
+	void (*multiplySpectra)(double *re, double *im, const double *xRe, const double *xIm,
+		const double *hRe, const double *hIm, int count);
+	void (*butterflyStage)(double *re, double *im, const double *wRe, const double *wIm,
+		int half, int size);
+	void (*mixSamples)(int *sums, const short *samples, int count);
+	void (*clampSums)(short *samples, const int *sums, int count);
+	uint32_t (*checksumBytes)(uint32_t crc, const void *bytes, size_t size);
+} Kernels;
+
+static const Kernels scalarKernels = {
+	"scalar", scaleSamplesScalar, applyGainsScalar, applyFrameGainsScalar,
+	reverseFramesScalar, swapFramesScalar, convolveFramesScalar, measureFramesScalar,
+	multiplySpectraScalar, butterflyStageScalar,
+	mixSamplesScalar, clampSumsScalar, checksumBytesScalar
+};
+#ifdef KERNELS_X86
+static const Kernels sse2Kernels = {
+	"sse2", scaleSamplesSse2, applyGainsSse2, applyFrameGainsSse2,
+	reverseFramesSse2, swapFramesSse2, convolveFramesSse2, measureFramesSse2,
+	multiplySpectraSse2, butterflyStageSse2,
+	mixSamplesSse2, clampSumsSse2, checksumBytesScalar
+};
+static const Kernels avx2Kernels = {
+	"avx2", scaleSamplesAvx2, applyGainsAvx2, applyFrameGainsAvx2,
+	reverseFramesAvx2, swapFramesAvx2, convolveFramesAvx2, measureFramesAvx2,
+	multiplySpectraAvx2, butterflyStageAvx2,
+	mixSamplesAvx2, clampSumsAvx2, checksumBytesSse42
+};
+static const Kernels avx512Kernels = {
+	"avx512", scaleSamplesAvx512, applyGainsAvx512, applyFrameGainsAvx512,
+	reverseFramesAvx512, swapFramesAvx512, convolveFramesAvx2, measureFramesAvx2,
+	multiplySpectraAvx512, butterflyStageAvx512,
+	mixSamplesAvx512, clampSumsAvx512, checksumBytesSse42
+};
+#endif
+#ifdef KERNELS_NEON
+static const Kernels neonKernels = {
+	"neon", scaleSamplesNeon, applyGainsNeon, applyFrameGainsNeon,
+	reverseFramesNeon, swapFramesNeon, convolveFramesNeon, measureFramesNeon,
+	multiplySpectraNeon, butterflyStageNeon,
+	mixSamplesNeon, clampSumsNeon, checksumBytesArm
+};
+#endif
+
+static const Kernels *kernels = NULL;
+
+/**
+ * Picks the fastest set of kernels the host supports, unless WAVE_KERNELS
+ * asks for a particular (supported) one.
+ *
+ * @return The selected kernels.
+ */
+static const Kernels *selectKernels(void) {
+	const Kernels *best = &scalarKernels;
+	const Kernels *supported[5];
+	int count = 0;
+
+	supported[count++] = &scalarKernels;
+#ifdef KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		supported[count++] = best = &sse2Kernels;
+	if (__builtin_cpu_supports("avx2"))
+		supported[count++] = best = &avx2Kernels;
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		supported[count++] = best = &avx512Kernels;
+#endif
+#ifdef KERNELS_NEON
+	supported[count++] = best = &neonKernels;
+#endif
+
+	const char *name = getenv("WAVE_KERNELS");
+	for (int i = 0; name != NULL && i < count; i++) {
+		if (strcmp(name, supported[i]->name) == 0)
+			return supported[i];
+	}
+
+	return best;
+}
+
+/**
+ * Selects the kernels now rather than on first use.  Call this before
+ * starting any threads that use the kernels.
+ */
+void initKernels(void) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+}
+
+/**
+ * Names the kernels in use, as WAVE_KERNELS would ask for them.
+ *
+ * @return The name of the selected kernels.
+ */
+const char *kernelsName(void) {
+	initKernels();
+	return kernels->name;
+}
+
+/**
+ * Scales every sample by some double quantity, clamping the results exactly
+ * as scaleSample does.
+ *
+ * @param samples The samples to scale in place.
+ * @param count The number of samples.
+ * @param scale How much to scale the samples.
+ */
+void scaleSamples(short *samples, int count, double scale) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	kernels->scaleSamples(samples, count, scale);
+}
+
+/**
+ * Scales each sample by its own gain, as in an envelope.
+ *
+ * @param samples The samples to scale in place.
+ * @param gains The gain of each sample, at most 1.
+ * @param count The number of samples.
+ */
+void applyGains(short *samples, const double *gains, int count) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	kernels->applyGains(samples, gains, count);
+}
+
+/**
+ * Scales both samples of each interleaved frame by the frame's gain.
+ *
+ * @param frames The interleaved frames to scale in place.
+ * @param gains The gain of each frame, at most 1.
+ * @param count The number of frames.
+ */
+void applyFrameGains(short *frames, const double *gains, int count) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	kernels->applyFrameGains(frames, gains, count);
+}
+
+/**
+ * Copies interleaved frames in reverse order, so the last input frame is the
+ * first output frame.  The two buffers must not overlap.
+ *
+ * @param out Where to store the frames.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ * @param swap 1 to swap the two samples of each frame as well.
+ */
+void reverseFrames(short *out, const short *in, int count, int swap) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	kernels->reverseFrames(out, in, count, swap);
+}
+
+/**
+ * Copies interleaved frames with the two samples of each frame swapped.  The
+ * copy can be made in place.
+ *
+ * @param out Where to store the frames, either "in" itself or a buffer that
+ *            does not overlap it.
+ * @param in The interleaved frames to copy.
+ * @param count The number of frames.
+ */
+void swapFrames(short *out, const short *in, int count) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	kernels->swapFrames(out, in, count);
+}
+
+/**
+ * Multiplies a run of interleaved frames by a filter's fixed-point taps and
+ * adds up the products of each channel.  The sums are exact, so every
+ * version gives the same result as long as no tap passes 2^25 and there
+ * are no more than 1024 of them.
+ *
+ * @param frames The interleaved frames under the filter.
+ * @param taps The filter's taps, one per frame.
+ * @param count The number of taps.
+ * @param sums Where to store the left and right sums.
+ */
+void convolveFrames(const short *frames, const int32_t *taps, int count, long long *sums) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	kernels->convolveFrames(frames, taps, count, sums);
+}
+
+/**
+ * Measures the level of a run of interleaved frames: the largest magnitude
+ * of each channel and the sum of its squares, both exact, so every version
+ * gives the same result.  The results are added to the ones given, so a
+ * long run can be measured in blocks.
+ *
+ * @param frames The interleaved frames to measure.
+ * @param count The number of frames.
+ * @param peaks The largest magnitude of each channel so far, updated.
+ * @param squares The sum of the squares of each channel so far, updated.
+ */
+void measureFrames(const short *frames, int count, int *peaks, long long *squares) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	kernels->measureFrames(frames, count, peaks, squares);
+}
+
+/**
+ * Multiplies two spectra bin by bin and adds the products to a running sum
+ * of spectra, all held as separate real and imaginary parts.  Every version
+ * gives the same sums to the bit.
+ *
+ * @param re The real parts of the sums, updated.
+ * @param im The imaginary parts of the sums, updated.
+ * @param xRe The real parts of one spectrum.
+ * @param xIm The imaginary parts of one spectrum.
+ * @param hRe The real parts of the other spectrum.
+ * @param hIm The imaginary parts of the other spectrum.
+ * @param count The number of bins.
+ */
+void multiplySpectra(double *re, double *im, const double *xRe, const double *xIm,
+		const double *hRe, const double *hIm, int count) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	kernels->multiplySpectra(re, im, xRe, xIm, hRe, hIm, count);
+}
+
+/**
+ * Runs one radix-2 stage of an FFT held as separate real and imaginary
+ * parts: every group of 2 * half points has its second half multiplied by
+ * the stage's twiddles and then added to and taken from its first.  Every
+ * version gives the same points to the bit.
+ *
+ * @param re The real parts of the points, updated.
+ * @param im The imaginary parts of the points, updated.
+ * @param wRe The real parts of the stage's twiddles, one per butterfly of a
+ *        group.
+ * @param wIm The imaginary parts of the stage's twiddles.
+ * @param half The span of each butterfly, half the size of a group.
+ * @param size The number of points.
+ */
+void butterflyStage(double *re, double *im, const double *wRe, const double *wIm, int half,
+		int size) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	kernels->butterflyStage(re, im, wRe, wIm, half, size);
+}
+
+/**
+ * Adds samples to a mix's running sums.
+ *
+ * @param sums The running sums, updated.
+ * @param samples The samples to add.
+ * @param count The number of samples.
+ */
+void mixSamples(int *sums, const short *samples, int count) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	kernels->mixSamples(sums, samples, count);
+}
+
+/**
+ * Stores a mix's sums as samples, saturating them to [SHRT_MIN, SHRT_MAX] as
+ * scaleSample does.  Every version gives the same samples.
+ *
+ * @param samples Where to store the clamped samples.
+ * @param sums The sums.
+ * @param count The number of samples.
+ */
+void clampSums(short *samples, const int *sums, int count) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	kernels->clampSums(samples, sums, count);
+}
+
+/**
+ * Fills in a block of an n-frame fade envelope, frames [first, first + count).
+ * The fade's progress through frame i is x = i / n for a fade in and
+ * x = 1 - i / n for a fade out, and the curve maps it to a gain on [0, 1].
+ * The quadratic curve computes exactly what the original fades did.
+ *
+ * @param gains Where to store the gains.
+ * @param count The number of gains to compute.
+ * @param first The index in the fade of the first gain.
+ * @param n The length of the fade in frames.
+ * @param curve The CURVE_* shape of the fade.
+ * @param fadeOut 1 for a fade out, 0 for a fade in.
+ */
+void fillEnvelope(double *gains, int count, int64_t first, int64_t n, int curve, int fadeOut) {
+	for (int k = 0; k < count; k++) {
+		int64_t i = first + k;
+		gains[k] = fadeOut ? 1.0 - i / (double) n : i / (double) n;
+	}
+
+	switch (curve) {
+	case CURVE_LINEAR:
+		break;
+	case CURVE_EQUAL_POWER:
+		for (int k = 0; k < count; k++)
+			gains[k] = sin(gains[k] * M_PI_2);
+		break;
+	case CURVE_EXPONENTIAL:
+		// A 60dB exponential ramp, pulled down to reach silence at x = 0.
+		for (int k = 0; k < count; k++)
+			gains[k] = (pow(1000.0, gains[k]) - 1.0) / 999.0;
+		break;
+	default:
+		for (int k = 0; k < count; k++)
+			gains[k] = gains[k] * gains[k];
+		break;
+	}
+}
+
+/**
+ * Works out the CRC-32C of a run of bytes, or carries one on over the next
+ * run, so a long run can be checksummed in pieces.  Every version gives the
+ * same checksum.
+ *
+ * @param crc 0 to start, or the checksum of the bytes before these.
+ * @param bytes The bytes.
+ * @param size The number of bytes.
+ * @return The checksum of everything so far.
+ */
+uint32_t checksumBytes(uint32_t crc, const void *bytes, size_t size) {
+	if (kernels == NULL)
+		kernels = selectKernels();
+
+	return kernels->checksumBytes(crc, bytes, size);
+}
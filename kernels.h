@@ -0,0 +1,43 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sample kernels shared by the actions.  Each kernel has a scalar reference
+ * version and, where the host supports them, vector versions that produce
+ * exactly the same samples.  The fastest supported version is picked at run
+ * time; the WAVE_KERNELS environment variable ("scalar", "sse2", "avx2",
+ * "avx512" or "neon") forces a particular one for testing and benchmarking.
+ */
+
+// Fade envelope shapes for fillEnvelope.
+
+#define CURVE_QUADRATIC   0
+#define CURVE_LINEAR      1
+#define CURVE_EQUAL_POWER 2
+#define CURVE_EXPONENTIAL 3
+
+void initKernels(void);
+const char *kernelsName(void);
+
+short scaleSample(short sample, double scale);
+void scaleSamples(short *samples, int count, double scale);
+void applyGains(short *samples, const double *gains, int count);
+void applyFrameGains(short *frames, const double *gains, int count);
+void reverseFrames(short *out, const short *in, int count, int swap);
+void swapFrames(short *out, const short *in, int count);
+void convolveFrames(const short *frames, const int32_t *taps, int count, long long *sums);
+void measureFrames(const short *frames, int count, int *peaks, long long *squares);
+void multiplySpectra(double *re, double *im, const double *xRe, const double *xIm,
+	const double *hRe, const double *hIm, int count);
+void butterflyStage(double *re, double *im, const double *wRe, const double *wIm, int half,
+	int size);
+void mixSamples(int *sums, const short *samples, int count);
+void clampSums(short *samples, const int *sums, int count);
+
+void fillEnvelope(double *gains, int count, int64_t first, int64_t n, int curve, int fadeOut);
+uint32_t checksumBytes(uint32_t crc, const void *bytes, size_t size);
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef LIBWAVE_H
+#define LIBWAVE_H
+
+#include <stddef.h>
+
+/*
+ * The wave processor as a library.  A context holds a chain of actions, the
+ * options it runs with and its own worker pool, and runs the chain over
+ * whole wave files held in memory: the input is read in place and the
+ * output is written straight in to a buffer the caller provides, so neither
+ * needs to be copied in or out of the library.  Contexts are independent,
+ * so separate threads can each run their own at the same time.
+ *
+ * No call prints or exits.  Each returns WAVE_OK or one of the WAVE_ERROR_*
+ * codes below, which waveErrorMessage describes, and a failed call leaves
+ * the context as it was.
+ */
+
+#if defined(__GNUC__)
+#define WAVE_API __attribute__((visibility("default")))
+#else
+#define WAVE_API
+#endif
+
+/*
+ * The header of a wave file as it is held in memory, which is not laid out
+ * as it is in the file: the RIFF and data sizes are 64-bit, so files over
+ * 4 GB fit.  It is written in WAVE_HEADER_SIZE bytes, the canonical RIFF
+ * header, or in WAVE_RF64_HEADER_SIZE, the RF64 header, which adds a "ds64"
+ * chunk holding the 64-bit sizes.
+ */
+typedef struct _FormatChunk {
+	unsigned char ID[4];
+	unsigned int size;
+	unsigned short compression;
+	unsigned short channels;
+	unsigned int sampleRate;
+	unsigned int byteRate;
+	unsigned short blockAlign;
+	unsigned short bitsPerSample;
+} FormatChunk;
+
+typedef struct _DataChunk {
+	unsigned char ID[4];
+	unsigned long long size;
+} DataChunk;
+
+typedef struct _WaveHeader {
+	unsigned char ID[4];
+	unsigned long long size;
+	unsigned char format[4];
+	FormatChunk formatChunk;
+	DataChunk dataChunk;
+} WaveHeader;
+
+#define WAVE_HEADER_SIZE      44
+#define WAVE_RF64_HEADER_SIZE 80
+
+#define WAVE_OK                   0
+#define WAVE_ERROR_USAGE          1
+#define WAVE_ERROR_MEMORY         2
+#define WAVE_ERROR_NOT_RIFF       3
+#define WAVE_ERROR_FORMAT_CHUNK   4
+#define WAVE_ERROR_DATA_CHUNK     5
+#define WAVE_ERROR_NO_CHANNELS    6
+#define WAVE_ERROR_SAMPLE_RATE    7
+#define WAVE_ERROR_SAMPLE_SIZE    8
+#define WAVE_ERROR_FILE_SIZE      9
+#define WAVE_ERROR_FILE_ACCESS    10
+#define WAVE_ERROR_SAME_FILE      11
+#define WAVE_ERROR_SPEED          12
+#define WAVE_ERROR_TIME           13
+#define WAVE_ERROR_VOLUME         14
+#define WAVE_ERROR_ECHO           15
+#define WAVE_ERROR_FEEDBACK       16
+#define WAVE_ERROR_TOO_MANY_TAPS  17
+#define WAVE_ERROR_JOBS           18
+#define WAVE_ERROR_JOB            19
+#define WAVE_ERROR_OUTPUT_SIZE    20
+#define WAVE_ERROR_WINDOW         21
+#define WAVE_ERROR_WINDOW_CHAIN   22
+#define WAVE_ERROR_NORMALIZE      23
+#define WAVE_ERROR_CHANNELS       24
+#define WAVE_ERROR_MANIFEST       25
+#define WAVE_ERROR_VERIFY_CHAIN   26
+#define WAVE_ERROR_VERIFY         27
+#define WAVE_ERROR_IMPULSE        28
+#define WAVE_ERROR_MIX            29
+#define WAVE_ERROR_WRITE          30
+
+#define WAVE_NUM_ERRORS           31
+
+typedef struct _WaveContext WaveContext;
+
+WAVE_API WaveContext *waveCreateContext(int threads);
+WAVE_API void waveDestroyContext(WaveContext *context);
+
+/*
+ * Building the chain.  waveParseChain replaces the chain with one given as
+ * command line arguments, from argv[1] on, and accepts everything the
+ * command line does but -in, -out, -j, --stats, --index, --checksums,
+ * --verify-against, the --start, --end and --in-place windows, and -c, which
+ * would read its impulse response from a file.  The other calls each add one
+ * action to the end of the chain; a NULL curve or method picks the default.
+ */
+WAVE_API int waveParseChain(WaveContext *context, int argc, char **argv);
+WAVE_API void waveClearChain(WaveContext *context);
+WAVE_API int waveReverse(WaveContext *context);
+WAVE_API int waveSpeed(WaveContext *context, double factor, const char *method);
+WAVE_API int waveFlip(WaveContext *context);
+WAVE_API int waveFadeOut(WaveContext *context, double duration, const char *curve);
+WAVE_API int waveFadeIn(WaveContext *context, double duration, const char *curve);
+WAVE_API int waveVolume(WaveContext *context, double scale);
+WAVE_API int waveEcho(WaveContext *context, double delay, double scale, int feedback);
+WAVE_API int waveNormalize(WaveContext *context, double target, const char *method);
+WAVE_API void waveSetFloatMode(WaveContext *context, int floatMode, int dither);
+
+/*
+ * Headers.  waveReadHeader validates the header of a wave file held in
+ * "buffer" and finds its sound data, just as the command line does, RF64 and
+ * BW64 files included, and waveWriteHeader writes a header in the canonical
+ * 44-byte form, or the 80-byte RF64 form once its sizes pass 4 GB;
+ * waveHeaderSize says which.
+ */
+WAVE_API int waveReadHeader(const unsigned char *buffer, size_t size, WaveHeader *header,
+	size_t *offset);
+WAVE_API int waveWriteHeader(const WaveHeader *header, unsigned char *buffer, size_t size);
+WAVE_API size_t waveHeaderSize(const WaveHeader *header);
+
+/*
+ * Processing.  waveOutputSize gives the size of the buffer waveProcess needs
+ * to run the context's chain over a wave file, which can be larger than the
+ * file it writes there.  waveProcess writes the whole output file to
+ * "output" and its size to "written".
+ */
+WAVE_API int waveOutputSize(WaveContext *context, const unsigned char *input, size_t inputSize,
+	size_t *size);
+WAVE_API int waveProcess(WaveContext *context, const unsigned char *input, size_t inputSize,
+	unsigned char *output, size_t outputSize, size_t *written);
+
+WAVE_API const char *waveErrorMessage(int code);
+
+/*
+ * The kernel set picked for the host, as the WAVE_KERNELS environment
+ * variable names them: "scalar", "sse2", "avx2", "avx512" or "neon".
+ */
+WAVE_API const char *waveKernelsName(void);
+
+#endif
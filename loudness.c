@@ -0,0 +1,363 @@
+#include <string.h>
+#include <math.h>
+
+#include "kernels.h"
+#include "loudness.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Samples converted to double at a time.
+#define LOUDNESS_RUN_FRAMES 256
+
+// The loudness of a block of mean square 1, and the two gates, in LUFS.
+#define LOUDNESS_OFFSET   -0.691
+#define LOUDNESS_ABSOLUTE -70.0
+#define LOUDNESS_RELATIVE -10.0
+
+// The kinds of samples a run can be fed from.
+#define SOURCE_SHORT 0
+#define SOURCE_INT   1
+#define SOURCE_FLOAT 2
+
+/**
+ * Where a run of frames comes from: one pointer per channel, with the samples
+ * of each channel "stride" samples apart.
+ */
+typedef struct _Source {
+	const void *samples[LOUDNESS_MAX_CHANNELS];
+	int stride;
+	int kind;
+} Source;
+
+/**
+ * Starts a measurement.  The K-weighting filter's coefficients are worked out
+ * for the sample rate from the analog prototypes of BS.1770, which gives the
+ * standard's own coefficients at 48 kHz.
+ *
+ * @param loudness The measurement.
+ * @param numChannels The number of channels.
+ * @param sampleRate The sample rate.
+ * @param fullScale The magnitude of a full-scale sample.
+ * @return 1, or 0 if there are more than LOUDNESS_MAX_CHANNELS channels.
+ */
+int initLoudness(Loudness *loudness, int numChannels, double sampleRate, double fullScale) {
+	if (numChannels < 1 || numChannels > LOUDNESS_MAX_CHANNELS)
+		return 0;
+
+	memset(loudness, 0, sizeof(Loudness));
+	loudness->numChannels = numChannels;
+	loudness->scale = 1 / fullScale;
+	loudness->stepFrames = (int) (sampleRate / 10 + 0.5);
+	if (loudness->stepFrames < 1)
+		loudness->stepFrames = 1;
+
+	double *f = loudness->filter;
+
+	// A high shelf for the acoustic effect of the head.
+	double k = tan(M_PI * 1681.974450955533 / sampleRate);
+	double q = 0.7071752369554196;
+	double vh = pow(10, 3.999843853973347 / 20);
+	double vb = pow(vh, 0.4996667741545416);
+	double a0 = 1 + k / q + k * k;
+	f[0] = (vh + vb * k / q + k * k) / a0;
+	f[1] = 2 * (k * k - vh) / a0;
+	f[2] = (vh - vb * k / q + k * k) / a0;
+	f[3] = 2 * (k * k - 1) / a0;
+	f[4] = (1 - k / q + k * k) / a0;
+
+	// The high pass of the revised low-frequency B-curve.
+	k = tan(M_PI * 38.13547087602444 / sampleRate);
+	q = 0.5003270373238773;
+	a0 = 1 + k / q + k * k;
+	f[5] = 1;
+	f[6] = -2;
+	f[7] = 1;
+	f[8] = 2 * (k * k - 1) / a0;
+	f[9] = (1 - k / q + k * k) / a0;
+
+	return 1;
+}
+
+/**
+ * Converts a run of one channel's samples to doubles on full scale 1.
+ *
+ * @param source Where the samples come from.
+ * @param c The channel.
+ * @param first The frame of the source to start at.
+ * @param count The number of samples.
+ * @param scale 1 over full scale.
+ * @param x Where to store the samples.
+ */
+static void loadSamples(const Source *source, int c, int64_t first, int count, double scale,
+		double *x) {
+	int stride = source->stride;
+
+	switch (source->kind) {
+	case SOURCE_SHORT: {
+		const short *samples = (const short *) source->samples[c] + first * stride;
+		for (int i = 0; i < count; i++)
+			x[i] = samples[i * stride] * scale;
+		break;
+	}
+	case SOURCE_INT: {
+		const int32_t *samples = (const int32_t *) source->samples[c] + first * stride;
+		for (int i = 0; i < count; i++)
+			x[i] = samples[i * stride] * scale;
+		break;
+	}
+	default: {
+		const float *samples = (const float *) source->samples[c] + first * stride;
+		for (int i = 0; i < count; i++)
+			x[i] = samples[i * stride] * scale;
+		break;
+	}
+	}
+}
+
+/**
+ * Runs a run of one channel through the K-weighting filter, in direct form
+ * II transposed, and adds the squares of the weighted samples to the
+ * channel's energy for the step.
+ *
+ * @param loudness The measurement.
+ * @param c The channel.
+ * @param x The samples.
+ * @param count The number of samples.
+ */
+static void weightSamples(Loudness *loudness, int c, const double *x, int count) {
+	const double *f = loudness->filter;
+	double *state = loudness->state[c];
+	double s0 = state[0], s1 = state[1], s2 = state[2], s3 = state[3];
+	double sum = loudness->energy[c];
+
+	for (int i = 0; i < count; i++) {
+		double y = f[0] * x[i] + s0;
+		s0 = f[1] * x[i] - f[3] * y + s1;
+		s1 = f[2] * x[i] - f[4] * y;
+
+		double z = f[5] * y + s2;
+		s2 = f[6] * y - f[8] * z + s3;
+		s3 = f[7] * y - f[9] * z;
+
+		sum += z * z;
+	}
+
+	state[0] = s0;
+	state[1] = s1;
+	state[2] = s2;
+	state[3] = s3;
+	loudness->energy[c] = sum;
+}
+
+/**
+ * Adds a finished 400 ms block to the histogram, unless the absolute gate
+ * drops it.
+ *
+ * @param loudness The measurement.
+ * @param energy The block's mean square, summed over the channels.
+ */
+static void addBlock(Loudness *loudness, double energy) {
+	if (energy <= 0)
+		return;
+
+	double level = LOUDNESS_OFFSET + 10 * log10(energy);
+	if (level <= LOUDNESS_ABSOLUTE)
+		return;
+
+	int bin = (int) ((level - LOUDNESS_ABSOLUTE) / LOUDNESS_BIN_WIDTH);
+	if (bin >= LOUDNESS_BINS)
+		bin = LOUDNESS_BINS - 1;
+
+	loudness->blocks[bin]++;
+	loudness->energies[bin] += energy;
+}
+
+/**
+ * Finishes a 100 ms step, and with it the block of the last four steps.
+ * Filter state small enough to be heading for denormals is flushed to zero,
+ * so that silence stays fast to filter.
+ *
+ * @param loudness The measurement.
+ */
+static void finishStep(Loudness *loudness) {
+	double step = 0;
+	for (int c = 0; c < loudness->numChannels; c++) {
+		step += loudness->energy[c];
+		loudness->energy[c] = 0;
+	}
+
+	if (loudness->numSteps == 3) {
+		double sum = loudness->steps[0] + loudness->steps[1] + loudness->steps[2] + step;
+		addBlock(loudness, sum / (4.0 * loudness->stepFrames));
+	} else {
+		loudness->numSteps++;
+	}
+
+	loudness->steps[0] = loudness->steps[1];
+	loudness->steps[1] = loudness->steps[2];
+	loudness->steps[2] = step;
+	loudness->filled = 0;
+
+	for (int c = 0; c < loudness->numChannels; c++) {
+		for (int k = 0; k < 4; k++) {
+			if (fabs(loudness->state[c][k]) < 1e-200)
+				loudness->state[c][k] = 0;
+		}
+	}
+}
+
+/**
+ * Feeds a run of frames to a measurement, a piece at a time, so that no
+ * piece crosses the end of a step.
+ *
+ * @param loudness The measurement.
+ * @param source Where the frames come from.
+ * @param first The frame of the source to start at.
+ * @param count The number of frames.
+ * @param levels 1 to measure the peak and RMS levels too, 0 if the caller
+ *               has.
+ */
+static void feed(Loudness *loudness, const Source *source, int64_t first, int count,
+		int levels) {
+	double x[LOUDNESS_RUN_FRAMES];
+
+	while (count > 0) {
+		int run = loudness->stepFrames - loudness->filled;
+		run = run < count ? run : count;
+		run = run < LOUDNESS_RUN_FRAMES ? run : LOUDNESS_RUN_FRAMES;
+
+		for (int c = 0; c < loudness->numChannels; c++) {
+			loadSamples(source, c, first, run, loudness->scale, x);
+			weightSamples(loudness, c, x, run);
+
+			for (int i = 0; levels && i < run; i++) {
+				double magnitude = fabs(x[i]);
+				if (magnitude > loudness->peaks[c])
+					loudness->peaks[c] = magnitude;
+				loudness->squares[c] += x[i] * x[i];
+			}
+		}
+
+		loudness->filled += run;
+		loudness->frames += run;
+		if (loudness->filled == loudness->stepFrames)
+			finishStep(loudness);
+
+		first += run;
+		count -= run;
+	}
+}
+
+/**
+ * Feeds a run of 16-bit stereo frames to a measurement.  Their peaks and
+ * squares are measured exactly, by the level kernel for interleaved frames,
+ * in a pass of their own.
+ *
+ * @param loudness The measurement, of two channels.
+ * @param left The left channel.
+ * @param right The right channel.
+ * @param stride The distance between consecutive samples of a channel: 2
+ *               for interleaved frames, in either order, or 1.
+ * @param count The number of frames.
+ */
+void measureShorts(Loudness *loudness, const short *left, const short *right, int stride,
+		int count) {
+	Source source = { { left, right }, stride, SOURCE_SHORT };
+	int peaks[2] = { 0, 0 };
+	long long squares[2] = { 0, 0 };
+
+	if (stride == 2) {
+		measureFrames(left < right ? left : right, count, peaks, squares);
+		if (left > right) {
+			int peak = peaks[0];
+			peaks[0] = peaks[1];
+			peaks[1] = peak;
+			long long square = squares[0];
+			squares[0] = squares[1];
+			squares[1] = square;
+		}
+	} else {
+		for (int c = 0; c < 2; c++) {
+			const short *samples = c == 0 ? left : right;
+			for (int i = 0; i < count; i++) {
+				int magnitude = samples[i * stride] < 0 ? -samples[i * stride] : samples[i * stride];
+				peaks[c] = magnitude > peaks[c] ? magnitude : peaks[c];
+				squares[c] += magnitude * magnitude;
+			}
+		}
+	}
+
+	for (int c = 0; c < 2; c++) {
+		if (peaks[c] * loudness->scale > loudness->peaks[c])
+			loudness->peaks[c] = peaks[c] * loudness->scale;
+		loudness->shortSquares[c] += (unsigned long long) squares[c];
+	}
+
+	feed(loudness, &source, 0, count, 0);
+}
+
+/**
+ * Feeds a run of frames of the format-generic path to a measurement.
+ *
+ * @param loudness The measurement, of as many channels as there are.
+ * @param channels The channels, int32_t or float.
+ * @param isFloat 1 for float samples, 0 for int32_t.
+ * @param first The first frame of the channels to feed.
+ * @param count The number of frames.
+ */
+void measureChannels(Loudness *loudness, void *const *channels, int isFloat, int64_t first,
+		int count) {
+	Source source;
+	for (int c = 0; c < loudness->numChannels; c++)
+		source.samples[c] = channels[c];
+	source.stride = 1;
+	source.kind = isFloat ? SOURCE_FLOAT : SOURCE_INT;
+
+	feed(loudness, &source, first, count, 1);
+}
+
+/**
+ * Works out the levels of everything fed to a measurement so far.  The
+ * relative gate keeps the bins whose middle is above it.
+ *
+ * @param loudness The measurement.
+ * @param levels Where to store the levels.
+ */
+void loudnessLevels(const Loudness *loudness, Levels *levels) {
+	levels->numChannels = loudness->numChannels;
+	for (int c = 0; c < loudness->numChannels; c++) {
+		double peak = loudness->peaks[c];
+		double square = loudness->squares[c]
+			+ loudness->shortSquares[c] * loudness->scale * loudness->scale;
+		square = loudness->frames > 0 ? square / loudness->frames : 0;
+
+		levels->peak[c] = peak > 0 ? 20 * log10(peak) : -INFINITY;
+		levels->rms[c] = square > 0 ? 10 * log10(square) : -INFINITY;
+	}
+
+	unsigned long long blocks = 0;
+	double energy = 0;
+	for (int b = 0; b < LOUDNESS_BINS; b++) {
+		blocks += loudness->blocks[b];
+		energy += loudness->energies[b];
+	}
+
+	levels->loudness = -INFINITY;
+	if (blocks == 0)
+		return;
+
+	double gate = LOUDNESS_OFFSET + 10 * log10(energy / blocks) + LOUDNESS_RELATIVE;
+	blocks = 0;
+	energy = 0;
+	for (int b = 0; b < LOUDNESS_BINS; b++) {
+		if (LOUDNESS_ABSOLUTE + (b + 0.5) * LOUDNESS_BIN_WIDTH > gate) {
+			blocks += loudness->blocks[b];
+			energy += loudness->energies[b];
+		}
+	}
+
+	if (blocks > 0)
+		levels->loudness = LOUDNESS_OFFSET + 10 * log10(energy / blocks);
+}
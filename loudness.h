@@ -0,0 +1,82 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stdint.h>
+
+/*
+ * Level measurements for the '-n' normalize action: the peak and RMS level
+ * of each channel, and the integrated loudness of the whole signal as EBU
+ * R128 (ITU-R BS.1770) defines it.  Loudness is the K-weighted mean square
+ * of the channels over 400 ms blocks that overlap by 75%, gated first at -70
+ * LUFS and then at 10 LU below the loudness of the blocks that pass.  Every
+ * channel is weighted alike, since the header does not say which channels
+ * are the surrounds.
+ *
+ * Frames are fed in order, in runs of any length, from either 16-bit frames
+ * or the channels of the format-generic path.  The finished blocks are kept
+ * as a histogram of 0.1 LU bins, so a measurement has a fixed size, can live
+ * on the stack and never allocates; the bins only round which side of the
+ * relative gate a block falls on, never the energy that is averaged.
+ */
+
+// What a '-n' action normalizes.
+
+#define NORMALIZE_LOUDNESS 0
+#define NORMALIZE_PEAK     1
+#define NORMALIZE_RMS      2
+
+#define LOUDNESS_MAX_CHANNELS 8
+
+// Histogram bins of LOUDNESS_BIN_WIDTH LU, from the absolute gate up.
+#define LOUDNESS_BINS      1000
+#define LOUDNESS_BIN_WIDTH 0.1
+
+/**
+ * A measurement in progress.  "scale" maps a sample to full scale 1.  The
+ * K-weighting filter is two biquads, with coefficients b0, b1, b2, a1, a2
+ * each in "filter" and two words of state per channel and biquad in "state".
+ * Each channel's weighted energy in the current 100 ms step is added up in
+ * "energy", one sample after another, and the energies of the last three
+ * steps are kept in "steps", so each new step finishes a 400 ms block.
+ * 16-bit samples have their squares added up exactly in "shortSquares".
+ * Nothing is summed in an order that depends on how the frames were split
+ * in to runs, so a measurement does not either.
+ */
+typedef struct _Loudness {
+	int numChannels;
+	double scale;
+	int stepFrames;
+	int filled;
+	int numSteps;
+	double filter[10];
+	double state[LOUDNESS_MAX_CHANNELS][4];
+	double energy[LOUDNESS_MAX_CHANNELS];
+	double steps[3];
+	int64_t frames;
+	double peaks[LOUDNESS_MAX_CHANNELS];
+	double squares[LOUDNESS_MAX_CHANNELS];
+	unsigned long long shortSquares[LOUDNESS_MAX_CHANNELS];
+	unsigned long long blocks[LOUDNESS_BINS];
+	double energies[LOUDNESS_BINS];
+} Loudness;
+
+/**
+ * The results of a measurement.  Levels are in dBFS, a full-scale sine
+ * having an RMS level of -3 dBFS, and the loudness in LUFS; silence, or a
+ * signal too short for a single block, measures -INFINITY.
+ */
+typedef struct _Levels {
+	int numChannels;
+	double peak[LOUDNESS_MAX_CHANNELS];
+	double rms[LOUDNESS_MAX_CHANNELS];
+	double loudness;
+} Levels;
+
+int initLoudness(Loudness *loudness, int numChannels, double sampleRate, double fullScale);
+void measureShorts(Loudness *loudness, const short *left, const short *right, int stride,
+	int count);
+void measureChannels(Loudness *loudness, void *const *channels, int isFloat, int64_t first,
+	int count);
+void loudnessLevels(const Loudness *loudness, Levels *levels);
+
+#endif
@@ -0,0 +1,167 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+struct _Pool {
+	pthread_t *threads;
+	int numThreads;        // Worker threads, not counting the caller.
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;  // Signalled when a new batch of tasks is posted.
+	pthread_cond_t done;   // Signalled when the last task of a batch ends.
+
+	PoolTask task;
+	void *context;
+	int numTasks;
+	int nextTask;
+	int finished;
+	unsigned generation;   // Bumped for every batch.
+	int stopping;
+};
+
+/**
+ * Runs tasks from the current batch until none are left.  Must be called
+ * with the lock held, and returns with it held.
+ *
+ * @param pool The pool.
+ */
+static void drainTasks(Pool *pool) {
+	while (pool->nextTask < pool->numTasks) {
+		int index = pool->nextTask++;
+		PoolTask task = pool->task;
+		void *context = pool->context;
+
+		pthread_mutex_unlock(&pool->lock);
+		task(context, index);
+		pthread_mutex_lock(&pool->lock);
+
+		if (++pool->finished == pool->numTasks)
+			pthread_cond_signal(&pool->done);
+	}
+}
+
+/**
+ * The body of each worker thread: wait for a batch, help drain it, repeat.
+ *
+ * @param arg The pool.
+ * @return NULL.
+ */
+static void *workerMain(void *arg) {
+	Pool *pool = arg;
+	unsigned seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->stopping && pool->generation == seen)
+			pthread_cond_wait(&pool->start, &pool->lock);
+
+		if (pool->stopping)
+			break;
+
+		seen = pool->generation;
+		drainTasks(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/**
+ * Creates a pool that runs tasks on "threads" threads in total: the thread
+ * calling runParallel plus threads - 1 workers.
+ *
+ * @param threads The total number of threads, at least 1.
+ * @return The new pool, or NULL if it could not be created.
+ */
+Pool *createPool(int threads) {
+	Pool *pool = calloc(1, sizeof(Pool));
+	if (pool == NULL)
+		return NULL;
+
+	pool->threads = calloc(threads > 1 ? threads - 1 : 1, sizeof(pthread_t));
+	if (pool->threads == NULL) {
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (int i = 0; i < threads - 1; i++) {
+		if (pthread_create(&pool->threads[i], NULL, workerMain, pool) != 0)
+			break;
+		pool->numThreads++;
+	}
+
+	return pool;
+}
+
+/**
+ * Runs task(context, i) for every i from 0 to tasks - 1, spread over the
+ * pool's threads, and waits for all of them to finish.  Tasks must not depend
+ * on each other's order.
+ *
+ * @param pool The pool, or NULL to run the tasks serially.
+ * @param tasks The number of tasks.
+ * @param task The function to run for each task.
+ * @param context Passed to every task.
+ */
+void runParallel(Pool *pool, int tasks, PoolTask task, void *context) {
+	if (pool == NULL || pool->numThreads == 0 || tasks <= 1) {
+		for (int i = 0; i < tasks; i++)
+			task(context, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->task = task;
+	pool->context = context;
+	pool->numTasks = tasks;
+	pool->nextTask = 0;
+	pool->finished = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+
+	drainTasks(pool);
+	while (pool->finished < pool->numTasks)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Returns how many threads run a pool's tasks, counting the caller.
+ *
+ * @param pool The pool, or NULL.
+ * @return The number of threads.
+ */
+int poolThreads(const Pool *pool) {
+	return pool == NULL ? 1 : pool->numThreads + 1;
+}
+
+/**
+ * Stops the workers and frees the pool.
+ *
+ * @param pool The pool, or NULL.
+ */
+void destroyPool(Pool *pool) {
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->numThreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	free(pool->threads);
+	free(pool);
+}
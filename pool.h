@@ -0,0 +1,23 @@
+#ifndef POOL_H
+#define POOL_H
+
+/*
+ * A fixed pool of worker threads for data-parallel loops.  runParallel hands
+ * out the task indices 0 to tasks - 1 to the workers and the calling thread,
+ * and returns once every task has finished.  A NULL pool runs the tasks in
+ * order on the calling thread, so callers need no separate serial path.
+ * Every task must return: one that jumps or exits out of runParallel leaves
+ * the pool waiting for it, so tasks that can fail have to catch the failure
+ * themselves and report it once runParallel returns.
+ */
+
+typedef struct _Pool Pool;
+
+typedef void (*PoolTask)(void *context, int index);
+
+Pool *createPool(int threads);
+void runParallel(Pool *pool, int tasks, PoolTask task, void *context);
+int poolThreads(const Pool *pool);
+void destroyPool(Pool *pool);
+
+#endif
@@ -8,450 +8,7623 @@
  *
  *******************************/
 
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <limits.h>
+#include <float.h>
+#include <math.h>
+#include <setjmp.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "wave.h"
+#include "kernels.h"
+#include "pool.h"
+#include "resample.h"
+#include "formats.h"
+#include "arena.h"
+#include "queue.h"
+#include "loudness.h"
+#include "index.h"
+#include "convolve.h"
+#include "libwave.h"
+
+// Sample layouts of WaveData, and of what an action prefers to work on.
+
+#define LAYOUT_ANY         0
+#define LAYOUT_PLANAR      1
+#define LAYOUT_INTERLEAVED 2
 
 /**
  * Simple struct for storing and passing the wave file header and the sound
  * data together.  The "numSamples" field makes it much easier to keep track
  * of how many samples there are, which is the lengths of "left" and "right".
+ *
+ * The sound data is held in one of two layouts.  In the planar layout it is
+ * split in to "left" and "right".  In the interleaved layout it stays in one
+ * "frames" buffer exactly as it is in the file; "swapped" is set when the
+ * channels have been flipped but the samples not yet moved, which happens as
+ * the data is written out.
+ * Likewise "reversed" is set when the data has been reversed but not yet
+ * moved, which happens as it is written out or as soon as an action needs
+ * the frames in order.
+ *
+ * Both layouts live in one of two ping-pong buffers allocated from "arena",
+ * each with room for "capacity" frames, the longest stage of the chain.  An
+ * action or conversion that cannot work in place writes in to the "spare"
+ * buffer and hands back the one it read from, so nothing is allocated once
+ * the data is loaded.
+ *
+ * When the chain starts with a '-n', the read also measures the data in to
+ * "loudness" and sets "measured", so that the action needs no pass of its
+ * own to find its gain.
  */
 typedef struct _WaveData {
 	WaveHeader *header;
-	int numSamples;
+	int64_t numSamples;
+	int layout;
 	short *left;
 	short *right;
+	short *frames;
+	int64_t capacity;
+	int swapped;
+	int reversed;
+	Arena *arena;
+	short *spare;
+	Loudness loudness;
+	int measured;
 } WaveData;
 
+// Integer codes returned by parseArgument for each flag.
+
+#define ACTION_REVERSE  0
+#define ACTION_SPEED    1
+#define ACTION_FLIP     2
+#define ACTION_FADE_OUT 3
+#define ACTION_FADE_IN  4
+#define ACTION_VOLUME   5
+#define ACTION_ECHO     6
+#define ACTION_NORMALIZE 7
+#define ACTION_CONVOLVE 8
+
+// The most taps one '-e' can have, and the most times a feedback echo is
+// allowed to repeat before its tail is cut off.
+#define ECHO_MAX_TAPS    8
+#define ECHO_MAX_REPEATS 1000
+
+/**
+ * One tap of an echo: a copy of the sound "delay" seconds later, scaled by
+ * "scale".  A plain tap echoes the input; a feedback tap echoes the output,
+ * so it repeats, dying away a little more each time.
+ */
+typedef struct _EchoTap {
+	double delay;
+	double scale;
+	int feedback;
+} EchoTap;
+
+/**
+ * An impulse response for '-c', loaded whole from its file: "length" frames
+ * of one channel for both channels of the input, or of one channel each, on
+ * full scale 1 whatever the file's format.
+ */
+typedef struct _Impulse {
+	int numChannels;
+	int sampleRate;
+	int64_t length;
+	double *samples[2];
+} Impulse;
+
+/**
+ * One parsed command line action.  "arg1" holds the flag's first parameter
+ * (speed factor, fade duration, volume scale, echo delay, or normalize
+ * target) and "arg2" the echo scale.  Unused parameters are 0.  A fade has a
+ * CURVE_* shape, a speed change a RESAMPLE_* method and a normalize a
+ * NORMALIZE_* one.  An echo also lists all of its taps, the
+ * first of which is the one in "arg1" and "arg2".  A '-c' holds the
+ * impulse response it loaded as it was parsed, which freeChain frees.
+ * "ordinal" is the action's place among the actions on the command line,
+ * which it keeps however the chain is rewritten, and "foldedInto" the
+ * ordinal of the action it was folded in to once optimizeChain takes it out
+ * of the chain, or -1.
+ */
+typedef struct _Action {
+	int type;
+	int ordinal;
+	int foldedInto;
+	double arg1;
+	double arg2;
+	int curve;
+	int method;
+	int numTaps;
+	EchoTap taps[ECHO_MAX_TAPS];
+	Impulse *impulse;
+} Action;
+
+/**
+ * Options that are not actions.  A NULL path means the standard stream.
+ * "floatMode" runs the chain on float samples, quantizing only once as the
+ * output is written, and "dither" adds dither noise as it does.  "stats"
+ * prints the time and data of each stage instead of the headers.  "window"
+ * is set when the chain only runs from "start" to "end" seconds in to the
+ * file, an "end" below 0 meaning the end of the file, and "inPlace" when it
+ * edits the input file instead of writing a new one.  "index" writes an
+ * index of the output file next to it once it is written, and "checksums"
+ * names a manifest to write the output's block checksums to.  "verify" names
+ * a manifest to verify instead of writing any output.  "folded" is the
+ * number of actions optimizeChain took out of the chain, which are kept
+ * after its last action for the stats.
+ */
+typedef struct _Options {
+	char *inPath;
+	char *outPath;
+	int jobs;
+	int floatMode;
+	int dither;
+	int stats;
+	int window;
+	double start;
+	double end;
+	int inPlace;
+	int index;
+	char *checksums;
+	char *verify;
+	int folded;
+} Options;
+
+// The worker pool for '-j', or NULL to run everything on the calling thread.
+// A library call runs on the pool of its context.
+static __thread Pool *pool = NULL;
+
 // Error messages for various errors
 
-#define ERROR_COMMAND_LINE_USAGE  "Usage: wave [[-r][-s factor][-f][-o delay][-i delay][-v scale][-e delay scale] < input > output"
+#define ERROR_COMMAND_LINE_USAGE  "Usage: wave [-in file] [-out file] [-j threads] [-float [dither]] [--stats] [--start seconds] [--end seconds] [--in-place] [--index] [--checksums manifest] [--verify-against manifest] [[-r][-s factor [method]][-f][-o delay [curve]][-i delay [curve]][-v scale][-e delay scale [feedback] ...][-n target [method]][-c impulse] < input > output\n       wave --batch manifest [-j threads]\n       wave --mix manifest [-out file] [-j threads] [--checksums manifest]"
 #define ERROR_INSUFFICIENT_MEMORY "Program out of memory"
 #define ERROR_FILE_NOT_RIFF       "File is not a RIFF file"
 #define ERROR_BAD_FORMAT_CHUNK    "Format chunk is corrupted"
 #define ERROR_BAD_DATA_CHUNK      "Data chunk is corrupted"
-#define ERROR_NOT_STEREO          "File is not stereo"
-#define ERROR_INVALID_SAMPLE_RATE "File does not use 44,100Hz sample rate"
-#define ERROR_INVALID_SAMPLE_SIZE "File does not have 16-bit samples"
+#define ERROR_NO_CHANNELS         "File has no channels"
+#define ERROR_INVALID_SAMPLE_RATE "File does not have a sample rate"
+#define ERROR_INVALID_SAMPLE_SIZE "File does not have 8, 16, 24 or 32-bit integer or 32-bit float samples"
 #define ERROR_INVALID_FILE_SIZE   "File size does not match size in header"
+#define ERROR_FILE_ACCESS         "Could not open or map file"
+#define ERROR_WRITE_FAILED        "Could not write the output"
+#define ERROR_SAME_FILE           "Input and output must be different files"
 
 #define ERROR_INVALID_SPEED       "A positive number must be supplied for the speed change"
 #define ERROR_INVALID_TIME        "A positive number must be supplied for the fade in and fade out time"
 #define ERROR_INVALID_VOLUME      "A positive number must be supplied for the volume scale"
 #define ERROR_INVALID_ECHO        "A positive number must be supplied for the echo delay and scale parameters"
+#define ERROR_INVALID_FEEDBACK    "The feedback echo scales must add up to less than 1"
+#define ERROR_TOO_MANY_TAPS       "An echo can have at most 8 taps"
+#define ERROR_INVALID_JOBS        "A positive whole number must be supplied for the number of threads"
+#define ERROR_INVALID_JOB         "A batch job must name an input and an output file, and cannot use -in, -out, -j, --stats, --in-place or --verify-against"
+#define ERROR_OUTPUT_SIZE         "The output buffer is too small"
+#define ERROR_INVALID_WINDOW      "A positive number must be supplied for the --start and --end times, with the start first"
+#define ERROR_WINDOW_CHAIN        "A window or in-place edit needs a 16-bit stereo input file, without -float, and allows only -r, -f, -o, -i and -v"
+#define ERROR_INVALID_NORMALIZE   "A number no greater than 0 must be supplied for the normalize target"
+#define ERROR_NORMALIZE_CHANNELS  "Only files with at most 8 channels can be normalized"
+#define ERROR_BAD_MANIFEST        "Checksum manifest is corrupted"
+#define ERROR_VERIFY_CHAIN        "Verification needs a 16-bit stereo input file, without -float, and allows only -r, -f, -o, -i, -v, -s with the nearest method and a leading -n"
+#define ERROR_VERIFY_FAILED       "The output does not match the checksum manifest"
+#define ERROR_INVALID_IMPULSE     "An impulse response must have at least one frame, the input's sample rate, and one channel, or two for a stereo input"
+#define ERROR_INVALID_MIX         "A mix needs at least one line, and each must name a 16-bit stereo file at the first one's sample rate and a start of 0 seconds or more, or '+' and an optional gap, and cannot use -in, -out, -j, -float, --stats, --start, --end, --in-place, --index, --checksums or --verify-against"
+
+// The error-messages by the WAVE_ERROR_* codes the library returns.
+static const char *const errorMessages[WAVE_NUM_ERRORS] = {
+	[WAVE_OK]                  = "No error",
+	[WAVE_ERROR_USAGE]         = ERROR_COMMAND_LINE_USAGE,
+	[WAVE_ERROR_MEMORY]        = ERROR_INSUFFICIENT_MEMORY,
+	[WAVE_ERROR_NOT_RIFF]      = ERROR_FILE_NOT_RIFF,
+	[WAVE_ERROR_FORMAT_CHUNK]  = ERROR_BAD_FORMAT_CHUNK,
+	[WAVE_ERROR_DATA_CHUNK]    = ERROR_BAD_DATA_CHUNK,
+	[WAVE_ERROR_NO_CHANNELS]   = ERROR_NO_CHANNELS,
+	[WAVE_ERROR_SAMPLE_RATE]   = ERROR_INVALID_SAMPLE_RATE,
+	[WAVE_ERROR_SAMPLE_SIZE]   = ERROR_INVALID_SAMPLE_SIZE,
+	[WAVE_ERROR_FILE_SIZE]     = ERROR_INVALID_FILE_SIZE,
+	[WAVE_ERROR_FILE_ACCESS]   = ERROR_FILE_ACCESS,
+	[WAVE_ERROR_SAME_FILE]     = ERROR_SAME_FILE,
+	[WAVE_ERROR_SPEED]         = ERROR_INVALID_SPEED,
+	[WAVE_ERROR_TIME]          = ERROR_INVALID_TIME,
+	[WAVE_ERROR_VOLUME]        = ERROR_INVALID_VOLUME,
+	[WAVE_ERROR_ECHO]          = ERROR_INVALID_ECHO,
+	[WAVE_ERROR_FEEDBACK]      = ERROR_INVALID_FEEDBACK,
+	[WAVE_ERROR_TOO_MANY_TAPS] = ERROR_TOO_MANY_TAPS,
+	[WAVE_ERROR_JOBS]          = ERROR_INVALID_JOBS,
+	[WAVE_ERROR_JOB]           = ERROR_INVALID_JOB,
+	[WAVE_ERROR_OUTPUT_SIZE]   = ERROR_OUTPUT_SIZE,
+	[WAVE_ERROR_WINDOW]        = ERROR_INVALID_WINDOW,
+	[WAVE_ERROR_WINDOW_CHAIN]  = ERROR_WINDOW_CHAIN,
+	[WAVE_ERROR_NORMALIZE]     = ERROR_INVALID_NORMALIZE,
+	[WAVE_ERROR_CHANNELS]      = ERROR_NORMALIZE_CHANNELS,
+	[WAVE_ERROR_MANIFEST]      = ERROR_BAD_MANIFEST,
+	[WAVE_ERROR_VERIFY_CHAIN]  = ERROR_VERIFY_CHAIN,
+	[WAVE_ERROR_VERIFY]        = ERROR_VERIFY_FAILED,
+	[WAVE_ERROR_IMPULSE]       = ERROR_INVALID_IMPULSE,
+	[WAVE_ERROR_MIX]           = ERROR_INVALID_MIX,
+	[WAVE_ERROR_WRITE]         = ERROR_WRITE_FAILED,
+};
+
+/*
+ * While a batch job or a library call runs, failure() jumps back to its
+ * recovery point with the message instead of exiting, so one bad job does not
+ * end the whole batch and the library never exits.  Each thread has its own
+ * recovery point.
+ */
+static __thread jmp_buf *failureJump = NULL;
+static __thread char *failureMessage = NULL;
+
+/*
+ * An output file is written under a temporary name next to it, and renamed
+ * over it only once it is complete, so a run that fails leaves no partial
+ * output and does not destroy a file that was already there.  Each thread
+ * has at most one output pending, which a failure removes.
+ */
+static __thread char *pendingOutput = NULL;
+static __thread char *pendingTarget = NULL;
+
+static pthread_once_t creationMaskOnce = PTHREAD_ONCE_INIT;
+static mode_t fileCreationMask;
+
+/**
+ * Reads the process's file creation mask.  umask can only be read by setting
+ * it, so this runs once, before any worker thread could be creating a file.
+ */
+void readCreationMask(void) {
+	fileCreationMask = umask(022);
+	umask(fileCreationMask);
+}
+
+/**
+ * Returns the file creation mask, which a new output, created by mkstemp
+ * without it, is given its mode by.
+ *
+ * @return The mask.
+ */
+mode_t creationMask(void) {
+	pthread_once(&creationMaskOnce, readCreationMask);
+	return fileCreationMask;
+}
+
+/**
+ * Removes this thread's pending output, if it has one.
+ */
+void discardOutput(void) {
+	if (pendingOutput == NULL)
+		return;
+
+	remove(pendingOutput);
+	free(pendingOutput);
+	free(pendingTarget);
+	pendingOutput = NULL;
+	pendingTarget = NULL;
+}
 
 /**
- * Prints an error-message to stderr and exits the program.
+ * Prints an error-message to stderr and exits the program, or fails the
+ * batch job or library call running on this thread.
  *
  * @param message The error-message to print.
  */
 void failure(char *message) {
+	if (failureJump != NULL) {
+		failureMessage = message;
+		longjmp(*failureJump, 1);
+	}
+
+	discardOutput();
 	fprintf(stderr, "Error: %s\n", message);
 	exit(1);
-} 
+}
+
 /**
- * Reads the wave file header into an allocated struct and returns a pointer to
- * it.  In addition, the files format is validated.
+ * Runs a call that may fail, catching its failure instead of exiting.
  *
- * @return A pointer to the wave file header.
+ * @param call The call.
+ * @param context The argument to pass to the call.
+ * @return The error-message the call failed with, or NULL if it succeeded.
  */
-WaveHeader *readFileHeader() {
-	// Read the wave file header
-	WaveHeader *header = malloc(sizeof(WaveHeader));
-	if (header == NULL)
-		failure(ERROR_INSUFFICIENT_MEMORY);
-	readHeader(header);
-	
-	// Perform validation tests on file
-	if (strncmp(header->ID, "RIFF", 4) != 0)
-		failure(ERROR_FILE_NOT_RIFF);
-
-	if (strncmp(header->formatChunk.ID, "fmt ", 4) != 0
-		|| header->formatChunk.size != 16
-		|| header->formatChunk.compression != 1)
-		failure(ERROR_BAD_FORMAT_CHUNK);
-
-	if (strncmp(header->dataChunk.ID, "data", 4) != 0)
-		failure(ERROR_BAD_DATA_CHUNK);
+char *catchFailure(void (*call)(void *), void *context) {
+	jmp_buf *outer = failureJump;
+	char *outerOutput = pendingOutput;
+	jmp_buf recovery;
 
-	if (header->formatChunk.channels != 2)
-		failure(ERROR_NOT_STEREO);
+	if (setjmp(recovery) != 0) {
+		failureJump = outer;
+		if (pendingOutput != outerOutput)
+			discardOutput();
+		return failureMessage;
+	}
 
-	if (header->formatChunk.sampleRate != 44100)
-		failure(ERROR_INVALID_SAMPLE_RATE);
+	failureJump = &recovery;
+	call(context);
+	failureJump = outer;
+	return NULL;
+}
 
-	if (header->formatChunk.bitsPerSample != 16)
-		failure(ERROR_INVALID_SAMPLE_SIZE);
+/*
+ * Tasks on the worker pool run under catchFailure too, since a worker has no
+ * recovery point of its own and a failure must not jump out of the pool
+ * while other tasks still run.  Once a task has failed the tasks not yet
+ * started are skipped, and the first failure is passed back to the calling
+ * thread after every task has stopped.
+ */
+typedef struct _GuardedTasks {
+	PoolTask task;
+	void *context;
+	pthread_mutex_t lock;
+	char *error;          // The first failure, or NULL.
+} GuardedTasks;
 
-	return header;
-}
+/**
+ * One task of a GuardedTasks, as catchFailure runs it.
+ */
+typedef struct _GuardedTask {
+	GuardedTasks *tasks;
+	int index;
+} GuardedTask;
 
 /**
- * Reads the next byte from the input stream.  Fails if the end of the stream
- * is reached.  This separates checking for the end of stream from reading the
- * next byte, which makes the program smoother to read and write.
+ * Runs one guarded task.
  *
- * @return The next byte from the input stream.
+ * @param context The GuardedTask.
  */
-int readByte() {
-	int ch = getchar();
-	if (ch == EOF)
-		failure(ERROR_INVALID_FILE_SIZE);
-
-	return ch;
+void runGuardedTask(void *context) {
+	const GuardedTask *guarded = context;
+	guarded->tasks->task(guarded->tasks->context, guarded->index);
 }
 
 /**
- * Reads the sound data from the input stream.  They are stored in the given
- * WaveData struct's "left" and "right" fields.  The "numSamples" field is
- * the number of bytes the sound data consumes divided by 4.
+ * Runs one task of a GuardedTasks on the pool, unless another has failed,
+ * and records its failure.
  *
- * @param A WaveData struct to store the sound data in.
+ * @param context The GuardedTasks.
+ * @param index The index of the task.
  */
-void readSoundData(WaveData *data) {
-	// Divide by 4 to account for the sample size and number of channels.
-	data->numSamples = data->header->dataChunk.size / 4;
-	data->left  = malloc(sizeof(short) * data->numSamples);
-	data->right = malloc(sizeof(short) * data->numSamples);
-	if (data->left == NULL || data->right == NULL)
-		failure(ERROR_INSUFFICIENT_MEMORY);
+void guardTask(void *context, int index) {
+	GuardedTasks *tasks = context;
+	pthread_mutex_lock(&tasks->lock);
+	int failed = tasks->error != NULL;
+	pthread_mutex_unlock(&tasks->lock);
+	if (failed)
+		return;
 
-	// Each sample uses two bytes (a short).
-	// Samples alternate between the left and right channels.
-	for (int i = 0; i < data->numSamples; i++) {
-		data->left[i]  = readByte() | (readByte() << 8);
-		data->right[i] = readByte() | (readByte() << 8);
+	GuardedTask guarded = { tasks, index };
+	char *error = catchFailure(runGuardedTask, &guarded);
+	if (error != NULL) {
+		pthread_mutex_lock(&tasks->lock);
+		if (tasks->error == NULL)
+			tasks->error = error;
+		pthread_mutex_unlock(&tasks->lock);
 	}
 }
 
 /**
- * Writes the wave data to another file.
+ * Runs task(context, i) for every i from 0 to tasks - 1 over this thread's
+ * pool, catching their failures.
  *
- * @param data The WaveData containing to file header and sound data.
+ * @param tasks The number of tasks.
+ * @param task The function to run for each task.
+ * @param context Passed to every task.
+ * @return The error-message of the first task that failed, or NULL.
  */
-void writeToFile(WaveData *data) {
-	writeHeader(data->header);
-
-	for (int i = 0; i < data->numSamples; i++) {
-		putchar((data->left[i]  & 0x00FF) >> 0);
-		putchar((data->left[i]  & 0xFF00) >> 8);
-		putchar((data->right[i] & 0x00FF) >> 0);
-		putchar((data->right[i] & 0xFF00) >> 8);
-	}
+char *tryTasks(int tasks, PoolTask task, void *context) {
+	GuardedTasks guarded = { task, context, PTHREAD_MUTEX_INITIALIZER, NULL };
+	runParallel(pool, tasks, guardTask, &guarded);
+	pthread_mutex_destroy(&guarded.lock);
+	return guarded.error;
 }
 
 /**
- * Note: Not required by this program. For debugging purposes.
+ * Runs task(context, i) for every i from 0 to tasks - 1 over this thread's
+ * pool, failing on this thread once they have all stopped if any of them
+ * failed.
  *
- * Prints the file header in a readable form.
- *
- * @param header The wave file header.
+ * @param tasks The number of tasks.
+ * @param task The function to run for each task.
+ * @param context Passed to every task.
  */
-void printWaveHeader(WaveHeader *header) {
-	fprintf(stderr, "ID:              %.*s\n", 4, header->ID);
-	fprintf(stderr, "Size:            %d\n", header->size);
-	fprintf(stderr, "Format:          %.*s\n", 4, header->format);
-	fprintf(stderr, "Format ID:       %.*s\n", 4, header->formatChunk.ID);
-	fprintf(stderr, "Format Size:     %d\n", header->formatChunk.size);
-	fprintf(stderr, "Compression:     %d\n", header->formatChunk.compression);
-	fprintf(stderr, "Channels:        %d\n", header->formatChunk.channels);
-	fprintf(stderr, "Sample Rate:     %d\n", header->formatChunk.sampleRate);
-	fprintf(stderr, "Byte Rate:       %d\n", header->formatChunk.byteRate);
-	fprintf(stderr, "Block Align:     %d\n", header->formatChunk.blockAlign);
-	fprintf(stderr, "Bits Per Sample: %d\n", header->formatChunk.bitsPerSample);
-	fprintf(stderr, "Data ID:         %.*s\n", 4, header->dataChunk.ID);
-	fprintf(stderr, "Data Size:       %d\n", header->dataChunk.size);
-	fprintf(stderr, "\n");
+void runTasks(int tasks, PoolTask task, void *context) {
+	char *error = tryTasks(tasks, task, context);
+	if (error != NULL)
+		failure(error);
 }
 
 /**
- * Reads an argument and parses it as a flag.  On success, the 6 flags '-r',
- * '-s', '-f', '-o', '-i', '-v', and '-e' return the integer codes 0 - 5,
- * respectively, referring to individual actions to be taken.  Fails if none
- * of these are matched.
+ * Returns the WAVE_ERROR_* code of an error-message.
  *
- * @param arg The argument to parse.
- * @return An integer code representing the matched flag.
+ * @param message The error-message, or NULL for none.
+ * @return The code.
  */
-int parseArgument(char *arg) {
-	if (*arg++ == '-') {
-		int action = -1;
-
-		switch (*arg++) {
-		case 'r': action = 0; break;
-		case 's': action = 1; break;
-		case 'f': action = 2; break;
-		case 'o': action = 3; break;
-		case 'i': action = 4; break;
-		case 'v': action = 5; break;
-		case 'e': action = 6; break;
-		}
+int errorCode(const char *message) {
+	if (message == NULL)
+		return WAVE_OK;
 
-		// If matched and arg had a length of 2.
-		if (action != -1 && *arg++ == '\0')
-			return action;
+	for (int code = 1; code < WAVE_NUM_ERRORS; code++) {
+		if (strcmp(message, errorMessages[code]) == 0)
+			return code;
 	}
 
-	// If '-[rsfoive]' is not matched.
-	failure(ERROR_COMMAND_LINE_USAGE);
+	return WAVE_ERROR_USAGE;
 }
 
-/**
- * Parses a command line argument as a double and returns the result.
- * The argument is first checked to ensure it matches the discription
- * of a positive integer, which here is '\d+.|.\d+|\d+.\d+'.
- * A negative double is returned upon failure.
- *
- * @param arg The argument to parse.
- * @return The parsed double.
+/*
+ * Instrumentation for '--stats'.  The run is split in to stages: reading the
+ * header, reading the sound data, each action in the order given, writing
+ * the output, and "other" for everything in between.  The action stages are
+ * those of the command line, one per action in its order there, even when
+ * optimizeChain has folded some of them in to others or dropped them.  Time
+ * is charged to whichever stage is current, so a stage that hands its output
+ * on to later stages (as the streaming speed change does) is only charged for
+ * its own work, and a reverse a fused pass leaves pending is charged to the
+ * stage that carries it out.  Only the main thread records anything, and with
+ * no '--stats' every hook returns at once.
  */
-double parseDouble(char *arg) {
-	// Check that arg is in the correct form.
-	int hasDot = 0;
-	for (int i = 0; arg[i]; i++) {
-		if (arg[i] == '.') {
-			if (hasDot)
-				return -1;
-			else
-				hasDot = 1;
 
-		} else if ('0' > arg[i] || arg[i] > '9') {
-			return -1;
-		}
-	}
+#define STATS_OTHER  0
+#define STATS_HEADER 1
+#define STATS_READ   2
+#define STATS_WRITE  3
 
-	// Parse the argument.
-	return atof(arg);
-}
+// The stage of the action that is "ordinal" on the command line.
+#define STATS_ACTION(ordinal) (4 + (ordinal))
 
 /**
- * The '-r' action.  Reverses the order of the sound samples so they play in
- * reverse.
- *
- * @param data The WaveData struct containing the samples to reverse.
+ * What one stage did.  "bytes" is the sound data it read, wrote or passed
+ * through, "samples" the samples it processed, "allocated" the buffer memory
+ * it allocated, and "fused" the number of actions it ran in one pass, 0 for
+ * an action run as part of an earlier one's pass or taken out of the chain.
+ * "folded" is set for an action optimizeChain took out.  A '-n' also keeps
+ * the "levels" it measured and the "gain" it scaled by.
  */
-void actionReverse(WaveData *data) {
-	short temp;
+typedef struct _StageStats {
+	double seconds;
+	unsigned long long bytes;
+	unsigned long long samples;
+	unsigned long long allocated;
+	int fused;
+	int folded;
+	int measured;
+	Levels levels;
+	double gain;
+} StageStats;
 
-	// Go half-way - too far would undo the reversal.
-	for (int i = 0; i < data->numSamples / 2; i++) {
-		temp = data->left[i];
-		data->left[i] = data->left[data->numSamples - i - 1];
-		data->left[data->numSamples - i - 1] = temp;
+/**
+ * The stats of the whole run, and which stage is current since "mark".
+ * "actions" holds every action of the command line, in its order there, as
+ * it was before any of them ran, and "ordinals" the ordinal of each action
+ * left in the chain.
+ */
+typedef struct _Stats {
+	Action *actions;
+	int numActions;
+	int *ordinals;
+	const char *path;
+	StageStats *stages;
+	int current;
+	double start;
+	double mark;
+} Stats;
 
-		temp = data->right[i];
-		data->right[i] = data->right[data->numSamples - i - 1];
-		data->right[data->numSamples - i - 1] = temp;
-	}
-}
+// The stats of the run, or NULL without '--stats'.
+static Stats *stats = NULL;
 
 /**
- * The '-s' action.  Slows down or speeds up the sound data.
+ * Returns the time on a monotonic clock.
  *
- * @param data The WaveData struct containing the samples to speed up or down.
- * @param factor How much to scale the speed.
+ * @return The time in seconds.
  */
-void actionChangeSpeed(WaveData *data, double factor) {
-	if (factor <= 0)
-		failure(ERROR_INVALID_SPEED);
+double clockSeconds(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
 
-	// Create new channels.
-	int length = (int) (data->numSamples / factor);
-	short *left = malloc(sizeof(short) * length);
-	short *right = malloc(sizeof(short) * length);
-	if (left == NULL || right == NULL)
+/**
+ * Starts recording stats for a chain, from now on.
+ *
+ * @param actions The parsed actions, followed by those optimizeChain took out.
+ * @param count The number of actions in the chain.
+ * @param folded The number optimizeChain took out.
+ */
+void startStats(const Action *actions, int count, int folded) {
+	int total = count + folded;
+	stats = malloc(sizeof(Stats));
+	if (stats == NULL)
 		failure(ERROR_INSUFFICIENT_MEMORY);
 
-	// Copy over the old sound data.
-	for (int i = 0; i < length; i++) {
-		int j = (int) (i * factor);
-
-		left[i]  = data->left[j];
-		right[i] = data->right[j];
-	}
+	stats->stages = calloc(STATS_ACTION(total), sizeof(StageStats));
+	stats->actions = malloc(sizeof(Action) * (total > 0 ? total : 1));
+	stats->ordinals = malloc(sizeof(int) * (count > 0 ? count : 1));
+	if (stats->stages == NULL || stats->actions == NULL || stats->ordinals == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
 
-	// Update the data records.
-	free(data->left);
-	free(data->right);
+	stats->numActions = total;
+	stats->path = "";
+	stats->current = STATS_OTHER;
+	stats->start = stats->mark = clockSeconds();
 
-	data->numSamples = length;
-	data->left = left;
-	data->right = right;
+	for (int i = 0; i < total; i++) {
+		int ordinal = actions[i].ordinal;
+		stats->actions[ordinal] = actions[i];
 
-	data->header->size = sizeof(WaveHeader) + 4 * length;
-	data->header->dataChunk.size = 4 * length;
+		if (i < count) {
+			stats->ordinals[i] = ordinal;
+			stats->stages[STATS_ACTION(ordinal)].fused = 1;
+		} else {
+			stats->stages[STATS_ACTION(ordinal)].folded = 1;
+		}
+	}
 }
 
 /**
- * The '-f' action.  Swaps the left and the right channels.
+ * Returns the stage of an action in the chain.
  *
- * @param data The WaveData struct containing the channels to swap.
+ * @param index The index of the action in the chain.
+ * @return The stage, to hand to enterStage.
  */
-void actionFlipChannels(WaveData *data) {
-	short *temp = data->left;
-	data->left = data->right;
-	data->right = temp;
+int actionStage(int index) {
+	return stats == NULL ? STATS_OTHER : STATS_ACTION(stats->ordinals[index]);
 }
 
 /**
- * The '-o' action.  Fades out the sound near the end of the data.
+ * Makes a stage current, charging the time since the last switch to the
+ * stage that was.
  *
- * @param data The WaveData stuct containing the samples to fade.
- * @param duration How long the fade out should last.
+ * @param stage The STATS_* stage.
+ * @return The stage that was current, to hand to leaveStage.
  */
-void actionFadeOut(WaveData *data, double duration) {
-	if (duration < 0)
-		failure(ERROR_INVALID_TIME);
+int enterStage(int stage) {
+	if (stats == NULL)
+		return 0;
 
-	int n = (int) (data->header->formatChunk.sampleRate * duration);
-	short *left = data->left + (data->numSamples - n);
-	short *right = data->right + (data->numSamples - n);
+	double now = clockSeconds();
+	stats->stages[stats->current].seconds += now - stats->mark;
+	stats->mark = now;
 
-	// Fade out only last n samples of each channel.
-	for (int i = 0; i < n; i++) {
-		double factor = 1.0 - i / (double) n;
-		
-		left [i] *= factor * factor;
-		right[i] *= factor * factor;
-	}
+	int previous = stats->current;
+	stats->current = stage;
+	return previous;
 }
 
 /**
- * The '-i' action.  Fades in the sound near the start of the data.
+ * Leaves the current stage, crediting it with the data it processed, and
+ * makes the stage before it current again.
  *
- * @param data The WaveData struct containing the samples to fade.
- * @param duration How long the fade in should last.
+ * @param previous The stage enterStage returned.
+ * @param frames The number of frames the stage processed.
+ * @param frameSize The size of a frame in bytes.
+ * @param channels The number of channels in a frame.
  */
-void actionFadeIn(WaveData *data, double duration) {
-	if (duration < 0)
-		failure(ERROR_INVALID_TIME);
+void leaveStage(int previous, size_t frames, int frameSize, int channels) {
+	if (stats == NULL)
+		return;
 
-	int n = (int) (data->header->formatChunk.sampleRate * duration);
-	short *left = data->left;
-	short *right = data->right;
+	StageStats *stage = &stats->stages[stats->current];
+	stage->bytes += (unsigned long long) frames * frameSize;
+	stage->samples += (unsigned long long) frames * channels;
 
-	// Fade in only first n samples of each channel.
-	for (int i = 0; i < n; i++) {
-		double factor = i / (double) n;
+	enterStage(previous);
+}
 
-		left[i]  *= factor * factor;
-		right[i] *= factor * factor;
-	}
+/**
+ * Records that an action's pass also ran the actions after it.
+ *
+ * @param index The index of the first action of the pass.
+ * @param count The number of actions in the pass.
+ */
+void fuseStages(int index, int count) {
+	if (stats == NULL)
+		return;
+
+	stats->stages[actionStage(index)].fused = count;
+	for (int i = 1; i < count; i++)
+		stats->stages[actionStage(index + i)].fused = 0;
 }
 
 /**
- * Scales a short value by some double quantity.
- * Ensures the result will be on [SHRT_MIN, SHRT_MAX].
+ * Charges a buffer allocation to the current stage.
  *
- * @param sample The data to scale.
- * @param scale How much to scale the sample.
- * @return The scaled short.
+ * @param bytes The size of the allocation.
  */
-short scaleSample(short sample, double scale) {
-	int temp = (int) (sample * scale);
-	if (temp < SHRT_MIN)
-		temp = SHRT_MIN;
-	if (temp > SHRT_MAX)
-		temp = SHRT_MAX;
-	return (short) temp;
+void noteAllocation(size_t bytes) {
+	if (stats != NULL)
+		stats->stages[stats->current].allocated += bytes;
 }
 
 /**
- * The '-v' action.  Scales the volume of the data.
+ * Records the levels a '-n' measured and the gain it worked out from them.
  *
- * @param data The WaveData struct containing the samples whose volume to scale.
- * @param scale How much to scale the volume.
+ * @param index The index of the action in the chain.
+ * @param levels The levels.
+ * @param gain The gain.
  */
-void actionVolume(WaveData *data, double scale) {
-	if (scale < 0)
-		failure(ERROR_INVALID_VOLUME);
+void noteLevels(int index, const Levels *levels, double gain) {
+	if (stats == NULL)
+		return;
 
-	// Scale data in left and right channels.
-	for (int i = 0; i < data->numSamples; i++) {
-		data->left[i]  = scaleSample(data->left[i], scale);
-		data->right[i] = scaleSample(data->right[i], scale);
-	}
+	StageStats *stage = &stats->stages[actionStage(index)];
+	stage->measured = 1;
+	stage->levels = *levels;
+	stage->gain = gain;
 }
 
 /**
- * The '-e' action.  Adds an echo to the sound data.
+ * Prints a level as a JSON number, or null for the -INFINITY of silence,
+ * which JSON has no number for.
  *
- * @param data The WaveData struct containing the data to add echos to.
- * @param delay How far in to the data to add the delay.
- * @param scale How much to scale the volume of the echo.
+ * @param level The level.
  */
-void actionEcho(WaveData *data, double delay, double scale) {
-	if (delay < 0 || scale < 0)
-		failure(ERROR_INVALID_ECHO);
+void printLevel(double level) {
+	if (isfinite(level))
+		fprintf(stderr, "%.2f", level);
+	else
+		fprintf(stderr, "null");
+}
 
-	int n = (int) (data->header->formatChunk.sampleRate * delay);
-	short *left  = malloc(sizeof(short) * (data->numSamples + n));
-	short *right = malloc(sizeof(short) * (data->numSamples + n));
-	if (left == NULL || right == NULL)
-		failure(ERROR_INSUFFICIENT_MEMORY);
+/**
+ * Prints the levels of a '-n' stage as more fields of its JSON object.
+ *
+ * @param stage The stage.
+ */
+void printLevels(const StageStats *stage) {
+	const Levels *levels = &stage->levels;
 
-	for (int i = 0; i < data->numSamples + n; i++) {
-		left[i]  = (i < data->numSamples ? data->left[i] : 0);
-		right[i] = (i < data->numSamples ? data->right[i] : 0);
+	fprintf(stderr, ",\"peak_dbfs\":[");
+	for (int c = 0; c < levels->numChannels; c++) {
+		if (c > 0)
+			fputc(',', stderr);
+		printLevel(levels->peak[c]);
+	}
 
-		if (i >= n) {
-			left[i]  += scaleSample(data->left[i - n], scale);
-			right[i] += scaleSample(data->right[i - n], scale);
-		}
+	fprintf(stderr, "],\"rms_dbfs\":[");
+	for (int c = 0; c < levels->numChannels; c++) {
+		if (c > 0)
+			fputc(',', stderr);
+		printLevel(levels->rms[c]);
 	}
 
-	// Update data records
-	free(data->left);
-	free(data->right);
+	fprintf(stderr, "],\"loudness_lufs\":");
+	printLevel(levels->loudness);
+	fprintf(stderr, ",\"gain\":%.6f", stage->gain);
+}
 
-	data->numSamples += n;
-	data->left = left;
-	data->right = right;
+/**
+ * Prints one stage of the stats as a JSON object.
+ *
+ * @param name The name of the stage.
+ * @param stage The stage.
+ */
+void printStage(const char *name, const StageStats *stage) {
+	fprintf(stderr, "{\"stage\":\"%s\",\"seconds\":%.6f,\"bytes\":%llu,\"samples\":%llu,"
+		"\"allocated\":%llu", name, stage->seconds, stage->bytes, stage->samples,
+		stage->allocated);
+}
 
-	data->header->size += 4 * n;
-	data->header->dataChunk.size += 4 * n;
+/**
+ * Names the path through the program the run takes, for its stats.
+ *
+ * @param path The name of the path.
+ */
+void setStatsPath(const char *path) {
+	if (stats != NULL)
+		stats->path = path;
 }
 
-// The main function.  Program begins here.
-int main(int argc, char **argv) {
-	// Create WaveData struct and load in file.
-	WaveData data;
-	data.header = readFileHeader();
-	readSoundData(&data);
+/**
+ * Prints the stats of the run as one line of JSON on stderr, with the stages
+ * in the order they run.  Each action's "index" is its place among the
+ * actions on the command line.  One that optimizeChain took out has "fused"
+ * 0 and a "folded_into" of the index of the action it was folded in to, or
+ * null if it was dropped, as a '-v 1' or either half of a pair that cancels
+ * is.
+ */
+void printStats(void) {
+	static const char *flags[] = { "-r", "-s", "-f", "-o", "-i", "-v", "-e", "-n", "-c" };
 
-	// Print out file header for convenience.
-	fprintf(stderr, "\nInput Wave Header Information\n\n");
-	printWaveHeader(data.header);
+	enterStage(STATS_OTHER);
 
-	for (int i = 1; i < argc; i++) {
-		int action = parseArgument(argv[i]);
-		
-		// Perform the action specified by the given argument.
-		switch (action) {
-		case 0: actionReverse(&data); break;
-		case 1: actionChangeSpeed(&data, parseDouble(argv[++i])); break;
-		case 2: actionFlipChannels(&data); break;
-		case 3: actionFadeOut(&data, parseDouble(argv[++i])); break;
-		case 4: actionFadeIn(&data, parseDouble(argv[++i])); break;
-		case 5: actionVolume(&data, parseDouble(argv[++i])); break;
-		case 6: actionEcho(&data, parseDouble(argv[++i]), parseDouble(argv[++i])); break;
-		}
-	}
-
-	// Print out file header to see comparison.
-	fprintf(stderr, "\nOutput Wave Header Information\n\n");
-	printWaveHeader(data.header);
-
-	// Write data to file and free allocated memory.
-	writeToFile(&data);
-	free(data.header);
-	free(data.left);
-	free(data.right);
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
 
-	return 0;
+	fprintf(stderr, "{\"path\":\"%s\",\"seconds\":%.6f,\"peak_rss_kb\":%ld,\"stages\":[",
+		stats->path, stats->mark - stats->start, (long) usage.ru_maxrss);
+
+	printStage("header", &stats->stages[STATS_HEADER]);
+	fprintf(stderr, "},");
+	printStage("read", &stats->stages[STATS_READ]);
+	fprintf(stderr, "},");
+
+	for (int i = 0; i < stats->numActions; i++) {
+		const StageStats *stage = &stats->stages[STATS_ACTION(i)];
+		const Action *action = &stats->actions[i];
+		printStage("action", stage);
+		fprintf(stderr, ",\"index\":%d,\"action\":\"%s\",\"fused\":%d", i,
+			flags[action->type], stage->fused);
+
+		if (stage->folded && action->foldedInto >= 0)
+			fprintf(stderr, ",\"folded_into\":%d", action->foldedInto);
+		else if (stage->folded)
+			fprintf(stderr, ",\"folded_into\":null");
+		if (stage->measured)
+			printLevels(stage);
+		fprintf(stderr, "},");
+	}
+
+	printStage("write", &stats->stages[STATS_WRITE]);
+	fprintf(stderr, "},");
+	printStage("other", &stats->stages[STATS_OTHER]);
+	fprintf(stderr, "}]}\n");
 }
 
+/**
+ * Validates the format of a wave file header.  Fails if the file is not an
+ * integer PCM or float wave file in one of the supported sample formats, or
+ * if its frame size does not match its channels and sample size.
+ *
+ * @param header The wave file header.
+ */
+void validateHeader(WaveHeader *header) {
+	if (strncmp(header->ID, "RIFF", 4) != 0)
+		failure(ERROR_FILE_NOT_RIFF);
+
+	if (strncmp(header->formatChunk.ID, "fmt ", 4) != 0
+		|| header->formatChunk.size != 16
+		|| (header->formatChunk.compression != 1 && header->formatChunk.compression != 3))
+		failure(ERROR_BAD_FORMAT_CHUNK);
+
+	if (strncmp(header->dataChunk.ID, "data", 4) != 0)
+		failure(ERROR_BAD_DATA_CHUNK);
+
+	if (header->formatChunk.channels == 0)
+		failure(ERROR_NO_CHANNELS);
+
+	if (header->formatChunk.sampleRate == 0)
+		failure(ERROR_INVALID_SAMPLE_RATE);
+
+	if (sampleFormat(header->formatChunk.compression, header->formatChunk.bitsPerSample) < 0)
+		failure(ERROR_INVALID_SAMPLE_SIZE);
+
+	if (header->formatChunk.blockAlign
+		!= header->formatChunk.channels * (header->formatChunk.bitsPerSample / 8))
+		failure(ERROR_BAD_FORMAT_CHUNK);
+}
+
+/**
+ * Reads the wave file header into an allocated struct and returns a pointer to
+ * it, leaving the input at the start of the sound data.  Chunks other than the
+ * format and data chunks are skipped.  In addition, the files format is
+ * validated.
+ *
+ * @return A pointer to the wave file header.
+ */
+WaveHeader *readFileHeader() {
+	// Read the wave file header
+	WaveHeader *header = malloc(sizeof(WaveHeader));
+	if (header == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	readHeader(header);
+
+	validateHeader(header);
+	return header;
+}
+
+// Number of frames moved per fread/fwrite call by the block I/O path.
+#define IO_BLOCK_FRAMES 16384
+
+// Bytes in one stereo frame of 16-bit samples.
+#define BYTES_PER_FRAME 4
+
+// The most frames a sound can have and still give its size in bytes.
+#define MAX_FRAMES (INT64_MAX / BYTES_PER_FRAME)
+
+/*
+ * Staging buffer shared by readFrames and writeFrames, of IO_BUFFER_BYTES.
+ * Held as shorts so it is at least sample-aligned; the bytes themselves are
+ * always decoded as little-endian regardless of the host.  The I/O state is
+ * per thread, so batch jobs can run side by side.  Each thread's buffer is
+ * allocated the first time it stages a block and freed when the thread
+ * exits, so the threads of a program linking the library carry none of it
+ * until they use it.
+ */
+#define IO_BUFFER_BYTES ((size_t) IO_BLOCK_FRAMES * BYTES_PER_FRAME)
+
+static pthread_key_t ioBufferKey;
+static pthread_once_t ioBufferOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Creates the key of the staging buffers, which frees each thread's buffer
+ * when it exits.
+ */
+void createIoBufferKey(void) {
+	pthread_key_create(&ioBufferKey, free);
+}
+
+/**
+ * Returns this thread's staging buffer, allocating it the first time.
+ *
+ * @return The buffer, of IO_BUFFER_BYTES.
+ */
+short *stagingBuffer(void) {
+	pthread_once(&ioBufferOnce, createIoBufferKey);
+
+	short *buffer = pthread_getspecific(ioBufferKey);
+	if (buffer == NULL) {
+		buffer = malloc(IO_BUFFER_BYTES);
+		if (buffer == NULL || pthread_setspecific(ioBufferKey, buffer) != 0) {
+			free(buffer);
+			failure(ERROR_INSUFFICIENT_MEMORY);
+		}
+	}
+
+	return buffer;
+}
+
+/*
+ * The checksums of sound data written to stdout, for a "--checksums" whose
+ * output cannot be read back once it is written.  Every writer of sound data
+ * to stdout hashes it on the way, one manifest block at a time, and only one
+ * thread writes the output at any time.  A writer thread cannot fail the run,
+ * so running out of memory for the checksums is only noted until the
+ * manifest is written.
+ */
+typedef struct _OutputChecksums {
+	size_t blockBytes; // Bytes in one block of the manifest.
+	int frameSize;
+	uint32_t crc;      // The checksum of the block being written.
+	size_t filled;     // How much of that block has been written.
+	uint32_t *sums;    // The checksums of the blocks before it.
+	int64_t numSums;
+	int64_t capacity;
+	int64_t bytes;     // Sound data written in all.
+	int failed;        // 1 if the checksums ran out of memory.
+} OutputChecksums;
+
+// The checksums of the output on stdout, or NULL without "--checksums".
+static OutputChecksums *outputChecksums = NULL;
+
+/**
+ * Ends the block of the output's checksums being written.
+ *
+ * @param sums The output's checksums.
+ */
+void endChecksumBlock(OutputChecksums *sums) {
+	if (sums->numSums == sums->capacity) {
+		int64_t capacity = sums->capacity > 0 ? 2 * sums->capacity : 64;
+		uint32_t *grown = realloc(sums->sums, sizeof(uint32_t) * capacity);
+		if (grown == NULL) {
+			sums->failed = 1;
+			return;
+		}
+		sums->sums = grown;
+		sums->capacity = capacity;
+	}
+
+	sums->sums[sums->numSums++] = sums->crc;
+	sums->crc = 0;
+	sums->filled = 0;
+}
+
+/**
+ * Hashes sound data written to stdout, if the output is being checksummed.
+ *
+ * @param bytes The sound data.
+ * @param size How many bytes there are.
+ */
+void checksumOutput(const void *bytes, size_t size) {
+	OutputChecksums *sums = outputChecksums;
+	if (sums == NULL)
+		return;
+
+	const unsigned char *next = bytes;
+	sums->bytes += (int64_t) size;
+	while (size > 0) {
+		size_t chunk = sums->blockBytes - sums->filled;
+		chunk = size < chunk ? size : chunk;
+		sums->crc = checksumBytes(sums->crc, next, chunk);
+		sums->filled += chunk;
+		if (sums->filled == sums->blockBytes)
+			endChecksumBlock(sums);
+
+		next += chunk;
+		size -= chunk;
+	}
+}
+
+/**
+ * Writes sound data to stdout, failing if it cannot all be written.
+ *
+ * @param bytes The sound data.
+ * @param size How many bytes there are.
+ */
+void writeSoundData(const void *bytes, size_t size) {
+	if (fwrite(bytes, 1, size, stdout) != size)
+		failure(ERROR_WRITE_FAILED);
+
+	checksumOutput(bytes, size);
+}
+
+/**
+ * Flushes stdout, failing if anything written to it so far, header or sound
+ * data, could not be written.
+ */
+void checkStdout(void) {
+	if (fflush(stdout) != 0 || ferror(stdout))
+		failure(ERROR_WRITE_FAILED);
+}
+
+/**
+ * When the input is a memory-mapped file, readFrames decodes straight out of
+ * the mapping instead of going through stdin and the staging buffer.
+ */
+static __thread const unsigned char *mappedInput = NULL;
+static __thread size_t mappedRemaining = 0;
+
+/**
+ * Reads up to IO_BLOCK_FRAMES interleaved frames from the input stream and
+ * splits them into the given left and right channels.  Fails if the stream
+ * ends before all of the frames are read.
+ *
+ * @param left Where to store the left channel samples.
+ * @param right Where to store the right channel samples.
+ * @param count How many frames to read, at most IO_BLOCK_FRAMES.
+ */
+void readFrames(short *left, short *right, int count) {
+	const unsigned char *bytes;
+	size_t size = (size_t) count * BYTES_PER_FRAME;
+
+	if (mappedInput != NULL) {
+		if (mappedRemaining < size)
+			failure(ERROR_INVALID_FILE_SIZE);
+
+		bytes = mappedInput;
+		mappedInput += size;
+		mappedRemaining -= size;
+	} else {
+		short *buffer = stagingBuffer();
+		if (fread(buffer, BYTES_PER_FRAME, count, stdin) != (size_t) count)
+			failure(ERROR_INVALID_FILE_SIZE);
+
+		bytes = (const unsigned char *) buffer;
+	}
+
+	// Each sample uses two bytes (a short).
+	// Samples alternate between the left and right channels.
+	for (int i = 0; i < count; i++, bytes += BYTES_PER_FRAME) {
+		left[i]  = (short) (bytes[0] | (bytes[1] << 8));
+		right[i] = (short) (bytes[2] | (bytes[3] << 8));
+	}
+}
+
+/**
+ * Interleaves up to IO_BLOCK_FRAMES frames from the given channels and writes
+ * them to the output stream in one call.
+ *
+ * @param left The left channel samples.
+ * @param right The right channel samples.
+ * @param count How many frames to write, at most IO_BLOCK_FRAMES.
+ * @param reversed 1 to write the frames last to first.
+ */
+void writeFrames(const short *left, const short *right, int count, int reversed) {
+	short *buffer = stagingBuffer();
+	unsigned char *bytes = (unsigned char *) buffer;
+	for (int i = 0; i < count; i++, bytes += BYTES_PER_FRAME) {
+		int j = reversed ? count - 1 - i : i;
+
+		bytes[0] = (left[j]  & 0x00FF) >> 0;
+		bytes[1] = (left[j]  & 0xFF00) >> 8;
+		bytes[2] = (right[j] & 0x00FF) >> 0;
+		bytes[3] = (right[j] & 0xFF00) >> 8;
+	}
+
+	writeSoundData(buffer, (size_t) BYTES_PER_FRAME * count);
+}
+
+/**
+ * Reads interleaved frames from the input stream without splitting them in to
+ * channels.  Like the header, the samples are used as they are stored, which
+ * assumes a little-endian host.  Fails if the stream ends early.
+ *
+ * @param frames Where to store the frames.
+ * @param count How many frames to read.
+ */
+void readInterleaved(short *frames, int64_t count) {
+	size_t size = (size_t) count * BYTES_PER_FRAME;
+
+	if (mappedInput != NULL) {
+		if (mappedRemaining < size)
+			failure(ERROR_INVALID_FILE_SIZE);
+
+		memcpy(frames, mappedInput, size);
+		mappedInput += size;
+		mappedRemaining -= size;
+	} else if (fread(frames, BYTES_PER_FRAME, count, stdin) != (size_t) count) {
+		failure(ERROR_INVALID_FILE_SIZE);
+	}
+}
+
+/**
+ * Writes interleaved frames to the output stream.  Frames whose channels are
+ * marked as swapped are flipped on the way out, and frames marked as reversed
+ * are written from the last one back, both through the staging buffer.
+ *
+ * @param frames The frames to write.
+ * @param count How many frames to write.
+ * @param swapped 1 if the two samples of each frame must be swapped.
+ * @param reversed 1 if the frames must be written last to first.
+ */
+void writeInterleaved(const short *frames, int64_t count, int swapped, int reversed) {
+	if (!swapped && !reversed) {
+		writeSoundData(frames, (size_t) BYTES_PER_FRAME * count);
+		return;
+	}
+
+	short *buffer = stagingBuffer();
+	for (int64_t i = 0; i < count; i += IO_BLOCK_FRAMES) {
+		int block = count - i < IO_BLOCK_FRAMES ? (int) (count - i) : IO_BLOCK_FRAMES;
+
+		if (reversed)
+			reverseFrames(buffer, frames + 2 * (count - i - block), block, swapped);
+		else
+			swapFrames(buffer, frames + 2 * i, block);
+
+		writeSoundData(buffer, (size_t) BYTES_PER_FRAME * block);
+	}
+}
+
+/**
+ * Reads interleaved frames as readInterleaved does, and measures them for a
+ * '-n' a block at a time, while each block is still in cache.
+ *
+ * @param frames Where to store the frames.
+ * @param count How many frames to read.
+ * @param loudness The measurement to feed, or NULL to only read.
+ */
+void readMeasured(short *frames, int64_t count, Loudness *loudness) {
+	if (loudness == NULL) {
+		readInterleaved(frames, count);
+		return;
+	}
+
+	for (int64_t i = 0; i < count; i += IO_BLOCK_FRAMES) {
+		int block = count - i < IO_BLOCK_FRAMES ? (int) (count - i) : IO_BLOCK_FRAMES;
+
+		readInterleaved(frames + 2 * i, block);
+		measureShorts(loudness, frames + 2 * i, frames + 2 * i + 1, 2, block);
+	}
+}
+
+/**
+ * Checks whether a chain starts with a '-n', whose input the read can
+ * measure on the way in.
+ *
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @return 1 if it does, 0 otherwise.
+ */
+int measuresOnRead(const Action *actions, int count) {
+	return count > 0 && actions[0].type == ACTION_NORMALIZE;
+}
+
+/**
+ * Reads the sound data from the input stream.  They are stored in the given
+ * WaveData struct's "left" and "right" fields, or in its "frames" field if
+ * its layout is interleaved.  The "numSamples" field is the number of bytes
+ * the sound data consumes divided by 4.  Both of the ping-pong buffers are
+ * allocated here, with room for the whole chain.
+ *
+ * @param A WaveData struct to store the sound data in.
+ * @param capacity The frames of room the longest stage of the chain needs.
+ * @param measure 1 to measure the data for a '-n' as it is read.
+ */
+void readSoundData(WaveData *data, int64_t capacity, int measure) {
+	// Divide by 4 to account for the sample size and number of channels.
+	data->numSamples = data->header->dataChunk.size / BYTES_PER_FRAME;
+
+	size_t size = (size_t) BYTES_PER_FRAME * (capacity > 0 ? capacity : 1);
+	data->capacity = capacity;
+	data->arena = createArena(2 * arenaSpace(size));
+	if (data->arena == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	noteAllocation(2 * arenaSpace(size));
+
+	short *buffer = arenaAlloc(data->arena, size);
+	data->spare = arenaAlloc(data->arena, size);
+
+	data->measured = measure;
+	if (measure)
+		initLoudness(&data->loudness, 2, data->header->formatChunk.sampleRate, 32768);
+
+	if (data->layout == LAYOUT_INTERLEAVED) {
+		data->frames = buffer;
+		readMeasured(data->frames, data->numSamples, measure ? &data->loudness : NULL);
+		return;
+	}
+
+	data->left  = buffer;
+	data->right = buffer + capacity;
+
+	for (int64_t i = 0; i < data->numSamples; i += IO_BLOCK_FRAMES) {
+		int count = data->numSamples - i < IO_BLOCK_FRAMES
+			? (int) (data->numSamples - i) : IO_BLOCK_FRAMES;
+
+		readFrames(data->left + i, data->right + i, count);
+		if (measure)
+			measureShorts(&data->loudness, data->left + i, data->right + i, 1, count);
+	}
+}
+
+/**
+ * Writes the wave data to another file.
+ *
+ * @param data The WaveData containing to file header and sound data.
+ */
+void writeToFile(WaveData *data) {
+	writeHeader(data->header);
+
+	if (data->layout == LAYOUT_INTERLEAVED) {
+		writeInterleaved(data->frames, data->numSamples, data->swapped, data->reversed);
+		return;
+	}
+
+	for (int64_t i = 0; i < data->numSamples; i += IO_BLOCK_FRAMES) {
+		int count = data->numSamples - i < IO_BLOCK_FRAMES
+			? (int) (data->numSamples - i) : IO_BLOCK_FRAMES;
+
+		// Reversed data is written from its last block back.
+		int64_t first = data->reversed ? data->numSamples - i - count : i;
+		writeFrames(data->left + first, data->right + first, count, data->reversed);
+	}
+}
+
+/**
+ * Note: Not required by this program. For debugging purposes.
+ *
+ * Prints the file header in a readable form.
+ *
+ * @param header The wave file header.
+ */
+void printWaveHeader(WaveHeader *header) {
+	fprintf(stderr, "ID:              %.*s\n", 4, header->ID);
+	fprintf(stderr, "Size:            %llu\n", header->size);
+	fprintf(stderr, "Format:          %.*s\n", 4, header->format);
+	fprintf(stderr, "Format ID:       %.*s\n", 4, header->formatChunk.ID);
+	fprintf(stderr, "Format Size:     %d\n", header->formatChunk.size);
+	fprintf(stderr, "Compression:     %d\n", header->formatChunk.compression);
+	fprintf(stderr, "Channels:        %d\n", header->formatChunk.channels);
+	fprintf(stderr, "Sample Rate:     %d\n", header->formatChunk.sampleRate);
+	fprintf(stderr, "Byte Rate:       %d\n", header->formatChunk.byteRate);
+	fprintf(stderr, "Block Align:     %d\n", header->formatChunk.blockAlign);
+	fprintf(stderr, "Bits Per Sample: %d\n", header->formatChunk.bitsPerSample);
+	fprintf(stderr, "Data ID:         %.*s\n", 4, header->dataChunk.ID);
+	fprintf(stderr, "Data Size:       %llu\n", header->dataChunk.size);
+	fprintf(stderr, "\n");
+}
+
+/**
+ * Prints a titled header dump on stderr, unless '--stats' is reporting on the
+ * run instead.
+ *
+ * @param title "Input" or "Output".
+ * @param header The wave file header.
+ */
+void showHeader(const char *title, WaveHeader *header) {
+	if (stats != NULL)
+		return;
+
+	fprintf(stderr, "\n%s Wave Header Information\n\n", title);
+	printWaveHeader(header);
+}
+
+/**
+ * Reads an argument and parses it as a flag.  On success, the 9 flags '-r',
+ * '-s', '-f', '-o', '-i', '-v', '-e', '-n' and '-c' return the integer codes
+ * 0 - 8 (ACTION_REVERSE through ACTION_CONVOLVE), respectively, referring to
+ * individual actions to be taken.  Fails if none
+ * of these are matched.
+ *
+ * @param arg The argument to parse.
+ * @return An integer code representing the matched flag.
+ */
+int parseArgument(char *arg) {
+	if (*arg++ == '-') {
+		int action = -1;
+
+		switch (*arg++) {
+		case 'r': action = ACTION_REVERSE;  break;
+		case 's': action = ACTION_SPEED;    break;
+		case 'f': action = ACTION_FLIP;     break;
+		case 'o': action = ACTION_FADE_OUT; break;
+		case 'i': action = ACTION_FADE_IN;  break;
+		case 'v': action = ACTION_VOLUME;   break;
+		case 'e': action = ACTION_ECHO;     break;
+		case 'n': action = ACTION_NORMALIZE; break;
+		case 'c': action = ACTION_CONVOLVE; break;
+		}
+
+		// If matched and arg had a length of 2.
+		if (action != -1 && *arg++ == '\0')
+			return action;
+	}
+
+	// If '-[rsfoivenc]' is not matched.
+	failure(ERROR_COMMAND_LINE_USAGE);
+}
+
+/**
+ * Parses a command line argument as a double and returns the result.
+ * The argument is first checked to ensure it matches the discription
+ * of a positive integer, which here is '\d+.|.\d+|\d+.\d+'.
+ * A negative double is returned upon failure.
+ *
+ * @param arg The argument to parse.
+ * @return The parsed double.
+ */
+double parseDouble(char *arg) {
+	// Check that arg is in the correct form.
+	int hasDot = 0;
+	for (int i = 0; arg[i]; i++) {
+		if (arg[i] == '.') {
+			if (hasDot)
+				return -1;
+			else
+				hasDot = 1;
+
+		} else if ('0' > arg[i] || arg[i] > '9') {
+			return -1;
+		}
+	}
+
+	// Parse the argument.
+	return atof(arg);
+}
+
+/**
+ * The '-r' action.  Reverses the order of the sound samples so they play in
+ * reverse.
+ *
+ * @param data The WaveData struct containing the samples to reverse.
+ */
+void actionReverse(WaveData *data) {
+	short temp;
+
+	// Go half-way - too far would undo the reversal.
+	for (int64_t i = 0; i < data->numSamples / 2; i++) {
+		temp = data->left[i];
+		data->left[i] = data->left[data->numSamples - i - 1];
+		data->left[data->numSamples - i - 1] = temp;
+
+		temp = data->right[i];
+		data->right[i] = data->right[data->numSamples - i - 1];
+		data->right[data->numSamples - i - 1] = temp;
+	}
+}
+
+/**
+ * Returns the ping-pong buffer the sound data is in now.  A flip can leave
+ * "right" before "left", so the buffer starts at whichever comes first.
+ *
+ * @param data The WaveData struct.
+ * @return The buffer.
+ */
+short *activeBuffer(const WaveData *data) {
+	if (data->layout == LAYOUT_INTERLEAVED)
+		return data->frames;
+
+	return data->left < data->right ? data->left : data->right;
+}
+
+/**
+ * The '-s' action.  Slows down or speeds up the sound data.
+ *
+ * @param data The WaveData struct containing the samples to speed up or down.
+ * @param factor How much to scale the speed.
+ */
+void actionChangeSpeed(WaveData *data, double factor) {
+	if (factor <= 0)
+		failure(ERROR_INVALID_SPEED);
+
+	// Build the new channels in the spare buffer.
+	int64_t length = (int64_t) (data->numSamples / factor);
+	short *left = data->spare;
+	short *right = data->spare + data->capacity;
+
+	// Copy over the old sound data.
+	for (int64_t i = 0; i < length; i++) {
+		int64_t j = (int64_t) (i * factor);
+
+		left[i]  = data->left[j];
+		right[i] = data->right[j];
+	}
+
+	// Update the data records.
+	data->spare = activeBuffer(data);
+
+	data->numSamples = length;
+	data->left = left;
+	data->right = right;
+
+	data->header->size = WAVE_HEADER_SIZE + 4 * length;
+	data->header->dataChunk.size = 4 * length;
+}
+
+/**
+ * The '-f' action.  Swaps the left and the right channels.
+ *
+ * @param data The WaveData struct containing the channels to swap.
+ */
+void actionFlipChannels(WaveData *data) {
+	short *temp = data->left;
+	data->left = data->right;
+	data->right = temp;
+}
+
+// Frames per block of precomputed fade gains.
+#define ENVELOPE_BLOCK_FRAMES 1024
+
+/**
+ * Applies frames [first, first + frames) of an n-frame fade envelope.  The
+ * gains are computed once per block and shared by both channels.  With a
+ * stride of 2 the channels are interleaved in one buffer.  Reversed samples
+ * run backwards through the fade, so the first sample gets the last gain.
+ *
+ * @param left The left channel samples to fade.
+ * @param right The right channel samples to fade.
+ * @param stride The distance between consecutive samples of a channel.
+ * @param frames The number of frames to fade.
+ * @param first The index in the fade of the first frame.
+ * @param n The length of the whole fade in frames.
+ * @param curve The CURVE_* shape of the fade.
+ * @param fadeOut 1 for a fade out, 0 for a fade in.
+ * @param reversed 1 if the samples are stored in reverse order.
+ */
+void applyFade(short *left, short *right, int stride, int64_t frames, int64_t first,
+		int64_t n, int curve, int fadeOut, int reversed) {
+	double gains[ENVELOPE_BLOCK_FRAMES];
+
+	for (int64_t i = 0; i < frames; i += ENVELOPE_BLOCK_FRAMES) {
+		int count = frames - i < ENVELOPE_BLOCK_FRAMES
+			? (int) (frames - i) : ENVELOPE_BLOCK_FRAMES;
+
+		if (reversed) {
+			fillEnvelope(gains, count, first + frames - i - count, n, curve, fadeOut);
+			for (int lo = 0, hi = count - 1; lo < hi; lo++, hi--) {
+				double temp = gains[lo];
+				gains[lo] = gains[hi];
+				gains[hi] = temp;
+			}
+		} else {
+			fillEnvelope(gains, count, first + i, n, curve, fadeOut);
+		}
+
+		if (stride == 1) {
+			applyGains(left + i, gains, count);
+			applyGains(right + i, gains, count);
+		} else {
+			applyFrameGains((left < right ? left : right) + 2 * i, gains, count);
+		}
+	}
+}
+
+/**
+ * Converts a duration in seconds to a number of frames at the header's
+ * sample rate, the same way the fade and echo actions do.  Fails with the
+ * given error if there would be more than MAX_FRAMES.
+ *
+ * @param header The wave file header.
+ * @param duration The duration in seconds, at least 0.
+ * @param error The error-message of the action the duration belongs to.
+ * @return The number of frames.
+ */
+int64_t durationFrames(const WaveHeader *header, double duration, char *error) {
+	double frames = header->formatChunk.sampleRate * duration;
+	if (!(frames < (double) MAX_FRAMES))
+		failure(error);
+
+	return (int64_t) frames;
+}
+
+/**
+ * The '-o' action.  Fades out the sound near the end of the data.
+ *
+ * @param data The WaveData stuct containing the samples to fade.
+ * @param duration How long the fade out should last.
+ * @param curve The CURVE_* shape of the fade.
+ */
+void actionFadeOut(WaveData *data, double duration, int curve) {
+	if (duration < 0)
+		failure(ERROR_INVALID_TIME);
+
+	int64_t n = durationFrames(data->header, duration, ERROR_INVALID_TIME);
+
+	// Fade out only last n samples of each channel.  A fade longer than
+	// the data starts part of the way in to the curve.
+	int64_t start = data->numSamples - n;
+	int64_t skip = start < 0 ? -start : 0;
+	applyFade(data->left + start + skip, data->right + start + skip, 1,
+		n - skip, skip, n, curve, 1, 0);
+}
+
+/**
+ * The '-i' action.  Fades in the sound near the start of the data.
+ *
+ * @param data The WaveData struct containing the samples to fade.
+ * @param duration How long the fade in should last.
+ * @param curve The CURVE_* shape of the fade.
+ */
+void actionFadeIn(WaveData *data, double duration, int curve) {
+	if (duration < 0)
+		failure(ERROR_INVALID_TIME);
+
+	int64_t n = durationFrames(data->header, duration, ERROR_INVALID_TIME);
+
+	// Fade in only first n samples of each channel.
+	applyFade(data->left, data->right, 1, n < data->numSamples ? n : data->numSamples,
+		0, n, curve, 0, 0);
+}
+
+/**
+ * Scales a run of samples of any length.  The kernels take a block's worth of
+ * samples at a time, so a whole channel is scaled a block at a time.
+ *
+ * @param samples The samples.
+ * @param count The number of samples.
+ * @param scale How much to scale the samples.
+ */
+void scaleSampleRun(short *samples, int64_t count, double scale) {
+	for (int64_t i = 0; i < count; i += 2 * IO_BLOCK_FRAMES) {
+		int block = count - i < 2 * IO_BLOCK_FRAMES ? (int) (count - i) : 2 * IO_BLOCK_FRAMES;
+		scaleSamples(samples + i, block, scale);
+	}
+}
+
+/**
+ * The '-v' action.  Scales the volume of the data.
+ *
+ * @param data The WaveData struct containing the samples whose volume to scale.
+ * @param scale How much to scale the volume.
+ */
+void actionVolume(WaveData *data, double scale) {
+	if (scale < 0)
+		failure(ERROR_INVALID_VOLUME);
+
+	// Scale data in left and right channels.
+	scaleSampleRun(data->left, data->numSamples, scale);
+	scaleSampleRun(data->right, data->numSamples, scale);
+}
+
+/**
+ * The '-e' action.  Adds an echo to the sound data.  The channels already
+ * have room for the echo's tail, and the echo runs from the back, so every
+ * delayed sample is read before it is overwritten.
+ *
+ * @param data The WaveData struct containing the data to add echos to.
+ * @param delay How far in to the data to add the delay.
+ * @param scale How much to scale the volume of the echo.
+ */
+void actionEcho(WaveData *data, double delay, double scale) {
+	if (delay < 0 || scale < 0)
+		failure(ERROR_INVALID_ECHO);
+
+	int64_t n = durationFrames(data->header, delay, ERROR_INVALID_ECHO);
+	int64_t numSamples = data->numSamples;
+
+	for (int64_t i = numSamples + n - 1; i >= 0; i--) {
+		short left  = (i < numSamples ? data->left[i] : 0);
+		short right = (i < numSamples ? data->right[i] : 0);
+
+		if (i >= n) {
+			left  += scaleSample(data->left[i - n], scale);
+			right += scaleSample(data->right[i - n], scale);
+		}
+
+		data->left[i]  = left;
+		data->right[i] = right;
+	}
+
+	// Update data records
+	data->numSamples += n;
+
+	data->header->size += 4 * n;
+	data->header->dataChunk.size += 4 * n;
+}
+
+/*
+ * The frame variants of the actions below work in place on interleaved
+ * little-endian frames, such as those in a mapped file, rather than on
+ * separate left and right channels.  Like the header I/O in wave.c, they
+ * assume a little-endian host.  Each one produces exactly the samples its
+ * whole-file counterpart does.
+ */
+
+// Frames per block swapped from each end by frameReverse.
+#define REVERSE_BLOCK_FRAMES 4096
+
+/**
+ * One in-place reversal of interleaved frames, shared by its block tasks.
+ */
+typedef struct _ReversePass {
+	short *frames;
+	int64_t numSamples;
+} ReversePass;
+
+/**
+ * Swaps the index'th block from the front of the frames with its mirror
+ * image at the back, reversing both on the way.  Each task touches only its
+ * own pair of blocks.
+ *
+ * @param context The ReversePass.
+ * @param index The index of the block.
+ */
+void runReverseBlock(void *context, int index) {
+	const ReversePass *pass = context;
+	short temp[2 * REVERSE_BLOCK_FRAMES];
+	int64_t first = (int64_t) index * REVERSE_BLOCK_FRAMES;
+	int count = pass->numSamples / 2 - first < REVERSE_BLOCK_FRAMES
+		? (int) (pass->numSamples / 2 - first) : REVERSE_BLOCK_FRAMES;
+
+	short *front = pass->frames + 2 * first;
+	short *back = pass->frames + 2 * (pass->numSamples - first - count);
+
+	reverseFrames(temp, front, count, 0);
+	reverseFrames(front, back, count, 0);
+	memcpy(back, temp, (size_t) BYTES_PER_FRAME * count);
+}
+
+/**
+ * The '-r' action on interleaved frames.  Blocks from the front and the back
+ * are swapped in pairs, over the worker pool when there is one.
+ *
+ * @param frames The interleaved frames.
+ * @param numSamples The number of frames.
+ */
+void frameReverse(short *frames, int64_t numSamples) {
+	ReversePass pass = { frames, numSamples };
+	int64_t half = numSamples / 2;
+
+	runTasks((int) ((half + REVERSE_BLOCK_FRAMES - 1) / REVERSE_BLOCK_FRAMES),
+		runReverseBlock, &pass);
+}
+
+/**
+ * The '-s' action on interleaved frames.  Speeding up reads ahead of where it
+ * writes, so it runs forwards; slowing down reads behind, so it runs
+ * backwards.  Either way no frame is overwritten before it is read.  The
+ * buffer must have room for the longer of the input and the output.
+ *
+ * @param frames The interleaved frames.
+ * @param numSamples The number of frames.
+ * @param factor How much to scale the speed.
+ * @return The new number of frames.
+ */
+int64_t frameChangeSpeed(short *frames, int64_t numSamples, double factor) {
+	int64_t length = (int64_t) (numSamples / factor);
+
+	if (factor >= 1) {
+		for (int64_t i = 0; i < length; i++) {
+			int64_t j = (int64_t) (i * factor);
+
+			frames[2 * i]     = frames[2 * j];
+			frames[2 * i + 1] = frames[2 * j + 1];
+		}
+	} else {
+		for (int64_t i = length - 1; i >= 0; i--) {
+			int64_t j = (int64_t) (i * factor);
+
+			frames[2 * i]     = frames[2 * j];
+			frames[2 * i + 1] = frames[2 * j + 1];
+		}
+	}
+
+	return length;
+}
+
+/**
+ * The '-f' action on interleaved frames.  Swaps the two samples of each frame.
+ *
+ * @param frames The interleaved frames.
+ * @param numSamples The number of frames.
+ */
+void frameFlipChannels(short *frames, int64_t numSamples) {
+	for (int64_t i = 0; i < numSamples; i++) {
+		short temp = frames[2 * i];
+		frames[2 * i] = frames[2 * i + 1];
+		frames[2 * i + 1] = temp;
+	}
+}
+
+/**
+ * The '-o' action on interleaved frames.
+ *
+ * @param frames The interleaved frames.
+ * @param numSamples The number of frames.
+ * @param n The length of the fade in frames.
+ * @param curve The CURVE_* shape of the fade.
+ */
+void frameFadeOut(short *frames, int64_t numSamples, int64_t n, int curve) {
+	int64_t start = numSamples - n;
+	int64_t skip = start < 0 ? -start : 0;
+
+	applyFade(frames + 2 * (start + skip), frames + 2 * (start + skip) + 1, 2,
+		n - skip, skip, n, curve, 1, 0);
+}
+
+/**
+ * The '-i' action on interleaved frames.
+ *
+ * @param frames The interleaved frames.
+ * @param numSamples The number of frames.
+ * @param n The length of the fade in frames.
+ * @param curve The CURVE_* shape of the fade.
+ */
+void frameFadeIn(short *frames, int64_t numSamples, int64_t n, int curve) {
+	applyFade(frames, frames + 1, 2, n < numSamples ? n : numSamples, 0, n, curve, 0, 0);
+}
+
+/**
+ * The '-v' action on interleaved frames.  Both channels are scaled the same,
+ * so the frames are treated as one run of samples.
+ *
+ * @param frames The interleaved frames.
+ * @param numSamples The number of frames.
+ * @param scale How much to scale the volume.
+ */
+void frameVolume(short *frames, int64_t numSamples, double scale) {
+	scaleSampleRun(frames, 2 * numSamples, scale);
+}
+
+/**
+ * Adds the plain taps of an echo to the interleaved output frames in
+ * [from, to).  Runs from the back so every delayed frame below "from" or in
+ * the range itself is read before it is overwritten.  Input frames past
+ * "numSamples" are silent.
+ *
+ * @param frames The interleaved frames.
+ * @param numSamples The number of input frames.
+ * @param taps The taps of the echo, none of them feedback taps.
+ * @param n The delay of each tap in frames.
+ * @param numTaps The number of taps.
+ * @param from The first output frame to compute.
+ * @param to The output frame to stop at.
+ * @param below The "reach" input frames just before "from", if those frames
+ *        may already have been overwritten, or NULL to read them in place.
+ * @param reach The longest delay of the taps.
+ */
+void echoFrames(short *frames, int64_t numSamples, const EchoTap *taps, const int64_t *n,
+		int numTaps, int64_t from, int64_t to, const short *below, int64_t reach) {
+	for (int64_t i = to - 1; i >= from; i--) {
+		short left  = (i < numSamples ? frames[2 * i] : 0);
+		short right = (i < numSamples ? frames[2 * i + 1] : 0);
+
+		for (int k = 0; k < numTaps; k++) {
+			int64_t j = i - n[k];
+			if (j < 0 || j >= numSamples)
+				continue;
+
+			const short *delayed = frames + 2 * j;
+			if (below != NULL && j < from)
+				delayed = below + 2 * (j - (from - reach));
+
+			left  += scaleSample(delayed[0], taps[k].scale);
+			right += scaleSample(delayed[1], taps[k].scale);
+		}
+
+		frames[2 * i]     = left;
+		frames[2 * i + 1] = right;
+	}
+}
+
+/**
+ * The '-e' action on interleaved frames, for echoes without feedback taps.
+ * Runs from the back so every delayed frame is read before it is
+ * overwritten.  The buffer must have room for "numSamples" plus the longest
+ * delay frames.
+ *
+ * @param frames The interleaved frames.
+ * @param numSamples The number of frames.
+ * @param taps The taps of the echo.
+ * @param n The delay of each tap in frames.
+ * @param numTaps The number of taps.
+ * @return The new number of frames.
+ */
+int64_t frameEcho(short *frames, int64_t numSamples, const EchoTap *taps, const int64_t *n,
+		int numTaps) {
+	int64_t reach = 0;
+	for (int k = 0; k < numTaps; k++) {
+		if (n[k] > reach)
+			reach = n[k];
+	}
+
+	echoFrames(frames, numSamples, taps, n, numTaps, 0, numSamples + reach, NULL, 0);
+
+	return numSamples + reach;
+}
+
+/**
+ * Parses the optional curve name of a fade: "quadratic" (the default),
+ * "linear", "equal-power" or "exponential".
+ *
+ * @param arg The argument to parse.
+ * @param curve Where to store the CURVE_* code on a match.
+ * @return 1 if the argument names a curve, 0 otherwise.
+ */
+int parseCurve(const char *arg, int *curve) {
+	static const char *names[] = { "quadratic", "linear", "equal-power", "exponential" };
+	static const int curves[] = {
+		CURVE_QUADRATIC, CURVE_LINEAR, CURVE_EQUAL_POWER, CURVE_EXPONENTIAL
+	};
+
+	for (int i = 0; i < 4; i++) {
+		if (strcmp(arg, names[i]) == 0) {
+			*curve = curves[i];
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Parses the optional resampling method of a speed change: "nearest" (the
+ * default), "linear", "cubic" or "sinc".
+ *
+ * @param arg The argument to parse.
+ * @param method Where to store the RESAMPLE_* code on a match.
+ * @return 1 if the argument names a method, 0 otherwise.
+ */
+int parseResampler(const char *arg, int *method) {
+	static const char *names[] = { "nearest", "linear", "cubic", "sinc" };
+	static const int methods[] = {
+		RESAMPLE_NEAREST, RESAMPLE_LINEAR, RESAMPLE_CUBIC, RESAMPLE_SINC
+	};
+
+	for (int i = 0; i < 4; i++) {
+		if (strcmp(arg, names[i]) == 0) {
+			*method = methods[i];
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Parses a command line argument as a level below full scale, which is
+ * written with its minus sign, like "-23".  A positive number is returned
+ * upon failure, as for a positive level, which no action accepts.
+ *
+ * @param arg The argument to parse.
+ * @return The parsed level.
+ */
+double parseLevel(char *arg) {
+	double level = parseDouble(arg[0] == '-' ? arg + 1 : arg);
+	if (level < 0)
+		return 1;
+
+	return arg[0] == '-' ? -level : level;
+}
+
+/**
+ * Parses the optional measure a normalize works to: "lufs" (the default) for
+ * integrated loudness, "peak" or "rms".
+ *
+ * @param arg The argument to parse.
+ * @param method Where to store the NORMALIZE_* code on a match.
+ * @return 1 if the argument names a measure, 0 otherwise.
+ */
+int parseNormalizer(const char *arg, int *method) {
+	static const char *names[] = { "lufs", "peak", "rms" };
+	static const int methods[] = { NORMALIZE_LOUDNESS, NORMALIZE_PEAK, NORMALIZE_RMS };
+
+	for (int i = 0; i < 3; i++) {
+		if (strcmp(arg, names[i]) == 0) {
+			*method = methods[i];
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Returns the next command line argument as an action parameter, advancing
+ * the index past it.  Fails if the command line has run out of arguments.
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @param i The index of the argument before the parameter.
+ * @return The parsed parameter.
+ */
+double parseParameter(int argc, char **argv, int *i) {
+	if (++*i >= argc)
+		failure(ERROR_COMMAND_LINE_USAGE);
+
+	return parseDouble(argv[*i]);
+}
+
+/**
+ * A file being loaded as an impulse response: its bytes, the impulse response
+ * it is decoded in to, and the channels it is decoded through.
+ */
+typedef struct _ImpulseLoad {
+	const unsigned char *bytes;
+	size_t size;
+	Impulse *impulse;
+	void *channels[2];
+} ImpulseLoad;
+
+/**
+ * Validates the header of an impulse response file held in memory, just as
+ * readFileHeader validates an input file's, and decodes its sound data on to
+ * full scale 1.
+ *
+ * @param context The ImpulseLoad.
+ */
+void decodeImpulse(void *context) {
+	ImpulseLoad *load = context;
+	Impulse *impulse = load->impulse;
+	WaveHeader header;
+
+	size_t offset = readHeaderBuffer(&header, load->bytes, load->size);
+	validateHeader(&header);
+
+	const FormatChunk *format = &header.formatChunk;
+	int64_t length = header.dataChunk.size / format->blockAlign;
+	if (load->size - offset < (size_t) length * format->blockAlign)
+		failure(ERROR_INVALID_FILE_SIZE);
+	if (length < 1 || format->channels > 2)
+		failure(ERROR_INVALID_IMPULSE);
+
+	impulse->numChannels = format->channels;
+	impulse->sampleRate = format->sampleRate;
+	impulse->length = length;
+	for (int c = 0; c < impulse->numChannels; c++) {
+		load->channels[c] = malloc((size_t) SAMPLE_SIZE * length);
+		impulse->samples[c] = malloc(sizeof(double) * length);
+		if (load->channels[c] == NULL || impulse->samples[c] == NULL)
+			failure(ERROR_INSUFFICIENT_MEMORY);
+	}
+
+	int code = sampleFormat(format->compression, format->bitsPerSample);
+	SampleKernels kernels = sampleKernels(code, impulse->numChannels);
+	kernels.decode(load->bytes + offset, load->channels, impulse->numChannels, 0, length);
+
+	double fullScale = code == FORMAT_F32 ? 1 : ldexp(1, format->bitsPerSample - 1);
+	for (int c = 0; c < impulse->numChannels; c++) {
+		const int32_t *ints = load->channels[c];
+		const float *floats = load->channels[c];
+		for (int64_t i = 0; i < length; i++)
+			impulse->samples[c][i] = code == FORMAT_F32 ? floats[i] : ints[i] / fullScale;
+	}
+}
+
+/**
+ * Frees an impulse response.
+ *
+ * @param impulse The impulse response, or NULL.
+ */
+void freeImpulse(Impulse *impulse) {
+	if (impulse == NULL)
+		return;
+
+	free(impulse->samples[0]);
+	free(impulse->samples[1]);
+	free(impulse);
+}
+
+/**
+ * Loads the impulse response of a '-c' from a wave file of any of the
+ * supported formats.  The file is read whole before it is decoded, and
+ * freed whether or not it decodes.
+ *
+ * @param path The path of the file.
+ * @return The allocated impulse response.
+ */
+Impulse *loadImpulse(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		failure(ERROR_FILE_ACCESS);
+
+	long size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+	unsigned char *bytes = size >= 0 ? malloc(size > 0 ? (size_t) size : 1) : NULL;
+	int read = bytes != NULL && fseek(file, 0, SEEK_SET) == 0
+		&& fread(bytes, 1, (size_t) size, file) == (size_t) size;
+	fclose(file);
+	if (!read) {
+		free(bytes);
+		failure(size < 0 ? ERROR_FILE_ACCESS : ERROR_INSUFFICIENT_MEMORY);
+	}
+
+	ImpulseLoad load = { bytes, (size_t) size, calloc(1, sizeof(Impulse)), { NULL, NULL } };
+	char *error = load.impulse != NULL ? catchFailure(decodeImpulse, &load)
+		: ERROR_INSUFFICIENT_MEMORY;
+
+	free(bytes);
+	free(load.channels[0]);
+	free(load.channels[1]);
+	if (error != NULL) {
+		freeImpulse(load.impulse);
+		failure(error);
+	}
+
+	return load.impulse;
+}
+
+/**
+ * Checks an action's parameters, failing with the same message the action
+ * itself would fail with.
+ *
+ * @param action The action to check.
+ */
+void validateAction(const Action *action) {
+	// Written so that NaN fails every check, as infinity does the finite one.
+	switch (action->type) {
+	case ACTION_SPEED:
+		if (!(action->arg1 > 0) || !isfinite(action->arg1))
+			failure(ERROR_INVALID_SPEED);
+		break;
+	case ACTION_FADE_OUT:
+	case ACTION_FADE_IN:
+		if (!(action->arg1 >= 0) || !isfinite(action->arg1))
+			failure(ERROR_INVALID_TIME);
+		break;
+	case ACTION_VOLUME:
+		if (!(action->arg1 >= 0) || !isfinite(action->arg1))
+			failure(ERROR_INVALID_VOLUME);
+		break;
+	case ACTION_NORMALIZE:
+		if (!(action->arg1 <= 0) || !isfinite(action->arg1))
+			failure(ERROR_INVALID_NORMALIZE);
+		break;
+	case ACTION_ECHO: {
+		double feedback = 0;
+		for (int k = 0; k < action->numTaps; k++) {
+			if (!(action->taps[k].delay >= 0) || !isfinite(action->taps[k].delay)
+				|| !(action->taps[k].scale >= 0) || !isfinite(action->taps[k].scale))
+				failure(ERROR_INVALID_ECHO);
+			if (action->taps[k].feedback)
+				feedback += action->taps[k].scale;
+		}
+
+		// Feedback that does not die away would never end.
+		if (feedback >= 1)
+			failure(ERROR_INVALID_FEEDBACK);
+		break;
+	}
+	}
+}
+
+/**
+ * Sets up an action of the given type with no parameters, a quadratic curve
+ * and the nearest-sample method.
+ *
+ * @param action The action.
+ * @param type The ACTION_* type.
+ */
+void initAction(Action *action, int type) {
+	action->type = type;
+	action->ordinal = 0;
+	action->foldedInto = -1;
+	action->arg1 = 0;
+	action->arg2 = 0;
+	action->curve = CURVE_QUADRATIC;
+	action->method = RESAMPLE_NEAREST;
+	action->numTaps = 0;
+	action->impulse = NULL;
+}
+
+/**
+ * Checks whether a scale is a power of two, so multiplying by it is exact.
+ *
+ * @param scale The scale.
+ * @return 1 if it is, 0 otherwise.
+ */
+int isPowerOfTwo(double scale) {
+	int exponent;
+	return scale > 0 && frexp(scale, &exponent) == 0.5;
+}
+
+/**
+ * Checks whether two scales and their product are all exact in single
+ * precision, and so in double precision too.
+ *
+ * @param a The first scale.
+ * @param b The second scale.
+ * @return 1 if they are, 0 otherwise.
+ */
+int isExactProduct(double a, double b) {
+	double c = a * b;
+	return fma(a, b, -c) == 0 && (float) a == a && (float) b == b && (float) c == c
+		&& (c == 0 || c >= FLT_MIN);
+}
+
+/**
+ * Checks whether '-v a -v b' gives the same samples as '-v a*b' in every
+ * path, apart from the clamping scaleSample does between the two.  Integer
+ * samples are truncated after each scale, which loses nothing when the first
+ * scale is whole, and truncating twice is the same as truncating once when
+ * the second scale divides by a power of two.  Float samples are rounded
+ * after each scale, which loses nothing when either scale is a power of two.
+ *
+ * @param a The first scale.
+ * @param b The second scale.
+ * @return 1 if the volumes can be folded, 0 otherwise.
+ */
+int foldsVolumes(double a, double b) {
+	if (a != floor(a) && !(isPowerOfTwo(b) && b <= 1))
+		return 0;
+	if (!isPowerOfTwo(a) && !isPowerOfTwo(b))
+		return 0;
+
+	return isExactProduct(a, b);
+}
+
+/**
+ * Checks whether '-s a -s b', both nearest-sample, picks the same frames as
+ * '-s a*b'.  It does when "b" is a whole power of two: the second speed
+ * change then picks whole multiples of "b", and its length truncates the
+ * first's exactly as the single length would.
+ *
+ * @param first The first '-s' action.
+ * @param second The second '-s' action.
+ * @return 1 if the speed changes can be folded, 0 otherwise.
+ */
+int foldsSpeeds(const Action *first, const Action *second) {
+	return first->method == RESAMPLE_NEAREST && second->method == RESAMPLE_NEAREST
+		&& isPowerOfTwo(second->arg1) && second->arg1 >= 1
+		&& isExactProduct(first->arg1, second->arg1);
+}
+
+/**
+ * Checks whether an action treats the channels differently, as a '-c' with a
+ * stereo impulse response does.
+ *
+ * @param action The action.
+ * @return 1 if it does, 0 if it treats them alike.
+ */
+int splitsChannels(const Action *action) {
+	return action->type == ACTION_CONVOLVE && action->impulse->numChannels == 2;
+}
+
+/**
+ * Checks whether an action gives exactly the same samples moved to the other
+ * side of a given action.  A flip commutes with everything that treats the
+ * channels alike; a volume with a '-r' or a nearest-sample '-s', which only
+ * move frames; and a nearest-sample '-s' with a volume.
+ *
+ * @param action The action to move.
+ * @param other The action to move it past.
+ * @return 1 if the two commute, 0 otherwise.
+ */
+int commutes(const Action *action, const Action *other) {
+	if (action->type == ACTION_FLIP || other->type == ACTION_FLIP)
+		return !splitsChannels(action) && !splitsChannels(other);
+
+	int nearest = other->type == ACTION_SPEED && other->method == RESAMPLE_NEAREST;
+	switch (action->type) {
+	case ACTION_VOLUME:
+		return other->type == ACTION_REVERSE || nearest;
+	case ACTION_REVERSE:
+		return other->type == ACTION_VOLUME;
+	case ACTION_SPEED:
+		return action->method == RESAMPLE_NEAREST && other->type == ACTION_VOLUME;
+	}
+
+	return 0;
+}
+
+/**
+ * Finds the next action of the same type as the one at "index" that it can
+ * be brought next to, past actions it commutes with.
+ *
+ * @param actions The actions.
+ * @param index The index of the action.
+ * @param count The number of actions.
+ * @return The index of the next such action, or -1 if there is none.
+ */
+int nextPartner(const Action *actions, int index, int count) {
+	for (int j = index + 1; j < count; j++) {
+		if (actions[j].type == actions[index].type)
+			return j;
+		if (!commutes(&actions[index], &actions[j]))
+			return -1;
+	}
+
+	return -1;
+}
+
+/**
+ * Removes an action from a chain, keeping it just after the chain's new last
+ * action, so the stats can still report it.
+ *
+ * @param actions The actions.
+ * @param index The index of the action to remove.
+ * @param count The number of actions, updated.
+ * @param foldedInto The ordinal of the action it was folded in to, or -1 if
+ *     it was dropped.
+ */
+void removeAction(Action *actions, int index, int *count, int foldedInto) {
+	Action removed = actions[index];
+	removed.foldedInto = foldedInto;
+
+	memmove(&actions[index], &actions[index + 1], sizeof(Action) * (*count - index - 1));
+	(*count)--;
+	actions[*count] = removed;
+}
+
+/**
+ * Rewrites a parsed chain in to a shorter one that gives the same output,
+ * so every job makes fewer passes over its samples.  Pairs of flips cancel,
+ * as do pairs of '-r' with only volumes and flips between them; volumes fold
+ * in to one, as do nearest-sample speed changes, when foldsVolumes and
+ * foldsSpeeds allow; and '-v 1' goes.  A '-s 1' stays, since it still
+ * rewrites the header's sizes.  Actions are only moved past ones they
+ * commute with.  The one difference in output is
+ * that folded volumes clamp once, at the end, so a sample that one volume
+ * drove in to the clamp of scaleSample and the next brought back keeps the
+ * part that was clamped off.  Fades are never merged; each truncates its own
+ * gain.  The actions taken out are kept after the last one left, in no
+ * particular order.
+ *
+ * @param actions The actions, rewritten in place.
+ * @param count The number of actions, updated.
+ * @return The number of actions taken out.
+ */
+int optimizeChain(Action *actions, int *count) {
+	int parsed = *count;
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+
+		for (int i = 0; i < *count; i++) {
+			Action *action = &actions[i];
+			if (action->type == ACTION_VOLUME && action->arg1 == 1) {
+				removeAction(actions, i--, count, -1);
+				changed = 1;
+				continue;
+			}
+
+			int j = nextPartner(actions, i, *count);
+			if (j < 0)
+				continue;
+
+			switch (action->type) {
+			case ACTION_FLIP:
+			case ACTION_REVERSE:
+				removeAction(actions, j, count, -1);
+				removeAction(actions, i--, count, -1);
+				changed = 1;
+				break;
+			case ACTION_VOLUME:
+				if (foldsVolumes(action->arg1, actions[j].arg1)) {
+					action->arg1 *= actions[j].arg1;
+					removeAction(actions, j, count, action->ordinal);
+					changed = 1;
+				}
+				break;
+			case ACTION_SPEED:
+				if (foldsSpeeds(action, &actions[j])) {
+					action->arg1 *= actions[j].arg1;
+					removeAction(actions, j, count, action->ordinal);
+					changed = 1;
+				}
+				break;
+			}
+		}
+	}
+
+	return parsed - *count;
+}
+
+/**
+ * Parses the whole command line into a list of actions before any of them
+ * run.  Each action is validated as it is parsed, so the first bad flag or
+ * parameter is reported just as it would be when running them one by one.
+ * The list is then optimized by optimizeChain, which keeps the actions it
+ * takes out after the last one left.
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @param options Where to store the non-action options.
+ * @param actions Where to store the actions, with room for "argc" of them.
+ * @param count Where to store the number of actions in the list.
+ */
+void parseActions(int argc, char **argv, Options *options, Action *actions, int *count) {
+	options->inPath = NULL;
+	options->outPath = NULL;
+	options->jobs = 1;
+	options->floatMode = 0;
+	options->dither = 0;
+	options->stats = 0;
+	options->window = 0;
+	options->start = 0;
+	options->end = -1;
+	options->inPlace = 0;
+	options->index = 0;
+	options->checksums = NULL;
+	options->verify = NULL;
+	options->folded = 0;
+
+	*count = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-in") == 0 || strcmp(argv[i], "-out") == 0) {
+			if (i + 1 >= argc)
+				failure(ERROR_COMMAND_LINE_USAGE);
+
+			if (argv[i][1] == 'i')
+				options->inPath = argv[++i];
+			else
+				options->outPath = argv[++i];
+			continue;
+		}
+
+		if (strcmp(argv[i], "-j") == 0) {
+			double jobs = parseParameter(argc, argv, &i);
+			if (jobs < 1 || jobs != (int) jobs)
+				failure(ERROR_INVALID_JOBS);
+
+			options->jobs = (int) jobs;
+			continue;
+		}
+
+		if (strcmp(argv[i], "--stats") == 0) {
+			options->stats = 1;
+			continue;
+		}
+
+		if (strcmp(argv[i], "--start") == 0 || strcmp(argv[i], "--end") == 0) {
+			double time = parseParameter(argc, argv, &i);
+			if (time < 0)
+				failure(ERROR_INVALID_WINDOW);
+
+			if (argv[i - 1][2] == 's')
+				options->start = time;
+			else
+				options->end = time;
+			options->window = 1;
+			continue;
+		}
+
+		if (strcmp(argv[i], "--in-place") == 0) {
+			options->inPlace = 1;
+			options->window = 1;
+			continue;
+		}
+
+		if (strcmp(argv[i], "--index") == 0) {
+			options->index = 1;
+			continue;
+		}
+
+		if (strcmp(argv[i], "--checksums") == 0 || strcmp(argv[i], "--verify-against") == 0) {
+			if (i + 1 >= argc)
+				failure(ERROR_COMMAND_LINE_USAGE);
+
+			if (argv[i][2] == 'c')
+				options->checksums = argv[++i];
+			else
+				options->verify = argv[++i];
+			continue;
+		}
+
+		if (strcmp(argv[i], "-float") == 0) {
+			options->floatMode = 1;
+
+			// Dither may follow, to quantize the float samples with it.
+			if (i + 1 < argc && strcmp(argv[i + 1], "dither") == 0) {
+				options->dither = 1;
+				i++;
+			}
+			continue;
+		}
+
+		Action *action = &actions[*count];
+		initAction(action, parseArgument(argv[i]));
+		action->ordinal = (*count)++;
+
+		switch (action->type) {
+		case ACTION_ECHO:
+			// Each further pair of numbers adds a tap, and "feedback" after
+			// a pair makes that tap echo the output instead of the input.
+			do {
+				if (action->numTaps == ECHO_MAX_TAPS)
+					failure(ERROR_TOO_MANY_TAPS);
+
+				EchoTap *tap = &action->taps[action->numTaps++];
+				tap->delay = parseParameter(argc, argv, &i);
+				tap->scale = parseParameter(argc, argv, &i);
+				tap->feedback = 0;
+
+				if (i + 1 < argc && strcmp(argv[i + 1], "feedback") == 0) {
+					tap->feedback = 1;
+					i++;
+				}
+			} while (i + 2 < argc && parseDouble(argv[i + 1]) >= 0
+				&& parseDouble(argv[i + 2]) >= 0);
+
+			action->arg1 = action->taps[0].delay;
+			action->arg2 = action->taps[0].scale;
+			break;
+		case ACTION_FADE_OUT:
+		case ACTION_FADE_IN:
+			action->arg1 = parseParameter(argc, argv, &i);
+
+			// The fade's curve may follow its duration.
+			if (i + 1 < argc && parseCurve(argv[i + 1], &action->curve))
+				i++;
+			break;
+		case ACTION_SPEED:
+			action->arg1 = parseParameter(argc, argv, &i);
+
+			// The speed change's resampling method may follow its factor.
+			if (i + 1 < argc && parseResampler(argv[i + 1], &action->method))
+				i++;
+			break;
+		case ACTION_VOLUME:
+			action->arg1 = parseParameter(argc, argv, &i);
+			break;
+		case ACTION_NORMALIZE:
+			if (++i >= argc)
+				failure(ERROR_COMMAND_LINE_USAGE);
+			action->arg1 = parseLevel(argv[i]);
+			action->method = NORMALIZE_LOUDNESS;
+
+			if (i + 1 < argc && parseNormalizer(argv[i + 1], &action->method))
+				i++;
+			break;
+		case ACTION_CONVOLVE:
+			if (++i >= argc)
+				failure(ERROR_COMMAND_LINE_USAGE);
+			action->impulse = loadImpulse(argv[i]);
+			break;
+		}
+
+		validateAction(action);
+	}
+
+	if (options->end >= 0 && options->start > options->end)
+		failure(ERROR_INVALID_WINDOW);
+
+	options->folded = optimizeChain(actions, count);
+}
+
+/**
+ * Parses the whole command line, as parseActions does, into an allocated
+ * list of actions.
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @param options Where to store the non-action options.
+ * @param count Where to store the number of actions in the list.
+ * @return The allocated list of actions.
+ */
+Action *parseChain(int argc, char **argv, Options *options, int *count) {
+	// There can never be more actions than arguments.
+	Action *actions = malloc(sizeof(Action) * argc);
+	if (actions == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	parseActions(argc, argv, options, actions, count);
+	return actions;
+}
+
+/**
+ * Frees a list of actions and the impulse responses they hold.
+ *
+ * @param actions The actions, or NULL.
+ * @param count The number of actions.
+ */
+void freeChain(Action *actions, int count) {
+	for (int i = 0; actions != NULL && i < count; i++)
+		freeImpulse(actions[i].impulse);
+
+	free(actions);
+}
+
+/**
+ * Returns the length of a fade in frames, or 0 for any other action.
+ *
+ * @param header The wave file header.
+ * @param action The action.
+ * @return The number of frames.
+ */
+int64_t fadeFrames(const WaveHeader *header, const Action *action) {
+	if (action->type != ACTION_FADE_IN && action->type != ACTION_FADE_OUT)
+		return 0;
+
+	return durationFrames(header, action->arg1, ERROR_INVALID_TIME);
+}
+
+/**
+ * Returns how many frames a '-s' leaves of the given number, failing if
+ * there would be more than MAX_FRAMES.
+ *
+ * @param length The number of frames going in to the speed change.
+ * @param factor The speed factor.
+ * @return The number of frames coming out.
+ */
+int64_t speedLength(int64_t length, double factor) {
+	double frames = length / factor;
+	if (!(frames < (double) MAX_FRAMES))
+		failure(ERROR_INVALID_SPEED);
+
+	return (int64_t) frames;
+}
+
+/**
+ * Converts the delays of an echo's taps to frames.  A feedback tap always
+ * waits at least one frame, since it echoes output that has to exist first.
+ *
+ * @param header The wave file header.
+ * @param action The '-e' action.
+ * @param n Where to store the delay of each tap.
+ */
+void echoDelays(const WaveHeader *header, const Action *action, int64_t *n) {
+	for (int k = 0; k < action->numTaps; k++) {
+		n[k] = durationFrames(header, action->taps[k].delay, ERROR_INVALID_ECHO);
+		if (action->taps[k].feedback && n[k] < 1)
+			n[k] = 1;
+	}
+}
+
+/**
+ * Checks whether an echo has any feedback taps.
+ *
+ * @param action The '-e' action.
+ * @return 1 if it does, 0 otherwise.
+ */
+int isFeedbackEcho(const Action *action) {
+	for (int k = 0; k < action->numTaps; k++) {
+		if (action->taps[k].feedback)
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Returns how many frames an echo adds to the end of the sound.  Plain taps
+ * add their longest delay, as a single '-e' always has.  Feedback taps then
+ * keep repeating their longest delay until their combined scale has brought
+ * a full-scale sample below the smallest step a 16-bit sample can take.
+ *
+ * @param header The wave file header.
+ * @param action The '-e' action.
+ * @return The length of the echo's tail in frames.
+ */
+int64_t echoTail(const WaveHeader *header, const Action *action) {
+	int64_t n[ECHO_MAX_TAPS];
+	echoDelays(header, action, n);
+
+	int64_t reach = 0;
+	int64_t loop = 0;
+	double gain = 0;
+	for (int k = 0; k < action->numTaps; k++) {
+		if (action->taps[k].feedback) {
+			loop = n[k] > loop ? n[k] : loop;
+			gain += action->taps[k].scale;
+		} else {
+			reach = n[k] > reach ? n[k] : reach;
+		}
+	}
+
+	if (loop == 0)
+		return reach;
+
+	int repeats = 1;
+	if (gain > 0)
+		repeats = (int) ceil(log(32768.0) / -log(gain));
+	if (repeats > ECHO_MAX_REPEATS)
+		repeats = ECHO_MAX_REPEATS;
+	if (loop > (MAX_FRAMES - reach) / repeats)
+		failure(ERROR_INVALID_ECHO);
+
+	return reach + loop * repeats;
+}
+
+/**
+ * Returns how many frames a '-c' adds to the end of the sound: the length of
+ * its impulse response less one.  Fails if the impulse response does not fit
+ * the input.
+ *
+ * @param header The wave file header.
+ * @param action The '-c' action.
+ * @return The length of the convolution's tail in frames.
+ */
+int64_t impulseTail(const WaveHeader *header, const Action *action) {
+	const Impulse *impulse = action->impulse;
+	if (impulse->sampleRate != (int) header->formatChunk.sampleRate
+		|| (impulse->numChannels == 2 && header->formatChunk.channels != 2))
+		failure(ERROR_INVALID_IMPULSE);
+
+	return impulse->length - 1;
+}
+
+/**
+ * Updates the header for one action the same way the whole-file action would
+ * and returns the number of frames the action leaves behind.
+ *
+ * @param header The wave file header to update.
+ * @param action The action.
+ * @param length The number of frames going in to the action.
+ * @return The number of frames coming out of the action.
+ */
+int64_t planAction(WaveHeader *header, const Action *action, int64_t length) {
+	int64_t n;
+
+	switch (action->type) {
+	case ACTION_SPEED:
+		length = speedLength(length, action->arg1);
+		header->size = WAVE_HEADER_SIZE + 4 * length;
+		header->dataChunk.size = 4 * length;
+		break;
+	case ACTION_ECHO:
+	case ACTION_CONVOLVE:
+		n = action->type == ACTION_ECHO ? echoTail(header, action) : impulseTail(header, action);
+		if (n > MAX_FRAMES - length)
+			failure(action->type == ACTION_ECHO ? ERROR_INVALID_ECHO : ERROR_INVALID_IMPULSE);
+		length += n;
+		header->size += 4 * n;
+		header->dataChunk.size += 4 * n;
+		break;
+	}
+
+	return length;
+}
+
+/**
+ * Allocates a zeroed block of interleaved frames.
+ *
+ * @param count The length of the block in frames.
+ * @return The allocated block, or NULL if memory runs out.
+ */
+short *tryAllocateFrames(int64_t count) {
+	short *frames = calloc(count > 0 ? (size_t) count : 1, BYTES_PER_FRAME);
+	if (frames != NULL)
+		noteAllocation((size_t) (count > 0 ? count : 1) * BYTES_PER_FRAME);
+
+	return frames;
+}
+
+/**
+ * Allocates a zeroed block of interleaved frames, failing if memory runs out.
+ *
+ * @param count The length of the block in frames.
+ * @return The allocated block.
+ */
+short *allocateFrames(int64_t count) {
+	short *frames = tryAllocateFrames(count);
+	if (frames == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	return frames;
+}
+
+/**
+ * The running state of an echo with feedback taps.  The echo runs forwards,
+ * one frame at a time, keeping its last "inputLength" input frames and its
+ * last "outputLength" output frames in rings, which is all the history any
+ * tap can reach.  That lets it run in place over a whole buffer or over a
+ * stream one block at a time, with the same memory either way.
+ */
+typedef struct _EchoLine {
+	const EchoTap *taps;
+	int numTaps;
+	int64_t n[ECHO_MAX_TAPS]; // Delay of each tap in frames.
+	int64_t inputLength;      // Longest plain delay.
+	int64_t outputLength;     // Longest feedback delay.
+	short *input;             // Ring of interleaved input frames.
+	short *output;            // Ring of interleaved output frames.
+	int64_t position;         // Frames processed so far.
+} EchoLine;
+
+/**
+ * Frees an EchoLine.
+ *
+ * @param line The EchoLine to free, or NULL.
+ */
+void freeEchoLine(EchoLine *line) {
+	if (line == NULL)
+		return;
+
+	free(line->input);
+	free(line->output);
+	free(line);
+}
+
+/**
+ * Creates the running state of an echo.
+ *
+ * @param header The wave file header.
+ * @param action The '-e' action.
+ * @return The allocated EchoLine.
+ */
+EchoLine *createEchoLine(const WaveHeader *header, const Action *action) {
+	EchoLine *line = calloc(1, sizeof(EchoLine));
+	if (line == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	noteAllocation(sizeof(EchoLine));
+
+	line->taps = action->taps;
+	line->numTaps = action->numTaps;
+	echoDelays(header, action, line->n);
+
+	for (int k = 0; k < line->numTaps; k++) {
+		int64_t *length = line->taps[k].feedback ? &line->outputLength : &line->inputLength;
+		if (line->n[k] > *length)
+			*length = line->n[k];
+	}
+
+	line->input = tryAllocateFrames(line->inputLength);
+	line->output = tryAllocateFrames(line->outputLength);
+	if (line->input == NULL || line->output == NULL) {
+		freeEchoLine(line);
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	}
+
+	return line;
+}
+
+/**
+ * Runs the echo in place over the next "frames" frames of its input.  The
+ * input must include the silence the tail is made from.  The samples of each
+ * channel are "stride" shorts apart, as in applySampleAction.
+ *
+ * @param line The EchoLine.
+ * @param left The left channel.
+ * @param right The right channel.
+ * @param stride The distance between consecutive samples of a channel.
+ * @param frames The number of frames.
+ */
+void runEchoLine(EchoLine *line, short *left, short *right, int stride, int64_t frames) {
+	for (int64_t i = 0; i < frames; i++, line->position++) {
+		int64_t p = line->position;
+		short in[2] = { left[i * stride], right[i * stride] };
+		short out[2] = { in[0], in[1] };
+
+		for (int k = 0; k < line->numTaps; k++) {
+			int64_t j = p - line->n[k];
+			if (j < 0)
+				continue;
+
+			const short *delayed = in;
+			if (line->taps[k].feedback)
+				delayed = line->output + 2 * (j % line->outputLength);
+			else if (line->n[k] > 0)
+				delayed = line->input + 2 * (j % line->inputLength);
+
+			out[0] += scaleSample(delayed[0], line->taps[k].scale);
+			out[1] += scaleSample(delayed[1], line->taps[k].scale);
+		}
+
+		// Each slot is read above before it is reused for this frame.
+		if (line->inputLength > 0)
+			memcpy(line->input + 2 * (p % line->inputLength), in, sizeof(in));
+		if (line->outputLength > 0)
+			memcpy(line->output + 2 * (p % line->outputLength), out, sizeof(out));
+
+		left[i * stride]  = out[0];
+		right[i * stride] = out[1];
+	}
+}
+
+/**
+ * The '-e' action with several taps or feedback on planar data.  The
+ * channels are grown in place and the echo runs forwards through them.
+ *
+ * @param data The WaveData struct in the planar layout.
+ * @param action The '-e' action.
+ */
+void planarEcho(WaveData *data, const Action *action) {
+	int64_t numSamples = data->numSamples;
+	int64_t length = numSamples + echoTail(data->header, action);
+
+	memset(data->left + numSamples, 0, sizeof(short) * (length - numSamples));
+	memset(data->right + numSamples, 0, sizeof(short) * (length - numSamples));
+
+	EchoLine *line = createEchoLine(data->header, action);
+	runEchoLine(line, data->left, data->right, 1, length);
+	freeEchoLine(line);
+
+	data->numSamples = planAction(data->header, action, numSamples);
+}
+
+// Frames per tile of an in-place echo spread over the worker pool.
+#define ECHO_TILE_FRAMES 65536
+
+/**
+ * One in-place echo over interleaved frames, shared by its tile tasks.
+ */
+typedef struct _TiledEcho {
+	short *frames;
+	int64_t numSamples;
+	const EchoTap *taps;
+	const int64_t *n;
+	int numTaps;
+	int64_t reach;
+	int64_t length;
+	int64_t tileFrames;
+	const short *snapshot;
+} TiledEcho;
+
+/**
+ * Computes one tile of an in-place echo.  A tile reads its own frames, which
+ * it overwrites from the back, and the "reach" frames below it, which the
+ * tile below may already have overwritten, so those come from the snapshot
+ * taken before any tile ran.
+ *
+ * @param context The TiledEcho.
+ * @param index The index of the tile.
+ */
+void runEchoTile(void *context, int index) {
+	const TiledEcho *echo = context;
+	int64_t from = index * echo->tileFrames;
+	int64_t to = from + echo->tileFrames < echo->length ? from + echo->tileFrames : echo->length;
+	const short *below = NULL;
+	if (index > 0)
+		below = echo->snapshot + 2 * echo->reach * (index - 1);
+
+	echoFrames(echo->frames, echo->numSamples, echo->taps, echo->n, echo->numTaps,
+		from, to, below, echo->reach);
+}
+
+/**
+ * An echo without feedback taps, run in place over interleaved frames and
+ * spread over the worker pool.  The output is cut in to tiles, each at least
+ * four delays long, so the snapshot of the frames each tile needs from below
+ * costs at most a quarter of the buffer.  Short buffers and long delays that
+ * leave too few tiles run on one thread instead.
+ *
+ * @param frames The interleaved frames, with room for the echo's tail.
+ * @param numSamples The number of frames.
+ * @param action The '-e' action.
+ * @param n The delay of each tap in frames.
+ */
+void tiledFrameEcho(short *frames, int64_t numSamples, const Action *action, const int64_t *n) {
+	int64_t reach = 0;
+	for (int k = 0; k < action->numTaps; k++)
+		reach = n[k] > reach ? n[k] : reach;
+
+	int64_t length = numSamples + reach;
+	int64_t tiles = length / ECHO_TILE_FRAMES;
+	if (tiles > 4 * poolThreads(pool))
+		tiles = 4 * poolThreads(pool);
+	if (reach > 0 && tiles > length / (4 * reach))
+		tiles = length / (4 * reach);
+
+	if (tiles < 2) {
+		frameEcho(frames, numSamples, action->taps, n, action->numTaps);
+		return;
+	}
+
+	int64_t tileFrames = (length + tiles - 1) / tiles;
+	tiles = (length + tileFrames - 1) / tileFrames;
+
+	short *snapshot = allocateFrames(reach * (tiles - 1));
+	for (int64_t t = 1; t < tiles; t++) {
+		int64_t from = t * tileFrames - reach;
+		int64_t to = t * tileFrames < numSamples ? t * tileFrames : numSamples;
+		if (to > from) {
+			memcpy(snapshot + 2 * reach * (t - 1), frames + 2 * from,
+				(size_t) BYTES_PER_FRAME * (to - from));
+		}
+	}
+
+	TiledEcho echo = {
+		frames, numSamples, action->taps, n, action->numTaps, reach, length,
+		tileFrames, snapshot
+	};
+	char *error = tryTasks((int) tiles, runEchoTile, &echo);
+	free(snapshot);
+	if (error != NULL)
+		failure(error);
+}
+
+/**
+ * The '-e' action in place on interleaved frames.  Echoes with feedback run
+ * forwards through an EchoLine; the rest run from the back, over the worker
+ * pool when there is one.
+ *
+ * @param header The wave file header.
+ * @param frames The interleaved frames, with room for the echo's tail.
+ * @param numSamples The number of frames.
+ * @param action The '-e' action.
+ */
+void runFrameEcho(const WaveHeader *header, short *frames, int64_t numSamples,
+		const Action *action) {
+	int64_t n[ECHO_MAX_TAPS];
+	echoDelays(header, action, n);
+
+	if (isFeedbackEcho(action)) {
+		int64_t tail = echoTail(header, action);
+		memset(frames + 2 * numSamples, 0, (size_t) BYTES_PER_FRAME * tail);
+
+		EchoLine *line = createEchoLine(header, action);
+		runEchoLine(line, frames, frames + 1, 2, numSamples + tail);
+		freeEchoLine(line);
+	} else if (pool != NULL) {
+		tiledFrameEcho(frames, numSamples, action, n);
+	} else {
+		frameEcho(frames, numSamples, action->taps, n, action->numTaps);
+	}
+}
+
+/**
+ * Creates the convolver of a '-c', with one impulse response for both
+ * channels or one for each.
+ *
+ * @param action The '-c' action.
+ * @return The convolver.
+ */
+Convolver *createImpulseConvolver(const Action *action) {
+	const Impulse *impulse = action->impulse;
+	Convolver *convolver = createConvolver(impulse->samples[0],
+		impulse->numChannels == 2 ? impulse->samples[1] : NULL, impulse->length);
+	if (convolver == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	return convolver;
+}
+
+/**
+ * Rounds a convolved sample to nearest and clamps it to 16 bits.
+ *
+ * @param sample The sample.
+ * @return The short.
+ */
+short roundSample(double sample) {
+	double rounded = floor(sample + 0.5);
+	if (rounded < SHRT_MIN)
+		return SHRT_MIN;
+	if (rounded > SHRT_MAX)
+		return SHRT_MAX;
+
+	return (short) rounded;
+}
+
+/**
+ * Runs a convolver in place over the next "frames" frames of a stereo pair,
+ * one of the convolver's blocks at a time.  Every run but the last must be a
+ * whole number of blocks long; the last block of the last one is finished
+ * with silence.  The samples of each channel are "stride" shorts apart, as
+ * in applySampleAction.
+ *
+ * @param convolver The convolver.
+ * @param work Room for two of the convolver's blocks.
+ * @param left The left channel.
+ * @param right The right channel.
+ * @param stride The distance between consecutive samples of a channel.
+ * @param frames The number of frames.
+ */
+void convolveShorts(Convolver *convolver, double *work, short *left, short *right, int stride,
+		int64_t frames) {
+	int block = convolverBlockFrames(convolver);
+	double *re = work;
+	double *im = work + block;
+
+	for (int64_t first = 0; first < frames; first += block) {
+		int count = frames - first < block ? (int) (frames - first) : block;
+		short *l = left + first * stride;
+		short *r = right + first * stride;
+
+		for (int i = 0; i < count; i++) {
+			re[i] = l[i * stride];
+			im[i] = r[i * stride];
+		}
+		for (int i = count; i < block; i++)
+			re[i] = im[i] = 0;
+
+		runConvolver(convolver, re, im);
+
+		for (int i = 0; i < count; i++) {
+			l[i * stride] = roundSample(re[i]);
+			r[i * stride] = roundSample(im[i]);
+		}
+	}
+}
+
+/**
+ * Allocates the work buffer convolveShorts needs for a convolver.
+ *
+ * @param convolver The convolver.
+ * @return The buffer, or NULL if memory runs out.
+ */
+double *allocateConvolveWork(const Convolver *convolver) {
+	return malloc(2 * sizeof(double) * convolverBlockFrames(convolver));
+}
+
+/**
+ * The '-c' action in place on interleaved frames or planar channels.  The
+ * input is followed by the silence the tail is made from, and the whole of
+ * it runs through the convolver at once.
+ *
+ * @param header The wave file header.
+ * @param left The left channel, with room for the tail.
+ * @param right The right channel, with room for the tail.
+ * @param stride The distance between consecutive samples of a channel.
+ * @param numSamples The number of frames.
+ * @param action The '-c' action.
+ */
+void runConvolve(const WaveHeader *header, short *left, short *right, int stride,
+		int64_t numSamples, const Action *action) {
+	int64_t length = numSamples + impulseTail(header, action);
+	for (int64_t i = numSamples; i < length; i++)
+		left[i * stride] = right[i * stride] = 0;
+
+	Convolver *convolver = createImpulseConvolver(action);
+	double *work = allocateConvolveWork(convolver);
+	if (work == NULL) {
+		destroyConvolver(convolver);
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	}
+
+	convolveShorts(convolver, work, left, right, stride, length);
+	free(work);
+	destroyConvolver(convolver);
+}
+
+/**
+ * The '-s' action with an interpolating resampler, in place on interleaved
+ * frames.  A speed-up writes each output frame no later than the input it
+ * has already been fed, so it runs straight through the buffer.  A slow-down
+ * first moves its input up to the end of the buffer, which leaves the output
+ * just far enough behind the input that it never overtakes it.  The buffer
+ * must have room for the longer of the input and the output.
+ *
+ * @param frames The interleaved frames.
+ * @param numSamples The number of frames.
+ * @param factor How much to scale the speed.
+ * @param method The RESAMPLE_* method.
+ * @return The new number of frames.
+ */
+int64_t frameResample(short *frames, int64_t numSamples, double factor, int method) {
+	int64_t length = (int64_t) (numSamples / factor);
+	Resampler *resampler = createResampler(method, factor, numSamples, IO_BLOCK_FRAMES);
+	if (resampler == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	short *input = frames;
+	if (length > numSamples) {
+		input = frames + 2 * (length - numSamples);
+		memmove(input, frames, (size_t) BYTES_PER_FRAME * numSamples);
+	}
+
+	int64_t produced = 0;
+	for (int64_t i = 0; i < numSamples; i += IO_BLOCK_FRAMES) {
+		int count = numSamples - i < IO_BLOCK_FRAMES ? (int) (numSamples - i) : IO_BLOCK_FRAMES;
+
+		// One block of input never makes more output than an int can count.
+		int room = length - produced < INT_MAX ? (int) (length - produced) : INT_MAX;
+		feedResampler(resampler, input + 2 * i, count);
+		produced += drainResampler(resampler, frames + 2 * produced, room);
+	}
+
+	destroyResampler(resampler);
+	return length;
+}
+
+/**
+ * The '-s' action with an interpolating resampler on planar data.  The
+ * resampler works on interleaved frames, so the channels are interleaved in
+ * to the spare buffer and split again afterwards.
+ *
+ * @param data The WaveData struct in the planar layout.
+ * @param action The '-s' action.
+ */
+void planarResample(WaveData *data, const Action *action) {
+	int64_t numSamples = data->numSamples;
+	int64_t length = speedLength(numSamples, action->arg1);
+	short *frames = data->spare;
+
+	for (int64_t i = 0; i < numSamples; i++) {
+		frames[2 * i]     = data->left[i];
+		frames[2 * i + 1] = data->right[i];
+	}
+
+	frameResample(frames, numSamples, action->arg1, action->method);
+
+	for (int64_t i = 0; i < length; i++) {
+		data->left[i]  = frames[2 * i];
+		data->right[i] = frames[2 * i + 1];
+	}
+	data->numSamples = planAction(data->header, action, numSamples);
+}
+
+/**
+ * Works out the gain of a '-n' action from the levels of its input: the
+ * difference between its target and the level it normalizes, as a scale.
+ * Silence has no level to normalize, and keeps a gain of 1.
+ *
+ * @param action The '-n' action.
+ * @param levels The levels of its input.
+ * @return The gain.
+ */
+double normalizeGain(const Action *action, const Levels *levels) {
+	double level = levels->loudness;
+
+	if (action->method == NORMALIZE_PEAK) {
+		level = -INFINITY;
+		for (int c = 0; c < levels->numChannels; c++)
+			level = levels->peak[c] > level ? levels->peak[c] : level;
+	} else if (action->method == NORMALIZE_RMS) {
+		// The RMS level of all the channels together.
+		double power = 0;
+		for (int c = 0; c < levels->numChannels; c++)
+			power += pow(10, levels->rms[c] / 10);
+		level = power > 0 ? 10 * log10(power / levels->numChannels) : -INFINITY;
+	}
+
+	if (!isfinite(level))
+		return 1;
+
+	return pow(10, (action->arg1 - level) / 20);
+}
+
+/**
+ * Turns a '-n' action in to the '-v' action that normalizes an input of the
+ * given levels, and records them in the stats.
+ *
+ * @param action The '-n' action.
+ * @param index The index of the action in the chain.
+ * @param levels The levels of the action's input.
+ * @return The '-v' action.
+ */
+Action levelsVolume(const Action *action, int index, const Levels *levels) {
+	Action volume;
+	initAction(&volume, ACTION_VOLUME);
+	volume.arg1 = normalizeGain(action, levels);
+	noteLevels(index, levels, volume.arg1);
+
+	return volume;
+}
+
+/**
+ * Turns a '-n' action in to the '-v' action that normalizes its input.
+ *
+ * @param action The '-n' action.
+ * @param index The index of the action in the chain.
+ * @param loudness The measurement of the action's input.
+ * @return The '-v' action.
+ */
+Action normalizeVolume(const Action *action, int index, const Loudness *loudness) {
+	Levels levels;
+	loudnessLevels(loudness, &levels);
+
+	return levelsVolume(action, index, &levels);
+}
+
+/**
+ * Measures 16-bit stereo sound data in memory, for a '-n' whose input the
+ * read could not measure.
+ *
+ * @param header The wave file header.
+ * @param loudness Where to store the measurement.
+ * @param left The left channel.
+ * @param right The right channel.
+ * @param stride The distance between consecutive samples of a channel.
+ * @param numSamples The number of frames.
+ */
+void measureFrameData(const WaveHeader *header, Loudness *loudness, const short *left,
+		const short *right, int stride, int64_t numSamples) {
+	initLoudness(loudness, 2, header->formatChunk.sampleRate, 32768);
+
+	for (int64_t i = 0; i < numSamples; i += IO_BLOCK_FRAMES) {
+		int count = numSamples - i < IO_BLOCK_FRAMES ? (int) (numSamples - i) : IO_BLOCK_FRAMES;
+		measureShorts(loudness, left + i * stride, right + i * stride, stride, count);
+	}
+}
+
+/**
+ * Measures the sound data for a '-n', unless the read already has.
+ *
+ * @param data The WaveData struct, in order.
+ * @return The measurement.
+ */
+const Loudness *measureWaveData(WaveData *data) {
+	if (data->measured) {
+		data->measured = 0;
+		return &data->loudness;
+	}
+
+	if (data->layout == LAYOUT_PLANAR) {
+		measureFrameData(data->header, &data->loudness, data->left, data->right, 1,
+			data->numSamples);
+	} else {
+		int s = data->swapped ? 1 : 0;
+		measureFrameData(data->header, &data->loudness, data->frames + s, data->frames + 1 - s,
+			2, data->numSamples);
+	}
+
+	return &data->loudness;
+}
+
+/**
+ * Performs a single parsed action on the whole of the sound data.
+ *
+ * @param data The WaveData struct to perform the action on.
+ * @param action The action to perform.
+ */
+void runAction(WaveData *data, const Action *action) {
+	switch (action->type) {
+	case ACTION_REVERSE:  actionReverse(data); break;
+	case ACTION_SPEED:
+		if (action->method == RESAMPLE_NEAREST)
+			actionChangeSpeed(data, action->arg1);
+		else
+			planarResample(data, action);
+		break;
+	case ACTION_FLIP:     actionFlipChannels(data); break;
+	case ACTION_FADE_OUT: actionFadeOut(data, action->arg1, action->curve); break;
+	case ACTION_FADE_IN:  actionFadeIn(data, action->arg1, action->curve); break;
+	case ACTION_VOLUME:   actionVolume(data, action->arg1); break;
+	case ACTION_ECHO:
+		if (action->numTaps == 1 && !isFeedbackEcho(action))
+			actionEcho(data, action->arg1, action->arg2);
+		else
+			planarEcho(data, action);
+		break;
+	case ACTION_CONVOLVE:
+		runConvolve(data->header, data->left, data->right, 1, data->numSamples, action);
+		data->numSamples = planAction(data->header, action, data->numSamples);
+		break;
+	}
+}
+
+/**
+ * Performs a single parsed action in place on interleaved frames and updates
+ * the header to match.
+ *
+ * @param header The wave file header.
+ * @param frames The interleaved frames, with room for the action's output.
+ * @param numSamples The number of frames going in to the action.
+ * @param action The action to perform.
+ * @return The number of frames coming out of the action.
+ */
+int64_t runFrameAction(WaveHeader *header, short *frames, int64_t numSamples,
+		const Action *action) {
+	switch (action->type) {
+	case ACTION_REVERSE:
+		frameReverse(frames, numSamples);
+		break;
+	case ACTION_SPEED:
+		if (action->method == RESAMPLE_NEAREST)
+			frameChangeSpeed(frames, numSamples, action->arg1);
+		else
+			frameResample(frames, numSamples, action->arg1, action->method);
+		break;
+	case ACTION_FLIP:
+		frameFlipChannels(frames, numSamples);
+		break;
+	case ACTION_FADE_OUT:
+		frameFadeOut(frames, numSamples, fadeFrames(header, action),
+			action->curve);
+		break;
+	case ACTION_FADE_IN:
+		frameFadeIn(frames, numSamples, fadeFrames(header, action),
+			action->curve);
+		break;
+	case ACTION_VOLUME:
+		frameVolume(frames, numSamples, action->arg1);
+		break;
+	case ACTION_ECHO:
+		runFrameEcho(header, frames, numSamples, action);
+		break;
+	case ACTION_CONVOLVE:
+		runConvolve(header, frames, frames + 1, 2, numSamples, action);
+		break;
+	}
+
+	return planAction(header, action, numSamples);
+}
+
+/**
+ * Returns the sample layout an action works best on.  The speed change and
+ * the echo run in place on interleaved frames, where the planar versions
+ * allocate new channels, and the convolution goes with them; the other
+ * actions work equally well on either.
+ *
+ * @param action The action.
+ * @return One of the LAYOUT_* codes.
+ */
+int preferredLayout(const Action *action) {
+	switch (action->type) {
+	case ACTION_SPEED:
+	case ACTION_ECHO:
+	case ACTION_CONVOLVE:
+		return LAYOUT_INTERLEAVED;
+	}
+
+	return LAYOUT_ANY;
+}
+
+/**
+ * Picks the layout to load the sound data in: the preference of the first
+ * action that has one, or else the file's own interleaved layout, so that
+ * nothing has to be converted at all.
+ *
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @return LAYOUT_PLANAR or LAYOUT_INTERLEAVED.
+ */
+int chainLayout(const Action *actions, int count) {
+	for (int i = 0; i < count; i++) {
+		int layout = preferredLayout(&actions[i]);
+		if (layout != LAYOUT_ANY)
+			return layout;
+	}
+
+	return LAYOUT_INTERLEAVED;
+}
+
+/**
+ * Converts the sound data to another layout in one pass, in to the spare
+ * buffer.  Channels marked as swapped are swapped for real on the way to the
+ * planar layout, and data marked as reversed is put back in order on the way
+ * to either layout.
+ *
+ * @param data The WaveData struct to convert.
+ * @param layout The layout to convert to; LAYOUT_ANY leaves it as it is.
+ */
+void convertLayout(WaveData *data, int layout) {
+	if (layout == LAYOUT_ANY || layout == data->layout)
+		return;
+
+	short *buffer = data->spare;
+	data->spare = activeBuffer(data);
+
+	if (layout == LAYOUT_PLANAR) {
+		data->left  = buffer;
+		data->right = buffer + data->capacity;
+
+		int l = data->swapped ? 1 : 0;
+		for (int64_t i = 0; i < data->numSamples; i++) {
+			int64_t j = data->reversed ? data->numSamples - 1 - i : i;
+			data->left[i]  = data->frames[2 * j + l];
+			data->right[i] = data->frames[2 * j + 1 - l];
+		}
+
+		data->frames = NULL;
+		data->swapped = 0;
+	} else {
+		data->frames = buffer;
+
+		for (int64_t i = 0; i < data->numSamples; i++) {
+			int64_t j = data->reversed ? data->numSamples - 1 - i : i;
+			data->frames[2 * i]     = data->left[j];
+			data->frames[2 * i + 1] = data->right[j];
+		}
+
+		data->left = NULL;
+		data->right = NULL;
+	}
+
+	data->layout = layout;
+	data->reversed = 0;
+}
+
+/**
+ * Moves data marked as reversed in to order, if it is not already.
+ *
+ * @param data The WaveData struct.
+ */
+void materializeReverse(WaveData *data) {
+	if (!data->reversed)
+		return;
+
+	if (data->layout == LAYOUT_PLANAR)
+		actionReverse(data);
+	else
+		frameReverse(data->frames, data->numSamples);
+
+	data->reversed = 0;
+}
+
+/**
+ * Returns how many frames the longest stage of a chain needs room for, so a
+ * buffer can be sized once for the whole chain.
+ *
+ * @param header The wave file header going in to the chain.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @param numSamples The number of frames going in to the chain.
+ * @return The number of frames of room needed.
+ */
+int64_t chainCapacity(const WaveHeader *header, const Action *actions, int count,
+		int64_t numSamples) {
+	WaveHeader scratch = *header;
+	int64_t capacity = numSamples;
+	int64_t length = numSamples;
+	for (int i = 0; i < count; i++) {
+		length = planAction(&scratch, &actions[i], length);
+		if (length > capacity)
+			capacity = length;
+	}
+
+	return capacity;
+}
+
+/**
+ * Returns the size the header coming out of a chain is written in, which is
+ * larger once the output no longer fits in a plain RIFF file, so the sound
+ * data can be put in place behind it before the chain runs.
+ *
+ * @param header The wave file header going in to the chain.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @return The size of the output header in bytes.
+ */
+size_t chainHeaderSize(const WaveHeader *header, const Action *actions, int count) {
+	WaveHeader scratch = *header;
+	int64_t length = header->dataChunk.size / BYTES_PER_FRAME;
+	for (int i = 0; i < count; i++)
+		length = planAction(&scratch, &actions[i], length);
+
+	return headerSize(&scratch);
+}
+
+// Frames per block when running fused per-sample actions over whole buffers.
+#define FUSED_BLOCK_FRAMES 4096
+
+/**
+ * Checks whether an action works on each sample independently of the others,
+ * so it can be fused with its neighbours in to a single pass.  These actions
+ * also treat both channels identically, which lets a '-f' among them be
+ * moved to the end of the group.
+ *
+ * @param action The action to check.
+ * @return 1 if the action is per-sample, 0 if it is a pipeline barrier.
+ */
+int isSampleAction(const Action *action) {
+	switch (action->type) {
+	case ACTION_FLIP:
+	case ACTION_FADE_OUT:
+	case ACTION_FADE_IN:
+	case ACTION_VOLUME:
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Checks whether an action can be part of a fused pass: a per-sample action,
+ * or a '-r', which moves nothing and only changes the direction the actions
+ * after it see the frames in.
+ *
+ * @param action The action to check.
+ * @return 1 if the action can be fused, 0 if it is a pipeline barrier.
+ */
+int joinsFusedPass(const Action *action) {
+	return isSampleAction(action) || action->type == ACTION_REVERSE;
+}
+
+/**
+ * Applies a '-o', '-i' or '-v' action to one block of frames that starts
+ * "position" frames in to the action's input.  The samples of each channel
+ * are "stride" shorts apart, so the same code serves separate channels
+ * (stride 1) and interleaved frames (stride 2).  If the frames are stored
+ * reversed, "position" counts from the end of the action's input, and the
+ * block runs backwards from its last logical frame.
+ *
+ * @param action The action to apply.
+ * @param n The length of the fade in frames.
+ * @param length The total number of frames the action receives.
+ * @param position The position of the block's first frame.
+ * @param left The left channel of the block.
+ * @param right The right channel of the block.
+ * @param stride The distance between consecutive samples of a channel.
+ * @param frames The number of frames in the block.
+ * @param reversed 1 if the frames are stored in reverse order.
+ */
+void applySampleAction(const Action *action, int64_t n, int64_t length, int64_t position,
+		short *left, short *right, int stride, int frames, int reversed) {
+	// The position of the block's first frame in the order the action sees.
+	int64_t first = reversed ? length - position - frames : position;
+
+	switch (action->type) {
+	case ACTION_FADE_OUT: {
+		// Only the part of the block that overlaps the fade is touched.
+		int64_t start = length - n;
+		int64_t skip = start > first ? start - first : 0;
+		if (skip < frames) {
+			int64_t offset = reversed ? 0 : skip;
+			applyFade(left + offset * stride, right + offset * stride, stride,
+				frames - skip, first + skip - start, n, action->curve, 1, reversed);
+		}
+		break;
+	}
+	case ACTION_FADE_IN:
+		if (first < n) {
+			int count = n - first < frames ? (int) (n - first) : frames;
+			int offset = reversed ? frames - count : 0;
+			applyFade(left + offset * stride, right + offset * stride, stride,
+				count, first, n, action->curve, 0, reversed);
+		}
+		break;
+	case ACTION_VOLUME:
+		if (stride == 1) {
+			scaleSamples(left, frames, action->arg1);
+			scaleSamples(right, frames, action->arg1);
+		} else {
+			// Interleaved frames are one run of samples.
+			scaleSamples(left < right ? left : right, 2 * frames, action->arg1);
+		}
+		break;
+	}
+}
+
+/**
+ * One fused pass over a run of frames, shared by its block tasks.
+ */
+typedef struct _FusedPass {
+	const Action *actions;
+	const int64_t *n;
+	int count;
+	short *left;
+	short *right;
+	int stride;
+	int64_t frames;
+	int64_t position;
+	int64_t length;
+	int swap;
+	int reversed;
+} FusedPass;
+
+/**
+ * Applies every action of a fused pass to one FUSED_BLOCK_FRAMES block,
+ * keeping track of the direction each one sees the frames in.  Blocks do not
+ * depend on each other, so they can run on any thread.
+ *
+ * @param context The FusedPass.
+ * @param index The index of the block.
+ */
+void runFusedBlock(void *context, int index) {
+	const FusedPass *pass = context;
+	int64_t first = (int64_t) index * FUSED_BLOCK_FRAMES;
+	int frames = pass->frames - first < FUSED_BLOCK_FRAMES
+		? (int) (pass->frames - first) : FUSED_BLOCK_FRAMES;
+
+	short *left  = pass->left  + first * pass->stride;
+	short *right = pass->right + first * pass->stride;
+	int reversed = pass->reversed;
+	for (int k = 0; k < pass->count; k++) {
+		if (pass->actions[k].type == ACTION_REVERSE) {
+			reversed = !reversed;
+			continue;
+		}
+
+		applySampleAction(&pass->actions[k], pass->n[k], pass->length,
+			pass->position + first, left, right, pass->stride, frames, reversed);
+	}
+
+	if (pass->swap)
+		frameFlipChannels(left, frames);
+}
+
+/**
+ * Runs a group of consecutive per-sample actions in one pass, block by block,
+ * so each block stays in cache while every action in the group is applied to
+ * it.  The blocks are spread over the worker pool when there is one.  Flips
+ * are counted rather than performed.  If "swapFrames" is set, an odd count
+ * swaps the samples of each interleaved block in the same pass; otherwise the
+ * caller swaps the channel pointers or marks them as swapped.  Reversals are
+ * not performed either: they only change how later fades map on to the
+ * frames, and counting them is left to the caller.  A group with nothing to
+ * apply makes no pass at all.
+ *
+ * @param actions The group of actions, each of which joins fused passes.
+ * @param n The fade length in frames of each action.
+ * @param count The number of actions in the group.
+ * @param left The left channel.
+ * @param right The right channel.
+ * @param stride The distance between consecutive samples of a channel.
+ * @param frames The number of frames to process.
+ * @param position The position of the first frame in the actions' input.
+ * @param length The total number of frames the actions receive.
+ * @param swapFrames 1 to swap interleaved samples if the group flips.
+ * @param reversed 1 if the frames are stored reversed going in to the group.
+ * @return 1 if the group swaps the channels, 0 otherwise.
+ */
+int runFusedActions(const Action *actions, const int64_t *n, int count,
+		short *left, short *right, int stride, int64_t frames, int64_t position,
+		int64_t length, int swapFrames, int reversed) {
+	int flipped = 0;
+	int work = 0;
+	for (int k = 0; k < count; k++) {
+		if (actions[k].type == ACTION_FLIP)
+			flipped = !flipped;
+		else if (actions[k].type != ACTION_REVERSE)
+			work = 1;
+	}
+
+	if (!work && !(flipped && swapFrames))
+		return flipped;
+
+	FusedPass pass = {
+		actions, n, count, left, right, stride, frames, position, length,
+		flipped && swapFrames, reversed
+	};
+	runTasks((int) ((frames + FUSED_BLOCK_FRAMES - 1) / FUSED_BLOCK_FRAMES),
+		runFusedBlock, &pass);
+
+	return flipped;
+}
+
+/**
+ * Runs a group of fused actions over the whole of some sound data.
+ *
+ * @param header The wave file header.
+ * @param actions The group of actions, each of which joins fused passes.
+ * @param count The number of actions in the group.
+ * @param left The left channel.
+ * @param right The right channel.
+ * @param stride The distance between consecutive samples of a channel.
+ * @param numSamples The number of frames.
+ * @param swapFrames 1 to swap interleaved samples if the group flips.
+ * @param reversed 1 if the frames are stored reversed going in to the group.
+ * @return 1 if the group swaps the channels, 0 otherwise.
+ */
+int runFusedGroup(const WaveHeader *header, const Action *actions, int count,
+		short *left, short *right, int stride, int64_t numSamples, int swapFrames,
+		int reversed) {
+	int64_t n[count > 0 ? count : 1];
+	for (int k = 0; k < count; k++)
+		n[k] = fadeFrames(header, &actions[k]);
+
+	return runFusedActions(actions, n, count, left, right, stride, numSamples, 0,
+		numSamples, swapFrames, reversed);
+}
+
+/**
+ * Counts the reversals in a group of fused actions.
+ *
+ * @param actions The group of actions.
+ * @param count The number of actions in the group.
+ * @return 1 if the group reverses the frames, 0 otherwise.
+ */
+int reversesFrames(const Action *actions, int count) {
+	int reversed = 0;
+	for (int k = 0; k < count; k++) {
+		if (actions[k].type == ACTION_REVERSE)
+			reversed = !reversed;
+	}
+
+	return reversed;
+}
+
+/**
+ * Runs the whole chain over the sound data in memory.  Consecutive per-sample
+ * actions are fused in to single passes; '-s' and '-e' depend on the order
+ * of the whole data and run on their own, as pipeline barriers, as does '-n',
+ * which measures the whole data before it scales it.  A '-r' only
+ * marks the data as reversed: the frames are put in order by the next
+ * barrier, or written out backwards, and two of them cancel out.  The data
+ * is only converted to another layout when a barrier prefers it.
+ *
+ * @param data The WaveData struct to perform the actions on.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ */
+void runChain(WaveData *data, const Action *actions, int count) {
+	for (int i = 0; i < count; ) {
+		int previous = enterStage(actionStage(i));
+		int64_t length = data->numSamples;
+
+		if (!joinsFusedPass(&actions[i])) {
+			const Action *action = &actions[i];
+			convertLayout(data, preferredLayout(action));
+			materializeReverse(data);
+
+			// A '-c' with a stereo impulse response needs each channel where
+			// it belongs.
+			if (splitsChannels(action) && data->swapped) {
+				frameFlipChannels(data->frames, data->numSamples);
+				data->swapped = 0;
+			}
+
+			// A '-n' runs as the '-v' that its measurement calls for.
+			Action volume;
+			if (action->type == ACTION_NORMALIZE) {
+				volume = normalizeVolume(action, i, measureWaveData(data));
+				action = &volume;
+			}
+
+			// The buffers already have room for every stage of the chain.
+			if (data->layout == LAYOUT_PLANAR) {
+				runAction(data, action);
+			} else {
+				data->numSamples = runFrameAction(data->header, data->frames,
+					data->numSamples, action);
+			}
+
+			leaveStage(previous, length, BYTES_PER_FRAME, 2);
+			i++;
+			continue;
+		}
+
+		int end = i;
+		while (end < count && joinsFusedPass(&actions[end]))
+			end++;
+
+		if (data->layout == LAYOUT_PLANAR) {
+			if (runFusedGroup(data->header, actions + i, end - i,
+					data->left, data->right, 1, data->numSamples, 0, data->reversed))
+				actionFlipChannels(data);
+		} else {
+			// Flipping interleaved data only marks it; writeToFile swaps.
+			if (runFusedGroup(data->header, actions + i, end - i,
+					data->frames, data->frames + 1, 2, data->numSamples, 0, data->reversed))
+				data->swapped = !data->swapped;
+		}
+
+		if (reversesFrames(actions + i, end - i))
+			data->reversed = !data->reversed;
+
+		leaveStage(previous, length, BYTES_PER_FRAME, 2);
+		fuseStages(i, end - i);
+		i = end;
+	}
+}
+
+/**
+ * The streaming state of one action in the chain.  Every stage knows up front
+ * how many frames it will receive, so position-dependent actions (the fades
+ * and the speed change) only need counters, and the echo only needs a delay
+ * line of its last "n" input frames, or an EchoLine if it has feedback taps.
+ * A convolution gathers its input in to whole blocks for its convolver.
+ * Blocks stay interleaved from the read to the write, so no stage ever splits
+ * or joins the channels.
+ */
+typedef struct _Stage {
+	const Action *action;
+	int64_t length;     // Frames this stage receives over the whole stream.
+	int64_t n;          // Fade length, or echo or convolution tail in frames.
+	int64_t position;   // Frames received so far.
+	int64_t produced;   // Frames emitted so far ('-s' only).
+	int64_t delayIndex; // Oldest frame in the echo delay line.
+	int blockFrames;    // The length of the stream's blocks.
+	int filled;         // Frames waiting in "out" ('-c' only).
+	int reversed;       // 1 if this stage sees the stream backwards.
+	int64_t delays[ECHO_MAX_TAPS]; // Delay of each echo tap in frames.
+	short *delay;       // The echo delay line, "n" interleaved frames.
+	short *in;          // Copy of the echo's input block, or silence block ('-c' tail).
+	short *out;         // Output block ('-s', '-c') or silence block ('-e' tail).
+	EchoLine *line;     // The running state of a feedback echo.
+	Resampler *resampler; // The running state of an interpolating '-s'.
+	Convolver *convolver; // The running state of a '-c'.
+	double *work;       // The convolver's work buffer.
+} Stage;
+
+/**
+ * Checks whether a chain can be run block by block.  A '-n' needs the whole
+ * of its input measured before it can scale the first frame, and so does
+ * '-r' before it can produce it, unless another '-r' cancels it with nothing
+ * but per-sample actions in between.  Those only
+ * see the frames backwards, which a fade can allow for, since the stream
+ * knows how many frames each stage receives.
+ *
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @return 1 if the chain can be streamed, 0 otherwise.
+ */
+int isStreamable(const Action *actions, int count) {
+	int reversed = 0;
+	for (int i = 0; i < count; i++) {
+		if (actions[i].type == ACTION_NORMALIZE)
+			return 0;
+		if (actions[i].type == ACTION_REVERSE)
+			reversed = !reversed;
+		else if (reversed && !isSampleAction(&actions[i]))
+			return 0;
+	}
+
+	return !reversed;
+}
+
+/**
+ * Frees the stages created by createStages.
+ *
+ * @param stages The stages to free.
+ * @param count The number of stages.
+ */
+void freeStages(Stage *stages, int count) {
+	for (int i = 0; i < count; i++) {
+		free(stages[i].delay);
+		free(stages[i].in);
+		free(stages[i].out);
+		free(stages[i].work);
+		freeEchoLine(stages[i].line);
+		destroyResampler(stages[i].resampler);
+		destroyConvolver(stages[i].convolver);
+	}
+
+	free(stages);
+}
+
+/**
+ * The arguments of planStages.
+ */
+typedef struct _StagePlan {
+	Stage *stages;
+	WaveHeader *header;
+	const Action *actions;
+	int count;
+	int blockFrames;
+} StagePlan;
+
+/**
+ * Fills in the stages of a chain, allocating their state, and updates the
+ * header as each action goes.
+ *
+ * @param context The StagePlan.
+ */
+void planStages(void *context) {
+	const StagePlan *plan = context;
+	WaveHeader *header = plan->header;
+	const Action *actions = plan->actions;
+	int blockFrames = plan->blockFrames;
+
+	int64_t length = header->dataChunk.size / BYTES_PER_FRAME;
+	int reversed = 0;
+	for (int i = 0; i < plan->count; i++) {
+		Stage *stage = &plan->stages[i];
+		stage->action = &actions[i];
+		stage->length = length;
+		stage->blockFrames = blockFrames;
+		stage->reversed = reversed;
+		if (actions[i].type == ACTION_REVERSE)
+			reversed = !reversed;
+
+		switch (actions[i].type) {
+		case ACTION_SPEED:
+			stage->out = allocateFrames(blockFrames);
+			if (actions[i].method != RESAMPLE_NEAREST) {
+				stage->resampler = createResampler(actions[i].method, actions[i].arg1,
+					length, blockFrames);
+				if (stage->resampler == NULL)
+					failure(ERROR_INSUFFICIENT_MEMORY);
+			}
+			break;
+		case ACTION_FADE_OUT:
+		case ACTION_FADE_IN:
+			stage->n = fadeFrames(header, &actions[i]);
+			break;
+		case ACTION_ECHO:
+			stage->n = echoTail(header, &actions[i]);
+			if (isFeedbackEcho(&actions[i])) {
+				stage->line = createEchoLine(header, &actions[i]);
+			} else {
+				echoDelays(header, &actions[i], stage->delays);
+				stage->delay = allocateFrames(stage->n);
+				stage->in = allocateFrames(blockFrames);
+			}
+			stage->out = allocateFrames(blockFrames);
+			break;
+		case ACTION_CONVOLVE:
+			stage->n = impulseTail(header, &actions[i]);
+			stage->convolver = createImpulseConvolver(&actions[i]);
+			stage->work = allocateConvolveWork(stage->convolver);
+			if (stage->work == NULL)
+				failure(ERROR_INSUFFICIENT_MEMORY);
+			stage->in = allocateFrames(blockFrames);
+			stage->out = allocateFrames(blockFrames);
+			break;
+		}
+
+		length = planAction(header, &actions[i], length);
+	}
+}
+
+/**
+ * Creates the streaming stages for a chain and updates the header to what the
+ * whole-file actions would have left it as, so it can be written before any
+ * sound data is processed.  If any of them cannot be created, those that
+ * were are freed before failing.
+ *
+ * @param header The input file header, updated to the output header.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @param blockFrames The length of the stream's blocks.
+ * @return The allocated stages, one per action.
+ */
+Stage *createStages(WaveHeader *header, const Action *actions, int count, int blockFrames) {
+	Stage *stages = calloc(count > 0 ? count : 1, sizeof(Stage));
+	if (stages == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	StagePlan plan = { stages, header, actions, count, blockFrames };
+	char *error = catchFailure(planStages, &plan);
+	if (error != NULL) {
+		freeStages(stages, count);
+		failure(error);
+	}
+
+	return stages;
+}
+
+/**
+ * One block of a streaming echo, shared by its tasks.  "input" is an
+ * unmodified copy of the block, so the block itself can be written to in
+ * place while other tasks still read the frames it held.
+ */
+typedef struct _EchoPass {
+	const Stage *stage;
+	short *frames;
+	const short *input;
+	int count;
+} EchoPass;
+
+/**
+ * Adds the echo to one FUSED_BLOCK_FRAMES piece of a streamed block.  A tap
+ * whose delay reaches back past the start of the block echoes a frame from
+ * the delay line; otherwise it echoes the copy of the block's own input.  The
+ * delay line starts out silent, and echoing silence adds nothing, so the
+ * start of the stream needs no special case.
+ *
+ * @param context The EchoPass.
+ * @param index The index of the piece.
+ */
+void runEchoBlock(void *context, int index) {
+	const EchoPass *pass = context;
+	const Stage *stage = pass->stage;
+	const Action *action = stage->action;
+	int first = index * FUSED_BLOCK_FRAMES;
+	int end = first + FUSED_BLOCK_FRAMES < pass->count ? first + FUSED_BLOCK_FRAMES : pass->count;
+
+	for (int i = first; i < end; i++) {
+		for (int k = 0; k < action->numTaps; k++) {
+			int64_t d = stage->delays[k];
+			const short *delayed;
+			if (i >= d)
+				delayed = pass->input + 2 * (i - d);
+			else
+				delayed = stage->delay + 2 * ((stage->delayIndex + stage->n + i - d) % stage->n);
+
+			pass->frames[2 * i]     += scaleSample(delayed[0], action->taps[k].scale);
+			pass->frames[2 * i + 1] += scaleSample(delayed[1], action->taps[k].scale);
+		}
+	}
+}
+
+/**
+ * Adds an echo whose taps all have a delay of 0 to one piece of a streamed
+ * block: each sample echoes itself, as it does in actionEcho.
+ *
+ * @param context The EchoPass.
+ * @param index The index of the piece.
+ */
+void runSelfEchoBlock(void *context, int index) {
+	const EchoPass *pass = context;
+	const Action *action = pass->stage->action;
+	int first = 2 * index * FUSED_BLOCK_FRAMES;
+	int end = first + 2 * FUSED_BLOCK_FRAMES < 2 * pass->count ? first + 2 * FUSED_BLOCK_FRAMES : 2 * pass->count;
+
+	for (int i = first; i < end; i++) {
+		short sample = pass->frames[i];
+		for (int k = 0; k < action->numTaps; k++)
+			pass->frames[i] += scaleSample(sample, action->taps[k].scale);
+	}
+}
+
+/**
+ * Adds the echo to one block in place, keeping the last "n" input frames in
+ * the stage's delay line for the next block.  The block is processed in
+ * pieces spread over the worker pool.  A feedback echo instead runs forwards
+ * through its EchoLine on this thread.
+ *
+ * @param stage The '-e' stage.
+ * @param frames The interleaved block.
+ * @param count The number of frames in the block.
+ */
+void echoBlock(Stage *stage, short *frames, int count) {
+	if (stage->line != NULL) {
+		runEchoLine(stage->line, frames, frames + 1, 2, count);
+		return;
+	}
+
+	EchoPass pass = { stage, frames, stage->in, count };
+	int pieces = (count + FUSED_BLOCK_FRAMES - 1) / FUSED_BLOCK_FRAMES;
+
+	if (stage->n == 0) {
+		runTasks(pieces, runSelfEchoBlock, &pass);
+		return;
+	}
+
+	memcpy(stage->in, frames, (size_t) BYTES_PER_FRAME * count);
+	runTasks(pieces, runEchoBlock, &pass);
+
+	// Keep the last n input frames, oldest first from delayIndex.
+	int64_t n = stage->n;
+	if (count >= n) {
+		memcpy(stage->delay, stage->in + 2 * (count - n), (size_t) BYTES_PER_FRAME * n);
+		stage->delayIndex = 0;
+	} else {
+		int64_t tail = n - stage->delayIndex;
+		int head = count < tail ? count : (int) tail;
+
+		memcpy(stage->delay + 2 * stage->delayIndex, stage->in, (size_t) BYTES_PER_FRAME * head);
+		memcpy(stage->delay, stage->in + 2 * head, (size_t) BYTES_PER_FRAME * (count - head));
+		stage->delayIndex = (stage->delayIndex + count) % n;
+	}
+}
+
+/**
+ * The I/O threads of a stream.  The reader thread reads blocks ahead in to
+ * "input" while the main thread runs the chain over the block before, and
+ * the writer thread writes out the blocks the chain has finished with from
+ * "output", so reading, processing and writing all overlap.  Output is
+ * gathered in to the block "pending" until it holds a whole block, however
+ * the chain happens to cut it up.
+ */
+typedef struct _StreamIO {
+	BlockQueue *input;
+	BlockQueue *output;
+	pthread_t reader;
+	pthread_t writer;
+	int64_t numSamples;          // Frames the reader reads in all.
+	int blockFrames;             // The length of the stream's blocks.
+	const unsigned char *mapped; // The mapped input, or NULL for stdin.
+	size_t mappedRemaining;
+	short *pending;
+	int pendingFrames;
+	int writeFailed;             // 1 once the writer could not write.
+} StreamIO;
+
+// The blocks each queue of a stream holds: one being filled, one being used,
+// and one more so neither side has to wait for the other to hand one back.
+#define STREAM_QUEUE_BLOCKS 3
+
+// The I/O threads of the stream running on this thread, if any.
+static __thread StreamIO *streamIO = NULL;
+
+/**
+ * The body of a stream's reader thread.  Reads the stream's frames block by
+ * block, from the mapped input or stdin, and stops after a short block if the
+ * input ends early, which the main thread then fails.
+ *
+ * @param arg The StreamIO.
+ * @return NULL.
+ */
+void *streamReader(void *arg) {
+	StreamIO *io = arg;
+
+	for (int64_t i = 0; i < io->numSamples; i += io->blockFrames) {
+		int frames = io->numSamples - i < io->blockFrames
+			? (int) (io->numSamples - i) : io->blockFrames;
+		size_t size = (size_t) BYTES_PER_FRAME * frames;
+
+		unsigned char *block = acquireBlock(io->input);
+		if (block == NULL)
+			break;
+
+		size_t used;
+		if (io->mapped != NULL) {
+			used = io->mappedRemaining < size ? io->mappedRemaining : size;
+			memcpy(block, io->mapped, used);
+			io->mapped += used;
+			io->mappedRemaining -= used;
+		} else {
+			used = BYTES_PER_FRAME * fread(block, BYTES_PER_FRAME, frames, stdin);
+		}
+
+		submitBlock(io->input, used);
+		if (used < size)
+			break;
+	}
+
+	closeBlockQueue(io->input);
+	return NULL;
+}
+
+/**
+ * The body of a stream's writer thread.  Writes each block handed to it to
+ * stdout, in order, until the stream is done.  A write that fails is noted
+ * for stopStreamIO to fail the stream with, and the blocks after it are
+ * only taken, so the main thread is never left waiting.
+ *
+ * @param arg The StreamIO.
+ * @return NULL.
+ */
+void *streamWriter(void *arg) {
+	StreamIO *io = arg;
+	unsigned char *block;
+	size_t used;
+
+	while ((block = takeBlock(io->output, &used)) != NULL) {
+		if (!io->writeFailed && fwrite(block, 1, used, stdout) != used)
+			io->writeFailed = 1;
+		if (!io->writeFailed)
+			checksumOutput(block, used);
+		returnBlock(io->output);
+	}
+
+	if (!io->writeFailed && fflush(stdout) != 0)
+		io->writeFailed = 1;
+	return NULL;
+}
+
+/**
+ * Starts the I/O threads of a stream, reading from wherever readInterleaved
+ * would, and sends the stream's output to them.
+ *
+ * @param io Where to keep the threads' state.
+ * @param numSamples The number of frames in the input stream.
+ * @param blockFrames The length of the stream's blocks.
+ */
+void startStreamIO(StreamIO *io, int64_t numSamples, int blockFrames) {
+	size_t size = (size_t) BYTES_PER_FRAME * blockFrames;
+
+	memset(io, 0, sizeof(StreamIO));
+	io->numSamples = numSamples;
+	io->blockFrames = blockFrames;
+	io->mapped = mappedInput;
+	io->mappedRemaining = mappedRemaining;
+
+	io->input = createBlockQueue(STREAM_QUEUE_BLOCKS, size);
+	io->output = createBlockQueue(STREAM_QUEUE_BLOCKS, size);
+	if (io->input == NULL || io->output == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	noteAllocation(2 * STREAM_QUEUE_BLOCKS * size);
+
+	// Whatever the header left in stdout's buffer goes out first.
+	checkStdout();
+
+	if (pthread_create(&io->reader, NULL, streamReader, io) != 0)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	if (pthread_create(&io->writer, NULL, streamWriter, io) != 0) {
+		cancelBlockQueue(io->input);
+		pthread_join(io->reader, NULL);
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	}
+
+	streamIO = io;
+}
+
+/**
+ * Hands frames to a stream's writer thread, swapping their channels on the
+ * way if they are marked as swapped.  The frames are copied, so the caller
+ * can reuse its block at once.
+ *
+ * @param io The stream's I/O threads.
+ * @param frames The interleaved frames.
+ * @param count How many frames there are.
+ * @param swapped 1 if the two samples of each frame must be swapped.
+ */
+void queueFrames(StreamIO *io, const short *frames, int count, int swapped) {
+	while (count > 0) {
+		if (io->pending == NULL) {
+			io->pending = acquireBlock(io->output);
+			io->pendingFrames = 0;
+		}
+
+		int room = io->blockFrames - io->pendingFrames;
+		int n = count < room ? count : room;
+		short *out = io->pending + 2 * io->pendingFrames;
+
+		if (swapped)
+			swapFrames(out, frames, n);
+		else
+			memcpy(out, frames, (size_t) BYTES_PER_FRAME * n);
+
+		io->pendingFrames += n;
+		frames += 2 * n;
+		count -= n;
+
+		if (io->pendingFrames == io->blockFrames) {
+			submitBlock(io->output, (size_t) BYTES_PER_FRAME * io->pendingFrames);
+			io->pending = NULL;
+		}
+	}
+}
+
+/**
+ * Stops the I/O threads of a stream, once the writer has written everything
+ * handed to it, and frees their queues.  Fails if the writer could not
+ * write it all.
+ *
+ * @param io The stream's I/O threads.
+ */
+void stopStreamIO(StreamIO *io) {
+	if (io->pending != NULL && io->pendingFrames > 0)
+		submitBlock(io->output, (size_t) BYTES_PER_FRAME * io->pendingFrames);
+	io->pending = NULL;
+
+	closeBlockQueue(io->output);
+	pthread_join(io->writer, NULL);
+
+	// The reader is only still going if the stream stopped early.
+	cancelBlockQueue(io->input);
+	pthread_join(io->reader, NULL);
+
+	destroyBlockQueue(io->input);
+	destroyBlockQueue(io->output);
+	streamIO = NULL;
+	if (io->writeFailed)
+		failure(ERROR_WRITE_FAILED);
+}
+
+/**
+ * The output of one input's chain in a mix, held until the mix reaches it.
+ * The frames from "start" to "count" are still to be mixed.
+ */
+typedef struct _HeldFrames {
+	short *frames;
+	int64_t start;
+	int64_t count;
+	int64_t capacity;
+} HeldFrames;
+
+// Where pushFrames holds the output of the chain it runs for a mix, or NULL
+// to write it to the stream.
+static __thread HeldFrames *heldFrames = NULL;
+
+/**
+ * Holds frames a chain has finished with, swapping their channels on the way
+ * if they are marked as swapped.  The frames already mixed are dropped first,
+ * so the buffer only grows as far as one push of the chain outruns the mix.
+ *
+ * @param held The held frames.
+ * @param frames The interleaved frames.
+ * @param count How many frames there are.
+ * @param swapped 1 if the two samples of each frame must be swapped.
+ */
+void holdFrames(HeldFrames *held, const short *frames, int count, int swapped) {
+	if (held->start > 0) {
+		held->count -= held->start;
+		memmove(held->frames, held->frames + 2 * held->start,
+			(size_t) BYTES_PER_FRAME * held->count);
+		held->start = 0;
+	}
+
+	if (held->count + count > held->capacity) {
+		int64_t capacity = 2 * (held->count + count);
+		short *grown = realloc(held->frames, (size_t) BYTES_PER_FRAME * capacity);
+		if (grown == NULL)
+			failure(ERROR_INSUFFICIENT_MEMORY);
+
+		held->frames = grown;
+		held->capacity = capacity;
+		noteAllocation((size_t) BYTES_PER_FRAME * capacity);
+	}
+
+	short *out = held->frames + 2 * held->count;
+	if (swapped)
+		swapFrames(out, frames, count);
+	else
+		memcpy(out, frames, (size_t) BYTES_PER_FRAME * count);
+	held->count += count;
+}
+
+/**
+ * Passes a block of frames through the stages starting at "from", writing
+ * whatever comes out of the last stage to the stream's writer thread, or
+ * holding it for a mix.  Runs of per-sample stages are fused in to one pass
+ * over the block; the speed change resamples into its own block and forwards
+ * it each time it fills.  A flip
+ * only toggles "swapped", and the samples are swapped once, as the block is
+ * written.  A '-r' moves nothing; the stages up to the '-r' that cancels it
+ * just see the stream backwards.
+ *
+ * @param stages The stages of the chain.
+ * @param from The first stage to run.
+ * @param count The total number of stages.
+ * @param block The interleaved block.
+ * @param frames The number of frames in the block, at most the stream's block size.
+ * @param swapped 1 if the block's channels are already marked as swapped.
+ */
+void pushFrames(Stage *stages, int from, int count, short *block, int frames, int swapped) {
+	for (int k = from; k < count && frames > 0; k++) {
+		Stage *stage = &stages[k];
+		const Action *action = stage->action;
+
+		if (joinsFusedPass(action)) {
+			int end = k;
+			while (end < count && joinsFusedPass(stages[end].action))
+				end++;
+
+			int64_t n[end - k];
+			for (int i = k; i < end; i++)
+				n[i - k] = stages[i].n;
+
+			int previous = enterStage(actionStage(k));
+			if (runFusedActions(action, n, end - k, block, block + 1, 2, frames,
+					stage->position, stage->length, 0, stage->reversed))
+				swapped = !swapped;
+			leaveStage(previous, frames, BYTES_PER_FRAME, 2);
+			fuseStages(k, end - k);
+
+			for (int i = k; i < end; i++)
+				stages[i].position += frames;
+
+			k = end - 1;
+			continue;
+		}
+
+		switch (action->type) {
+		case ACTION_SPEED: {
+			// Whatever the later stages do with the blocks this one fills is
+			// charged to them.
+			int previous = enterStage(actionStage(k));
+			int input = frames;
+
+			if (stage->resampler != NULL) {
+				feedResampler(stage->resampler, block, frames);
+
+				int filled = 0;
+				int made;
+				while ((made = drainResampler(stage->resampler, stage->out + 2 * filled,
+						stage->blockFrames - filled)) > 0) {
+					filled += made;
+					if (filled == stage->blockFrames) {
+						pushFrames(stages, k + 1, count, stage->out, filled, swapped);
+						filled = 0;
+					}
+				}
+
+				stage->position += frames;
+				block = stage->out;
+				frames = filled;
+				leaveStage(previous, input, BYTES_PER_FRAME, 2);
+				continue;
+			}
+
+			int64_t length = speedLength(stage->length, action->arg1);
+			int64_t end = stage->position + frames;
+			int filled = 0;
+
+			while (stage->produced < length) {
+				int64_t j = (int64_t) (stage->produced * action->arg1);
+				if (j >= end)
+					break;
+
+				stage->out[2 * filled]     = block[2 * (j - stage->position)];
+				stage->out[2 * filled + 1] = block[2 * (j - stage->position) + 1];
+				stage->produced++;
+
+				if (++filled == stage->blockFrames) {
+					pushFrames(stages, k + 1, count, stage->out, filled, swapped);
+					filled = 0;
+				}
+			}
+
+			stage->position = end;
+			block = stage->out;
+			frames = filled;
+			leaveStage(previous, input, BYTES_PER_FRAME, 2);
+			continue;
+		}
+		case ACTION_ECHO: {
+			int previous = enterStage(actionStage(k));
+			echoBlock(stage, block, frames);
+			leaveStage(previous, frames, BYTES_PER_FRAME, 2);
+			break;
+		}
+		case ACTION_CONVOLVE: {
+			// The convolver takes whole blocks, and the stream's block size is
+			// a multiple of every convolver's, so the frames wait in "out"
+			// until it fills, or until the stage has received the last of its
+			// input and tail.  A stereo impulse response follows the channels
+			// to wherever the flips before it have left them.
+			int previous = enterStage(actionStage(k));
+			int64_t end = stage->length + stage->n;
+			int s = swapped ? 1 : 0;
+
+			for (int i = 0; i < frames; ) {
+				int take = frames - i < stage->blockFrames - stage->filled
+					? frames - i : stage->blockFrames - stage->filled;
+				memcpy(stage->out + 2 * stage->filled, block + 2 * i,
+					(size_t) BYTES_PER_FRAME * take);
+				stage->filled += take;
+				stage->position += take;
+				i += take;
+
+				if (stage->filled == stage->blockFrames || stage->position == end) {
+					convolveShorts(stage->convolver, stage->work, stage->out + s,
+						stage->out + 1 - s, 2, stage->filled);
+					pushFrames(stages, k + 1, count, stage->out, stage->filled, swapped);
+					stage->filled = 0;
+				}
+			}
+
+			leaveStage(previous, frames, BYTES_PER_FRAME, 2);
+			frames = 0;
+			continue;
+		}
+		}
+
+		stage->position += frames;
+	}
+
+	if (frames > 0) {
+		int previous = enterStage(STATS_WRITE);
+		if (heldFrames != NULL)
+			holdFrames(heldFrames, block, frames, swapped);
+		else
+			queueFrames(streamIO, block, frames, swapped);
+		leaveStage(previous, frames, BYTES_PER_FRAME, 2);
+	}
+}
+
+/**
+ * Pushes the tails of a stream's echoes and convolutions through the stages,
+ * once the last of the input has been.  A tail is what its stage makes of
+ * silence, fed through the later stages with the channels marked the way the
+ * earlier flips left them.
+ *
+ * @param stages The stages of the chain.
+ * @param count The number of stages.
+ * @param blockFrames The length of the stream's blocks.
+ */
+void flushTails(Stage *stages, int count, int blockFrames) {
+	int swapped = 0;
+	for (int k = 0; k < count; k++) {
+		Stage *stage = &stages[k];
+		if (stage->action->type == ACTION_FLIP)
+			swapped = !swapped;
+		if (stage->action->type != ACTION_ECHO && stage->action->type != ACTION_CONVOLVE)
+			continue;
+
+		short *silence = stage->action->type == ACTION_ECHO ? stage->out : stage->in;
+		for (int64_t i = 0; i < stage->n; i += blockFrames) {
+			int frames = stage->n - i < blockFrames ? (int) (stage->n - i) : blockFrames;
+
+			memset(silence, 0, (size_t) BYTES_PER_FRAME * frames);
+			pushFrames(stages, k, count, silence, frames, swapped);
+		}
+	}
+}
+
+/**
+ * Streams the sound data from the input stream to the output stream through
+ * the stages, one block at a time, then flushes the echo tails.  The blocks
+ * are read and written on their own threads, so the chain runs over one
+ * block while the next is read and the last is written.  Memory use is
+ * bounded by the block size plus the echo delays.  Because output starts
+ * before the input has been fully read, a short input still fails with
+ * ERROR_INVALID_FILE_SIZE but may leave partial output behind.
+ *
+ * With '--stats', the read and write stages are the time the chain spends
+ * waiting for the I/O threads, and handing blocks to them.
+ *
+ * @param numSamples The number of frames in the input stream.
+ * @param stages The stages of the chain.
+ * @param count The number of stages.
+ * @param blockFrames The length of the stream's blocks.
+ */
+void streamSoundData(int64_t numSamples, Stage *stages, int count, int blockFrames) {
+	StreamIO io;
+	startStreamIO(&io, numSamples, blockFrames);
+
+	for (int64_t i = 0; i < numSamples; i += blockFrames) {
+		int frames = numSamples - i < blockFrames ? (int) (numSamples - i) : blockFrames;
+
+		int previous = enterStage(STATS_READ);
+		size_t used = 0;
+		short *block = takeBlock(io.input, &used);
+		leaveStage(previous, frames, BYTES_PER_FRAME, 2);
+
+		// Everything before the short block still goes out.
+		if (block == NULL || used < (size_t) BYTES_PER_FRAME * frames) {
+			stopStreamIO(&io);
+			failure(ERROR_INVALID_FILE_SIZE);
+		}
+
+		pushFrames(stages, 0, count, block, frames, 0);
+		returnBlock(io.input);
+	}
+
+	flushTails(stages, count, blockFrames);
+	stopStreamIO(&io);
+}
+
+/**
+ * A wave file mapped into memory.
+ */
+typedef struct _MappedFile {
+	int fd;
+	unsigned char *map;
+	size_t size;
+} MappedFile;
+
+/**
+ * Maps a whole file read-only.  The kernel is told the mapping will be read
+ * sequentially so it can read ahead aggressively.
+ *
+ * @param file Where to store the mapping.
+ * @param path The path of the file to map.
+ */
+void mapInputFile(MappedFile *file, const char *path) {
+	struct stat info;
+
+	file->fd = open(path, O_RDONLY);
+	if (file->fd < 0 || fstat(file->fd, &info) != 0)
+		failure(ERROR_FILE_ACCESS);
+
+	file->size = (size_t) info.st_size;
+	file->map = NULL;
+	if (file->size > 0) {
+		file->map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+		if (file->map == MAP_FAILED)
+			failure(ERROR_FILE_ACCESS);
+
+		posix_madvise(file->map, file->size, POSIX_MADV_SEQUENTIAL);
+	}
+}
+
+/**
+ * Opens an output file to write.  A regular file, or one that does not exist
+ * yet, is created under a temporary name until finishOutput renames it over
+ * the path; anything else, such as a device, is opened as it is.
+ *
+ * @param path The path of the output file.
+ * @param access O_WRONLY or O_RDWR.
+ * @return The file descriptor of the output.
+ */
+int createOutput(const char *path, int access) {
+	struct stat info;
+	int exists = stat(path, &info) == 0;
+	if (exists && !S_ISREG(info.st_mode)) {
+		int fd = open(path, access | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			failure(ERROR_FILE_ACCESS);
+
+		return fd;
+	}
+
+	// Through a link, the file it points to is the one replaced.
+	char *target = exists ? realpath(path, NULL) : strdup(path);
+	if (target == NULL)
+		failure(ERROR_FILE_ACCESS);
+
+	// mkstemp picks a name no other file has, next to the target so the
+	// rename stays on one file system.
+	char *temporary = malloc(strlen(target) + sizeof(".XXXXXX"));
+	if (temporary == NULL) {
+		free(target);
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	}
+	sprintf(temporary, "%s.XXXXXX", target);
+
+	int fd = mkstemp(temporary);
+	if (fd < 0) {
+		free(temporary);
+		free(target);
+		failure(ERROR_FILE_ACCESS);
+	}
+
+	pendingOutput = temporary;
+	pendingTarget = target;
+	mode_t mode = exists ? info.st_mode & 07777 : 0644 & ~creationMask();
+	if (fchmod(fd, mode) != 0)
+		failure(ERROR_FILE_ACCESS);
+
+	return fd;
+}
+
+/**
+ * Renames this thread's pending output over its path, once the output has
+ * been written and closed.
+ */
+void finishOutput(void) {
+	if (pendingOutput == NULL)
+		return;
+
+	if (rename(pendingOutput, pendingTarget) != 0)
+		failure(ERROR_FILE_ACCESS);
+
+	free(pendingOutput);
+	free(pendingTarget);
+	pendingOutput = NULL;
+	pendingTarget = NULL;
+}
+
+/**
+ * Creates an output file of the given size and maps it writable.
+ *
+ * @param file Where to store the mapping.
+ * @param path The path of the output file.
+ * @param size The size to create the file with.
+ */
+void mapOutputFile(MappedFile *file, const char *path, size_t size) {
+	file->fd = createOutput(path, O_RDWR);
+	if (ftruncate(file->fd, (off_t) size) != 0)
+		failure(ERROR_FILE_ACCESS);
+
+	file->size = size;
+	file->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+	if (file->map == MAP_FAILED)
+		failure(ERROR_FILE_ACCESS);
+}
+
+/**
+ * Unmaps and closes a mapped file.  Writable files are then cut down to their
+ * final size, which can be smaller than the size they were mapped with.
+ *
+ * @param file The mapping to release.
+ * @param finalSize The size to leave a writable file at, or 0 to leave it.
+ */
+void unmapFile(MappedFile *file, size_t finalSize) {
+	if (file->map != NULL)
+		munmap(file->map, file->size);
+
+	if (finalSize > 0 && ftruncate(file->fd, (off_t) finalSize) != 0)
+		failure(ERROR_FILE_ACCESS);
+
+	close(file->fd);
+}
+
+/**
+ * Reads and validates the header of a mapped input file, and points
+ * readFrames at its sound data, wherever the data chunk starts.  Unlike a stream, the
+ * file's length is checked against the header before any data is processed.
+ *
+ * @param header Where to store the wave file header.
+ * @param map The mapped input file, or a wave file held in memory.
+ * @param size The size of the file.
+ * @return The offset of the sound data in the file.
+ */
+size_t readMappedHeader(WaveHeader *header, const unsigned char *map, size_t size) {
+	size_t offset = readHeaderBuffer(header, map, size);
+	validateHeader(header);
+
+	mappedInput = map + offset;
+	mappedRemaining = size - offset;
+	size_t frameSize = header->formatChunk.blockAlign;
+	if (mappedRemaining < (header->dataChunk.size / frameSize) * frameSize)
+		failure(ERROR_INVALID_FILE_SIZE);
+
+	return offset;
+}
+
+/**
+ * Works out the identity of an open file, which the file's index records.
+ *
+ * @param fd The file.
+ * @return Its identity.
+ */
+IndexStamp fileStamp(int fd) {
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+		failure(ERROR_FILE_ACCESS);
+
+	IndexStamp stamp;
+	stamp.device = (uint64_t) info.st_dev;
+	stamp.inode = (uint64_t) info.st_ino;
+	stamp.size = (uint64_t) info.st_size;
+	stamp.seconds = (int64_t) info.st_mtim.tv_sec;
+	stamp.nanoseconds = (int64_t) info.st_mtim.tv_nsec;
+	return stamp;
+}
+
+/**
+ * Reads the header of a mapped input file as readMappedHeader does, or takes
+ * it from the file's index instead, if the file has one that still matches
+ * it.  An index's header was validated when the index was made and is
+ * trusted as it is; only the bounds of the sound data are checked, so the
+ * file is never read past its end.
+ *
+ * @param header Where to store the wave file header.
+ * @param file The mapped input file.
+ * @param path The path of the input file.
+ * @param index Where to store the fixed part of the index, which is cleared
+ *              if there is none to use.
+ * @return The offset of the sound data in the file.
+ */
+size_t readIndexedHeader(WaveHeader *header, const MappedFile *file, const char *path,
+		WaveIndex *index) {
+	IndexStamp stamp = fileStamp(file->fd);
+	if (!readIndex(path, &stamp, index) || index->dataOffset > file->size
+		|| file->size - index->dataOffset < index->header.dataChunk.size) {
+		memset(index, 0, sizeof(WaveIndex));
+		return readMappedHeader(header, file->map, file->size);
+	}
+
+	*header = index->header;
+	mappedInput = file->map + index->dataOffset;
+	mappedRemaining = file->size - index->dataOffset;
+	return (size_t) index->dataOffset;
+}
+
+/**
+ * Reads the header of a mapped input file, as readIndexedHeader does, into an
+ * allocated struct.
+ *
+ * @param file The mapped input file.
+ * @param path The path of the input file.
+ * @param index Where to store the fixed part of the file's index.
+ * @return A pointer to the wave file header.
+ */
+WaveHeader *mapFileHeader(const MappedFile *file, const char *path, WaveIndex *index) {
+	WaveHeader *header = malloc(sizeof(WaveHeader));
+	if (header == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	readIndexedHeader(header, file, path, index);
+	return header;
+}
+
+/**
+ * Replaces a '-n' at the start of a chain with the '-v' that the levels in
+ * the input's index call for, so the sound data need not be measured.
+ *
+ * @param index The fixed part of the input's index.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ */
+void useIndexLevels(const WaveIndex *index, Action *actions, int count) {
+	if (index->measured && measuresOnRead(actions, count))
+		actions[0] = levelsVolume(&actions[0], 0, &index->levels);
+}
+
+/**
+ * Writes the index of a finished wave file next to it.
+ *
+ * @param path The path of the wave file.
+ */
+void indexFile(const char *path) {
+	MappedFile file;
+	WaveHeader header;
+
+	mapInputFile(&file, path);
+	size_t offset = readMappedHeader(&header, file.map, file.size);
+	mappedInput = NULL;
+
+	IndexStamp stamp = fileStamp(file.fd);
+	int result = writeIndex(path, &stamp, &header, file.map, offset);
+	unmapFile(&file, 0);
+
+	if (result == INDEX_ERROR_MEMORY)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	if (result != INDEX_OK)
+		failure(ERROR_FILE_ACCESS);
+}
+
+/**
+ * Runs the whole chain in place over interleaved frames and updates the
+ * header to match.
+ *
+ * @param header The wave file header.
+ * @param frames The interleaved frames, with room for the longest stage.
+ * @param numSamples The number of frames going in to the chain.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @param loudness Room for the measurements of '-n' actions.
+ * @param measured 1 if "loudness" already holds the measurement of the
+ *                 frames for a '-n' at the start of the chain.
+ * @return The number of frames coming out of the chain.
+ */
+int64_t runFrameChain(WaveHeader *header, short *frames, int64_t numSamples,
+		const Action *actions, int count, Loudness *loudness, int measured) {
+	int reversed = 0;
+	for (int i = 0; i < count; i++) {
+		const Action *action = &actions[i];
+
+		// Fuse consecutive per-sample actions in to one pass, and only note
+		// which way round the frames are.
+		if (joinsFusedPass(action)) {
+			int end = i;
+			while (end < count && joinsFusedPass(&actions[end]))
+				end++;
+
+			int previous = enterStage(actionStage(i));
+			runFusedGroup(header, action, end - i, frames, frames + 1, 2, numSamples, 1,
+				reversed);
+			leaveStage(previous, numSamples, BYTES_PER_FRAME, 2);
+			fuseStages(i, end - i);
+
+			if (reversesFrames(action, end - i))
+				reversed = !reversed;
+
+			i = end - 1;
+			continue;
+		}
+
+		int previous = enterStage(actionStage(i));
+		int64_t length = numSamples;
+		if (reversed)
+			frameReverse(frames, numSamples);
+		reversed = 0;
+
+		// A '-n' runs as the '-v' that its measurement calls for.
+		Action volume;
+		if (action->type == ACTION_NORMALIZE) {
+			if (!measured)
+				measureFrameData(header, loudness, frames, frames + 1, 2, numSamples);
+			measured = 0;
+
+			volume = normalizeVolume(action, i, loudness);
+			action = &volume;
+		}
+
+		numSamples = runFrameAction(header, frames, numSamples, action);
+		leaveStage(previous, length, BYTES_PER_FRAME, 2);
+	}
+
+	if (reversed) {
+		int previous = enterStage(STATS_WRITE);
+		frameReverse(frames, numSamples);
+		leaveStage(previous, 0, BYTES_PER_FRAME, 2);
+	}
+
+	return numSamples;
+}
+
+/**
+ * Runs the chain directly in an output buffer with room for a header and the
+ * longest stage of the chain.  The sound data is copied in from the mapped
+ * input (or read from stdin), just behind where the output header will end,
+ * and measured on the way for a '-n' at the start of the chain, every action
+ * runs in place over the interleaved frames, and the output header is
+ * written in front of them.
+ *
+ * @param header The input file header, updated to the output header.
+ * @param buffer The output buffer.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @return The size of the output file in the buffer.
+ */
+size_t runBufferChain(WaveHeader *header, unsigned char *buffer,
+		const Action *actions, int count) {
+	int64_t numSamples = header->dataChunk.size / BYTES_PER_FRAME;
+
+	size_t offset = chainHeaderSize(header, actions, count);
+	unsigned char *samples = buffer + offset;
+	Loudness loudness;
+	int measured = measuresOnRead(actions, count);
+	if (measured)
+		initLoudness(&loudness, 2, header->formatChunk.sampleRate, 32768);
+
+	int previous = enterStage(STATS_READ);
+	readMeasured((short *) samples, numSamples, measured ? &loudness : NULL);
+	leaveStage(previous, numSamples, BYTES_PER_FRAME, 2);
+
+	numSamples = runFrameChain(header, (short *) samples, numSamples, actions, count,
+		&loudness, measured);
+
+	previous = enterStage(STATS_WRITE);
+	writeHeaderBuffer(header, buffer);
+	leaveStage(previous, 0, BYTES_PER_FRAME, 2);
+
+	return offset + (size_t) numSamples * BYTES_PER_FRAME;
+}
+
+/**
+ * Runs the chain directly in a mapped output file.  The file is created large
+ * enough for the longest stage of the chain, the chain runs in it as
+ * runBufferChain does, and the file is then cut down to its final size.  No
+ * separate channel arrays are allocated.
+ *
+ * @param header The input file header, updated to the output header.
+ * @param path The path of the output file.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ */
+void runMappedOutput(WaveHeader *header, const char *path,
+		const Action *actions, int count) {
+	int64_t numSamples = header->dataChunk.size / BYTES_PER_FRAME;
+
+	// Find the longest stage so the whole chain fits in the mapping.
+	int64_t capacity = chainCapacity(header, actions, count, numSamples);
+
+	MappedFile output;
+	int previous = enterStage(STATS_WRITE);
+	mapOutputFile(&output, path, chainHeaderSize(header, actions, count)
+		+ (size_t) capacity * BYTES_PER_FRAME);
+	leaveStage(previous, 0, BYTES_PER_FRAME, 2);
+
+	size_t size = runBufferChain(header, output.map, actions, count);
+
+	previous = enterStage(STATS_WRITE);
+	unmapFile(&output, size);
+	finishOutput();
+	leaveStage(previous, (size - headerSize(header)) / BYTES_PER_FRAME, BYTES_PER_FRAME, 2);
+}
+
+/**
+ * Checks whether a file is in the 16-bit stereo format the rest of the
+ * program is specialized for.
+ *
+ * @param header The wave file header.
+ * @return 1 if it is, 0 if it needs the format-generic path.
+ */
+int isNativeFormat(const WaveHeader *header) {
+	return header->formatChunk.compression == 1 && header->formatChunk.channels == 2
+		&& header->formatChunk.bitsPerSample == 16;
+}
+
+/*
+ * A chain that leaves the sound data as it is, or only swaps the channels of
+ * each frame, never needs the samples in memory.  The data chunk is copied
+ * straight from the input file to the output, by the kernel where it can be
+ * (copy_file_range, or sendfile in to a pipe), or through one buffer with a
+ * single swapping pass, and only the header is written by the program.
+ */
+
+#define PASS_NONE     0
+#define PASS_IDENTITY 1
+#define PASS_SWAP     2
+
+// Frames moved per read and write by a swapping pass-through.
+#define PASS_BLOCK_FRAMES (IO_BLOCK_FRAMES * 16)
+
+/**
+ * Checks whether a chain of optimized actions can pass the sound data
+ * through.  An empty chain copies the data of any format as it is, unless
+ * the float working mode quantizes it on the way out, and a lone '-f' swaps
+ * the channels of 16-bit stereo.
+ *
+ * @param header The input file header.
+ * @param options The options the chain runs with.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @return PASS_IDENTITY, PASS_SWAP or PASS_NONE.
+ */
+int passThroughKind(const WaveHeader *header, const Options *options,
+		const Action *actions, int count) {
+	if (options->floatMode)
+		return PASS_NONE;
+	if (count == 0)
+		return PASS_IDENTITY;
+	if (count == 1 && actions[0].type == ACTION_FLIP && isNativeFormat(header))
+		return PASS_SWAP;
+
+	return PASS_NONE;
+}
+
+/**
+ * Writes all of a buffer to a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param bytes The bytes to write.
+ * @param size How many bytes there are.
+ */
+void writeAll(int fd, const void *bytes, size_t size) {
+	const unsigned char *next = bytes;
+	while (size > 0) {
+		ssize_t written = write(fd, next, size);
+		if (written <= 0)
+			failure(ERROR_WRITE_FAILED);
+
+		next += written;
+		size -= (size_t) written;
+	}
+}
+
+/**
+ * Reads all of a run of bytes from a file at an offset, failing if the file
+ * ends first.
+ *
+ * @param fd The file descriptor.
+ * @param bytes Where to store the bytes.
+ * @param size How many bytes to read.
+ * @param offset Where in the file to read them from.
+ */
+void readAllAt(int fd, void *bytes, size_t size, off_t offset) {
+	unsigned char *next = bytes;
+	while (size > 0) {
+		ssize_t got = pread(fd, next, size, offset);
+		if (got <= 0)
+			failure(ERROR_INVALID_FILE_SIZE);
+
+		next += got;
+		offset += got;
+		size -= (size_t) got;
+	}
+}
+
+/**
+ * Copies bytes from one file to another in the kernel, without them passing
+ * through the program.
+ *
+ * @param in The input file descriptor.
+ * @param offset The position in the input to copy from, advanced.
+ * @param out The output file descriptor, written at its current position.
+ * @param size How many bytes to copy.
+ * @return How many bytes were left for another route, when the kernel
+ *         cannot copy between the two files.
+ */
+size_t copyInKernel(int in, off_t *offset, int out, size_t size) {
+	// Output being checksummed has to pass through the program.
+	if (outputChecksums != NULL)
+		return size;
+
+#ifdef __linux__
+	ssize_t copied;
+	while (size > 0 && (copied = copy_file_range(in, offset, out, NULL, size, 0)) > 0)
+		size -= (size_t) copied;
+	while (size > 0 && (copied = sendfile(out, in, offset, size)) > 0)
+		size -= (size_t) copied;
+#else
+	(void) in;
+	(void) offset;
+	(void) out;
+#endif
+	return size;
+}
+
+/**
+ * Passes the sound data of a file through to the output behind its header.
+ * The data is read with its file offset, so it does not matter where the
+ * file's position is.  Fails if the input ends early.
+ *
+ * @param header The wave file header, which the output keeps.
+ * @param in The input file descriptor.
+ * @param offset Where the sound data starts in the input.
+ * @param out The output file descriptor, positioned at its start.
+ * @param kind PASS_IDENTITY or PASS_SWAP.
+ */
+void passThrough(const WaveHeader *header, int in, off_t offset, int out, int kind) {
+	int frameSize = header->formatChunk.blockAlign;
+	int64_t numSamples = header->dataChunk.size / frameSize;
+	size_t size = (size_t) numSamples * frameSize;
+
+	unsigned char buffer[WAVE_RF64_HEADER_SIZE];
+	writeHeaderBuffer(header, buffer);
+	writeAll(out, buffer, headerSize(header));
+
+	int previous = enterStage(STATS_WRITE);
+	if (kind == PASS_IDENTITY)
+		size = copyInKernel(in, &offset, out, size);
+
+	short *block = size > 0 ? allocateFrames(PASS_BLOCK_FRAMES) : NULL;
+	while (size > 0) {
+		size_t chunk = size < (size_t) BYTES_PER_FRAME * PASS_BLOCK_FRAMES
+			? size : (size_t) BYTES_PER_FRAME * PASS_BLOCK_FRAMES;
+		readAllAt(in, block, chunk, offset);
+
+		// A chunk is read whole, however short the reads, so a swap always
+		// starts on a frame.
+		if (kind == PASS_SWAP)
+			swapFrames(block, block, (int) (chunk / BYTES_PER_FRAME));
+		writeAll(out, block, chunk);
+		checksumOutput(block, chunk);
+
+		offset += (off_t) chunk;
+		size -= chunk;
+	}
+	free(block);
+	leaveStage(previous, numSamples, frameSize, header->formatChunk.channels);
+}
+
+/**
+ * Passes the sound data of a file through to a new output file, or to stdout
+ * if there is no path.
+ *
+ * @param header The wave file header, which the output keeps.
+ * @param in The input file descriptor.
+ * @param offset Where the sound data starts in the input.
+ * @param path The path of the output file, or NULL for stdout.
+ * @param kind PASS_IDENTITY or PASS_SWAP.
+ */
+void passThroughFile(const WaveHeader *header, int in, off_t offset, const char *path,
+		int kind) {
+	if (path == NULL) {
+		checkStdout();
+		passThrough(header, in, offset, STDOUT_FILENO, kind);
+		return;
+	}
+
+	int out = createOutput(path, O_WRONLY);
+	passThrough(header, in, offset, out, kind);
+	close(out);
+	finishOutput();
+}
+
+/**
+ * Finds where the sound data starts in stdin, when stdin is a regular file
+ * holding all of it, so it can be passed through.  The header has been read
+ * through stdin's buffer, so its logical position is the start of the data.
+ *
+ * @param header The wave file header.
+ * @return The offset of the sound data, or -1 if stdin cannot be passed
+ *         through.
+ */
+off_t stdinDataOffset(const WaveHeader *header) {
+	struct stat info;
+	if (fstat(STDIN_FILENO, &info) != 0 || !S_ISREG(info.st_mode))
+		return -1;
+
+	off_t offset = ftello(stdin);
+	int frameSize = header->formatChunk.blockAlign;
+	size_t size = (size_t) (header->dataChunk.size / frameSize) * frameSize;
+	if (offset < 0 || (unsigned long long) info.st_size < (unsigned long long) offset + size)
+		return -1;
+
+	return offset;
+}
+
+/*
+ * A window limits the chain to the frames between "--start" and "--end", and
+ * leaves the rest of the sound data as it was.  Only the frames the chain
+ * actually changes are read and processed: all of the window for a '-v',
+ * '-f' or '-r', but only the ends of it for fades.  The rest of the data is
+ * copied as a pass-through copies it, or, with "--in-place", not touched at
+ * all, since the chains a window allows never change the header.  Every
+ * block is read and written with its own file offset.
+ */
+
+/**
+ * Checks whether a chain can run over a window of a file: 16-bit stereo,
+ * outside the float working mode, with only actions that keep every frame
+ * where it is or, for '-r', within the window.
+ *
+ * @param header The input file header.
+ * @param options The options the chain runs with.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @return 1 if it can, 0 otherwise.
+ */
+int isWindowChain(const WaveHeader *header, const Options *options,
+		const Action *actions, int count) {
+	if (options->floatMode || !isNativeFormat(header))
+		return 0;
+
+	for (int i = 0; i < count; i++) {
+		if (!joinsFusedPass(&actions[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Finds the frames of a window that a chain changes, as up to two ranges of
+ * frames counted from the start of the window.
+ *
+ * @param header The input file header.
+ * @param actions The parsed actions, all of which join fused passes.
+ * @param count The number of actions.
+ * @param length The length of the window in frames.
+ * @param ranges Where to store the first and end frame of each range.
+ * @return The number of ranges, in order and not overlapping.
+ */
+int windowRanges(const WaveHeader *header, const Action *actions, int count, int64_t length,
+		int64_t ranges[2][2]) {
+	int64_t fadeIn = 0;
+	int64_t fadeOut = 0;
+	for (int i = 0; i < count; i++) {
+		int64_t n = fadeFrames(header, &actions[i]);
+
+		switch (actions[i].type) {
+		case ACTION_FADE_IN:
+			fadeIn = n > fadeIn ? n : fadeIn;
+			break;
+		case ACTION_FADE_OUT:
+			fadeOut = n > fadeOut ? n : fadeOut;
+			break;
+		default:
+			// Anything else changes the whole window.
+			fadeIn = length;
+			break;
+		}
+	}
+
+	fadeIn = fadeIn < length ? fadeIn : length;
+	fadeOut = fadeOut < length ? fadeOut : length;
+
+	int numRanges = 0;
+	if (fadeIn + fadeOut >= length) {
+		ranges[numRanges][0] = 0;
+		ranges[numRanges++][1] = fadeIn + fadeOut > 0 ? length : 0;
+	} else {
+		ranges[numRanges][0] = 0;
+		ranges[numRanges++][1] = fadeIn;
+		ranges[numRanges][0] = length - fadeOut;
+		ranges[numRanges++][1] = length;
+	}
+
+	return numRanges;
+}
+
+/**
+ * Writes all of a run of bytes to a file at an offset.
+ *
+ * @param fd The file descriptor.
+ * @param bytes The bytes to write.
+ * @param size How many bytes there are.
+ * @param offset Where in the file to write them.
+ */
+void writeAllAt(int fd, const void *bytes, size_t size, off_t offset) {
+	const unsigned char *next = bytes;
+	while (size > 0) {
+		ssize_t written = pwrite(fd, next, size, offset);
+		if (written <= 0)
+			failure(ERROR_WRITE_FAILED);
+
+		next += written;
+		offset += written;
+		size -= (size_t) written;
+	}
+}
+
+/**
+ * Copies sound data from one file to the current position of another, in the
+ * kernel where it can, or else through a buffer.
+ *
+ * @param in The input file descriptor.
+ * @param offset Where in the input to copy from.
+ * @param out The output file descriptor.
+ * @param size How many bytes to copy.
+ */
+void copyBytes(int in, off_t offset, int out, size_t size) {
+	size_t left = copyInKernel(in, &offset, out, size);
+	short *buffer = left > 0 ? stagingBuffer() : NULL;
+	while (left > 0) {
+		size_t chunk = left < IO_BUFFER_BYTES ? left : IO_BUFFER_BYTES;
+		readAllAt(in, buffer, chunk, offset);
+		writeAll(out, buffer, chunk);
+		checksumOutput(buffer, chunk);
+
+		offset += (off_t) chunk;
+		left -= chunk;
+	}
+}
+
+/**
+ * Runs a window's chain over frames of the window in memory.
+ *
+ * @param header The input file header.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @param frames The interleaved frames.
+ * @param numFrames How many frames there are.
+ * @param position The position of the first frame in the window.
+ * @param length The length of the window in frames.
+ */
+void runWindowBlock(const WaveHeader *header, const Action *actions, int count,
+		short *frames, int64_t numFrames, int64_t position, int64_t length) {
+	int64_t n[count > 0 ? count : 1];
+	for (int k = 0; k < count; k++)
+		n[k] = fadeFrames(header, &actions[k]);
+
+	int previous = enterStage(actionStage(0));
+	runFusedActions(actions, n, count, frames, frames + 1, 2, numFrames, position, length, 1, 0);
+	leaveStage(previous, numFrames, BYTES_PER_FRAME, 2);
+	fuseStages(0, count);
+}
+
+/**
+ * Runs a chain over a window of a file's sound data.  The output is either
+ * a new file, written from its start, or the input itself, in which case
+ * only the frames the chain changes are written back.  The ranges the chain
+ * changes are processed one block at a time, unless the chain reverses
+ * them, which needs the whole window in memory.
+ *
+ * @param header The input file header, which the output keeps.
+ * @param options The options, with the window.
+ * @param in The input file descriptor, open for writing too when in place.
+ * @param offset Where the sound data starts in the input.
+ * @param out The output file descriptor, or -1 to edit the input in place.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ */
+void runWindow(const WaveHeader *header, const Options *options, int in, off_t offset, int out,
+		const Action *actions, int count) {
+	int64_t numSamples = header->dataChunk.size / BYTES_PER_FRAME;
+	int64_t start = durationFrames(header, options->start, ERROR_INVALID_WINDOW);
+	int64_t end = options->end >= 0 ? durationFrames(header, options->end, ERROR_INVALID_WINDOW) : numSamples;
+	start = start < numSamples ? start : numSamples;
+	end = end < numSamples ? end : numSamples;
+	int64_t length = end - start;
+
+	if (out >= 0) {
+		unsigned char buffer[WAVE_RF64_HEADER_SIZE];
+		writeHeaderBuffer(header, buffer);
+		writeAll(out, buffer, headerSize(header));
+	}
+
+	int64_t ranges[2][2];
+	int numRanges = windowRanges(header, actions, count, length, ranges);
+	int reversed = reversesFrames(actions, count);
+	int64_t blockFrames = reversed ? length : PASS_BLOCK_FRAMES;
+	short *block = allocateFrames(blockFrames < length ? blockFrames : length);
+
+	int64_t done = 0;
+	for (int r = 0; r < numRanges; r++) {
+		int64_t first = start + ranges[r][0];
+		int64_t last = start + ranges[r][1];
+		if (first == last)
+			continue;
+
+		int previous = enterStage(STATS_WRITE);
+		if (out >= 0)
+			copyBytes(in, offset + (off_t) done * BYTES_PER_FRAME, out,
+				(size_t) (first - done) * BYTES_PER_FRAME);
+		leaveStage(previous, first - done, BYTES_PER_FRAME, 2);
+
+		for (int64_t i = first; i < last; i += blockFrames) {
+			int64_t frames = last - i < blockFrames ? last - i : blockFrames;
+			off_t at = offset + (off_t) i * BYTES_PER_FRAME;
+			size_t size = (size_t) frames * BYTES_PER_FRAME;
+
+			previous = enterStage(STATS_READ);
+			readAllAt(in, block, size, at);
+			leaveStage(previous, frames, BYTES_PER_FRAME, 2);
+
+			runWindowBlock(header, actions, count, block, frames, i - start, length);
+			if (reversed)
+				frameReverse(block, frames);
+
+			previous = enterStage(STATS_WRITE);
+			if (out >= 0) {
+				writeAll(out, block, size);
+				checksumOutput(block, size);
+			} else {
+				writeAllAt(in, block, size, at);
+			}
+			leaveStage(previous, frames, BYTES_PER_FRAME, 2);
+		}
+
+		done = last;
+	}
+
+	int previous = enterStage(STATS_WRITE);
+	if (out >= 0)
+		copyBytes(in, offset + (off_t) done * BYTES_PER_FRAME, out,
+			(size_t) (numSamples - done) * BYTES_PER_FRAME);
+	leaveStage(previous, numSamples - done, BYTES_PER_FRAME, 2);
+
+	free(block);
+}
+
+/**
+ * Runs a chain over a window of a file, in to a new output file, stdout if
+ * there is no path, or the input file itself with "--in-place".
+ *
+ * @param header The input file header, which the output keeps.
+ * @param options The options, with the window and the input's path.
+ * @param in The input file descriptor.
+ * @param offset Where the sound data starts in the input.
+ * @param path The path of the output file, or NULL.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ */
+void runWindowFile(const WaveHeader *header, const Options *options, int in, off_t offset,
+		const char *path, const Action *actions, int count) {
+	if (options->inPlace) {
+		int fd = open(options->inPath, O_RDWR);
+		if (fd < 0)
+			failure(ERROR_FILE_ACCESS);
+
+		runWindow(header, options, fd, offset, -1, actions, count);
+		close(fd);
+		return;
+	}
+
+	if (path == NULL) {
+		checkStdout();
+		runWindow(header, options, in, offset, STDOUT_FILENO, actions, count);
+		return;
+	}
+
+	int out = createOutput(path, O_WRONLY);
+	runWindow(header, options, in, offset, out, actions, count);
+	close(out);
+	finishOutput();
+}
+
+/*
+ * Checksum manifests.  "--checksums" writes the CRC-32C of each
+ * CHECKSUM_BLOCK_FRAMES block of an output's sound data to a text manifest,
+ * whichever engine wrote it: a first line giving the number of frames and
+ * their size, and then one checksum per line.  An output file is hashed
+ * once it is finished, and output to stdout as it is written.  The blocks
+ * are those of an index, so an index of the output holds the same
+ * checksums.
+ *
+ * "--verify-against" checks a manifest without running the chain again: it
+ * works out only VERIFY_BLOCKS blocks, spread evenly over the output, with
+ * the scalar reference, and compares their checksums with the manifest's.
+ * The reference traces each frame of a block back through the chain to the
+ * input frame it comes from, and applies each action's arithmetic to it in
+ * turn, one frame at a time, with none of the kernels, fused passes, threads
+ * or streams of the engines that made the output.  That only works for
+ * actions that take each frame from a single input frame, so a chain to be
+ * verified is limited to those.
+ */
+
+#define CHECKSUM_BLOCK_FRAMES INDEX_BLOCK_FRAMES
+#define VERIFY_BLOCKS         64
+
+/**
+ * Writes a checksum manifest.
+ *
+ * @param manifest The path of the manifest.
+ * @param frames The number of frames of sound data.
+ * @param frameSize The size of a frame.
+ * @param checksums The checksums of its blocks.
+ * @param count The number of blocks.
+ * @return NULL, or the error-message of the manifest's failure.
+ */
+char *saveManifest(const char *manifest, int64_t frames, int frameSize,
+		const uint32_t *checksums, int64_t count) {
+	FILE *out = fopen(manifest, "w");
+	if (out == NULL)
+		return ERROR_FILE_ACCESS;
+
+	fprintf(out, "frames %lld size %d\n", (long long) frames, frameSize);
+	for (int64_t b = 0; b < count; b++)
+		fprintf(out, "%08x\n", (unsigned) checksums[b]);
+
+	int failed = ferror(out);
+	return fclose(out) != 0 || failed ? ERROR_WRITE_FAILED : NULL;
+}
+
+/**
+ * Writes the checksum manifest of a finished wave file.
+ *
+ * @param path The path of the wave file.
+ * @param manifest The path of the manifest.
+ */
+void writeManifest(const char *path, const char *manifest) {
+	MappedFile file;
+	WaveHeader header;
+
+	mapInputFile(&file, path);
+	size_t offset = readMappedHeader(&header, file.map, file.size);
+	mappedInput = NULL;
+
+	int frameSize = header.formatChunk.blockAlign;
+	int64_t numSamples = header.dataChunk.size / frameSize;
+	int64_t count = (numSamples + CHECKSUM_BLOCK_FRAMES - 1) / CHECKSUM_BLOCK_FRAMES;
+	uint32_t *checksums = malloc(sizeof(uint32_t) * (count > 0 ? count : 1));
+	if (checksums == NULL) {
+		unmapFile(&file, 0);
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	}
+
+	for (int64_t b = 0; b < count; b++) {
+		int64_t i = b * CHECKSUM_BLOCK_FRAMES;
+		int64_t frames = numSamples - i < CHECKSUM_BLOCK_FRAMES ? numSamples - i
+			: CHECKSUM_BLOCK_FRAMES;
+		checksums[b] = checksumBytes(0, file.map + offset + i * frameSize,
+			(size_t) (frames * frameSize));
+	}
+	unmapFile(&file, 0);
+
+	char *error = saveManifest(manifest, numSamples, frameSize, checksums, count);
+	free(checksums);
+	if (error != NULL)
+		failure(error);
+}
+
+/**
+ * Starts checksumming the sound data written to stdout.
+ *
+ * @param frameSize The size of a frame of the output.
+ */
+void startOutputChecksums(int frameSize) {
+	outputChecksums = calloc(1, sizeof(OutputChecksums));
+	if (outputChecksums == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	outputChecksums->frameSize = frameSize;
+	outputChecksums->blockBytes = (size_t) CHECKSUM_BLOCK_FRAMES * frameSize;
+}
+
+/**
+ * Writes the checksum manifest of the sound data written to stdout, once all
+ * of it has been written, and stops checksumming.
+ *
+ * @param manifest The path of the manifest.
+ */
+void finishOutputChecksums(const char *manifest) {
+	OutputChecksums *sums = outputChecksums;
+	outputChecksums = NULL;
+	if (sums->filled > 0)
+		endChecksumBlock(sums);
+
+	char *error = sums->failed ? ERROR_INSUFFICIENT_MEMORY
+		: saveManifest(manifest, sums->bytes / sums->frameSize, sums->frameSize, sums->sums,
+			sums->numSums);
+	free(sums->sums);
+	free(sums);
+	if (error != NULL)
+		failure(error);
+}
+
+/**
+ * Reads a checksum manifest.
+ *
+ * @param manifest The path of the manifest.
+ * @param numSamples Where to store the number of frames it covers.
+ * @param frameSize Where to store the size of each frame.
+ * @return The allocated checksums, one per block.
+ */
+uint32_t *readManifest(const char *manifest, int64_t *numSamples, int *frameSize) {
+	FILE *in = fopen(manifest, "r");
+	if (in == NULL)
+		failure(ERROR_FILE_ACCESS);
+
+	long long frames;
+	uint32_t *checksums = NULL;
+	if (fscanf(in, "frames %lld size %d", &frames, frameSize) == 2 && frames >= 0
+			&& *frameSize > 0) {
+		int64_t blocks = (frames + CHECKSUM_BLOCK_FRAMES - 1) / CHECKSUM_BLOCK_FRAMES;
+		checksums = malloc(sizeof(uint32_t) * (blocks > 0 ? blocks : 1));
+
+		for (int64_t b = 0; checksums != NULL && b < blocks; b++) {
+			unsigned checksum;
+			if (fscanf(in, "%8x", &checksum) != 1) {
+				free(checksums);
+				checksums = NULL;
+			} else {
+				checksums[b] = checksum;
+			}
+		}
+	}
+
+	fclose(in);
+	if (checksums == NULL)
+		failure(ERROR_BAD_MANIFEST);
+
+	*numSamples = frames;
+	return checksums;
+}
+
+/**
+ * Checks whether the reference can verify a chain: 16-bit stereo, outside
+ * the float working mode, with only actions that take each frame from a
+ * single input frame, and a '-n' only at the start, where its input is the
+ * file itself.
+ *
+ * @param header The input file header.
+ * @param options The options the chain runs with.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ * @return 1 if it can, 0 otherwise.
+ */
+int isVerifiableChain(const WaveHeader *header, const Options *options,
+		const Action *actions, int count) {
+	if (options->floatMode || !isNativeFormat(header))
+		return 0;
+
+	for (int i = 0; i < count; i++) {
+		int nearest = actions[i].type == ACTION_SPEED && actions[i].method == RESAMPLE_NEAREST;
+		if (!joinsFusedPass(&actions[i]) && !nearest
+			&& !(actions[i].type == ACTION_NORMALIZE && i == 0))
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Works out frames of the output of a chain with the scalar reference.  Each
+ * frame is traced back to the input frame it comes from, through the
+ * position it has in the input of each action, and then every action is
+ * applied to it in order, as the original whole-file actions would.
+ *
+ * @param actions The parsed actions, which the reference can verify and none
+ *                of which is a '-n'.
+ * @param count The number of actions.
+ * @param lengths The number of frames going in to each action, and coming
+ *                out of the last one.
+ * @param n The fade length in frames of each action.
+ * @param input The interleaved input frames.
+ * @param first The first output frame to work out.
+ * @param frames The number of frames to work out.
+ * @param output Where to store the interleaved frames.
+ */
+void referenceFrames(const Action *actions, int count, const int64_t *lengths, const int64_t *n,
+		const short *input, int64_t first, int frames, short *output) {
+	int64_t positions[count + 1];
+
+	for (int j = 0; j < frames; j++) {
+		positions[count] = first + j;
+		for (int k = count - 1; k >= 0; k--) {
+			int64_t position = positions[k + 1];
+			if (actions[k].type == ACTION_REVERSE)
+				position = lengths[k] - 1 - position;
+			else if (actions[k].type == ACTION_SPEED)
+				position = (int64_t) (position * actions[k].arg1);
+			positions[k] = position;
+		}
+
+		short left = input[2 * positions[0]];
+		short right = input[2 * positions[0] + 1];
+		for (int k = 0; k < count; k++) {
+			const Action *action = &actions[k];
+			int64_t position = positions[k];
+			double gain = 1;
+
+			switch (action->type) {
+			case ACTION_FLIP: {
+				short temp = left;
+				left = right;
+				right = temp;
+				break;
+			}
+			case ACTION_VOLUME:
+				gain = action->arg1;
+				break;
+			case ACTION_FADE_OUT:
+				if (position >= lengths[k] - n[k])
+					fillEnvelope(&gain, 1, position - (lengths[k] - n[k]), n[k], action->curve, 1);
+				break;
+			case ACTION_FADE_IN:
+				if (position < n[k])
+					fillEnvelope(&gain, 1, position, n[k], action->curve, 0);
+				break;
+			}
+
+			if (action->type == ACTION_VOLUME || action->type == ACTION_FADE_OUT
+				|| action->type == ACTION_FADE_IN) {
+				left = scaleSample(left, gain);
+				right = scaleSample(right, gain);
+			}
+		}
+
+		output[2 * j] = left;
+		output[2 * j + 1] = right;
+	}
+}
+
+/**
+ * Verifies a checksum manifest of a chain's output against the scalar
+ * reference, on sampled blocks only.  A '-n' at the start is measured first,
+ * unless the input's index has already stood in for it.  The blocks that do
+ * not match are listed on stderr before the run fails.
+ *
+ * @param header The input file header.
+ * @param options The options, with the manifest.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ */
+void verifyChain(const WaveHeader *header, const Options *options, Action *actions, int count) {
+	if (!isVerifiableChain(header, options, actions, count))
+		failure(ERROR_VERIFY_CHAIN);
+
+	const short *input = (const short *) mappedInput;
+	int64_t numSamples = header->dataChunk.size / BYTES_PER_FRAME;
+	if (measuresOnRead(actions, count)) {
+		Loudness loudness;
+		int previous = enterStage(actionStage(0));
+		measureFrameData(header, &loudness, input, input + 1, 2, numSamples);
+		actions[0] = normalizeVolume(&actions[0], 0, &loudness);
+		leaveStage(previous, numSamples, BYTES_PER_FRAME, 2);
+	}
+
+	int64_t lengths[count + 1];
+	int64_t n[count > 0 ? count : 1];
+	lengths[0] = numSamples;
+	for (int k = 0; k < count; k++) {
+		n[k] = fadeFrames(header, &actions[k]);
+		lengths[k + 1] = actions[k].type == ACTION_SPEED
+			? speedLength(lengths[k], actions[k].arg1) : lengths[k];
+	}
+
+	int64_t frames;
+	int frameSize;
+	uint32_t *checksums = readManifest(options->verify, &frames, &frameSize);
+	if (frames != lengths[count] || frameSize != BYTES_PER_FRAME) {
+		free(checksums);
+		failure(ERROR_VERIFY_FAILED);
+	}
+
+	int previous = enterStage(STATS_WRITE);
+	int64_t blocks = (frames + CHECKSUM_BLOCK_FRAMES - 1) / CHECKSUM_BLOCK_FRAMES;
+	int samples = blocks < VERIFY_BLOCKS ? (int) blocks : VERIFY_BLOCKS;
+	short output[2 * CHECKSUM_BLOCK_FRAMES];
+	int mismatches = 0;
+	for (int i = 0; i < samples; i++) {
+		int64_t b = samples > 1 ? i * (blocks - 1) / (samples - 1) : 0;
+		int64_t first = b * CHECKSUM_BLOCK_FRAMES;
+		int length = frames - first < CHECKSUM_BLOCK_FRAMES
+			? (int) (frames - first) : CHECKSUM_BLOCK_FRAMES;
+
+		referenceFrames(actions, count, lengths, n, input, first, length, output);
+		if (checksumBytes(0, output, (size_t) length * BYTES_PER_FRAME) != checksums[b]) {
+			fprintf(stderr, "Block %lld (frames %lld to %lld) does not match\n", (long long) b,
+				(long long) first, (long long) (first + length - 1));
+			mismatches++;
+		}
+	}
+	leaveStage(previous, (size_t) samples * CHECKSUM_BLOCK_FRAMES, BYTES_PER_FRAME, 2);
+
+	free(checksums);
+	if (mismatches > 0)
+		failure(ERROR_VERIFY_FAILED);
+
+	if (stats == NULL)
+		fprintf(stderr, "\nVerified %d of %lld blocks\n", samples, (long long) blocks);
+}
+
+/*
+ * Every format other than 16-bit stereo runs through the format-generic path
+ * below, as does any format in the float working mode.  The whole file is
+ * read in to one array per channel, at the file's own precision or as float,
+ * each action runs over the channels one at a time, on the worker pool when
+ * there is one, and the result is written back out in the same format.
+ */
+
+/**
+ * Sound data in the format-generic path.  Each of the "numChannels" arrays in
+ * "channels" holds "numSamples" samples, int32_t or float as the format calls
+ * for, and "kernels" are the format's kernels.  Like WaveData, every channel
+ * has a ping-pong partner in "spares", and all of them come from "arena"
+ * with room for "capacity" samples.  "isFloat" is set for float samples, and
+ * "fullScale" is the magnitude of a full-scale sample.  As in WaveData, the
+ * read measures the data in to "loudness" for a '-n' at the start of the
+ * chain, and sets "measured".
+ */
+typedef struct _SampleData {
+	WaveHeader *header;
+	SampleKernels kernels;
+	int numChannels;
+	int64_t numSamples;
+	int64_t capacity;
+	void **channels;
+	void **spares;
+	Arena *arena;
+	int isFloat;
+	double fullScale;
+	Loudness loudness;
+	int measured;
+} SampleData;
+
+/*
+ * In batch mode each thread keeps the arena of its last job under
+ * "arenaKey", so the next job that fits in it reuses the memory, already
+ * faulted in, instead of mapping its own.  A worker's arena is destroyed
+ * when the worker exits.
+ */
+static int reuseArenas = 0;
+static pthread_key_t arenaKey;
+
+/**
+ * Destroys the arena a thread kept, as the thread exits.
+ *
+ * @param arena The arena.
+ */
+void dropArena(void *arena) {
+	destroyArena(arena);
+}
+
+/**
+ * Returns an arena with at least "size" bytes of room, reusing this thread's
+ * cached arena when it is large enough.  Reused memory is not zeroed.
+ *
+ * @param size The bytes of room needed.
+ * @return The arena, or NULL if memory runs out.
+ */
+Arena *acquireArena(size_t size) {
+	Arena *arena = NULL;
+	if (reuseArenas) {
+		arena = pthread_getspecific(arenaKey);
+		pthread_setspecific(arenaKey, NULL);
+	}
+
+	if (arena != NULL && arenaRoom(arena) >= size) {
+		resetArena(arena);
+		return arena;
+	}
+
+	destroyArena(arena);
+	noteAllocation(size);
+	return createArena(size);
+}
+
+/**
+ * Gives back an arena from acquireArena, which keeps it for the next job in
+ * batch mode and destroys it otherwise.
+ *
+ * @param arena The arena, or NULL.
+ */
+void releaseArena(Arena *arena) {
+	if (!reuseArenas || arena == NULL) {
+		destroyArena(arena);
+		return;
+	}
+
+	destroyArena(pthread_getspecific(arenaKey));
+	pthread_setspecific(arenaKey, arena);
+}
+
+/**
+ * Reads the sound data from the mapped input, or the input stream through
+ * the staging buffer, and splits it in to channels.
+ *
+ * @param data The SampleData to fill in.
+ * @param header The validated wave file header.
+ * @param options The options, which pick the float working mode.
+ * @param capacity The frames of room the longest stage of the chain needs.
+ * @param measure 1 to measure the data for a '-n' as it is read.
+ */
+void readSamples(SampleData *data, WaveHeader *header, const Options *options,
+		int64_t capacity, int measure) {
+	const FormatChunk *format = &header->formatChunk;
+	int code = sampleFormat(format->compression, format->bitsPerSample);
+
+	data->header = header;
+	data->kernels = options->floatMode ? floatKernels(code, format->channels, options->dither)
+		: sampleKernels(code, format->channels);
+	data->numChannels = format->channels;
+	data->numSamples = header->dataChunk.size / format->blockAlign;
+	data->isFloat = options->floatMode || code == FORMAT_F32;
+	data->fullScale = code == FORMAT_F32 ? 1 : ldexp(1, format->bitsPerSample - 1);
+
+	data->measured = measure;
+	if (measure && !initLoudness(&data->loudness, data->numChannels, format->sampleRate,
+			data->fullScale))
+		failure(ERROR_NORMALIZE_CHANNELS);
+
+	data->capacity = capacity;
+
+	size_t size = (size_t) SAMPLE_SIZE * (capacity > 0 ? capacity : 1);
+	data->channels = malloc(sizeof(void *) * data->numChannels);
+	data->spares = malloc(sizeof(void *) * data->numChannels);
+	data->arena = acquireArena(2 * data->numChannels * arenaSpace(size));
+	if (data->channels == NULL || data->spares == NULL || data->arena == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	for (int c = 0; c < data->numChannels; c++) {
+		data->channels[c] = arenaAlloc(data->arena, size);
+		data->spares[c] = arenaAlloc(data->arena, size);
+	}
+
+	if (mappedInput != NULL && !measure) {
+		data->kernels.decode(mappedInput, data->channels, data->numChannels, 0, data->numSamples);
+		return;
+	}
+
+	// A measured read decodes a block at a time, so each is measured while it
+	// is still in cache.
+	int block = IO_BUFFER_BYTES / format->blockAlign;
+	for (int64_t i = 0; i < data->numSamples; i += block) {
+		int count = data->numSamples - i < block ? (int) (data->numSamples - i) : block;
+
+		if (mappedInput != NULL) {
+			data->kernels.decode(mappedInput + (size_t) i * format->blockAlign, data->channels,
+				data->numChannels, i, count);
+		} else {
+			short *buffer = stagingBuffer();
+			if (fread(buffer, format->blockAlign, count, stdin) != (size_t) count)
+				failure(ERROR_INVALID_FILE_SIZE);
+
+			data->kernels.decode((const unsigned char *) buffer, data->channels,
+				data->numChannels, i, count);
+		}
+
+		if (measure)
+			measureChannels(&data->loudness, data->channels, data->isFloat, i, count);
+	}
+}
+
+/**
+ * Measures the sound data of the format-generic path for a '-n', unless the
+ * read already has.
+ *
+ * @param data The SampleData.
+ * @return The measurement.
+ */
+const Loudness *measureSampleData(SampleData *data) {
+	if (data->measured) {
+		data->measured = 0;
+		return &data->loudness;
+	}
+
+	if (!initLoudness(&data->loudness, data->numChannels, data->header->formatChunk.sampleRate,
+			data->fullScale))
+		failure(ERROR_NORMALIZE_CHANNELS);
+
+	for (int64_t i = 0; i < data->numSamples; i += IO_BLOCK_FRAMES) {
+		int count = data->numSamples - i < IO_BLOCK_FRAMES
+			? (int) (data->numSamples - i) : IO_BLOCK_FRAMES;
+		measureChannels(&data->loudness, data->channels, data->isFloat, i, count);
+	}
+
+	return &data->loudness;
+}
+
+/**
+ * Writes the header and sound data in to a buffer with room for them.
+ *
+ * @param data The SampleData to write.
+ * @param buffer The buffer.
+ * @return The size of the output file in the buffer.
+ */
+size_t writeSampleBuffer(const SampleData *data, unsigned char *buffer) {
+	size_t offset = headerSize(data->header);
+
+	writeHeaderBuffer(data->header, buffer);
+	data->kernels.encode(buffer + offset, data->channels,
+		data->numChannels, 0, data->numSamples);
+
+	return offset + (size_t) data->numSamples * data->header->formatChunk.blockAlign;
+}
+
+/**
+ * Writes the header and sound data to the output stream, or straight in to
+ * a mapped output file when there is an output path.
+ *
+ * @param data The SampleData to write.
+ * @param path The path of the output file, or NULL for the output stream.
+ */
+void writeSamples(const SampleData *data, const char *path) {
+	int frameSize = data->header->formatChunk.blockAlign;
+
+	if (path != NULL) {
+		MappedFile output;
+		size_t size = headerSize(data->header) + (size_t) data->numSamples * frameSize;
+
+		mapOutputFile(&output, path, size);
+		unmapFile(&output, writeSampleBuffer(data, output.map));
+		finishOutput();
+		return;
+	}
+
+	writeHeader(data->header);
+
+	short *buffer = stagingBuffer();
+	int block = IO_BUFFER_BYTES / frameSize;
+	for (int64_t i = 0; i < data->numSamples; i += block) {
+		int count = data->numSamples - i < block ? (int) (data->numSamples - i) : block;
+
+		data->kernels.encode((unsigned char *) buffer, data->channels,
+			data->numChannels, i, count);
+		writeSoundData(buffer, (size_t) frameSize * count);
+	}
+}
+
+/**
+ * Frees the channels of a SampleData.
+ *
+ * @param data The SampleData.
+ */
+void freeSamples(SampleData *data) {
+	releaseArena(data->arena);
+	free(data->channels);
+	free(data->spares);
+}
+
+/**
+ * The '-o' and '-i' actions on one block of a channel, with gains computed
+ * just as applyFade does.  Only the part of the block the fade overlaps is
+ * touched.
+ *
+ * @param kernels The format's kernels.
+ * @param block The block's samples.
+ * @param position The index in the channel of the block's first sample.
+ * @param frames The length of the block.
+ * @param length The length of the whole channel.
+ * @param n The length of the fade in frames.
+ * @param curve The CURVE_* shape of the fade.
+ * @param fadeOut 1 for a fade out, 0 for a fade in.
+ */
+void sampleFade(const SampleKernels *kernels, void *block, int64_t position, int frames,
+		int64_t length, int64_t n, int curve, int fadeOut) {
+	double gains[ENVELOPE_BLOCK_FRAMES];
+
+	// A fade out longer than the data starts part of the way in to the curve.
+	int64_t start = fadeOut ? length - n : 0;
+	int64_t from = position > start ? position : start;
+	int64_t to = position + frames < start + n ? position + frames : start + n;
+
+	for (int64_t i = from; i < to; i += ENVELOPE_BLOCK_FRAMES) {
+		int count = to - i < ENVELOPE_BLOCK_FRAMES ? (int) (to - i) : ENVELOPE_BLOCK_FRAMES;
+
+		fillEnvelope(gains, count, i - start, n, curve, fadeOut);
+		kernels->gain((char *) block + (size_t) SAMPLE_SIZE * (i - position), gains, count);
+	}
+}
+
+/**
+ * Runs a group of consecutive '-o', '-i', '-v' and '-f' actions over one
+ * channel in a single pass, block by block, so each block stays in cache
+ * while every action in the group is applied to it.  The flips have already
+ * been applied to the order of the channels.
+ *
+ * @param kernels The format's kernels.
+ * @param samples The channel.
+ * @param numSamples The length of the channel.
+ * @param header The wave file header.
+ * @param actions The actions of the group.
+ * @param count The number of actions in the group.
+ */
+void sampleGroup(const SampleKernels *kernels, void *samples, int64_t numSamples,
+		const WaveHeader *header, const Action *actions, int count) {
+	for (int64_t i = 0; i < numSamples; i += ENVELOPE_BLOCK_FRAMES) {
+		int frames = numSamples - i < ENVELOPE_BLOCK_FRAMES
+			? (int) (numSamples - i) : ENVELOPE_BLOCK_FRAMES;
+
+		char *block = (char *) samples + (size_t) SAMPLE_SIZE * i;
+		for (int k = 0; k < count; k++) {
+			const Action *action = &actions[k];
+
+			switch (action->type) {
+			case ACTION_FADE_OUT:
+			case ACTION_FADE_IN:
+				sampleFade(kernels, block, i, frames, numSamples,
+					fadeFrames(header, action), action->curve,
+					action->type == ACTION_FADE_OUT);
+				break;
+			case ACTION_VOLUME:
+				kernels->scale(block, frames, action->arg1);
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * The '-e' action on one channel.  The plain taps are mixed in from the
+ * input, a whole tap at a time.  Feedback taps echo the output, so they are
+ * mixed in over steps no longer than the shortest of their delays, each of
+ * which reads only output that is already finished.
+ *
+ * @param kernels The format's kernels.
+ * @param out Where to store the echoed channel.
+ * @param samples The channel.
+ * @param numSamples The length of the channel.
+ * @param length The length of the echoed channel.
+ * @param action The '-e' action.
+ * @param n The delay of each tap in frames.
+ */
+void sampleEcho(const SampleKernels *kernels, char *out, const void *samples,
+		int64_t numSamples, int64_t length, const Action *action, const int64_t *n) {
+	// Zero bits are silence in every format.
+	memcpy(out, samples, (size_t) SAMPLE_SIZE * numSamples);
+	memset(out + (size_t) SAMPLE_SIZE * numSamples, 0,
+		(size_t) SAMPLE_SIZE * (length - numSamples));
+
+	int64_t step = length;
+	for (int k = 0; k < action->numTaps; k++) {
+		if (action->taps[k].feedback) {
+			step = n[k] < step ? n[k] : step;
+			continue;
+		}
+
+		// The echo's tail leaves room for every plain tap.
+		kernels->mix(out + (size_t) SAMPLE_SIZE * n[k], samples, numSamples,
+			action->taps[k].scale);
+	}
+
+	for (int64_t i = 0; isFeedbackEcho(action) && i < length; i += step) {
+		int64_t end = i + step < length ? i + step : length;
+
+		for (int k = 0; k < action->numTaps; k++) {
+			int64_t from = i > n[k] ? i : n[k];
+			if (!action->taps[k].feedback || from >= end)
+				continue;
+
+			kernels->mix(out + (size_t) SAMPLE_SIZE * from,
+				out + (size_t) SAMPLE_SIZE * (from - n[k]), end - from, action->taps[k].scale);
+		}
+	}
+}
+
+/**
+ * One action, or one group of per-sample actions, over the channels of a
+ * SampleData, shared by its channel tasks.  "length" is the number of frames
+ * coming out of it and "n" holds the delays of an echo's taps.  A '-c' has a
+ * convolver for each pair of channels.
+ */
+typedef struct _SamplePass {
+	SampleData *data;
+	const Action *action;
+	int count;
+	int64_t length;
+	int64_t n[ECHO_MAX_TAPS];
+	Resampler *resampler;
+	Convolver **convolvers;
+	double *scratch;
+} SamplePass;
+
+/**
+ * Runs a '-c' over one pair of channels of a SampleData, in to their spare
+ * buffers, which then swap places with them.  The pair is the first and
+ * second channel of the convolver, and the last channel of an odd number of
+ * them is paired with silence.  Integer samples are rounded to nearest and
+ * saturate to the format's range; float ones are left as they are.
+ *
+ * @param context The SamplePass.
+ * @param index The index of the pair.
+ */
+void runConvolveTask(void *context, int index) {
+	const SamplePass *pass = context;
+	SampleData *data = pass->data;
+	Convolver *convolver = pass->convolvers[index];
+	int block = convolverBlockFrames(convolver);
+	double *parts[2] = { pass->scratch + (size_t) 2 * block * index,
+		pass->scratch + (size_t) 2 * block * index + block };
+	int numChannels = 2 * index + 1 < data->numChannels ? 2 : 1;
+	double high = data->fullScale - 1;
+
+	for (int64_t first = 0; first < pass->length; first += block) {
+		int count = pass->length - first < block ? (int) (pass->length - first) : block;
+		int known = data->numSamples - first < count
+			? (int) (data->numSamples > first ? data->numSamples - first : 0) : count;
+
+		for (int c = 0; c < 2; c++) {
+			const int32_t *ints = c < numChannels ? data->channels[2 * index + c] : NULL;
+			const float *floats = c < numChannels ? data->channels[2 * index + c] : NULL;
+			for (int i = 0; i < block; i++) {
+				double sample = 0;
+				if (c < numChannels && i < known)
+					sample = data->isFloat ? floats[first + i] : ints[first + i];
+				parts[c][i] = sample;
+			}
+		}
+
+		runConvolver(convolver, parts[0], parts[1]);
+
+		for (int c = 0; c < numChannels; c++) {
+			int32_t *ints = data->spares[2 * index + c];
+			float *floats = data->spares[2 * index + c];
+			for (int i = 0; i < count; i++) {
+				double sample = parts[c][i];
+				if (data->isFloat) {
+					floats[first + i] = (float) sample;
+					continue;
+				}
+
+				sample = floor(sample + 0.5);
+				sample = sample < -data->fullScale ? -data->fullScale : sample;
+				ints[first + i] = (int32_t) (sample > high ? high : sample);
+			}
+		}
+	}
+
+	for (int c = 2 * index; c < 2 * index + numChannels; c++) {
+		void *temp = data->channels[c];
+		data->channels[c] = data->spares[c];
+		data->spares[c] = temp;
+	}
+}
+
+/**
+ * Runs an action over one channel.  The speed change and the echo write in
+ * to the channel's spare buffer, which then swaps places with it.
+ *
+ * @param context The SamplePass.
+ * @param index The index of the channel.
+ */
+void runSampleTask(void *context, int index) {
+	const SamplePass *pass = context;
+	SampleData *data = pass->data;
+	const SampleKernels *kernels = &data->kernels;
+	const Action *action = pass->action;
+	void *samples = data->channels[index];
+	void *out = data->spares[index];
+
+	switch (action->type) {
+	case ACTION_REVERSE:
+		kernels->reverse(samples, data->numSamples);
+		return;
+	case ACTION_SPEED:
+		if (pass->resampler != NULL)
+			kernels->resample(out, pass->length, samples, data->numSamples, pass->resampler);
+		else
+			kernels->pick(out, pass->length, samples, action->arg1);
+		break;
+	case ACTION_FLIP:
+	case ACTION_FADE_OUT:
+	case ACTION_FADE_IN:
+	case ACTION_VOLUME:
+		sampleGroup(kernels, samples, data->numSamples, data->header, action, pass->count);
+		return;
+	case ACTION_ECHO:
+		sampleEcho(kernels, out, samples, data->numSamples, pass->length, action, pass->n);
+		break;
+	}
+
+	data->channels[index] = out;
+	data->spares[index] = samples;
+}
+
+/**
+ * Runs a SamplePass over the channels of its SampleData, creating the
+ * resampler or convolvers it needs first.  They are left in the pass, for
+ * releaseSamplePass to free whether or not it succeeds.
+ *
+ * @param context The SamplePass.
+ */
+void runSamplePass(void *context) {
+	SamplePass *pass = context;
+	const Action *action = pass->action;
+	SampleData *data = pass->data;
+	int pairs = (data->numChannels + 1) / 2;
+
+	if (action->type == ACTION_SPEED && action->method != RESAMPLE_NEAREST) {
+		pass->resampler = createResampler(action->method, action->arg1, data->numSamples, 0);
+		if (pass->resampler == NULL)
+			failure(ERROR_INSUFFICIENT_MEMORY);
+	}
+
+	if (action->type != ACTION_CONVOLVE) {
+		runTasks(data->numChannels, runSampleTask, pass);
+		return;
+	}
+
+	// A stereo impulse response only ever meets a stereo pair.
+	pass->convolvers = calloc(pairs, sizeof(Convolver *));
+	pass->scratch = malloc(sizeof(double) * 2 * CONVOLVE_MAX_BLOCK * pairs);
+	if (pass->convolvers == NULL || pass->scratch == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	for (int p = 0; p < pairs; p++)
+		pass->convolvers[p] = createImpulseConvolver(action);
+
+	runTasks(pairs, runConvolveTask, pass);
+}
+
+/**
+ * Frees what runSamplePass created.
+ *
+ * @param pass The SamplePass.
+ */
+void releaseSamplePass(SamplePass *pass) {
+	int pairs = (pass->data->numChannels + 1) / 2;
+
+	destroyResampler(pass->resampler);
+	for (int p = 0; pass->convolvers != NULL && p < pairs; p++)
+		destroyConvolver(pass->convolvers[p]);
+	free(pass->convolvers);
+	free(pass->scratch);
+}
+
+/**
+ * Performs the actions in order on sound data in the format-generic path,
+ * keeping the header's sizes in step with the data.
+ *
+ * @param data The SampleData.
+ * @param actions The parsed actions.
+ * @param count The number of actions.
+ */
+void runSampleChain(SampleData *data, const Action *actions, int count) {
+	WaveHeader *header = data->header;
+
+	for (int i = 0; i < count; i++) {
+		const Action *action = &actions[i];
+		SamplePass pass = { data, action, 1, data->numSamples, { 0 }, NULL, NULL, NULL };
+		Action volume;
+		int first = i, work = 1;
+		int64_t length = data->numSamples;
+		int previous = enterStage(actionStage(i));
+
+		switch (action->type) {
+		case ACTION_FLIP:
+		case ACTION_FADE_OUT:
+		case ACTION_FADE_IN:
+		case ACTION_VOLUME: {
+			// Every per-sample action treats the channels alike, so the flips
+			// of the group can all be applied to the order of the channels
+			// first, each reversing it, which swaps a stereo pair.
+			work = 0;
+			for (pass.count = 0; i + pass.count < count
+				&& isSampleAction(&actions[i + pass.count]); pass.count++) {
+				if (actions[i + pass.count].type != ACTION_FLIP) {
+					work = 1;
+					continue;
+				}
+
+				for (int lo = 0, hi = data->numChannels - 1; lo < hi; lo++, hi--) {
+					void *temp = data->channels[lo];
+					data->channels[lo] = data->channels[hi];
+					data->channels[hi] = temp;
+				}
+			}
+
+			i += pass.count - 1;
+			break;
+		}
+		case ACTION_SPEED:
+			pass.length = speedLength(data->numSamples, action->arg1);
+			break;
+		case ACTION_ECHO:
+			echoDelays(header, action, pass.n);
+			pass.length += echoTail(header, action);
+			break;
+		case ACTION_NORMALIZE:
+			// A '-n' runs as the '-v' that its measurement calls for.
+			volume = normalizeVolume(action, i, measureSampleData(data));
+			pass.action = &volume;
+			break;
+		case ACTION_CONVOLVE:
+			pass.length += impulseTail(header, action);
+			break;
+		}
+
+		// A group of nothing but flips has already been applied.
+		char *error = work ? catchFailure(runSamplePass, &pass) : NULL;
+		releaseSamplePass(&pass);
+		if (error != NULL)
+			failure(error);
+
+		unsigned long long size = (unsigned long long) pass.length * header->formatChunk.blockAlign;
+		header->size += size - header->dataChunk.size;
+		header->dataChunk.size = size;
+		data->numSamples = pass.length;
+
+		leaveStage(previous, length, header->formatChunk.blockAlign, data->numChannels);
+		fuseStages(first, i - first + 1);
+	}
+}
+
+/*
+ * The library interface in libwave.h.  Each call runs its work under
+ * catchFailure, on the pool of its context, and turns the error-message of
+ * a failure in to its WAVE_ERROR_* code.  Everything a call allocates is
+ * held in the context or the call, or freed on the way out of the step that
+ * failed, so it can be released when the call fails.  A failure in a task on
+ * the pool reaches the call once all of its tasks have stopped.
+ */
+
+struct _WaveContext {
+	Pool *pool;
+	Options options;
+	Action *actions;
+	int numActions;
+	WaveHeader header;
+	SampleData samples;
+};
+
+/**
+ * The arguments and results of one library call.
+ */
+typedef struct _WaveCall {
+	WaveContext *context;
+	int argc;
+	char **argv;
+	Action *actions;
+	const unsigned char *input;
+	size_t inputSize;
+	unsigned char *output;
+	size_t outputSize;
+	WaveHeader *header;
+	size_t size;
+} WaveCall;
+
+/**
+ * Runs a library call on the pool of its context.
+ *
+ * @param call The call.
+ * @param run The work of the call.
+ * @return The WAVE_ERROR_* code of its failure, or WAVE_OK.
+ */
+int runCall(WaveCall *call, void (*run)(void *)) {
+	Pool *outer = pool;
+	pool = call->context != NULL ? call->context->pool : NULL;
+
+	int code = errorCode(catchFailure(run, call));
+
+	pool = outer;
+	mappedInput = NULL;
+	return code;
+}
+
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Creates a context with an empty chain and a pool of "threads" threads.
+ *
+ * @param threads The number of threads each call may use, at least 1.
+ * @return The context, or NULL if memory runs out.
+ */
+WaveContext *waveCreateContext(int threads) {
+	pthread_once(&kernelsOnce, initKernels);
+	creationMask();
+
+	WaveContext *context = calloc(1, sizeof(WaveContext));
+	if (context == NULL)
+		return NULL;
+
+	context->options.jobs = threads > 1 ? threads : 1;
+	if (threads > 1) {
+		context->pool = createPool(threads);
+		if (context->pool == NULL) {
+			free(context);
+			return NULL;
+		}
+	}
+
+	return context;
+}
+
+/**
+ * Frees a context and stops its pool.
+ *
+ * @param context The context, or NULL.
+ */
+void waveDestroyContext(WaveContext *context) {
+	if (context == NULL)
+		return;
+
+	destroyPool(context->pool);
+	free(context->actions);
+	free(context);
+}
+
+/**
+ * Parses the chain of a waveParseChain call in to the call's actions.
+ *
+ * @param context The WaveCall.
+ */
+void parseCall(void *context) {
+	WaveCall *call = context;
+	Options options;
+	int count;
+
+	// A '-c' would load its impulse response from a file, and the library
+	// works on memory alone.
+	for (int i = 1; i < call->argc; i++) {
+		if (strcmp(call->argv[i], "-c") == 0)
+			failure(ERROR_COMMAND_LINE_USAGE);
+	}
+
+	parseActions(call->argc, call->argv, &options, call->actions, &count);
+	if (options.inPath != NULL || options.outPath != NULL || options.jobs != 1 || options.stats
+			|| options.window || options.index || options.checksums != NULL
+			|| options.verify != NULL)
+		failure(ERROR_COMMAND_LINE_USAGE);
+
+	call->context->options.floatMode = options.floatMode;
+	call->context->options.dither = options.dither;
+	call->size = count;
+}
+
+/**
+ * Replaces the chain of a context with one given as command line arguments.
+ *
+ * @param context The context.
+ * @param argc The number of arguments.
+ * @param argv The arguments, the first of which is skipped.
+ * @return WAVE_OK, or the error the chain fails to parse with.
+ */
+int waveParseChain(WaveContext *context, int argc, char **argv) {
+	WaveCall call = { context };
+	call.argc = argc;
+	call.argv = argv;
+	call.actions = malloc(sizeof(Action) * (argc > 0 ? argc : 1));
+	if (call.actions == NULL)
+		return WAVE_ERROR_MEMORY;
+
+	int code = runCall(&call, parseCall);
+	if (code != WAVE_OK) {
+		free(call.actions);
+		return code;
+	}
+
+	free(context->actions);
+	context->actions = call.actions;
+	context->numActions = (int) call.size;
+	return WAVE_OK;
+}
+
+/**
+ * Empties the chain of a context.
+ *
+ * @param context The context.
+ */
+void waveClearChain(WaveContext *context) {
+	context->numActions = 0;
+}
+
+/**
+ * Validates the action of an addAction call.
+ *
+ * @param context The WaveCall.
+ */
+void validateCall(void *context) {
+	WaveCall *call = context;
+	validateAction(call->actions);
+}
+
+/**
+ * Validates an action and adds it to the end of the chain of a context.
+ *
+ * @param context The context.
+ * @param action The action.
+ * @return WAVE_OK, or the error the action fails to validate with.
+ */
+int addAction(WaveContext *context, const Action *action) {
+	WaveCall call = { context };
+	call.actions = (Action *) action;
+
+	int code = runCall(&call, validateCall);
+	if (code != WAVE_OK)
+		return code;
+
+	Action *actions = realloc(context->actions, sizeof(Action) * (context->numActions + 1));
+	if (actions == NULL)
+		return WAVE_ERROR_MEMORY;
+
+	actions[context->numActions++] = *action;
+	context->actions = actions;
+	return WAVE_OK;
+}
+
+/**
+ * Adds a '-r' action to the chain of a context.
+ *
+ * @param context The context.
+ * @return WAVE_OK, or WAVE_ERROR_MEMORY.
+ */
+int waveReverse(WaveContext *context) {
+	Action action;
+	initAction(&action, ACTION_REVERSE);
+	return addAction(context, &action);
+}
+
+/**
+ * Adds a '-s' action to the chain of a context.
+ *
+ * @param context The context.
+ * @param factor The speed factor.
+ * @param method The name of the resampling method, or NULL.
+ * @return WAVE_OK, or the error the action fails with.
+ */
+int waveSpeed(WaveContext *context, double factor, const char *method) {
+	Action action;
+	initAction(&action, ACTION_SPEED);
+	action.arg1 = factor;
+	if (method != NULL && !parseResampler(method, &action.method))
+		return WAVE_ERROR_USAGE;
+
+	return addAction(context, &action);
+}
+
+/**
+ * Adds a '-f' action to the chain of a context.
+ *
+ * @param context The context.
+ * @return WAVE_OK, or WAVE_ERROR_MEMORY.
+ */
+int waveFlip(WaveContext *context) {
+	Action action;
+	initAction(&action, ACTION_FLIP);
+	return addAction(context, &action);
+}
+
+/**
+ * Adds a '-o' action to the chain of a context.
+ *
+ * @param context The context.
+ * @param duration The length of the fade in seconds.
+ * @param curve The name of the fade's curve, or NULL.
+ * @return WAVE_OK, or the error the action fails with.
+ */
+int waveFadeOut(WaveContext *context, double duration, const char *curve) {
+	Action action;
+	initAction(&action, ACTION_FADE_OUT);
+	action.arg1 = duration;
+	if (curve != NULL && !parseCurve(curve, &action.curve))
+		return WAVE_ERROR_USAGE;
+
+	return addAction(context, &action);
+}
+
+/**
+ * Adds a '-i' action to the chain of a context.
+ *
+ * @param context The context.
+ * @param duration The length of the fade in seconds.
+ * @param curve The name of the fade's curve, or NULL.
+ * @return WAVE_OK, or the error the action fails with.
+ */
+int waveFadeIn(WaveContext *context, double duration, const char *curve) {
+	Action action;
+	initAction(&action, ACTION_FADE_IN);
+	action.arg1 = duration;
+	if (curve != NULL && !parseCurve(curve, &action.curve))
+		return WAVE_ERROR_USAGE;
+
+	return addAction(context, &action);
+}
+
+/**
+ * Adds a '-v' action to the chain of a context.
+ *
+ * @param context The context.
+ * @param scale The volume scale.
+ * @return WAVE_OK, or the error the action fails with.
+ */
+int waveVolume(WaveContext *context, double scale) {
+	Action action;
+	initAction(&action, ACTION_VOLUME);
+	action.arg1 = scale;
+	return addAction(context, &action);
+}
+
+/**
+ * Adds a '-n' action to the chain of a context.
+ *
+ * @param context The context.
+ * @param target The level to normalize to, in LUFS or dBFS, at most 0.
+ * @param method "lufs", "peak" or "rms", or NULL for the default.
+ * @return WAVE_OK, or the error the action fails with.
+ */
+int waveNormalize(WaveContext *context, double target, const char *method) {
+	Action action;
+	initAction(&action, ACTION_NORMALIZE);
+	action.arg1 = target;
+	action.method = NORMALIZE_LOUDNESS;
+	if (method != NULL && !parseNormalizer(method, &action.method))
+		return WAVE_ERROR_USAGE;
+
+	return addAction(context, &action);
+}
+
+/**
+ * Adds a '-e' action with a single tap to the chain of a context.  Echoes
+ * with several taps can be given to waveParseChain.
+ *
+ * @param context The context.
+ * @param delay The delay of the echo in seconds.
+ * @param scale The scale of the echo.
+ * @param feedback 1 to echo the output instead of the input.
+ * @return WAVE_OK, or the error the action fails with.
+ */
+int waveEcho(WaveContext *context, double delay, double scale, int feedback) {
+	Action action;
+	initAction(&action, ACTION_ECHO);
+	action.arg1 = delay;
+	action.arg2 = scale;
+	action.numTaps = 1;
+	action.taps[0].delay = delay;
+	action.taps[0].scale = scale;
+	action.taps[0].feedback = feedback != 0;
+	return addAction(context, &action);
+}
+
+/**
+ * Picks whether a context runs its chain in the float working mode, as
+ * '-float' does.
+ *
+ * @param context The context.
+ * @param floatMode 1 for the float working mode.
+ * @param dither 1 to dither as the float samples are quantized.
+ */
+void waveSetFloatMode(WaveContext *context, int floatMode, int dither) {
+	context->options.floatMode = floatMode != 0;
+	context->options.dither = floatMode && dither;
+}
+
+/**
+ * Reads the header of a waveReadHeader or waveOutputSize call.
+ *
+ * @param context The WaveCall.
+ */
+void headerCall(void *context) {
+	WaveCall *call = context;
+	call->size = readMappedHeader(call->header, call->input, call->inputSize);
+}
+
+/**
+ * Reads and validates the header of a wave file held in memory.
+ *
+ * @param buffer The wave file.
+ * @param size The size of the file.
+ * @param header Where to store the header.
+ * @param offset Where to store the offset of the sound data, or NULL.
+ * @return WAVE_OK, or the error the header fails to validate with.
+ */
+int waveReadHeader(const unsigned char *buffer, size_t size, WaveHeader *header,
+		size_t *offset) {
+	WaveCall call = { NULL };
+	call.input = buffer;
+	call.inputSize = size;
+	call.header = header;
+
+	int code = runCall(&call, headerCall);
+	if (code == WAVE_OK && offset != NULL)
+		*offset = call.size;
+
+	return code;
+}
+
+/**
+ * Writes a header in the canonical 44-byte form, or the 80-byte RF64 form if
+ * its sizes need it.
+ *
+ * @param header The header.
+ * @param buffer Where to write the header.
+ * @param size The size of the buffer.
+ * @return WAVE_OK, or WAVE_ERROR_OUTPUT_SIZE if the header does not fit.
+ */
+int waveWriteHeader(const WaveHeader *header, unsigned char *buffer, size_t size) {
+	if (size < headerSize(header))
+		return WAVE_ERROR_OUTPUT_SIZE;
+
+	writeHeaderBuffer(header, buffer);
+	return WAVE_OK;
+}
+
+/**
+ * Returns how many bytes waveWriteHeader writes a header in.
+ *
+ * @param header The header.
+ * @return WAVE_HEADER_SIZE, or WAVE_RF64_HEADER_SIZE once its sizes pass 4 GB.
+ */
+size_t waveHeaderSize(const WaveHeader *header) {
+	return headerSize(header);
+}
+
+/**
+ * Returns the size of the buffer a context's chain needs to run over a wave
+ * file whose header has been read: room for the header and the longest
+ * stage of the chain.  Room is always left for an RF64 header, which the
+ * format-generic path only knows it needs once the chain has run.
+ *
+ * @param context The context.
+ * @param header The header of the input file.
+ * @return The size in bytes.
+ */
+size_t contextOutputSize(const WaveContext *context, const WaveHeader *header) {
+	int frameSize = header->formatChunk.blockAlign;
+	int64_t capacity = chainCapacity(header, context->actions, context->numActions,
+		header->dataChunk.size / frameSize);
+
+	return WAVE_RF64_HEADER_SIZE + (size_t) capacity * frameSize;
+}
+
+/**
+ * Finds the output size of a wave file for a context's chain.
+ *
+ * @param context The context.
+ * @param input The input wave file.
+ * @param inputSize The size of the input file.
+ * @param size Where to store the size of the buffer waveProcess needs.
+ * @return WAVE_OK, or the error the input's header fails to validate with.
+ */
+int waveOutputSize(WaveContext *context, const unsigned char *input, size_t inputSize,
+		size_t *size) {
+	WaveHeader header;
+	int code = waveReadHeader(input, inputSize, &header, NULL);
+	if (code == WAVE_OK)
+		*size = contextOutputSize(context, &header);
+
+	return code;
+}
+
+/**
+ * Runs the chain of a waveProcess call over its input, in to its output.
+ *
+ * @param context The WaveCall.
+ */
+void processCall(void *context) {
+	WaveCall *call = context;
+	WaveContext *wave = call->context;
+	WaveHeader *header = &wave->header;
+
+	readMappedHeader(header, call->input, call->inputSize);
+	if (call->outputSize < contextOutputSize(wave, header))
+		failure(ERROR_OUTPUT_SIZE);
+
+	if (wave->options.floatMode || !isNativeFormat(header)) {
+		int64_t numSamples = header->dataChunk.size / header->formatChunk.blockAlign;
+		readSamples(&wave->samples, header, &wave->options,
+			chainCapacity(header, wave->actions, wave->numActions, numSamples),
+			measuresOnRead(wave->actions, wave->numActions));
+
+		runSampleChain(&wave->samples, wave->actions, wave->numActions);
+		call->size = writeSampleBuffer(&wave->samples, call->output);
+	} else {
+		call->size = runBufferChain(header, call->output, wave->actions, wave->numActions);
+	}
+}
+
+/**
+ * Runs the chain of a context over a wave file held in memory, writing the
+ * output file in to a buffer.  The output buffer must not overlap the input.
+ *
+ * @param context The context.
+ * @param input The input wave file.
+ * @param inputSize The size of the input file.
+ * @param output The output buffer, of at least the size waveOutputSize gives.
+ * @param outputSize The size of the output buffer.
+ * @param written Where to store the size of the output file.
+ * @return WAVE_OK, or the error the chain fails with.
+ */
+int waveProcess(WaveContext *context, const unsigned char *input, size_t inputSize,
+		unsigned char *output, size_t outputSize, size_t *written) {
+	WaveCall call = { context };
+	call.input = input;
+	call.inputSize = inputSize;
+	call.output = output;
+	call.outputSize = outputSize;
+
+	memset(&context->samples, 0, sizeof(SampleData));
+	int code = runCall(&call, processCall);
+	freeSamples(&context->samples);
+
+	if (code == WAVE_OK)
+		*written = call.size;
+
+	return code;
+}
+
+/**
+ * Describes a WAVE_ERROR_* code.
+ *
+ * @param code The code.
+ * @return The error-message of the code.
+ */
+const char *waveErrorMessage(int code) {
+	if (code < 0 || code >= WAVE_NUM_ERRORS)
+		return "Unknown error";
+
+	return errorMessages[code];
+}
+
+/**
+ * Names the kernels the library runs with.
+ *
+ * @return "scalar", "sse2", "avx2", "avx512" or "neon".
+ */
+const char *waveKernelsName(void) {
+	pthread_once(&kernelsOnce, initKernels);
+	return kernelsName();
+}
+
+// Batch mode, mix mode and main are the command line's own; the library is
+// built without them.
+#ifndef WAVE_LIBRARY
+
+/*
+ * Batch mode runs many jobs in one process.  Each line of the manifest names
+ * an input file, an output file and the chain of actions to run between them,
+ * separated by whitespace; blank lines and lines starting with '#' are
+ * skipped.  Every chain is parsed up front, the jobs then run side by side on
+ * the worker pool, each one on a single thread, and the jobs that failed are
+ * reported once the batch is done instead of ending it.
+ */
+
+/**
+ * One job of a batch.  "line" is its line in the manifest and "error" is the
+ * message it failed with, or NULL.  The input, header and samples are kept
+ * here rather than on the stack so that a failed job can still release them.
+ */
+typedef struct _BatchJob {
+	int line;
+	char **words;
+	int numWords;
+	Action *actions;
+	int numActions;
+	Options options;
+	char *error;
+	MappedFile input;
+	WaveHeader header;
+	SampleData samples;
+} BatchJob;
+
+/**
+ * Fails if the input and output are the same file, which mapping the output
+ * would truncate before the input is read.
+ *
+ * @param inPath The path of the input file.
+ * @param outPath The path of the output file, or NULL.
+ */
+void checkDistinctFiles(const char *inPath, const char *outPath) {
+	struct stat in, out;
+
+	if (outPath != NULL && stat(inPath, &in) == 0 && stat(outPath, &out) == 0
+		&& in.st_dev == out.st_dev && in.st_ino == out.st_ino)
+		failure(ERROR_SAME_FILE);
+}
+
+/**
+ * Parses the chain of a batch job.  The words after the input and output are
+ * parsed just as a command line is.
+ *
+ * @param context The job.
+ */
+void parseJob(void *context) {
+	BatchJob *job = context;
+
+	if (job->numWords < 2)
+		failure(ERROR_INVALID_JOB);
+
+	// The actions are kept in the job first, so they are freed even if the
+	// chain fails to parse, and the output word stands in for the program
+	// name parseActions skips.
+	job->actions = calloc(job->numWords, sizeof(Action));
+	if (job->actions == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	parseActions(job->numWords - 1, job->words + 1, &job->options, job->actions,
+		&job->numActions);
+	if (job->options.inPath != NULL || job->options.outPath != NULL || job->options.jobs != 1
+		|| job->options.stats || job->options.inPlace || job->options.verify != NULL)
+		failure(ERROR_INVALID_JOB);
+
+	job->options.inPath = job->words[0];
+	job->options.outPath = job->words[1];
+}
+
+/**
+ * Runs a batch job from its input file to its output file, always through
+ * the mappings.
+ *
+ * @param context The parsed job.
+ */
+void runJob(void *context) {
+	BatchJob *job = context;
+	const Options *options = &job->options;
+
+	checkDistinctFiles(options->inPath, options->outPath);
+	mapInputFile(&job->input, options->inPath);
+	WaveIndex index;
+	size_t offset = readIndexedHeader(&job->header, &job->input, options->inPath, &index);
+	useIndexLevels(&index, job->actions, job->numActions);
+
+	WaveHeader *header = &job->header;
+	int passKind = passThroughKind(header, options, job->actions, job->numActions);
+	if (options->window) {
+		if (!isWindowChain(header, options, job->actions, job->numActions))
+			failure(ERROR_WINDOW_CHAIN);
+
+		runWindowFile(header, options, job->input.fd, (off_t) offset, options->outPath,
+			job->actions, job->numActions);
+	} else if (passKind != PASS_NONE) {
+		passThroughFile(header, job->input.fd, (off_t) offset, options->outPath, passKind);
+	} else if (options->floatMode || !isNativeFormat(header)) {
+		int64_t numSamples = header->dataChunk.size / header->formatChunk.blockAlign;
+		readSamples(&job->samples, header, options,
+			chainCapacity(header, job->actions, job->numActions, numSamples),
+			measuresOnRead(job->actions, job->numActions));
+
+		runSampleChain(&job->samples, job->actions, job->numActions);
+		writeSamples(&job->samples, options->outPath);
+	} else {
+		runMappedOutput(header, options->outPath, job->actions, job->numActions);
+	}
+
+	if (options->index)
+		indexFile(options->outPath);
+	if (options->checksums != NULL)
+		writeManifest(options->outPath, options->checksums);
+}
+
+/**
+ * Runs a parsed batch job, if it parsed, and releases everything it holds
+ * whether or not it succeeded.
+ *
+ * @param context The array of jobs.
+ * @param index The index of the job.
+ */
+void runBatchJob(void *context, int index) {
+	BatchJob *job = (BatchJob *) context + index;
+
+	if (job->error == NULL)
+		job->error = catchFailure(runJob, job);
+
+	if (job->input.fd >= 0) {
+		if (job->input.map == MAP_FAILED)
+			job->input.map = NULL;
+		unmapFile(&job->input, 0);
+	}
+
+	freeSamples(&job->samples);
+	freeChain(job->actions, job->numActions);
+}
+
+/**
+ * Reads a whole file in to a NUL-terminated buffer, failing if it cannot.
+ *
+ * @param path The path of the file.
+ * @return The allocated contents.
+ */
+char *readTextFile(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		failure(ERROR_FILE_ACCESS);
+
+	size_t length = 0, size = 4096;
+	char *text = malloc(size);
+	while (text != NULL) {
+		length += fread(text + length, 1, size - length - 1, file);
+		if (length < size - 1)
+			break;
+
+		size *= 2;
+		char *grown = realloc(text, size);
+		if (grown == NULL)
+			free(text);
+		text = grown;
+	}
+
+	fclose(file);
+	if (text == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	text[length] = '\0';
+	return text;
+}
+
+/**
+ * Splits a manifest in to jobs, one per line that is not blank or a comment.
+ * The lines are split in place, so the jobs' words point in to the text.
+ *
+ * @param text The manifest's text.
+ * @param count Where to store the number of jobs.
+ * @return The allocated jobs, zeroed but for their words.
+ */
+BatchJob *splitManifest(char *text, int *count) {
+	int lines = 1;
+	for (char *c = text; *c != '\0'; c++)
+		lines += *c == '\n';
+
+	BatchJob *jobs = calloc(lines, sizeof(BatchJob));
+	if (jobs == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	*count = 0;
+	char *next;
+	for (int line = 1; text != NULL; line++, text = next) {
+		next = strchr(text, '\n');
+		if (next != NULL)
+			*next++ = '\0';
+
+		// A line has at most one word per two characters.
+		char **words = malloc(sizeof(char *) * (strlen(text) / 2 + 1));
+		if (words == NULL)
+			failure(ERROR_INSUFFICIENT_MEMORY);
+
+		int numWords = 0;
+		char *state;
+		for (char *word = strtok_r(text, " \t\r", &state); word != NULL;
+				word = strtok_r(NULL, " \t\r", &state))
+			words[numWords++] = word;
+
+		if (numWords == 0 || words[0][0] == '#') {
+			free(words);
+			continue;
+		}
+
+		BatchJob *job = &jobs[(*count)++];
+		job->line = line;
+		job->words = words;
+		job->numWords = numWords;
+		job->input.fd = -1;
+	}
+
+	return jobs;
+}
+
+/**
+ * Runs every job of a manifest, "wave --batch manifest [-j threads]", and
+ * reports the jobs that failed in the order they are listed.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments, starting with "wave --batch".
+ * @return The exit status: 0 if every job succeeded, 1 otherwise.
+ */
+int runBatch(int argc, char **argv) {
+	int threads = 1;
+	for (int i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "-j") != 0)
+			failure(ERROR_COMMAND_LINE_USAGE);
+
+		double jobs = parseParameter(argc, argv, &i);
+		if (jobs < 1 || jobs != (int) jobs)
+			failure(ERROR_INVALID_JOBS);
+		threads = (int) jobs;
+	}
+
+	char *text = readTextFile(argv[2]);
+	int count;
+	BatchJob *jobs = splitManifest(text, &count);
+
+	for (int i = 0; i < count; i++)
+		jobs[i].error = catchFailure(parseJob, &jobs[i]);
+
+	// Each job runs on one thread, so the jobs themselves are what is spread
+	// over the pool.
+	initKernels();
+	creationMask();
+	if (pthread_key_create(&arenaKey, dropArena) != 0)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+	reuseArenas = 1;
+
+	Pool *batchPool = createPool(threads);
+	if (threads > 1 && batchPool == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	runParallel(batchPool, count, runBatchJob, jobs);
+	destroyPool(batchPool);
+	destroyArena(pthread_getspecific(arenaKey));
+
+	int status = 0;
+	for (int i = 0; i < count; i++) {
+		if (jobs[i].error != NULL) {
+			fprintf(stderr, "Error: %s:%d: %s\n", argv[2], jobs[i].line, jobs[i].error);
+			status = 1;
+		}
+		free(jobs[i].words);
+	}
+
+	free(jobs);
+	free(text);
+	return status;
+}
+
+/*
+ * Mix mode builds one output from many inputs in a single pass, "wave --mix
+ * manifest [-out file] [-j threads] [--checksums manifest]".  Each line of the manifest names an
+ * input file, where it starts in the output and the chain of actions to run
+ * over it, separated by whitespace; blank lines and lines starting with '#'
+ * are skipped, as in a batch.  The start is a time in seconds, or '+' to start
+ * right where the line before ends, or '+' and a time to start that long
+ * after it, so a manifest can concatenate spots as well as lay them over each
+ * other.  Every input is a 16-bit stereo file at the first one's sample rate.
+ *
+ * Every chain is planned up front, so the length of the output, and with it
+ * the output header, is known before any sound data is processed, and the
+ * output can go to stdout.  The output is then built a block at a time: each
+ * input under the block has its chain streamed just as far as the block
+ * needs, or run over its whole input the first time it is needed if the
+ * chain cannot be streamed, and the block is the sum of the inputs under it,
+ * clamped once they have all been added.  Wherever no input plays, the
+ * output is silent, and an input is released as soon as the output passes
+ * its end.
+ */
+
+/**
+ * One input of a mix.  "start" and "length" place the output of its chain in
+ * the mix, and "mixed" is how much of that has been mixed in so far.  A chain
+ * that streams keeps its stages, and a writable copy of the block being
+ * pushed through them; one that cannot is run whole in "rendered" and its
+ * output held there.
+ */
+typedef struct _MixInput {
+	int line;
+	char **words;
+	int numWords;
+	Action *actions;
+	int numActions;
+	MappedFile input;
+	WaveHeader header;
+	const unsigned char *data; // The input's sound data, in the mapping.
+	size_t dataSize;           // The bytes of the mapping from "data" on.
+	int64_t numSamples;        // Frames of input.
+	int64_t read;              // Frames of input pushed through the chain.
+	int flushed;               // 1 once the chain's tails have been pushed.
+	int blockFrames;           // The length of the mix's blocks.
+	const char *outPath;       // The mix's output file, or NULL for stdout.
+	int after;                 // 1 if the start follows the line before.
+	double offset;             // The start, or the gap after the line before.
+	int64_t start;
+	int64_t length;
+	int64_t mixed;
+	Stage *stages;
+	short *block;
+	unsigned char *rendered;
+	HeldFrames held;
+} MixInput;
+
+/**
+ * Parses a line of a mix and opens its input.  The words after the input and
+ * the start are parsed just as a command line is.
+ *
+ * @param context The mix input.
+ */
+void openMixInput(void *context) {
+	MixInput *mix = context;
+
+	if (mix->numWords < 2)
+		failure(ERROR_INVALID_MIX);
+
+	const char *word = mix->words[1];
+	mix->after = word[0] == '+';
+	char *end = (char *) word + mix->after;
+	if (*end != '\0')
+		mix->offset = strtod(word + mix->after, &end);
+	if (*end != '\0' || end == word || !(mix->offset >= 0) || !isfinite(mix->offset))
+		failure(ERROR_INVALID_MIX);
+
+	// The start word stands in for the program name parseActions skips.
+	Options options;
+	mix->actions = calloc(mix->numWords, sizeof(Action));
+	if (mix->actions == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	parseActions(mix->numWords - 1, mix->words + 1, &options, mix->actions, &mix->numActions);
+	if (options.inPath != NULL || options.outPath != NULL || options.jobs != 1
+		|| options.floatMode || options.stats || options.window || options.inPlace
+		|| options.index || options.checksums != NULL || options.verify != NULL)
+		failure(ERROR_INVALID_MIX);
+
+	checkDistinctFiles(mix->words[0], mix->outPath);
+	mapInputFile(&mix->input, mix->words[0]);
+	WaveIndex index;
+	size_t offset = readIndexedHeader(&mix->header, &mix->input, mix->words[0], &index);
+	if (!isNativeFormat(&mix->header))
+		failure(ERROR_INVALID_MIX);
+
+	useIndexLevels(&index, mix->actions, mix->numActions);
+	mix->data = mix->input.map + offset;
+	mix->dataSize = mix->input.size - offset;
+	mix->numSamples = mix->header.dataChunk.size / BYTES_PER_FRAME;
+}
+
+/**
+ * Plans the chain of a mix input: works out how long its output is, and
+ * creates its stages if it can be streamed.
+ *
+ * @param context The opened mix input.
+ */
+void planMixInput(void *context) {
+	MixInput *mix = context;
+
+	WaveHeader header = mix->header;
+	mix->length = mix->numSamples;
+	for (int i = 0; i < mix->numActions; i++)
+		mix->length = planAction(&header, &mix->actions[i], mix->length);
+
+	if (isStreamable(mix->actions, mix->numActions)) {
+		header = mix->header;
+		mix->stages = createStages(&header, mix->actions, mix->numActions, mix->blockFrames);
+		mix->block = allocateFrames(mix->blockFrames);
+	}
+}
+
+/**
+ * Makes sure a mix input holds the output of its chain up to "end", in frames
+ * of that output.  A chain that streams has the next blocks of its input, and
+ * then its tails, pushed through it until it does; one that cannot is run
+ * over its whole input the first time.
+ *
+ * @param mix The mix input.
+ * @param end How far in to the chain's output the mix needs.
+ */
+void fillMixInput(MixInput *mix, int64_t end) {
+	if (mix->stages == NULL) {
+		if (mix->rendered != NULL)
+			return;
+
+		WaveHeader header = mix->header;
+		size_t offset = chainHeaderSize(&header, mix->actions, mix->numActions);
+		int64_t capacity = chainCapacity(&header, mix->actions, mix->numActions,
+			mix->numSamples);
+		mix->rendered = malloc(offset + (size_t) BYTES_PER_FRAME * capacity);
+		if (mix->rendered == NULL)
+			failure(ERROR_INSUFFICIENT_MEMORY);
+
+		mappedInput = mix->data;
+		mappedRemaining = mix->dataSize;
+		size_t size = runBufferChain(&header, mix->rendered, mix->actions, mix->numActions);
+		mix->held.frames = (short *) (mix->rendered + offset);
+		mix->held.count = (int64_t) ((size - offset) / BYTES_PER_FRAME);
+		return;
+	}
+
+	heldFrames = &mix->held;
+	while (mix->mixed + mix->held.count - mix->held.start < end && !mix->flushed) {
+		if (mix->read < mix->numSamples) {
+			int frames = mix->numSamples - mix->read < mix->blockFrames
+				? (int) (mix->numSamples - mix->read) : mix->blockFrames;
+
+			memcpy(mix->block, mix->data + (size_t) BYTES_PER_FRAME * mix->read,
+				(size_t) BYTES_PER_FRAME * frames);
+			pushFrames(mix->stages, 0, mix->numActions, mix->block, frames, 0);
+			mix->read += frames;
+		} else {
+			flushTails(mix->stages, mix->numActions, mix->blockFrames);
+			mix->flushed = 1;
+		}
+	}
+	heldFrames = NULL;
+}
+
+/**
+ * Releases everything a mix input holds.  It can be called again once it
+ * has.
+ *
+ * @param mix The mix input.
+ */
+void releaseMixInput(MixInput *mix) {
+	if (mix->stages != NULL)
+		freeStages(mix->stages, mix->numActions);
+	freeChain(mix->actions, mix->numActions);
+	free(mix->block);
+	if (mix->rendered == NULL)
+		free(mix->held.frames);
+	free(mix->rendered);
+
+	if (mix->input.fd >= 0) {
+		if (mix->input.map == MAP_FAILED)
+			mix->input.map = NULL;
+		unmapFile(&mix->input, 0);
+		mix->input.fd = -1;
+	}
+
+	mix->stages = NULL;
+	mix->actions = NULL;
+	mix->numActions = 0;
+	mix->block = NULL;
+	mix->rendered = NULL;
+	memset(&mix->held, 0, sizeof(HeldFrames));
+}
+
+/**
+ * Mixes one block of the output: adds the part of every input's output that
+ * falls in the block to "sums", and releases the inputs that end in it.
+ *
+ * @param mixes The inputs.
+ * @param count The number of inputs.
+ * @param sums The block's sums, two per frame.
+ * @param first The first frame of the block in the output.
+ * @param frames The number of frames in the block.
+ */
+void mixBlock(MixInput *mixes, int count, int *sums, int64_t first, int frames) {
+	memset(sums, 0, sizeof(int) * 2 * frames);
+
+	for (int i = 0; i < count; i++) {
+		MixInput *mix = &mixes[i];
+		int64_t from = mix->start + mix->mixed;
+		int64_t to = mix->start + mix->length;
+		if (from < first)
+			from = first;
+		if (to > first + frames)
+			to = first + frames;
+		if (from >= to)
+			continue;
+
+		fillMixInput(mix, to - mix->start);
+		int64_t n = to - from;
+		if (n > mix->held.count - mix->held.start)
+			n = mix->held.count - mix->held.start;
+
+		mixSamples(sums + 2 * (from - first), mix->held.frames + 2 * mix->held.start,
+			(int) (2 * n));
+		mix->held.start += n;
+		mix->mixed += n;
+
+		if (to == mix->start + mix->length)
+			releaseMixInput(mix);
+	}
+}
+
+/**
+ * Mixes every block of the output and writes it, after the header, to a
+ * mapped output file or to stdout through a stream's writer thread.
+ *
+ * @param header The output header.
+ * @param mixes The planned inputs, placed in the output.
+ * @param count The number of inputs.
+ * @param total The length of the output in frames.
+ * @param outPath The path of the output file, or NULL for stdout.
+ */
+void writeMix(const WaveHeader *header, MixInput *mixes, int count, int64_t total,
+		const char *outPath) {
+	int blockFrames = mixes[0].blockFrames;
+	int *sums = malloc(sizeof(int) * 2 * blockFrames);
+	if (sums == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	MappedFile output;
+	StreamIO io;
+	short *samples;
+	if (outPath != NULL) {
+		mapOutputFile(&output, outPath, headerSize(header) + (size_t) BYTES_PER_FRAME * total);
+		writeHeaderBuffer(header, output.map);
+		samples = (short *) (output.map + headerSize(header));
+	} else {
+		writeHeader(header);
+		startStreamIO(&io, 0, blockFrames);
+		samples = allocateFrames(blockFrames);
+	}
+
+	for (int64_t first = 0; first < total; first += blockFrames) {
+		int frames = total - first < blockFrames ? (int) (total - first) : blockFrames;
+
+		mixBlock(mixes, count, sums, first, frames);
+		if (outPath != NULL) {
+			clampSums(samples + 2 * first, sums, 2 * frames);
+		} else {
+			clampSums(samples, sums, 2 * frames);
+			queueFrames(&io, samples, frames, 0);
+		}
+	}
+
+	if (outPath != NULL) {
+		unmapFile(&output, 0);
+		finishOutput();
+	} else {
+		stopStreamIO(&io);
+		free(samples);
+	}
+	free(sums);
+}
+
+/**
+ * Runs a mix, "wave --mix manifest [-out file] [-j threads] [--checksums
+ * manifest]", writing the output to the file or to stdout.  A line that fails to parse, open or plan
+ * is reported with its line number, and nothing is written.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments, starting with "wave --mix".
+ * @return The exit status: 0 if the mix was written, 1 otherwise.
+ */
+int runMix(int argc, char **argv) {
+	const char *outPath = NULL;
+	const char *checksums = NULL;
+	int threads = 1;
+	for (int i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "-out") == 0 && i + 1 < argc) {
+			outPath = argv[++i];
+		} else if (strcmp(argv[i], "--checksums") == 0 && i + 1 < argc) {
+			checksums = argv[++i];
+		} else if (strcmp(argv[i], "-j") == 0) {
+			double jobs = parseParameter(argc, argv, &i);
+			if (jobs < 1 || jobs != (int) jobs)
+				failure(ERROR_INVALID_JOBS);
+			threads = (int) jobs;
+		} else {
+			failure(ERROR_COMMAND_LINE_USAGE);
+		}
+	}
+
+	char *text = readTextFile(argv[2]);
+	int count;
+	BatchJob *lines = splitManifest(text, &count);
+	if (count == 0)
+		failure(ERROR_INVALID_MIX);
+
+	MixInput *mixes = calloc(count, sizeof(MixInput));
+	if (mixes == NULL)
+		failure(ERROR_INSUFFICIENT_MEMORY);
+
+	int blockFrames = IO_BLOCK_FRAMES * threads;
+	for (int i = 0; i < count; i++) {
+		mixes[i].line = lines[i].line;
+		mixes[i].words = lines[i].words;
+		mixes[i].numWords = lines[i].numWords;
+		mixes[i].blockFrames = blockFrames;
+		mixes[i].outPath = outPath;
+		mixes[i].input.fd = -1;
+	}
+	free(lines);
+
+	// Pick the kernels, and read the creation mask, before any worker thread
+	// can race to do it.
+	initKernels();
+	creationMask();
+	if (threads > 1) {
+		pool = createPool(threads);
+		if (pool == NULL)
+			failure(ERROR_INSUFFICIENT_MEMORY);
+	}
+
+	int status = 0;
+	for (int i = 0; i < count && status == 0; i++) {
+		char *error = catchFailure(openMixInput, &mixes[i]);
+		if (error == NULL && mixes[i].header.formatChunk.sampleRate
+				!= mixes[0].header.formatChunk.sampleRate)
+			error = ERROR_INVALID_MIX;
+		if (error == NULL)
+			error = catchFailure(planMixInput, &mixes[i]);
+
+		if (error != NULL) {
+			fprintf(stderr, "Error: %s:%d: %s\n", argv[2], mixes[i].line, error);
+			status = 1;
+		}
+	}
+
+	// Each input starts at its own time, or after the line before it ends.
+	if (status == 0) {
+		int64_t end = 0, total = 0;
+		for (int i = 0; i < count; i++) {
+			MixInput *mix = &mixes[i];
+			mix->start = (mix->after ? end : 0) + durationFrames(&mixes[0].header, mix->offset,
+				ERROR_INVALID_MIX);
+			end = mix->start + mix->length;
+			if (end > total)
+				total = end;
+		}
+
+		WaveHeader header = mixes[0].header;
+		header.dataChunk.size = (unsigned long long) BYTES_PER_FRAME * total;
+		header.size = WAVE_HEADER_SIZE - 8 + header.dataChunk.size;
+		showHeader("Output", &header);
+
+		if (checksums != NULL && outPath == NULL)
+			startOutputChecksums(BYTES_PER_FRAME);
+		writeMix(&header, mixes, count, total, outPath);
+		if (checksums != NULL && outPath != NULL)
+			writeManifest(outPath, checksums);
+		else if (checksums != NULL)
+			finishOutputChecksums(checksums);
+	}
+
+	for (int i = 0; i < count; i++) {
+		releaseMixInput(&mixes[i]);
+		free(mixes[i].words);
+	}
+
+	destroyPool(pool);
+	pool = NULL;
+	free(mixes);
+	free(text);
+	return status;
+}
+
+// The main function.  Program begins here.
+int main(int argc, char **argv) {
+	if (argc >= 3 && strcmp(argv[1], "--batch") == 0)
+		return runBatch(argc, argv);
+	if (argc >= 3 && strcmp(argv[1], "--mix") == 0)
+		return runMix(argc, argv);
+
+	Options options;
+	int numActions;
+	Action *actions = parseChain(argc, argv, &options, &numActions);
+	if (options.inPlace && (options.inPath == NULL || options.outPath != NULL))
+		failure(ERROR_COMMAND_LINE_USAGE);
+
+	// Only a file can have an index, and verifying a manifest writes no
+	// output at all.
+	const char *indexPath = options.inPlace ? options.inPath : options.outPath;
+	if (options.index && indexPath == NULL)
+		failure(ERROR_COMMAND_LINE_USAGE);
+	if (options.verify != NULL && (options.inPath == NULL || options.outPath != NULL
+		|| options.window || options.index || options.checksums != NULL))
+		failure(ERROR_COMMAND_LINE_USAGE);
+	if (options.stats)
+		startStats(actions, numActions, options.folded);
+
+	// Pick the kernels, and read the creation mask, before any worker thread
+	// can race to do it.
+	initKernels();
+	creationMask();
+	if (options.jobs > 1) {
+		pool = createPool(options.jobs);
+		if (pool == NULL)
+			failure(ERROR_INSUFFICIENT_MEMORY);
+	}
+
+	// Create WaveData struct and load in file header.
+	WaveData data;
+	memset(&data, 0, sizeof(data));
+
+	// An input file's index stands in for its header, and for measuring it.
+	MappedFile input;
+	WaveIndex index;
+	int previous = enterStage(STATS_HEADER);
+	if (options.inPath != NULL) {
+		checkDistinctFiles(options.inPath, options.outPath);
+		mapInputFile(&input, options.inPath);
+		data.header = mapFileHeader(&input, options.inPath, &index);
+		useIndexLevels(&index, actions, numActions);
+	} else {
+		data.header = readFileHeader();
+	}
+	leaveStage(previous, 1, (int) headerSize(data.header), 0);
+	data.layout = chainLayout(actions, numActions);
+
+	// Output to stdout is checksummed as it is written, in the input's format.
+	if (options.checksums != NULL && indexPath == NULL)
+		startOutputChecksums(data.header->formatChunk.blockAlign);
+
+	// Print out file header for convenience.
+	showHeader("Input", data.header);
+
+	// Find out whether the sound data can go straight through, or only part
+	// of it needs to be read.
+	int passKind = passThroughKind(data.header, &options, actions, numActions);
+	off_t dataOffset = -1;
+	if ((passKind != PASS_NONE || options.window) && options.inPath != NULL)
+		dataOffset = (off_t) (mappedInput - input.map);
+	else if (passKind != PASS_NONE || options.window)
+		dataOffset = stdinDataOffset(data.header);
+	int inFd = options.inPath != NULL ? input.fd : STDIN_FILENO;
+
+	if (options.verify != NULL) {
+		setStatsPath("verify");
+		verifyChain(data.header, &options, actions, numActions);
+	} else if (options.window) {
+		if (dataOffset < 0 || !isWindowChain(data.header, &options, actions, numActions))
+			failure(ERROR_WINDOW_CHAIN);
+
+		setStatsPath(options.inPlace ? "in-place" : "window");
+		showHeader("Output", data.header);
+
+		runWindowFile(data.header, &options, inFd, dataOffset, options.outPath, actions,
+			numActions);
+	} else if (dataOffset >= 0) {
+		setStatsPath("pass-through");
+		showHeader("Output", data.header);
+
+		passThroughFile(data.header, inFd, dataOffset, options.outPath, passKind);
+	} else if (options.floatMode || !isNativeFormat(data.header)) {
+		SampleData samples;
+		const FormatChunk *format = &data.header->formatChunk;
+		int64_t numSamples = data.header->dataChunk.size / format->blockAlign;
+
+		setStatsPath(options.floatMode ? "float" : "generic");
+		previous = enterStage(STATS_READ);
+		readSamples(&samples, data.header, &options,
+			chainCapacity(data.header, actions, numActions, numSamples),
+			measuresOnRead(actions, numActions));
+		leaveStage(previous, numSamples, format->blockAlign, format->channels);
+
+		// Perform the actions in the order given.
+		runSampleChain(&samples, actions, numActions);
+
+		showHeader("Output", data.header);
+
+		previous = enterStage(STATS_WRITE);
+		writeSamples(&samples, options.outPath);
+		leaveStage(previous, samples.numSamples, format->blockAlign, format->channels);
+		freeSamples(&samples);
+	} else if (options.outPath != NULL) {
+		setStatsPath("mapped");
+		runMappedOutput(data.header, options.outPath, actions, numActions);
+
+		showHeader("Output", data.header);
+	} else if (isStreamable(actions, numActions)) {
+		// The output header is known before any sound data is processed.
+		int64_t numSamples = data.header->dataChunk.size / BYTES_PER_FRAME;
+		int blockFrames = IO_BLOCK_FRAMES * options.jobs;
+		Stage *stages = createStages(data.header, actions, numActions, blockFrames);
+
+		setStatsPath("stream");
+		showHeader("Output", data.header);
+
+		previous = enterStage(STATS_WRITE);
+		writeHeader(data.header);
+		leaveStage(previous, 0, BYTES_PER_FRAME, 2);
+
+		streamSoundData(numSamples, stages, numActions, blockFrames);
+		freeStages(stages, numActions);
+	} else {
+		int64_t numSamples = data.header->dataChunk.size / BYTES_PER_FRAME;
+
+		setStatsPath("whole-file");
+		previous = enterStage(STATS_READ);
+		readSoundData(&data, chainCapacity(data.header, actions, numActions, numSamples),
+			measuresOnRead(actions, numActions));
+		leaveStage(previous, numSamples, BYTES_PER_FRAME, 2);
+
+		// Perform the actions in the order given.
+		runChain(&data, actions, numActions);
+
+		// Print out file header to see comparison.
+		showHeader("Output", data.header);
+
+		// Write data to file and free allocated memory.
+		previous = enterStage(STATS_WRITE);
+		writeToFile(&data);
+		leaveStage(previous, data.numSamples, BYTES_PER_FRAME, 2);
+		destroyArena(data.arena);
+	}
+
+	if (options.inPath != NULL)
+		unmapFile(&input, 0);
+
+	// Output to stdout has only all been written once the last of it is
+	// flushed.
+	checkStdout();
+
+	if (options.index)
+		indexFile(indexPath);
+	if (options.checksums != NULL && indexPath != NULL)
+		writeManifest(indexPath, options.checksums);
+	else if (options.checksums != NULL)
+		finishOutputChecksums(options.checksums);
+
+	if (stats != NULL)
+		printStats();
+
+	destroyPool(pool);
+	free(data.header);
+	freeChain(actions, numActions);
+
+	return 0;
+}
+#endif
@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "queue.h"
+
+struct _BlockQueue {
+	unsigned char *memory;
+	size_t size;           // Bytes in each buffer.
+	size_t *used;          // Bytes filled in each buffer.
+	int numBlocks;
+
+	pthread_mutex_t lock;
+	pthread_cond_t filled; // Signalled when a buffer is submitted.
+	pthread_cond_t empty;  // Signalled when a buffer is returned.
+
+	// Running counts of buffers that went each way; buffer i % numBlocks is
+	// the i-th one submitted and the i-th one taken.
+	unsigned long long submitted;
+	unsigned long long taken;
+	unsigned long long returned;
+	int closed;
+	int cancelled;
+};
+
+/**
+ * Creates a queue of "blocks" buffers of "size" bytes each.
+ *
+ * @param blocks The number of buffers, at least 2 for the two sides to
+ *               overlap.
+ * @param size The size of each buffer in bytes.
+ * @return The queue, or NULL if memory runs out.
+ */
+BlockQueue *createBlockQueue(int blocks, size_t size) {
+	BlockQueue *queue = calloc(1, sizeof(BlockQueue));
+	if (queue == NULL)
+		return NULL;
+
+	queue->memory = malloc((size_t) blocks * size);
+	queue->used = calloc(blocks, sizeof(size_t));
+	if (queue->memory == NULL || queue->used == NULL) {
+		free(queue->memory);
+		free(queue->used);
+		free(queue);
+		return NULL;
+	}
+
+	queue->size = size;
+	queue->numBlocks = blocks;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->filled, NULL);
+	pthread_cond_init(&queue->empty, NULL);
+
+	return queue;
+}
+
+/**
+ * Waits for an empty buffer for the producer to fill.  The producer holds at
+ * most one at a time, until it submits it.
+ *
+ * @param queue The queue.
+ * @return The buffer, or NULL if the queue was cancelled.
+ */
+void *acquireBlock(BlockQueue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	while (!queue->cancelled && queue->submitted - queue->returned == (unsigned) queue->numBlocks)
+		pthread_cond_wait(&queue->empty, &queue->lock);
+
+	void *block = NULL;
+	if (!queue->cancelled)
+		block = queue->memory + queue->submitted % queue->numBlocks * queue->size;
+	pthread_mutex_unlock(&queue->lock);
+
+	return block;
+}
+
+/**
+ * Hands the buffer the producer acquired on to the consumer.
+ *
+ * @param queue The queue.
+ * @param used How many bytes of the buffer were filled.
+ */
+void submitBlock(BlockQueue *queue, size_t used) {
+	pthread_mutex_lock(&queue->lock);
+	queue->used[queue->submitted % queue->numBlocks] = used;
+	queue->submitted++;
+	pthread_cond_signal(&queue->filled);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Tells the consumer that the producer will submit nothing more.
+ *
+ * @param queue The queue.
+ */
+void closeBlockQueue(BlockQueue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = 1;
+	pthread_cond_signal(&queue->filled);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Waits for the next filled buffer.  The consumer holds at most one at a
+ * time, until it returns it.
+ *
+ * @param queue The queue.
+ * @param used Where to store how many bytes of the buffer were filled.
+ * @return The buffer, or NULL once the queue is closed and drained, or
+ *         cancelled.
+ */
+void *takeBlock(BlockQueue *queue, size_t *used) {
+	pthread_mutex_lock(&queue->lock);
+	while (!queue->cancelled && !queue->closed && queue->taken == queue->submitted)
+		pthread_cond_wait(&queue->filled, &queue->lock);
+
+	void *block = NULL;
+	if (!queue->cancelled && queue->taken < queue->submitted) {
+		int index = (int) (queue->taken % queue->numBlocks);
+		block = queue->memory + index * queue->size;
+		*used = queue->used[index];
+		queue->taken++;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return block;
+}
+
+/**
+ * Gives the buffer the consumer took back to the producer.
+ *
+ * @param queue The queue.
+ */
+void returnBlock(BlockQueue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->returned++;
+	pthread_cond_signal(&queue->empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Cancels a queue, so that both sides stop waiting and every later acquire
+ * or take returns NULL.
+ *
+ * @param queue The queue.
+ */
+void cancelBlockQueue(BlockQueue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->cancelled = 1;
+	pthread_cond_broadcast(&queue->filled);
+	pthread_cond_broadcast(&queue->empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Frees a queue and its buffers.  Neither side may be using it any more.
+ *
+ * @param queue The queue, or NULL.
+ */
+void destroyBlockQueue(BlockQueue *queue) {
+	if (queue == NULL)
+		return;
+
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->filled);
+	pthread_cond_destroy(&queue->empty);
+	free(queue->memory);
+	free(queue->used);
+	free(queue);
+}
@@ -0,0 +1,28 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stddef.h>
+
+/*
+ * A bounded queue of reusable buffers between two threads, for overlapping
+ * I/O with the rest of the program.  The producer acquires an empty buffer,
+ * fills it and submits it; the consumer takes the filled buffers in the
+ * order they were submitted and returns each one once it is done with it, so
+ * the same few buffers go round and round.  The producer waits when every
+ * buffer is in use and the consumer when none is filled.  When the producer
+ * closes the queue, the consumer gets the buffers still filled and then
+ * NULL, and either side can cancel it to stop the other waiting for good.
+ */
+
+typedef struct _BlockQueue BlockQueue;
+
+BlockQueue *createBlockQueue(int blocks, size_t size);
+void *acquireBlock(BlockQueue *queue);
+void submitBlock(BlockQueue *queue, size_t used);
+void closeBlockQueue(BlockQueue *queue);
+void *takeBlock(BlockQueue *queue, size_t *used);
+void returnBlock(BlockQueue *queue);
+void cancelBlockQueue(BlockQueue *queue);
+void destroyBlockQueue(BlockQueue *queue);
+
+#endif
@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "kernels.h"
+#include "resample.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Filters per frame of input position.
+#define RESAMPLE_PHASES 1024
+
+// Zero crossings on each side of the windowed-sinc filter, and the limit on
+// its half-width once it is stretched to filter out what a speed-up aliases.
+#define SINC_ZEROS    16
+#define SINC_MAX_HALF 512
+
+struct _Resampler {
+	double factor;
+	int64_t length;    // Input frames.
+	int64_t outLength; // Output frames, (int64_t) (length / factor).
+	int before;        // Taps before the frame an output is taken from.
+	int taps;          // Taps per filter.
+	int32_t *bank;     // RESAMPLE_PHASES + 1 filters of "taps" taps each.
+	short *window;     // Interleaved input frames [base, base + filled).
+	short *edge;       // The taps' input frames, clamped to the ends.
+	int64_t base;
+	int filled;
+	int64_t produced;  // Output frames emitted so far.
+};
+
+/**
+ * The weight a method gives an input frame "d" frames away from the output's
+ * position.
+ *
+ * @param method The RESAMPLE_* method.
+ * @param d The distance in frames.
+ * @param half The half-width of the sinc filter in frames.
+ * @param cutoff The sinc filter's cutoff, as a fraction of the input's Nyquist
+ *        frequency.
+ * @return The weight, before normalizing.
+ */
+static double filterWeight(int method, double d, int half, double cutoff) {
+	double a = fabs(d);
+
+	switch (method) {
+	case RESAMPLE_LINEAR:
+		return a < 1 ? 1 - a : 0;
+	case RESAMPLE_CUBIC:
+		// Catmull-Rom: passes through the frames on either side.
+		if (a < 1)
+			return (1.5 * a - 2.5) * a * a + 1;
+		if (a < 2)
+			return ((-0.5 * a + 2.5) * a - 4) * a + 2;
+		return 0;
+	case RESAMPLE_SINC: {
+		if (a >= half)
+			return 0;
+
+		double x = M_PI * cutoff * d;
+		double sinc = x == 0 ? 1 : sin(x) / x;
+		double u = M_PI * d / half;
+		double blackman = 0.42 + 0.5 * cos(u) + 0.08 * cos(2 * u);
+		return cutoff * sinc * blackman;
+	}
+	}
+
+	// Nearest: the one tap takes the frame at or before the position.
+	return 1;
+}
+
+/**
+ * Computes the fixed-point filter for one fraction of a frame.  The taps are
+ * normalized so they add up to exactly 1, which keeps a constant signal
+ * constant, and any rounding left over goes to the largest tap.
+ *
+ * @param resampler The resampler.
+ * @param method The RESAMPLE_* method.
+ * @param phase The index of the filter in the bank.
+ * @param half The half-width of the sinc filter in frames.
+ * @param cutoff The sinc filter's cutoff.
+ */
+static void fillFilter(Resampler *resampler, int method, int phase, int half, double cutoff) {
+	int32_t *taps = resampler->bank + (size_t) phase * resampler->taps;
+	double fraction = phase / (double) RESAMPLE_PHASES;
+	double weights[2 * SINC_MAX_HALF];
+	double total = 0;
+
+	for (int k = 0; k < resampler->taps; k++) {
+		weights[k] = filterWeight(method, k - resampler->before - fraction, half, cutoff);
+		total += weights[k];
+	}
+
+	long long sum = 0;
+	int largest = 0;
+	for (int k = 0; k < resampler->taps; k++) {
+		taps[k] = (int32_t) lrint(weights[k] / total * (1 << RESAMPLE_FILTER_BITS));
+		sum += taps[k];
+		if (abs(taps[k]) > abs(taps[largest]))
+			largest = k;
+	}
+
+	taps[largest] += (int32_t) ((1 << RESAMPLE_FILTER_BITS) - sum);
+}
+
+/**
+ * Creates a resampler for one speed change and fills in its filter bank.  A
+ * speed-up lowers the sinc filter's cutoff to the output's Nyquist frequency
+ * and widens it to match, within SINC_MAX_HALF.
+ *
+ * @param method The RESAMPLE_* method.
+ * @param factor How much to scale the speed.
+ * @param length The number of input frames.
+ * @param blockFrames The most frames any one feedResampler call passes in, or 0
+ *        if the resampler is only used through resamplerFilter.
+ * @return The resampler, or NULL if memory runs out.
+ */
+Resampler *createResampler(int method, double factor, int64_t length, int blockFrames) {
+	Resampler *resampler = calloc(1, sizeof(Resampler));
+	if (resampler == NULL)
+		return NULL;
+
+	double cutoff = factor > 1 ? 1 / factor : 1;
+	int half = (int) ceil(SINC_ZEROS / cutoff);
+	if (half > SINC_MAX_HALF)
+		half = SINC_MAX_HALF;
+
+	resampler->factor = factor;
+	resampler->length = length;
+	resampler->outLength = (int64_t) (length / factor);
+
+	switch (method) {
+	case RESAMPLE_LINEAR: resampler->before = 0;        resampler->taps = 2;        break;
+	case RESAMPLE_CUBIC:  resampler->before = 1;        resampler->taps = 4;        break;
+	case RESAMPLE_SINC:   resampler->before = half - 1; resampler->taps = 2 * half; break;
+	default:              resampler->before = 0;        resampler->taps = 1;        break;
+	}
+
+	resampler->bank = malloc(sizeof(int32_t) * (RESAMPLE_PHASES + 1) * resampler->taps);
+	resampler->window = malloc(2 * sizeof(short) * ((size_t) blockFrames + resampler->taps));
+	resampler->edge = malloc(2 * sizeof(short) * resampler->taps);
+	if (resampler->bank == NULL || resampler->window == NULL || resampler->edge == NULL) {
+		destroyResampler(resampler);
+		return NULL;
+	}
+
+	for (int phase = 0; phase <= RESAMPLE_PHASES; phase++)
+		fillFilter(resampler, method, phase, half, cutoff);
+
+	return resampler;
+}
+
+/**
+ * Passes the next block of input frames to a resampler.  The frames that no
+ * output still to come can need are dropped first.
+ *
+ * @param resampler The resampler.
+ * @param frames The interleaved input frames.
+ * @param count The number of frames, at most the resampler's block size.
+ */
+void feedResampler(Resampler *resampler, const short *frames, int count) {
+	int64_t end = resampler->base + resampler->filled;
+	int64_t keep = (int64_t) (resampler->produced * resampler->factor) - resampler->before;
+	if (keep > end)
+		keep = end;
+
+	if (keep > resampler->base) {
+		resampler->filled = (int) (end - keep);
+		memmove(resampler->window, resampler->window + 2 * (keep - resampler->base),
+			2 * sizeof(short) * resampler->filled);
+		resampler->base = keep;
+	}
+
+	memcpy(resampler->window + 2 * resampler->filled, frames, 2 * sizeof(short) * count);
+	resampler->filled += count;
+}
+
+/**
+ * Interpolates between the sums of the filters either side of an output's
+ * fraction, and clamps the result back to a 16-bit sample, rounding to
+ * nearest.
+ *
+ * @param lower The sum of the taps of the filter below times the samples.
+ * @param upper The same for the filter above.
+ * @param fraction How far the output lies from the filter below to the one
+ *        above.
+ * @return The sample.
+ */
+static short clampSum(long long lower, long long upper, double fraction) {
+	double sum = lower + fraction * (double) (upper - lower);
+	double half = sum / (1 << RESAMPLE_FILTER_BITS) + 0.5;
+
+	// Round down without a call to floor.
+	long long sample = (long long) half;
+	sample -= sample > half;
+	if (sample < SHRT_MIN)
+		return SHRT_MIN;
+	if (sample > SHRT_MAX)
+		return SHRT_MAX;
+	return (short) sample;
+}
+
+/**
+ * Emits the output frames whose input frames have all been fed in, or, once
+ * all of the input has been fed in, every output frame left.  The caller
+ * keeps draining until nothing more comes out before feeding in more input.
+ *
+ * @param resampler The resampler.
+ * @param out Where to store the interleaved output frames.
+ * @param room The most frames to emit.
+ * @return The number of frames emitted.
+ */
+int drainResampler(Resampler *resampler, short *out, int room) {
+	int64_t available = resampler->base + resampler->filled;
+	int count = 0;
+
+	while (count < room && resampler->produced < resampler->outLength) {
+		int64_t first;
+		double fraction;
+		const int32_t *taps = resamplerFilter(resampler, resampler->produced, &first, &fraction);
+		int64_t last = first + resampler->taps - 1;
+		if (last >= available && available < resampler->length)
+			break;
+
+		const short *frames;
+		if (first >= 0 && last < resampler->length) {
+			frames = resampler->window + 2 * (first - resampler->base);
+		} else {
+			// Repeat the end frames for taps that reach past the input.
+			for (int k = 0; k < resampler->taps; k++) {
+				int64_t f = first + k;
+				f = f < 0 ? 0 : (f >= resampler->length ? resampler->length - 1 : f);
+
+				resampler->edge[2 * k]     = resampler->window[2 * (f - resampler->base)];
+				resampler->edge[2 * k + 1] = resampler->window[2 * (f - resampler->base) + 1];
+			}
+			frames = resampler->edge;
+		}
+
+		// An output that falls on a filter needs only that one.
+		long long lower[2], upper[2];
+		convolveFrames(frames, taps, resampler->taps, lower);
+		if (fraction > 0)
+			convolveFrames(frames, taps + resampler->taps, resampler->taps, upper);
+		else
+			upper[0] = lower[0], upper[1] = lower[1];
+
+		out[2 * count]     = clampSum(lower[0], upper[0], fraction);
+		out[2 * count + 1] = clampSum(lower[1], upper[1], fraction);
+		count++;
+		resampler->produced++;
+	}
+
+	return count;
+}
+
+/**
+ * Returns how many taps each of a resampler's filters has.
+ *
+ * @param resampler The resampler.
+ * @return The number of taps.
+ */
+int resamplerTaps(const Resampler *resampler) {
+	return resampler->taps;
+}
+
+/**
+ * Looks up the filters for one output frame, for callers that filter samples
+ * of their own instead of feeding them in.  The filter returned lies at or
+ * below the output's fraction of a frame, and the next one in the bank,
+ * resamplerTaps taps further on, above it; the output is the first filter's
+ * sum plus "fraction" times the difference of the two.  Tap k weighs input
+ * frame first + k, which can lie beyond either end of the input.
+ *
+ * @param resampler The resampler.
+ * @param index The index of the output frame.
+ * @param first Where to store the input frame of the first tap.
+ * @param fraction Where to store how far the output lies between the two
+ *        filters, from 0 up to but not including 1.
+ * @return The taps of the filter below.
+ */
+const int32_t *resamplerFilter(const Resampler *resampler, int64_t index, int64_t *first,
+		double *fraction) {
+	double position = index * resampler->factor;
+	int64_t j = (int64_t) position;
+	double phases = (position - j) * RESAMPLE_PHASES;
+	int phase = (int) phases;
+
+	*first = j - resampler->before;
+	*fraction = phases - phase;
+	return resampler->bank + (size_t) phase * resampler->taps;
+}
+
+/**
+ * Frees a resampler.
+ *
+ * @param resampler The resampler to free, or NULL.
+ */
+void destroyResampler(Resampler *resampler) {
+	if (resampler == NULL)
+		return;
+
+	free(resampler->bank);
+	free(resampler->window);
+	free(resampler->edge);
+	free(resampler);
+}
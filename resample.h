@@ -0,0 +1,40 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+
+/*
+ * Interpolating resamplers for the speed change.  Output frame i is taken
+ * from input position i * factor, just as in the nearest-sample speed change,
+ * but is filtered from the input frames around that position instead of
+ * copied from the one before it.  Each method is a polyphase bank of 32-bit
+ * fixed-point filters, one per fraction of a frame, computed once when the
+ * resampler is created.  A frame is filtered by the two filters either side
+ * of its fraction, two exact dot products, and the output is interpolated
+ * between them, so it is not limited by how finely the bank divides a
+ * frame.  Input is fed in blocks and only the frames a later output can
+ * still need are kept, so a resampler never holds a whole channel.  Frames
+ * beyond either end of the input repeat the first or last frame.
+ */
+
+#define RESAMPLE_NEAREST 0
+#define RESAMPLE_LINEAR  1
+#define RESAMPLE_CUBIC   2
+#define RESAMPLE_SINC    3
+
+// The fixed-point scale of a filter tap: the taps of each filter add up to
+// 1 << RESAMPLE_FILTER_BITS.
+#define RESAMPLE_FILTER_BITS 24
+
+typedef struct _Resampler Resampler;
+
+Resampler *createResampler(int method, double factor, int64_t length, int blockFrames);
+void feedResampler(Resampler *resampler, const short *frames, int count);
+int drainResampler(Resampler *resampler, short *out, int room);
+void destroyResampler(Resampler *resampler);
+
+int resamplerTaps(const Resampler *resampler);
+const int32_t *resamplerFilter(const Resampler *resampler, int64_t index, int64_t *first,
+	double *fraction);
+
+#endif
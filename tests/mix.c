@@ -0,0 +1,193 @@
+/*
+ * Tests of "wave --mix".  Builds short inputs, mixes them through the
+ * program, to a file and to stdout, and checks the output's header against
+ * the file the program wrote.
+ *
+ * Usage: mix [program]
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "libwave.h"
+
+static int failures = 0;
+
+/**
+ * Reports a failed check.
+ *
+ * @param passed 1 if the check passed.
+ * @param what What was checked.
+ */
+static void check(int passed, const char *what) {
+	if (!passed) {
+		fprintf(stderr, "mix: FAILED %s\n", what);
+		failures++;
+	}
+}
+
+/**
+ * Reads a little-endian 32-bit value.
+ *
+ * @param bytes The bytes.
+ * @return The value.
+ */
+static unsigned long readLong(const unsigned char *bytes) {
+	return bytes[0] | bytes[1] << 8 | (unsigned long) bytes[2] << 16
+		| (unsigned long) bytes[3] << 24;
+}
+
+/**
+ * Writes a 16-bit stereo wave file of a quiet ramp.
+ *
+ * @param path The path of the file.
+ * @param frames The number of frames.
+ */
+static void writeInput(const char *path, int frames) {
+	WaveHeader header;
+	memcpy(header.ID, "RIFF", 4);
+	memcpy(header.format, "WAVE", 4);
+	memcpy(header.formatChunk.ID, "fmt ", 4);
+	header.formatChunk.size = 16;
+	header.formatChunk.compression = 1;
+	header.formatChunk.channels = 2;
+	header.formatChunk.sampleRate = 44100;
+	header.formatChunk.byteRate = 44100 * 4;
+	header.formatChunk.blockAlign = 4;
+	header.formatChunk.bitsPerSample = 16;
+	memcpy(header.dataChunk.ID, "data", 4);
+	header.dataChunk.size = (unsigned long long) frames * 4;
+	header.size = WAVE_HEADER_SIZE - 8 + header.dataChunk.size;
+
+	size_t size = WAVE_HEADER_SIZE + (size_t) frames * 4;
+	unsigned char *bytes = malloc(size);
+	if (bytes == NULL || waveWriteHeader(&header, bytes, size) != WAVE_OK) {
+		fprintf(stderr, "mix: could not build %s\n", path);
+		exit(1);
+	}
+
+	for (int i = 0; i < 2 * frames; i++) {
+		int sample = i % 2000 - 1000;
+		bytes[WAVE_HEADER_SIZE + 2 * i] = sample & 0xFF;
+		bytes[WAVE_HEADER_SIZE + 2 * i + 1] = (sample >> 8) & 0xFF;
+	}
+
+	FILE *out = fopen(path, "wb");
+	if (out == NULL || fwrite(bytes, 1, size, out) != size || fclose(out) != 0) {
+		fprintf(stderr, "mix: could not write %s\n", path);
+		exit(1);
+	}
+	free(bytes);
+}
+
+/**
+ * Runs the program on a manifest, writing the mix to a file with -out, or
+ * to stdout redirected to the file.
+ *
+ * @param program The program.
+ * @param manifest The path of the manifest.
+ * @param path The path of the output file.
+ * @param useOut 1 to pass -out, 0 to write to stdout.
+ * @return 1 if the program succeeded.
+ */
+static int runMix(const char *program, const char *manifest, const char *path, int useOut) {
+	pid_t child = fork();
+	if (child == 0) {
+		int out = open(useOut ? "/dev/null" : path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		int null = open("/dev/null", O_WRONLY);
+		dup2(out, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		if (useOut)
+			execl(program, program, "--mix", manifest, "-out", path, (char *) NULL);
+		else
+			execl(program, program, "--mix", manifest, (char *) NULL);
+		_exit(127);
+	}
+
+	int status;
+	return child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status)
+		&& WEXITSTATUS(status) == 0;
+}
+
+/**
+ * Checks the header of a mixed file against the length of the file.
+ *
+ * @param path The path of the output file.
+ * @param frames The number of frames the mix should hold.
+ * @param how Which way the file was written.
+ */
+static void checkOutput(const char *path, int frames, const char *how) {
+	char what[128];
+	unsigned char header[WAVE_HEADER_SIZE];
+	struct stat info;
+	FILE *in = fopen(path, "rb");
+	int read = in != NULL && fread(header, 1, sizeof(header), in) == sizeof(header)
+		&& stat(path, &info) == 0;
+	if (in != NULL)
+		fclose(in);
+
+	snprintf(what, sizeof(what), "%s: the output can be read", how);
+	check(read, what);
+	if (!read)
+		return;
+
+	snprintf(what, sizeof(what), "%s: the RIFF size is the file's length less 8", how);
+	check(readLong(header + 4) == (unsigned long) info.st_size - 8, what);
+	snprintf(what, sizeof(what), "%s: the data size is the file's length less the header", how);
+	check(readLong(header + 40) == (unsigned long) info.st_size - WAVE_HEADER_SIZE, what);
+	snprintf(what, sizeof(what), "%s: the mix holds every frame", how);
+	check(info.st_size == WAVE_HEADER_SIZE + 4L * frames, what);
+}
+
+int main(int argc, char **argv) {
+	const char *program = argc > 1 ? argv[1] : "./wave";
+	const char *tmp = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+	char directory[256], first[300], second[300], manifest[300], output[300];
+
+	snprintf(directory, sizeof(directory), "%s/wave-test-mix-XXXXXX", tmp);
+	if (mkdtemp(directory) == NULL) {
+		fprintf(stderr, "mix: could not create a directory in %s\n", tmp);
+		return 1;
+	}
+
+	snprintf(first, sizeof(first), "%s/first.wav", directory);
+	snprintf(second, sizeof(second), "%s/second.wav", directory);
+	snprintf(manifest, sizeof(manifest), "%s/mix.txt", directory);
+	snprintf(output, sizeof(output), "%s/out.wav", directory);
+	writeInput(first, 3000);
+	writeInput(second, 2000);
+
+	// The second input starts after the first, so the mix is 5000 frames.
+	FILE *out = fopen(manifest, "w");
+	if (out == NULL) {
+		fprintf(stderr, "mix: could not write %s\n", manifest);
+		return 1;
+	}
+	fprintf(out, "%s 0 -v 0.5\n%s + -r\n%s 0.01 -f\n", first, second, second);
+	fclose(out);
+
+	check(runMix(program, manifest, output, 1), "the mix to a file runs");
+	checkOutput(output, 5000, "-out");
+	check(runMix(program, manifest, output, 0), "the mix to stdout runs");
+	checkOutput(output, 5000, "stdout");
+
+	remove(output);
+	remove(manifest);
+	remove(second);
+	remove(first);
+	rmdir(directory);
+
+	if (failures > 0)
+		return 1;
+
+	printf("mix: ok\n");
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Tests of the sinc resampler's accuracy.  Resamples a sine sweep through
+ * the library at several speeds, in 16-bit and in 24-bit samples, and
+ * measures the signal-to-noise ratio of the output against the sweep itself
+ * at the output's positions.  The sweep stays in the band the filter passes,
+ * and the frames near either end, where the input is extended by repeating
+ * its first and last frames, are left out.
+ *
+ * Usage: resample
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "libwave.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SAMPLE_RATE 44100
+#define FRAMES      65536
+#define AMPLITUDE   0.9
+
+// Frames left out at either end of the output, more than the filter's reach.
+#define EDGE_FRAMES 2048
+
+// The sweep runs up to this fraction of the slower of the two sample rates.
+#define SWEEP_TOP   0.35
+
+// The lowest signal-to-noise ratio accepted, in dB.  Up there the filter's
+// own roll-off, not the precision of its taps, is what limits it.
+#define LEAST_SNR   85
+
+static int failures = 0;
+
+/**
+ * The sweep at an input position: a sine whose frequency rises linearly from
+ * near zero to "top" cycles per frame over the input, and in the right
+ * channel a quarter cycle ahead of the left.
+ *
+ * @param position The position in input frames.
+ * @param top The highest frequency, in cycles per frame.
+ * @param channel 0 for the left channel, 1 for the right.
+ * @return The sample, as a fraction of full scale.
+ */
+static double sweep(double position, double top, int channel) {
+	double phase = 2 * M_PI * (0.001 * position
+		+ (top - 0.001) * position * position / (2.0 * FRAMES));
+	return AMPLITUDE * (channel == 0 ? sin(phase) : cos(phase));
+}
+
+/**
+ * Writes a little-endian sample of "bytes" bytes.
+ *
+ * @param out Where to write it.
+ * @param sample The sample.
+ * @param bytes The size of the sample.
+ */
+static void writeSample(unsigned char *out, long sample, int bytes) {
+	for (int b = 0; b < bytes; b++)
+		out[b] = (unsigned char) ((unsigned long) sample >> (8 * b));
+}
+
+/**
+ * Reads a little-endian signed sample of "bytes" bytes.
+ *
+ * @param in The sample's bytes.
+ * @param bytes The size of the sample.
+ * @return The sample.
+ */
+static long readSample(const unsigned char *in, int bytes) {
+	unsigned long value = 0;
+	for (int b = 0; b < bytes; b++)
+		value |= (unsigned long) in[b] << (8 * b);
+
+	unsigned long sign = 1UL << (8 * bytes - 1);
+	return (long) (value ^ sign) - (long) sign;
+}
+
+/**
+ * Resamples the sweep at one speed and checks the output's signal-to-noise
+ * ratio.
+ *
+ * @param factor How much to scale the speed.
+ * @param bits 16 or 24.
+ * @param least The lowest signal-to-noise ratio to accept, in dB.
+ */
+static void checkSpeed(double factor, int bits, double least) {
+	int bytes = bits / 8;
+	int frameSize = 2 * bytes;
+	double scale = (double) (1L << (bits - 1));
+	double top = SWEEP_TOP * (factor > 1 ? 1 / factor : 1);
+
+	WaveHeader header;
+	memcpy(header.ID, "RIFF", 4);
+	memcpy(header.format, "WAVE", 4);
+	memcpy(header.formatChunk.ID, "fmt ", 4);
+	header.formatChunk.size = 16;
+	header.formatChunk.compression = 1;
+	header.formatChunk.channels = 2;
+	header.formatChunk.sampleRate = SAMPLE_RATE;
+	header.formatChunk.byteRate = SAMPLE_RATE * frameSize;
+	header.formatChunk.blockAlign = frameSize;
+	header.formatChunk.bitsPerSample = bits;
+	memcpy(header.dataChunk.ID, "data", 4);
+	header.dataChunk.size = (unsigned long long) FRAMES * frameSize;
+	header.size = WAVE_HEADER_SIZE - 8 + header.dataChunk.size;
+
+	size_t inputSize = WAVE_HEADER_SIZE + (size_t) FRAMES * frameSize;
+	unsigned char *input = malloc(inputSize);
+	if (input == NULL || waveWriteHeader(&header, input, inputSize) != WAVE_OK) {
+		fprintf(stderr, "resample: could not build the input\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < FRAMES; i++) {
+		for (int c = 0; c < 2; c++) {
+			writeSample(input + WAVE_HEADER_SIZE + (size_t) i * frameSize + c * bytes,
+				lrint(sweep(i, top, c) * scale), bytes);
+		}
+	}
+
+	WaveContext *context = waveCreateContext(1);
+	size_t outputSize, written;
+	unsigned char *output = NULL;
+	int code = context == NULL ? WAVE_ERROR_MEMORY : waveSpeed(context, factor, "sinc");
+	if (code == WAVE_OK)
+		code = waveOutputSize(context, input, inputSize, &outputSize);
+	if (code == WAVE_OK) {
+		output = malloc(outputSize);
+		code = output == NULL ? WAVE_ERROR_MEMORY
+			: waveProcess(context, input, inputSize, output, outputSize, &written);
+	}
+	if (code != WAVE_OK) {
+		fprintf(stderr, "resample: -s %g at %d bits failed: %s\n", factor, bits,
+			waveErrorMessage(code));
+		exit(1);
+	}
+
+	WaveHeader out;
+	size_t offset;
+	if (waveReadHeader(output, written, &out, &offset) != WAVE_OK) {
+		fprintf(stderr, "resample: -s %g at %d bits wrote no header\n", factor, bits);
+		exit(1);
+	}
+
+	long frames = (long) (out.dataChunk.size / frameSize);
+	double signal = 0, noise = 0;
+	for (long i = EDGE_FRAMES; i < frames - EDGE_FRAMES; i++) {
+		for (int c = 0; c < 2; c++) {
+			double expected = sweep(i * factor, top, c);
+			const unsigned char *sample = output + offset + (size_t) i * frameSize + c * bytes;
+			double actual = readSample(sample, bytes) / scale;
+			signal += expected * expected;
+			noise += (actual - expected) * (actual - expected);
+		}
+	}
+
+	double snr = 10 * log10(signal / noise);
+	printf("resample: -s %g at %d bits: %.1f dB\n", factor, bits, snr);
+	if (!(snr >= least)) {
+		fprintf(stderr, "resample: FAILED -s %g at %d bits: %.1f dB, below %.1f dB\n", factor,
+			bits, snr, least);
+		failures++;
+	}
+
+	free(output);
+	free(input);
+	waveDestroyContext(context);
+}
+
+int main(void) {
+	const double factors[] = { 0.5, 0.75, 0.9, 1.1, 1.5, 2 };
+
+	for (size_t i = 0; i < sizeof(factors) / sizeof(factors[0]); i++) {
+		checkSpeed(factors[i], 16, LEAST_SNR);
+		checkSpeed(factors[i], 24, LEAST_SNR);
+	}
+
+	if (failures > 0)
+		return 1;
+
+	printf("resample: ok\n");
+	return 0;
+}
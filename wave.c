@@ -1,19 +1,345 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "wave.h"
 
+#define WAVE_FORMAT_EXTENSIBLE	0xFFFE
+
+/* Bytes of a format chunk that are looked at: the PCM fields, then the
+   extensible fields up to and including the sub-format GUID. */
+#define FORMAT_PCM_SIZE			16
+#define FORMAT_EXTENSIBLE_SIZE	40
+
+/* A RIFF or data chunk size that is left to the "ds64" chunk of an RF64
+   file.  The "ds64" fields looked at are the RIFF, data and sample counts
+   and the length of its table, which gives the 64-bit size of any other
+   chunk too large for its own size field. */
+#define RF64_SIZE_IN_DS64		0xFFFFFFFFu
+#define DS64_SIZE				28
+#define DS64_ENTRY_SIZE			12
+#define DS64_MAX_ENTRIES		8
+
+/* The part of an extensible sub-format GUID after its format code, which is
+   the same for every KSDATAFORMAT_SUBTYPE_* of a plain WAVE_FORMAT_* code. */
+static const unsigned char subFormatBase[14] =
+{
+	0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+	0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+};
+
+/* The 64-bit sizes of an RF64 file's "ds64" chunk.  Only the first
+   DS64_MAX_ENTRIES entries of its table are kept. */
+typedef struct _Ds64
+{
+	unsigned long long	riffSize;
+	unsigned long long	dataSize;
+	unsigned int		numEntries;
+	unsigned char		entryID[DS64_MAX_ENTRIES][4];
+	unsigned long long	entrySize[DS64_MAX_ENTRIES];
+} Ds64;
+
+/* Where the chunk walker reads from: a stream, or a buffer such as a mapped
+   file. */
+typedef struct _ChunkSource
+{
+	FILE*					file;
+	const unsigned char*	buffer;
+	size_t					size;
+	size_t					offset;
+} ChunkSource;
+
+static int sourceRead( ChunkSource* source, void* bytes, size_t count )
+{
+	if( source->file != NULL )
+	{
+		if( count > 0 && fread( bytes, count, 1, source->file ) != 1 )
+			return 0;
+	}
+	else
+	{
+		if( source->size - source->offset < count )
+			return 0;
+
+		memcpy( bytes, source->buffer + source->offset, count );
+	}
+
+	source->offset += count;
+	return 1;
+}
+
+static int sourceSkip( ChunkSource* source, size_t count )
+{
+	if( source->file == NULL )
+	{
+		if( source->size - source->offset < count )
+			return 0;
+
+		source->offset += count;
+		return 1;
+	}
+
+	/* Pipes cannot seek, so fall back to reading past the chunk. */
+	if( count <= 0x7FFFFFFF && fseek( source->file, (long) count, SEEK_CUR ) == 0 )
+	{
+		source->offset += count;
+		return 1;
+	}
+
+	unsigned char scratch[4096];
+	while( count > 0 )
+	{
+		size_t block = count < sizeof( scratch ) ? count : sizeof( scratch );
+		if( !sourceRead( source, scratch, block ) )
+			return 0;
+
+		count -= block;
+	}
+
+	return 1;
+}
+
+/* Reads the body of a format chunk into the header.  An extensible format
+   whose sub-format stands for a plain format code, such as PCM or IEEE
+   float, is recorded as that code.  Returns 0 if the chunk is too short to
+   hold the PCM fields. */
+static int readFormatChunk( ChunkSource* source, WaveHeader* header, unsigned int size )
+{
+	unsigned char body[FORMAT_EXTENSIBLE_SIZE];
+	size_t used = size < sizeof( body ) ? size : sizeof( body );
+
+	if( size < FORMAT_PCM_SIZE || !sourceRead( source, body, used )
+		|| !sourceSkip( source, size - used + ( size & 1 ) ) )
+		return 0;
+
+	FormatChunk* format = &header->formatChunk;
+	memcpy( &format->compression, body, FORMAT_PCM_SIZE );
+
+	if( format->compression == WAVE_FORMAT_EXTENSIBLE && used == FORMAT_EXTENSIBLE_SIZE
+		&& memcmp( body + 26, subFormatBase, sizeof( subFormatBase ) ) == 0 )
+		format->compression = (unsigned short) ( body[24] | body[25] << 8 );
+
+	/* Only the PCM fields are ever written back out. */
+	memcpy( format->ID, "fmt ", 4 );
+	format->size = FORMAT_PCM_SIZE;
+	return 1;
+}
+
+/* Reads the body of an RF64 file's "ds64" chunk.  Returns 0 if the chunk is
+   too short to hold the sizes it must. */
+static int readDs64Chunk( ChunkSource* source, Ds64* ds64, unsigned int size )
+{
+	unsigned char body[DS64_SIZE];
+	unsigned int tableLength;
+
+	if( size < DS64_SIZE || !sourceRead( source, body, DS64_SIZE ) )
+		return 0;
+
+	memcpy( &ds64->riffSize, body, 8 );
+	memcpy( &ds64->dataSize, body + 8, 8 );
+	memcpy( &tableLength, body + 24, 4 );
+
+	size -= DS64_SIZE;
+	for( unsigned int i = 0; i < tableLength && size >= DS64_ENTRY_SIZE; i++ )
+	{
+		unsigned char entry[DS64_ENTRY_SIZE];
+		if( !sourceRead( source, entry, DS64_ENTRY_SIZE ) )
+			return 0;
+
+		size -= DS64_ENTRY_SIZE;
+		if( ds64->numEntries < DS64_MAX_ENTRIES )
+		{
+			memcpy( ds64->entryID[ds64->numEntries], entry, 4 );
+			memcpy( &ds64->entrySize[ds64->numEntries], entry + 4, 8 );
+			ds64->numEntries++;
+		}
+	}
+
+	return sourceSkip( source, (size_t) size + ( size & 1 ) );
+}
+
+/* Returns the size of a chunk, which an RF64 file can leave to its "ds64"
+   chunk. */
+static unsigned long long chunkSize( const Ds64* ds64, const unsigned char* id, unsigned int size )
+{
+	if( ds64 == NULL || size != RF64_SIZE_IN_DS64 )
+		return size;
+
+	if( strncmp( (char*) id, "data", 4 ) == 0 )
+		return ds64->dataSize;
+
+	for( unsigned int i = 0; i < ds64->numEntries; i++ )
+	{
+		if( memcmp( ds64->entryID[i], id, 4 ) == 0 )
+			return ds64->entrySize[i];
+	}
+
+	return size;
+}
+
+/* Walks the chunks of a RIFF, RF64 or BW64 file up to its data chunk,
+   skipping any chunk other than "fmt " and "ds64" and leaving the source at
+   the first byte of sound data.  The header is filled in as the canonical
+   header, with the 64-bit sizes of an RF64 file; the ID of any part that is
+   missing or corrupted is left zeroed.  Returns 1 if both the format and
+   data chunks were found. */
+static int walkChunks( ChunkSource* source, WaveHeader* header )
+{
+	unsigned char id[4];
+	unsigned int size;
+	int skipped = 0;
+	Ds64 ds64Chunk;
+	Ds64* ds64 = NULL;
+
+	memset( header, 0, sizeof( WaveHeader ) );
+	if( !sourceRead( source, header->ID, 4 ) || !sourceRead( source, &size, 4 )
+		|| !sourceRead( source, header->format, 4 ) )
+	{
+		memset( header, 0, sizeof( WaveHeader ) );
+		return 0;
+	}
+
+	header->size = size;
+	if( strncmp( (char*) header->format, "WAVE", 4 ) != 0 )
+		return 0;
+
+	if( strncmp( (char*) header->ID, "RF64", 4 ) == 0 || strncmp( (char*) header->ID, "BW64", 4 ) == 0 )
+	{
+		/* The "ds64" chunk comes first, and it is never written back out. */
+		memset( &ds64Chunk, 0, sizeof( Ds64 ) );
+		if( !sourceRead( source, id, 4 ) || !sourceRead( source, &size, 4 )
+			|| strncmp( (char*) id, "ds64", 4 ) != 0 || !readDs64Chunk( source, &ds64Chunk, size ) )
+			return 0;
+
+		ds64 = &ds64Chunk;
+		memcpy( header->ID, "RIFF", 4 );
+		if( header->size == RF64_SIZE_IN_DS64 )
+			header->size = ds64->riffSize;
+		skipped = 1;
+	}
+	else if( strncmp( (char*) header->ID, "RIFF", 4 ) != 0 )
+	{
+		return 0;
+	}
+
+	while( sourceRead( source, id, 4 ) && sourceRead( source, &size, 4 ) )
+	{
+		if( strncmp( (char*) id, "fmt ", 4 ) == 0 )
+		{
+			if( !readFormatChunk( source, header, size ) )
+				return 0;
+
+			if( header->formatChunk.size != size )
+				skipped = 1;
+		}
+		else if( strncmp( (char*) id, "data", 4 ) == 0 )
+		{
+			if( header->formatChunk.ID[0] == 0 )
+				return 0;
+
+			memcpy( header->dataChunk.ID, "data", 4 );
+			header->dataChunk.size = chunkSize( ds64, id, size );
+
+			/* The output holds only the canonical chunks, so the RIFF size
+			   that came with the dropped ones no longer applies. */
+			if( skipped )
+				header->size = WAVE_HEADER_SIZE - 8 + header->dataChunk.size;
+
+			return 1;
+		}
+		else
+		{
+			/* Chunks are padded to an even number of bytes. */
+			unsigned long long length = chunkSize( ds64, id, size );
+			if( !sourceSkip( source, (size_t) ( length + ( length & 1 ) ) ) )
+				return 0;
+
+			skipped = 1;
+		}
+	}
+
+	return 0;
+}
+
 int readHeader( WaveHeader* header )
-{	
-	if( fread( header, sizeof( WaveHeader ), 1, stdin) != 1 )
-		return 0;	
-		
-	return 1;	
+{
+	ChunkSource source = { stdin, NULL, 0, 0 };
+
+	return walkChunks( &source, header );
 }
 
 int writeHeader( const WaveHeader* header )
-{	
-	if( fwrite( header, sizeof( WaveHeader ), 1, stdout) != 1 )			
-		return 0;	
-		
-	return 1;	
+{
+	unsigned char buffer[WAVE_RF64_HEADER_SIZE];
+
+	writeHeaderBuffer( header, buffer );
+	if( fwrite( buffer, headerSize( header ), 1, stdout) != 1 )
+		return 0;
+
+	return 1;
+}
+
+size_t readHeaderBuffer( WaveHeader* header, const unsigned char* buffer, size_t size )
+{
+	ChunkSource source = { NULL, buffer, size, 0 };
+
+	if( !walkChunks( &source, header ) )
+		return 0;
+
+	return source.offset;
+}
+
+/* Copies "count" bytes in to a header being written, returning where the
+   next field goes.  Like the readers, this keeps the host's byte order,
+   which assumes a little-endian host. */
+static unsigned char* putField( unsigned char* buffer, const void* field, size_t count )
+{
+	memcpy( buffer, field, count );
+	return buffer + count;
+}
+
+void writeHeaderBuffer( const WaveHeader* header, unsigned char* buffer )
+{
+	unsigned int size = RF64_SIZE_IN_DS64;
+	unsigned int dataSize = RF64_SIZE_IN_DS64;
+
+	if( headerSize( header ) == WAVE_HEADER_SIZE )
+	{
+		size = (unsigned int) header->size;
+		dataSize = (unsigned int) header->dataChunk.size;
+		buffer = putField( buffer, header->ID, 4 );
+		buffer = putField( buffer, &size, 4 );
+		buffer = putField( buffer, header->format, 4 );
+	}
+	else
+	{
+		/* The RIFF size grows by the "ds64" chunk, and the sample count is
+		   the number of frames. */
+		unsigned int ds64Size = DS64_SIZE;
+		unsigned int tableLength = 0;
+		unsigned long long riffSize = header->size + ( WAVE_RF64_HEADER_SIZE - WAVE_HEADER_SIZE );
+		unsigned long long sampleCount = header->formatChunk.blockAlign > 0
+			? header->dataChunk.size / header->formatChunk.blockAlign : 0;
+
+		buffer = putField( buffer, "RF64", 4 );
+		buffer = putField( buffer, &size, 4 );
+		buffer = putField( buffer, header->format, 4 );
+		buffer = putField( buffer, "ds64", 4 );
+		buffer = putField( buffer, &ds64Size, 4 );
+		buffer = putField( buffer, &riffSize, 8 );
+		buffer = putField( buffer, &header->dataChunk.size, 8 );
+		buffer = putField( buffer, &sampleCount, 8 );
+		buffer = putField( buffer, &tableLength, 4 );
+	}
+
+	buffer = putField( buffer, &header->formatChunk, sizeof( FormatChunk ) );
+	buffer = putField( buffer, header->dataChunk.ID, 4 );
+	putField( buffer, &dataSize, 4 );
+}
+
+size_t headerSize( const WaveHeader* header )
+{
+	if( header->size < RF64_SIZE_IN_DS64 && header->dataChunk.size < RF64_SIZE_IN_DS64 )
+		return WAVE_HEADER_SIZE;
+
+	return WAVE_RF64_HEADER_SIZE;
 }
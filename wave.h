@@ -1,36 +1,24 @@
-#ifndef WAVE_H
-#define WAVE_H
-
-typedef struct _FormatChunk
-{
-	unsigned char	ID[4];
-	unsigned int	size;
-	unsigned short	compression;
-	unsigned short	channels;
-	unsigned int	sampleRate;
-	unsigned int	byteRate;
-	unsigned short	blockAlign;
-	unsigned short	bitsPerSample;
-} FormatChunk;
-
-typedef struct _DataChunk
-{
-	unsigned char	ID[4];
-	unsigned int	size;
-} DataChunk;
-
-typedef struct _WaveHeader
-{
-	unsigned char	ID[4];
-	unsigned int	size;
-	unsigned char	format[4];
-	FormatChunk		formatChunk;
-	DataChunk		dataChunk;
-} WaveHeader;
-
-
-
-int readHeader( WaveHeader* header );
-int writeHeader( const WaveHeader* header );
-
-#endif
+#ifndef WAVE_H
+#define WAVE_H
+
+#include <stddef.h>
+
+/* The header types and sizes are part of the library's API. */
+#include "libwave.h"
+
+/* The readers walk the file's chunks up to "data", skipping any they do not
+   use, and fill in the canonical header.  RF64 and BW64 files are read too,
+   with their sizes taken from the "ds64" chunk, and come back with a "RIFF"
+   ID.  readHeaderBuffer returns the offset of the sound data in the buffer,
+   or 0 if it holds no valid header.
+
+   The writers write the canonical header while its sizes fit in 32 bits, and
+   an RF64 header once they do not; headerSize says how many bytes that takes. */
+int readHeader( WaveHeader* header );
+int writeHeader( const WaveHeader* header );
+
+size_t readHeaderBuffer( WaveHeader* header, const unsigned char* buffer, size_t size );
+void writeHeaderBuffer( const WaveHeader* header, unsigned char* buffer );
+size_t headerSize( const WaveHeader* header );
+
+#endif